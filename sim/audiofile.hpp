@@ -0,0 +1,233 @@
+#ifndef SIM_AUDIOFILE_HPP
+#define SIM_AUDIOFILE_HPP
+
+// Audio for the host runs of the beat pipeline: WAV files with beat annotations, and synthetic drum tracks with
+// known beat times
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "fft.h"
+
+// Mono 16-bit PCM at the firmware's SAMPLING_FREQ, as it comes off the microphone, and its beat annotations
+struct Recording {
+	std::vector<int16_t> pcm;
+	std::vector<double> beats;  // seconds
+};
+
+struct DrumPattern {
+	double bpm = 124.0;
+	double seconds = 30.0;
+	double swingMillis = 0.0;    // random timing error of each hit, standard deviation
+	float kickLevel = 6000.0f;   // peak of the kick, in raw microphone units before VOLUME_GAIN
+	float noiseLevel = 150.0f;   // background noise, standard deviation
+	bool snare = true;           // on beats 2 and 4
+	bool hats = true;            // on the off-beats
+	uint32_t seed = 1;
+};
+
+/**
+ * A four-on-the-floor drum loop: a kick on every beat (a pitch sweep from 120 to 50 Hz), and optionally snares and
+ * hi-hats, over background noise. The beats are annotated at the start of each kick.
+ */
+inline Recording synthesizeDrums(const DrumPattern& pattern) {
+	Recording recording;
+	const double rate = SAMPLING_FREQ;
+	recording.pcm.assign(size_t(pattern.seconds * rate), 0);
+	std::vector<float> mix(recording.pcm.size(), 0.0f);
+	std::mt19937 random(pattern.seed);
+	std::normal_distribution<float> noise(0.0f, 1.0f);
+	std::normal_distribution<double> swing(0.0, pattern.swingMillis / 1000.0);
+
+	auto addHit = [&](double start, double seconds, auto sample) {
+		size_t first = size_t(fmax(start, 0.0) * rate);
+		size_t last = std::min(mix.size(), size_t((start + seconds) * rate));
+		for (size_t i = first; i < last; i++) {
+			mix[i] += sample(double(i) / rate - start);
+		}
+	};
+
+	double period = 60.0 / pattern.bpm;
+	for (int beat = 0; 0.1 + beat * period < pattern.seconds; beat++) {
+		double start = 0.1 + beat * period + (pattern.swingMillis > 0.0 ? swing(random) : 0.0);
+		recording.beats.push_back(start);
+		double phase = 0.0;
+		addHit(start, 0.25, [&](double t) {
+			double hz = 50.0 + 70.0 * exp(-t / 0.03);
+			phase += 2.0 * M_PI * hz / rate;
+			return float(pattern.kickLevel * exp(-t / 0.08) * sin(phase));
+		});
+		if (pattern.snare && beat % 2 == 1) {
+			addHit(start, 0.15, [&](double t) {
+				return float(0.35 * pattern.kickLevel * exp(-t / 0.04) * (0.6 * noise(random) + 0.4 * sin(2.0 * M_PI * 190.0 * t)));
+			});
+		}
+		if (pattern.hats) {
+			float previous = 0.0f;
+			addHit(start + period / 2, 0.04, [&](double t) {
+				float white = noise(random);
+				float high = white - previous;  // first difference: mostly above 4 kHz
+				previous = white;
+				return float(0.15 * pattern.kickLevel * exp(-t / 0.01) * high);
+			});
+		}
+	}
+
+	for (size_t i = 0; i < mix.size(); i++) {
+		float value = mix[i] + pattern.noiseLevel * noise(random);
+		recording.pcm[i] = int16_t(fmaxf(-32768.0f, fminf(32767.0f, value)));
+	}
+	return recording;
+}
+
+static inline uint32_t readLittleEndian(const uint8_t* bytes, int size) {
+	uint32_t value = 0;
+	for (int i = size - 1; i >= 0; i--) {
+		value = (value << 8) | bytes[i];
+	}
+	return value;
+}
+
+/**
+ * Reads a PCM WAV file of 8, 16, 24 or 32-bit integer samples into `recording`: channels are averaged and the
+ * audio is resampled linearly to SAMPLING_FREQ. Returns false, with the reason in `error`, if the file can't be used.
+ */
+inline bool readWav(const std::string& path, Recording& recording, std::string& error) {
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+		error = "can't open " + path;
+		return false;
+	}
+	std::vector<uint8_t> bytes;
+	uint8_t buffer[65536];
+	size_t length;
+	while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		bytes.insert(bytes.end(), buffer, buffer + length);
+	}
+	fclose(file);
+	if (bytes.size() < 12 || memcmp(&bytes[0], "RIFF", 4) != 0 || memcmp(&bytes[8], "WAVE", 4) != 0) {
+		error = path + " is not a WAV file";
+		return false;
+	}
+
+	uint32_t format = 0, channels = 0, rate = 0, bits = 0;
+	const uint8_t* data = nullptr;
+	size_t dataSize = 0;
+	for (size_t chunk = 12; chunk + 8 <= bytes.size();) {
+		uint32_t size = readLittleEndian(&bytes[chunk + 4], 4);
+		size_t available = std::min<size_t>(size, bytes.size() - chunk - 8);
+		if (memcmp(&bytes[chunk], "fmt ", 4) == 0 && available >= 16) {
+			format = readLittleEndian(&bytes[chunk + 8], 2);
+			channels = readLittleEndian(&bytes[chunk + 10], 2);
+			rate = readLittleEndian(&bytes[chunk + 12], 4);
+			bits = readLittleEndian(&bytes[chunk + 22], 2);
+			if (format == 0xFFFE && available >= 26) {
+				format = readLittleEndian(&bytes[chunk + 32], 2);  // WAVE_FORMAT_EXTENSIBLE: the subformat's tag
+			}
+		} else if (memcmp(&bytes[chunk], "data", 4) == 0) {
+			data = &bytes[chunk + 8];
+			dataSize = available;
+		}
+		chunk += 8 + size + (size & 1);
+	}
+	if (format != 1 || channels == 0 || rate == 0 || (bits != 8 && bits != 16 && bits != 24 && bits != 32) || data == nullptr) {
+		error = path + ": only integer PCM WAV files are supported";
+		return false;
+	}
+
+	const uint32_t sampleBytes = bits / 8;
+	const size_t frames = dataSize / (sampleBytes * channels);
+	std::vector<float> mono(frames);
+	for (size_t i = 0; i < frames; i++) {
+		float sum = 0.0f;
+		for (uint32_t c = 0; c < channels; c++) {
+			uint32_t raw = readLittleEndian(data + (i * channels + c) * sampleBytes, sampleBytes);
+			int32_t value = bits == 8 ? int32_t(raw) - 128 : int32_t(raw << (32 - bits)) >> (32 - bits);
+			sum += float(value) * powf(2.0f, 16.0f - float(bits));  // to the 16-bit scale
+		}
+		mono[i] = sum / float(channels);
+	}
+
+	const double step = double(rate) / SAMPLING_FREQ;
+	recording.pcm.assign(size_t(frames / step), 0);
+	for (size_t i = 0; i < recording.pcm.size(); i++) {
+		double position = i * step;
+		size_t index = size_t(position);
+		float next = index + 1 < frames ? mono[index + 1] : mono[index];
+		float value = mono[index] + float(position - index) * (next - mono[index]);
+		recording.pcm[i] = int16_t(fmaxf(-32768.0f, fminf(32767.0f, roundf(value))));
+	}
+	return true;
+}
+
+/**
+ * Writes the recording's PCM as a mono 16-bit WAV file at SAMPLING_FREQ
+ */
+inline bool writeWav(const std::string& path, const Recording& recording) {
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		return false;
+	}
+	auto put = [&](uint32_t value, int size) {
+		for (int i = 0; i < size; i++) {
+			fputc((value >> (8 * i)) & 0xFF, file);
+		}
+	};
+	uint32_t dataSize = uint32_t(recording.pcm.size() * sizeof(int16_t));
+	fwrite("RIFF", 1, 4, file);
+	put(36 + dataSize, 4);
+	fwrite("WAVEfmt ", 1, 8, file);
+	put(16, 4);
+	put(1, 2);                          // PCM
+	put(1, 2);                          // mono
+	put(SAMPLING_FREQ, 4);
+	put(SAMPLING_FREQ * 2, 4);          // bytes per second
+	put(2, 2);                          // bytes per frame
+	put(16, 2);
+	fwrite("data", 1, 4, file);
+	put(dataSize, 4);
+	for (int16_t sample : recording.pcm) {
+		put(uint16_t(sample), 2);
+	}
+	return fclose(file) == 0;
+}
+
+/**
+ * Reads beat annotations, one beat per line with its time in seconds as the first number, as in the usual .beats
+ * and .txt annotation files; other columns and lines that don't start with a number are ignored
+ */
+inline bool readAnnotations(const std::string& path, std::vector<double>& beats) {
+	FILE* file = fopen(path.c_str(), "r");
+	if (file == nullptr) {
+		return false;
+	}
+	char line[256];
+	while (fgets(line, sizeof(line), file) != nullptr) {
+		double seconds;
+		if (sscanf(line, "%lf", &seconds) == 1) {
+			beats.push_back(seconds);
+		}
+	}
+	fclose(file);
+	std::sort(beats.begin(), beats.end());
+	return true;
+}
+
+inline bool writeAnnotations(const std::string& path, const std::vector<double>& beats) {
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == nullptr) {
+		return false;
+	}
+	for (double beat : beats) {
+		fprintf(file, "%.4f\n", beat);
+	}
+	return fclose(file) == 0;
+}
+
+#endif // SIM_AUDIOFILE_HPP
@@ -0,0 +1,142 @@
+/**
+ * Stress test of AudioBlockRing (src/audioring.hpp): a producer and a consumer thread hammer one ring the way the
+ * sampling and analysis tasks do, and every window the consumer accepts is checked for tearing.
+ *
+ * The producer stamps each sample with its position in the stream, so a window is intact exactly when its samples
+ * count up by one from start to end. The consumer mixes readLatestWindow() with a hop cursor over readWindow(), as
+ * readNextHopWindow() in fft.cpp does, and now and then stalls so the producer laps it. Any torn window the ring
+ * hands out is a failure, and the ring must have noticed the laps in overwrittenBlocks.
+ *
+ * Options: --seconds S to run for (2).
+ */
+
+#include <atomic>
+#include <chrono>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+
+#include "check.hpp"
+
+#include "audioring.hpp"
+
+static const uint16_t BLOCK = 64;        // BLOCK_SAMPLES
+static const uint16_t BLOCKS = 32;       // RING_BLOCKS
+static const uint16_t WINDOW = 8;        // WINDOW_BLOCKS, SAMPLES / BLOCK_SAMPLES
+static const uint16_t HOP = 2;           // HOP_BLOCKS
+
+typedef AudioBlockRing<uint32_t, BLOCK, BLOCKS> Ring;
+
+// Whether the window counts up by one from its first sample, and starts at the beginning of block `start`
+static bool intact(const uint32_t* window, uint32_t start) {
+	for (uint32_t i = 0; i < uint32_t(WINDOW) * BLOCK; i++) {
+		if (window[i] != start * BLOCK + i) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void checkAccounting() {
+	static Ring ring;
+	uint32_t window[WINDOW * BLOCK];
+	CHECK(ring.readLatestWindow(WINDOW, window) == 0, "a window was read from an empty ring");
+
+	for (uint32_t block = 0; block < 40; block++) {
+		uint32_t* slot = ring.beginWrite();
+		for (uint16_t i = 0; i < BLOCK; i++) {
+			slot[i] = block * BLOCK + i;
+		}
+		ring.commitWrite();
+	}
+	CHECK(ring.readWindow(40, WINDOW, window) && intact(window, 32), "the newest window did not read back");
+	CHECK(ring.readWindow(34, WINDOW, window) && intact(window, 26), "a window within the ring did not read back");
+	CHECK(!ring.readWindow(41, WINDOW, window), "a window past the producer was read");
+
+	// The block at `published` may be in flight, so a window starting at published - BLOCKS is already lapped
+	uint32_t before = ring.overwrittenBlocks;
+	CHECK(!ring.readWindow(16, WINDOW, window), "a lapped window was read");
+	CHECK(ring.overwrittenBlocks - before == 1, "lapping by one block counted %u blocks", unsigned(ring.overwrittenBlocks - before));
+
+	before = ring.droppedBlocks;
+	ring.beginWrite();
+	ring.dropWrite();
+	CHECK(ring.droppedBlocks - before == 1 && ring.sequence() == 40, "a dropped block was published or not counted");
+}
+
+int main(int argc, char** argv) {
+	double seconds = 2.0;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--seconds") seconds = atof(argv[i + 1]);
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	checkAccounting();
+
+	static Ring ring;
+	std::atomic<bool> running{true};
+	std::thread producer([&] {
+		uint32_t block = 0;
+		while (running.load(std::memory_order_relaxed)) {
+			uint32_t* slot = ring.beginWrite();
+			for (uint16_t i = 0; i < BLOCK; i++) {
+				slot[i] = block * BLOCK + i;
+			}
+			ring.commitWrite();
+			block++;
+			if (block % HOP == 0) {
+				std::this_thread::yield();  // lets a consumer on the same core keep up, most of the time
+			}
+		}
+	});
+
+	uint64_t latestReads = 0, hopReads = 0, rejected = 0, torn = 0, stalls = 0;
+	uint32_t window[WINDOW * BLOCK];
+	uint32_t nextWindowEnd = WINDOW;
+	auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(int64_t(seconds * 1e6));
+	for (uint64_t iteration = 0; std::chrono::steady_clock::now() < end; iteration++) {
+		if (iteration % 2 == 0) {
+			uint32_t windowEnd = ring.readLatestWindow(WINDOW, window);
+			if (windowEnd == 0) {
+				rejected++;
+			} else {
+				latestReads++;
+				torn += !intact(window, windowEnd - WINDOW);
+			}
+		} else {
+			// The hop cursor of readNextHopWindow(): skip ahead to the newest hop when lapped
+			uint32_t published = ring.sequence();
+			if (published >= nextWindowEnd) {
+				bool read = ring.readWindow(nextWindowEnd, WINDOW, window);
+				if (!read) {
+					rejected++;
+					nextWindowEnd += ((published - nextWindowEnd) / HOP) * HOP;
+					read = ring.readWindow(nextWindowEnd, WINDOW, window);
+				}
+				if (read) {
+					hopReads++;
+					torn += !intact(window, nextWindowEnd - WINDOW);
+				}
+				nextWindowEnd += HOP;
+			}
+		}
+		if (iteration % 10000 == 0) {
+			stalls++;
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+	}
+	running = false;
+	producer.join();
+
+	printf("blocks produced: %u  windows read: %llu latest + %llu by hop  rejected: %llu  overwritten blocks: %u  stalls: %llu\n",
+		   unsigned(ring.sequence()), (unsigned long long)latestReads, (unsigned long long)hopReads,
+		   (unsigned long long)rejected, unsigned(ring.overwrittenBlocks), (unsigned long long)stalls);
+	CHECK(torn == 0, "%llu torn windows", (unsigned long long)torn);
+	CHECK(latestReads > 0 && hopReads > 0, "the consumer never got a window");
+	CHECK(ring.overwrittenBlocks > 0, "the producer lapped the consumer but no blocks were counted as overwritten");
+	return checkResult();
+}
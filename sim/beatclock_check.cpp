@@ -0,0 +1,155 @@
+/**
+ * Measures how well the master's beat clock (BeatClock in tempo.hpp) predicts beats: a recording with annotated
+ * beats is replayed through the audio pipeline (replay.hpp), and for every annotated beat the prediction that a ring
+ * would have had --lead-ms earlier, the nextBeatTimestamp of the last frame published by then, is compared with it.
+ * For reference it also reports how late the spectral heuristic itself reports the same beats.
+ *
+ * Without --wav it replays synthetic drum loops, steady and with humanized timing, and checks that the locked clock
+ * predicts their beats to within a fraction of the 32 ms analysis window.
+ *
+ * Options: --wav FILE --beats FILE of annotations (seconds, one per line), --lead-ms (100), --skip S seconds of
+ * warm-up (10), --seconds S of synthetic audio (40).
+ */
+
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string>
+
+#include "audiofile.hpp"
+#include "check.hpp"
+#include "isolate.hpp"
+#include "replay.hpp"
+#include "scoring.hpp"
+
+struct PredictionStats {
+	uint32_t beats = 0;        // annotated beats after the warm-up
+	uint32_t locked = 0;       // of which the clock was locked `lead` before
+	double medianError = NAN;  // of |predicted - annotated| over the locked ones, in seconds
+	double p90Error = NAN;
+	double meanError = NAN;    // signed, positive when the predictions are late
+	double medianDetectionLatency = NAN;  // from the annotated beat to the heuristic's report of it
+};
+
+static double quantile(std::vector<double> values, double q) {
+	if (values.empty()) return NAN;
+	size_t index = std::min(values.size() - 1, size_t(q * values.size()));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+// Seconds into the recording at which a frame was published: the end of its window
+static double frameTime(const AnalysisFrame& frame) {
+	return double(SAMPLES + (frame.sequence - 1) * HOP_SAMPLES) / SAMPLING_FREQ;
+}
+
+static PredictionStats measure(const Recording& recording, double lead, double skip) {
+	ReplayResult result = replayRecording(recording, getBeatDetectorParams());
+	PredictionStats stats;
+	std::vector<double> errors, absolute;
+	size_t frame = 0;
+	for (double beat : recording.beats) {
+		if (beat < skip) {
+			continue;
+		}
+		// The most recent frame published by the time the ring has to schedule the accent
+		double deadline = beat - lead;
+		while (frame + 1 < result.frames.size() && frameTime(result.frames[frame + 1]) <= deadline) {
+			frame++;
+		}
+		if (result.frames.empty() || frameTime(result.frames[frame]) > deadline) {
+			continue;
+		}
+		stats.beats++;
+		const AnalysisFrame& latest = result.frames[frame];
+		if (!latest.beatClockLocked) {
+			continue;
+		}
+		stats.locked++;
+		double predicted = (double(latest.nextBeatTimestamp) - REPLAY_START_MICROS / 1000) / 1000.0;
+		errors.push_back(predicted - beat);
+		absolute.push_back(fabs(predicted - beat));
+	}
+	stats.medianError = quantile(absolute, 0.5);
+	stats.p90Error = quantile(absolute, 0.9);
+	double sum = 0.0;
+	for (double error : errors) sum += error;
+	stats.meanError = errors.empty() ? NAN : sum / errors.size();
+
+	std::vector<double> skipped;
+	for (double beat : recording.beats) {
+		if (beat >= skip) skipped.push_back(beat);
+	}
+	stats.medianDetectionLatency = quantile(eventLatencies(result.beats, skipped, 0.070, 0.100), 0.5);
+	return stats;
+}
+
+// Replays in a child process, since the pipeline can only run once per process
+static bool measureIsolated(const Recording& recording, double lead, double skip, PredictionStats& stats) {
+	std::vector<uint8_t> bytes = runIsolated([&](FILE* out) {
+		PredictionStats result = measure(recording, lead, skip);
+		fwrite(&result, sizeof(result), 1, out);
+	});
+	if (bytes.size() != sizeof(stats)) {
+		return false;
+	}
+	memcpy(&stats, bytes.data(), sizeof(stats));
+	return true;
+}
+
+static void report(const char* name, const PredictionStats& stats) {
+	printf("%-28s %3u beats, clock locked for %3u: |error| median %5.1f ms, p90 %5.1f ms, mean %+5.1f ms; "
+		   "heuristic reports beats after %+5.1f ms\n",
+		   name, stats.beats, stats.locked, stats.medianError * 1000.0, stats.p90Error * 1000.0, stats.meanError * 1000.0,
+		   stats.medianDetectionLatency * 1000.0);
+}
+
+int main(int argc, char** argv) {
+	std::string wavPath, beatsPath;
+	double lead = 0.100;
+	double skip = 10.0;
+	DrumPattern pattern;
+	pattern.seconds = 40.0;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--wav") wavPath = argv[i + 1];
+		else if (option == "--beats") beatsPath = argv[i + 1];
+		else if (option == "--lead-ms") lead = atof(argv[i + 1]) / 1000.0;
+		else if (option == "--skip") skip = atof(argv[i + 1]);
+		else if (option == "--seconds") pattern.seconds = atof(argv[i + 1]);
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	Serial.muted = true;
+
+	if (!wavPath.empty()) {
+		Recording recording;
+		std::string error;
+		if (!readWav(wavPath, recording, error) || beatsPath.empty() || !readAnnotations(beatsPath, recording.beats)) {
+			fprintf(stderr, "%s\n", error.empty() ? "--wav needs --beats with the annotations" : error.c_str());
+			return 1;
+		}
+		PredictionStats stats;
+		CHECK(measureIsolated(recording, lead, skip, stats), "the replay failed");
+		report(wavPath.c_str(), stats);
+		return checkResult();
+	}
+
+	DrumPattern steady = pattern;
+	DrumPattern humanized = pattern;
+	humanized.swingMillis = 8.0;
+	humanized.bpm = 128.0;
+	humanized.seed = 2;
+	PredictionStats steadyStats, humanizedStats;
+	CHECK(measureIsolated(synthesizeDrums(steady), lead, skip, steadyStats), "the steady replay failed");
+	CHECK(measureIsolated(synthesizeDrums(humanized), lead, skip, humanizedStats), "the humanized replay failed");
+	report("steady loop at 124 BPM", steadyStats);
+	report("humanized loop at 128 BPM", humanizedStats);
+	CHECK(steadyStats.locked >= steadyStats.beats * 9 / 10, "the clock was locked for %u of %u beats", steadyStats.locked, steadyStats.beats);
+	CHECK(steadyStats.medianError < 0.016, "steady beats predicted %.1f ms off", steadyStats.medianError * 1000.0);
+	CHECK(humanizedStats.locked >= humanizedStats.beats * 3 / 4, "the clock was locked for %u of %u beats", humanizedStats.locked, humanizedStats.beats);
+	CHECK(humanizedStats.medianError < 0.025, "humanized beats predicted %.1f ms off", humanizedStats.medianError * 1000.0);
+	return checkResult();
+}
@@ -0,0 +1,317 @@
+/**
+ * Offline evaluation of the beat detector over a corpus of recordings with beat annotations, for tuning its
+ * parameters away from the speaker.
+ *
+ * Every recording is replayed through the unmodified sampling task and doFFT() -> computeBeatHeuristic() chain with
+ * a virtual millis() (replay.hpp), once per configuration of a parameter grid, and the detected beats are scored
+ * against the annotations (scoring.hpp). Each replay runs in its own child process (isolate.hpp), and a pool of
+ * threads keeps --jobs of them running at once. The result is a CSV with one row per configuration: the parameters,
+ * the F-measure, precision and recall over the whole corpus, the mean F-measure per recording, the mean timing
+ * offset of the matched beats, and the CPU time the sampling and analysis tasks took per second of audio.
+ *
+ * Usage:
+ *   beateval [--corpus DIR] [--track FILE.wav FILE.beats]... [--grid PARAMETER=V1,V2,...]...
+ *            [--jobs N] [--csv FILE] [--tolerance-ms MS] [--skip SECONDS]
+ *
+ * --corpus takes every .wav file in DIR that has annotations next to it, in a .beats or .txt file of the same name:
+ * one beat per line, its time in seconds first. Without recordings, a synthetic corpus of drum loops is used. The
+ * parameters are the fields of BeatDetectorParams (beatdetection.h); those not in the grid keep their defaults.
+ * --jobs defaults to the number of cores, --tolerance-ms to 70 (as in MIREX), --skip to 5 seconds of warm-up that
+ * are not scored.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audiofile.hpp"
+#include "check.hpp"
+#include "isolate.hpp"
+#include "replay.hpp"
+#include "scoring.hpp"
+
+struct Track {
+	std::string name;
+	Recording recording;
+};
+
+struct Parameter {
+	std::string name;
+	std::vector<double> values;
+};
+
+// What a child reports back for one replay
+struct TrackResult {
+	EventScore score;
+	double audioSeconds = 0.0;
+	double cpuSeconds = 0.0;
+	double wallSeconds = 0.0;
+	bool complete = false;
+};
+
+static bool setParameter(BeatDetectorParams& params, const std::string& name, double value) {
+	if (name == "thresholdWindowFrames") params.thresholdWindowFrames = uint16_t(value);
+	else if (name == "singleBeatDuration") params.singleBeatDuration = uint16_t(value);
+	else if (name == "fudgeFactor") params.fudgeFactor = float(value);
+	else if (name == "previousBeatBonus") params.previousBeatBonus = float(value);
+	else if (name == "bassHeuristicWeight") params.bassHeuristicWeight = float(value);
+	else if (name == "convolveWithPreviousBeats") params.convolveWithPreviousBeats = value != 0.0;
+	else if (name == "applyRecencyFactor") params.applyRecencyFactor = value != 0.0;
+	else if (name == "useNeuralOnset") params.useNeuralOnset = value != 0.0;
+	else return false;
+	return true;
+}
+
+static bool parseGrid(const std::string& argument, Parameter& parameter) {
+	size_t equals = argument.find('=');
+	if (equals == std::string::npos) {
+		return false;
+	}
+	parameter.name = argument.substr(0, equals);
+	BeatDetectorParams probe;
+	if (!setParameter(probe, parameter.name, 0.0)) {
+		return false;
+	}
+	std::string values = argument.substr(equals + 1);
+	for (size_t start = 0; start <= values.size();) {
+		size_t comma = values.find(',', start);
+		if (comma == std::string::npos) comma = values.size();
+		std::string value = values.substr(start, comma - start);
+		char* end;
+		double number = strtod(value.c_str(), &end);
+		if (value.empty() || *end != '\0') {
+			return false;
+		}
+		parameter.values.push_back(number);
+		start = comma + 1;
+	}
+	return !parameter.values.empty();
+}
+
+static bool loadTrack(const std::string& wavPath, const std::string& beatsPath, std::vector<Track>& tracks) {
+	Track track;
+	std::string error;
+	track.name = wavPath.substr(wavPath.find_last_of('/') + 1);
+	if (!readWav(wavPath, track.recording, error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return false;
+	}
+	if (!readAnnotations(beatsPath, track.recording.beats)) {
+		fprintf(stderr, "can't read %s\n", beatsPath.c_str());
+		return false;
+	}
+	tracks.push_back(track);
+	return true;
+}
+
+static bool loadCorpus(const std::string& directory, std::vector<Track>& tracks) {
+	DIR* dir = opendir(directory.c_str());
+	if (dir == nullptr) {
+		fprintf(stderr, "can't open %s\n", directory.c_str());
+		return false;
+	}
+	std::vector<std::string> names;
+	while (dirent* entry = readdir(dir)) {
+		std::string name = entry->d_name;
+		if (name.size() > 4 && name.compare(name.size() - 4, 4, ".wav") == 0) {
+			names.push_back(name.substr(0, name.size() - 4));
+		}
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+	for (const std::string& name : names) {
+		std::string stem = directory + "/" + name;
+		for (const char* extension : {".beats", ".txt"}) {
+			if (FILE* annotations = fopen((stem + extension).c_str(), "r")) {
+				fclose(annotations);
+				if (!loadTrack(stem + ".wav", stem + extension, tracks)) {
+					return false;
+				}
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+// Drum loops over the range of tempos and feels the detector is tuned for
+static std::vector<Track> syntheticCorpus() {
+	std::vector<Track> tracks;
+	const struct { double bpm, swingMillis; float noiseLevel; bool hats; } loops[] = {
+		{ 124.0, 0.0, 150.0f, true },
+		{ 128.0, 6.0, 300.0f, true },
+		{ 100.0, 4.0, 150.0f, false },
+		{ 140.0, 8.0, 600.0f, true },
+	};
+	uint32_t seed = 1;
+	for (const auto& loop : loops) {
+		DrumPattern pattern;
+		pattern.bpm = loop.bpm;
+		pattern.swingMillis = loop.swingMillis;
+		pattern.noiseLevel = loop.noiseLevel;
+		pattern.hats = loop.hats;
+		pattern.seconds = 60.0;  // the percentile threshold takes over from the fixed one after 30 seconds
+		pattern.seed = seed++;
+		char name[64];
+		snprintf(name, sizeof(name), "drums-%.0fbpm-swing%.0fms", loop.bpm, loop.swingMillis);
+		tracks.push_back({ name, synthesizeDrums(pattern) });
+	}
+	return tracks;
+}
+
+static TrackResult evaluate(const Track& track, const BeatDetectorParams& params, double tolerance, double skip) {
+	auto start = std::chrono::steady_clock::now();
+	ReplayResult replay = replayRecording(track.recording, params);
+	TrackResult result;
+	result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.score = scoreEvents(replay.beats, track.recording.beats, tolerance, skip);
+	result.audioSeconds = double(track.recording.pcm.size()) / SAMPLING_FREQ;
+	result.cpuSeconds = replay.cpuSeconds;
+	result.complete = replay.complete;
+	return result;
+}
+
+int main(int argc, char** argv) {
+	std::vector<Track> tracks;
+	std::vector<Parameter> grid;
+	unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+	std::string csvPath;
+	double tolerance = 0.070;
+	double skip = 5.0;
+	for (int i = 1; i < argc; i++) {
+		std::string option = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (option == "--track" && i + 2 < argc) {
+			if (!loadTrack(argv[i + 1], argv[i + 2], tracks)) return 1;
+			i += 2;
+		} else if (option == "--corpus" && hasValue) {
+			if (!loadCorpus(argv[++i], tracks)) return 1;
+		} else if (option == "--grid" && hasValue) {
+			Parameter parameter;
+			if (!parseGrid(argv[++i], parameter)) {
+				fprintf(stderr, "bad --grid %s: expected a BeatDetectorParams field, '=' and numbers separated by commas\n", argv[i]);
+				return 1;
+			}
+			grid.push_back(parameter);
+		} else if (option == "--jobs" && hasValue) {
+			jobs = std::max(1, atoi(argv[++i]));
+		} else if (option == "--csv" && hasValue) {
+			csvPath = argv[++i];
+		} else if (option == "--tolerance-ms" && hasValue) {
+			tolerance = atof(argv[++i]) / 1000.0;
+		} else if (option == "--skip" && hasValue) {
+			skip = atof(argv[++i]);
+		} else {
+			fprintf(stderr, "unknown or incomplete option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	Serial.muted = true;
+	if (tracks.empty()) {
+		tracks = syntheticCorpus();
+	}
+	if (grid.empty()) {
+		grid.push_back({ "fudgeFactor", { 0.9, 1.05, 1.2 } });
+		grid.push_back({ "previousBeatBonus", { 0.2, 0.4 } });
+	}
+
+	// Every combination of the grid's values, the first parameter varying slowest
+	std::vector<BeatDetectorParams> configurations(1);
+	std::vector<std::vector<double>> values(1);
+	for (const Parameter& parameter : grid) {
+		std::vector<BeatDetectorParams> expanded;
+		std::vector<std::vector<double>> expandedValues;
+		for (size_t c = 0; c < configurations.size(); c++) {
+			for (double value : parameter.values) {
+				BeatDetectorParams params = configurations[c];
+				setParameter(params, parameter.name, value);
+				expanded.push_back(params);
+				expandedValues.push_back(values[c]);
+				expandedValues.back().push_back(value);
+			}
+		}
+		configurations.swap(expanded);
+		values.swap(expandedValues);
+	}
+
+	// The pool: each thread takes the next (configuration, track) replay until there are none left
+	const size_t replays = configurations.size() * tracks.size();
+	std::vector<TrackResult> results(replays);
+	std::vector<bool> succeeded(replays, false);
+	std::atomic<size_t> next{0};
+	std::atomic<size_t> done{0};
+	std::vector<std::thread> pool;
+	fprintf(stderr, "%zu configurations x %zu recordings on %u threads\n", configurations.size(), tracks.size(), jobs);
+	for (unsigned j = 0; j < std::min<size_t>(jobs, replays); j++) {
+		pool.emplace_back([&] {
+			for (size_t job; (job = next++) < replays;) {
+				const BeatDetectorParams& params = configurations[job / tracks.size()];
+				const Track& track = tracks[job % tracks.size()];
+				std::vector<uint8_t> bytes = runIsolated([&](FILE* out) {
+					TrackResult result = evaluate(track, params, tolerance, skip);
+					fwrite(&result, sizeof(result), 1, out);
+				});
+				if (bytes.size() == sizeof(TrackResult)) {
+					memcpy(&results[job], bytes.data(), sizeof(TrackResult));
+					succeeded[job] = results[job].complete;
+				}
+				fprintf(stderr, "\r%zu of %zu replays", ++done, replays);
+			}
+		});
+	}
+	for (std::thread& thread : pool) {
+		thread.join();
+	}
+	fprintf(stderr, "\n");
+
+	FILE* csv = csvPath.empty() ? stdout : fopen(csvPath.c_str(), "w");
+	if (csv == nullptr) {
+		fprintf(stderr, "can't write %s\n", csvPath.c_str());
+		return 1;
+	}
+	for (const Parameter& parameter : grid) {
+		fprintf(csv, "%s,", parameter.name.c_str());
+	}
+	fprintf(csv, "recordings,f_measure,precision,recall,mean_recording_f_measure,mean_offset_ms,cpu_ms_per_audio_second,realtime_factor\n");
+	size_t failed = 0;
+	for (size_t c = 0; c < configurations.size(); c++) {
+		EventScore total;
+		double offsets = 0.0, meanF = 0.0, audio = 0.0, cpu = 0.0, wall = 0.0;
+		uint32_t scored = 0;
+		for (size_t t = 0; t < tracks.size(); t++) {
+			size_t job = c * tracks.size() + t;
+			if (!succeeded[job]) {
+				fprintf(stderr, "the replay of %s failed\n", tracks[t].name.c_str());
+				failed++;
+				continue;
+			}
+			const TrackResult& result = results[job];
+			total.matched += result.score.matched;
+			total.detections += result.score.detections;
+			total.annotations += result.score.annotations;
+			offsets += result.score.meanOffset * result.score.matched;
+			meanF += result.score.fMeasure();
+			audio += result.audioSeconds;
+			cpu += result.cpuSeconds;
+			wall += result.wallSeconds;
+			scored++;
+		}
+		for (double value : values[c]) {
+			fprintf(csv, "%g,", value);
+		}
+		fprintf(csv, "%u,%.4f,%.4f,%.4f,%.4f,%.2f,%.2f,%.1f\n", scored, total.fMeasure(), total.precision(), total.recall(),
+				scored > 0 ? meanF / scored : 0.0, total.matched > 0 ? offsets / total.matched * 1000.0 : 0.0,
+				audio > 0.0 ? cpu / audio * 1000.0 : 0.0, wall > 0.0 ? audio / wall : 0.0);
+	}
+	if (csv != stdout) {
+		fclose(csv);
+	}
+	CHECK(failed == 0, "%zu of %zu replays failed", failed, replays);
+	return checkFailures > 0 ? 1 : 0;
+}
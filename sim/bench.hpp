@@ -0,0 +1,32 @@
+#ifndef SIM_BENCH_HPP
+#define SIM_BENCH_HPP
+
+// Timing for the host benchmarks. Host nanoseconds only compare alternatives with each other; the ESP32-S3 runs
+// these loops several times slower, and not always by the same factor.
+
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+
+static volatile float benchSink;  // results go here so the optimizer cannot drop the work
+
+/**
+ * Median over `rounds` rounds of the nanoseconds per call of `work`, which is called `calls` times per round
+ */
+template <typename F>
+double nanosecondsPerCall(F work, uint32_t calls, int rounds = 7) {
+	double perCall[16];
+	rounds = std::min(rounds, 16);
+	for (int round = 0; round < rounds; round++) {
+		auto start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < calls; i++) {
+			work(i);
+		}
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		perCall[round] = std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+	}
+	std::sort(perCall, perCall + rounds);
+	return perCall[rounds / 2];
+}
+
+#endif // SIM_BENCH_HPP
@@ -0,0 +1,378 @@
+/**
+ * Checks the state broadcast (protocol.hpp) over a lossy link, in virtual time: the master and its rings run the
+ * firmware's protocol steps and transmit queues (txqueue.hpp) tick by tick, and every copy of every packet is lost
+ * on its way to each receiver with the given probability.
+ *
+ * What it checks, for a clean link and then the lossy one:
+ *   - all rings join, and the master sends at most one state packet per tick, broadcast STATE_BROADCAST_REPEATS
+ *     times under one sequence number,
+ *   - the rings apply each sequence number once and count the other copies as duplicates; on a clean link nothing
+ *     is lost and every repeat is a duplicate,
+ *   - with loss, a ring misses a state only when all of its copies are lost, and the loss each ring reports in its
+ *     feedback is what the master ends up with,
+ *   - the rings catch up with the master's beats, section and settings within a few ticks of a change, even when the
+ *     radio only gets to the queue every --drain ticks and later state packets replace queued ones; when it gets to
+ *     it less often than the resends of a change last, within a couple of keyframes,
+ *   - a ring that goes silent is evicted after RING_TIMEOUT_MILLIS and the state stops carrying its target, so boards
+ *     replaced one after another never fill the ring table, and an evicted ring that comes back gets its index back.
+ *
+ * Options: --loss P per copy (0.1), --rings N up to MAX_RINGS (6), --seconds S of virtual time (120), --drain K
+ * ticks between the times the master's radio empties its queue in the lossy run (2).
+ */
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+#include "protocol.hpp"
+#include "txqueue.hpp"
+
+static const int64_t TICK_MICROS = 20000;     // the loop() rate of the master and rings
+static const uint32_t CATCH_UP_TICKS = 4;     // 1 + StateReplicator's DELTA_RESENDS
+static const uint32_t KEYFRAME_TICKS = 50;    // StateReplicator's KEYFRAME_INTERVAL
+
+// Sends into a TxQueue, stamped with the virtual time
+template <uint8_t DEPTH>
+struct QueueSender {
+	TxQueue<DEPTH> queue;
+	uint32_t nowMicros = 0;
+
+	void send(const uint8_t* destination, WireMessage type, const uint8_t* data, size_t length, uint8_t repeats = 1) {
+		queue.push(destination, type, data, uint8_t(length), repeats, nowMicros);
+	}
+};
+
+struct SimRing {
+	uint8_t mac[6] = {0x02, 0, 0, 0, 0, 0};
+	StateReceiver receiver;
+	ClockSync clockSync;
+	RingLink link;
+	uint8_t index = NO_RING;
+	QueueSender<TX_QUEUE_DEPTH> tx;
+	uint32_t staleTicks = 0;         // in a row where the ring's state differs from the master's
+	uint32_t longestStale = 0;
+	WireLinkStats reported;          // as of the last feedback that reached the master
+	uint32_t transmitted = 0;        // state packets the master's radio sent since the ring's first one
+	uint32_t missed = 0;             // of those, the ones whose every copy was lost on the way to the ring
+	uint32_t unsent = 0;             // sequence numbers in between that never went out, replaced or evicted in the queue
+	uint16_t lastTransmitted = 0;    // sequence number of the last of those
+	uint32_t missedSince = 0;        // missed and unsent since the ring last got a state, which it can not know of yet
+	uint32_t unsentSince = 0;
+};
+
+struct RunResult {
+	uint32_t joined = 0;
+	uint32_t statesSent = 0;
+	uint32_t mostStatesPerTick = 0;
+	uint32_t worstRepeats = STATE_BROADCAST_REPEATS;
+	uint64_t stateBytes = 0;
+	uint32_t coalesced = 0;
+	std::vector<WireLinkStats> links;       // as counted by each ring
+	std::vector<WireLinkStats> reported;    // as the master has them from the feedback
+	std::vector<WireLinkStats> delivered;   // as of each ring's last feedback that reached the master
+	std::vector<uint32_t> transmitted, missed, unsent;
+	uint32_t longestStale = 0;
+};
+
+// Whether the ring has what the master last decided on, of the values that change in steps
+static bool upToDate(const State& ring, const State& master) {
+	return ring.elapsedBeats == master.elapsedBeats && ring.section == master.section && ring.brightness == master.brightness
+		&& ring.shader_index == master.shader_index && ring.ring_count == master.ring_count;
+}
+
+static RunResult runBroadcast(int ringCount, float loss, uint32_t ticks, uint32_t drain, uint32_t seed) {
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<float> chance(0.0f, 1.0f);
+	uint8_t masterMac[6] = {0x02, 0, 0, 0, 0, 0xFF};
+	MasterRings rings;
+	StateReplicator replicator;
+	State state;
+	uint16_t sequence = 0;
+	QueueSender<TX_QUEUE_DEPTH> masterTx;
+	auto noPeers = [](const uint8_t*) {};  // the radio here delivers unicasts to any ring
+	std::vector<SimRing> nodes(ringCount);
+	for (int i = 0; i < ringCount; i++) {
+		nodes[i].mac[5] = uint8_t(i + 1);
+	}
+
+	RunResult result;
+	for (uint32_t tick = 0; tick < ticks; tick++) {
+		int64_t now = int64_t(tick) * TICK_MICROS;
+		masterTx.nowMicros = uint32_t(now);
+
+		// The master: beats every 500 ms, a section change every 7 s, a setting now and then, targets on a sweep
+		state.time = (unsigned long)(now / 1000);
+		state.shared_micros = now;
+		state.isPaused = false;
+		if (state.time / 500 != state.elapsedBeats) {
+			state.elapsedBeats = state.time / 500;
+			state.lastBeatTimestamp = state.time;
+		}
+		state.beat_intensity = expf(-float(state.time - state.lastBeatTimestamp) / 100.0f);
+		state.section = uint8_t((state.time / 7000) % 4);
+		state.brightness = uint8_t(160 + 20 * ((state.time / 11000) % 3));
+		state.ring_count = rings.directory.span();
+		for (uint8_t i = 0; i < state.ring_count; i++) {
+			state.target_angle[i] = fmodf(float(now) / 1e6f * 30.0f + 60.0f * i, 360.0f);
+			state.target_angular_velocity[i] = 30.0f;
+			state.target_angle_rate[i] = 30.0f;
+		}
+		size_t length = broadcastState(replicator, state, sequence, masterTx);
+		result.stateBytes += length * STATE_BROADCAST_REPEATS;
+
+		// The master's radio, every `drain` ticks: broadcasts reach each ring independently, unicasts their one ring
+		uint32_t statesThisTick = 0;
+		TxMessage message;
+		while (tick % drain == 0 && masterTx.queue.pop(message)) {
+			bool isState = message.type == WireMessage::State;
+			std::vector<bool> listening(nodes.size()), arrived(nodes.size());
+			if (isState) {
+				statesThisTick++;
+				result.statesSent++;
+				result.worstRepeats = std::min<uint32_t>(result.worstRepeats, message.repeats);
+				WireHeader header;
+				decodeHeader(message.data, message.length, header);
+				for (size_t r = 0; r < nodes.size(); r++) {
+					listening[r] = nodes[r].receiver.tracker.stats().received > 0;
+					if (listening[r]) {
+						nodes[r].transmitted++;
+						nodes[r].unsentSince += uint16_t(header.sequence - nodes[r].lastTransmitted - 1);
+					}
+					nodes[r].lastTransmitted = header.sequence;
+				}
+			}
+			for (uint8_t copy = 0; copy < message.repeats; copy++) {
+				for (size_t r = 0; r < nodes.size(); r++) {
+					SimRing& ring = nodes[r];
+					bool addressed = memcmp(message.destination, BROADCAST_ALL, 6) == 0 || memcmp(message.destination, ring.mac, 6) == 0;
+					if (!addressed || chance(random) < loss) {
+						continue;
+					}
+					arrived[r] = true;
+					uint8_t assigned;
+					switch (receiveFromMaster(ring.receiver, ring.clockSync, message.data, message.length, now, assigned)) {
+					case MasterPacket::Assign:
+						ring.index = assigned;
+						break;
+					case MasterPacket::State:
+						memcpy(ring.link.masterMac, masterMac, 6);
+						ring.link.masterKnown = true;
+						ring.missed += ring.missedSince;
+						ring.unsent += ring.unsentSince;
+						ring.missedSince = ring.unsentSince = 0;
+						break;
+					default:
+						break;
+					}
+				}
+			}
+			for (size_t r = 0; r < nodes.size(); r++) {
+				if (listening[r] && !arrived[r]) {
+					nodes[r].missedSince++;
+				}
+			}
+		}
+		result.mostStatesPerTick = std::max(result.mostStatesPerTick, statesThisTick);
+
+		// The rings: join, report back and ping; their radios keep up
+		for (SimRing& ring : nodes) {
+			ring.tx.nowMicros = uint32_t(now);
+			ringTick(ring.link, ring.index, NO_RING, 0.0f, ring.receiver.tracker.stats(), ring.clockSync.estimate(), now, ring.tx);
+			while (ring.tx.queue.pop(message)) {
+				if (chance(random) < loss) {
+					continue;
+				}
+				if (answerPing(ring.mac, message.data, message.length, now, now, masterTx)) {
+					continue;
+				}
+				WireFeedback feedback;
+				if (decodeFeedback(message.data, message.length, feedback)) {
+					ring.reported = feedback.link;
+				}
+				if (handleRingPacket(rings, ring.mac, message.data, message.length, (unsigned long)(now / 1000), masterTx, noPeers)
+					== RingPacket::Joined) {
+					replicator.requestKeyframe();
+				}
+			}
+
+			// Only count from the first state the ring got after joining
+			if (ring.index != NO_RING && ring.receiver.tracker.stats().received > 0) {
+				ring.staleTicks = upToDate(ring.receiver.state, state) ? 0 : ring.staleTicks + 1;
+				ring.longestStale = std::max(ring.longestStale, ring.staleTicks);
+			}
+		}
+	}
+
+	result.joined = rings.directory.count();
+	result.coalesced = masterTx.queue.stats.coalesced;
+	for (SimRing& ring : nodes) {
+		result.links.push_back(ring.receiver.tracker.stats());
+		uint8_t index = rings.directory.find(ring.mac);
+		result.reported.push_back(index != NO_RING ? rings.links[index] : WireLinkStats());
+		result.delivered.push_back(ring.reported);
+		result.transmitted.push_back(ring.transmitted);
+		result.missed.push_back(ring.missed);
+		result.unsent.push_back(ring.unsent);
+		result.longestStale = std::max(result.longestStale, ring.longestStale);
+	}
+	return result;
+}
+
+static void report(const char* name, const RunResult& result, float seconds) {
+	uint64_t received = 0, lost = 0, duplicates = 0;
+	for (const WireLinkStats& link : result.links) {
+		received += link.received;
+		lost += link.lost;
+		duplicates += link.duplicates;
+	}
+	printf("%-34s %u rings joined, %u state packets (at most %u per tick), %.0f B/s, %u coalesced; rings applied %llu, "
+		   "lost %llu (%.2f%%), dropped %llu duplicates; stale for at most %u ticks\n",
+		   name, result.joined, result.statesSent, result.mostStatesPerTick, result.stateBytes / seconds, result.coalesced,
+		   (unsigned long long)received, (unsigned long long)lost, received + lost > 0 ? 100.0 * lost / (received + lost) : 0.0,
+		   (unsigned long long)duplicates, result.longestStale);
+}
+
+/**
+ * Replaces one of three boards with a new one every RING_TIMEOUT_MILLIS and a bit, many times over, with the
+ * master's feedback handling and eviction running every tick
+ */
+static void checkEviction() {
+	MasterRings rings;
+	QueueSender<TX_QUEUE_DEPTH> tx;
+	auto noPeers = [](const uint8_t*) {};
+	std::vector<uint8_t> removed;  // indices, in the order they were evicted
+	auto removePeer = [&](const uint8_t*, uint8_t index) { removed.push_back(index); };
+	uint8_t packet[WIRE_MAX_PACKET_SIZE];
+
+	const int BOARDS = 3;
+	const int REPLACEMENTS = 3 * MAX_RINGS;
+	const unsigned long REPLACE_MILLIS = RING_TIMEOUT_MILLIS + 1000;
+	uint8_t macs[BOARDS][6] = {};
+	uint8_t indices[BOARDS];
+	uint8_t nextMac = 1;
+	for (int b = 0; b < BOARDS; b++) {
+		macs[b][0] = 0x02;
+		macs[b][5] = nextMac++;
+		indices[b] = NO_RING;
+	}
+	uint32_t full = 0;
+	uint8_t widest = 0;
+	for (unsigned long now = 0; now < REPLACEMENTS * REPLACE_MILLIS; now += TICK_MICROS / 1000) {
+		if (now > 0 && now % REPLACE_MILLIS == 0) {
+			int b = int(now / REPLACE_MILLIS) % BOARDS;
+			macs[b][5] = nextMac++;  // the old board goes silent, a new one takes its place
+			indices[b] = NO_RING;
+		}
+		for (int b = 0; b < BOARDS; b++) {
+			size_t length;
+			if (indices[b] == NO_RING) {
+				length = encodeRingIndex(WireMessage::Announce, NO_RING, 1, packet, sizeof(packet));
+			} else {
+				WireFeedback feedback;
+				feedback.ringIndex = indices[b];
+				length = encodeFeedback(feedback, 1, packet, sizeof(packet));
+			}
+			full += handleRingPacket(rings, macs[b], packet, int(length), now, tx, noPeers) == RingPacket::Full;
+			indices[b] = rings.directory.find(macs[b]);
+		}
+		evictSilentRings(rings, now, removePeer);
+		widest = std::max(widest, rings.directory.span());
+	}
+	printf("%d board replacements: %zu rings evicted, ring table %u wide at most, %u full\n", REPLACEMENTS,
+		   removed.size(), widest, full);
+	CHECK(full == 0, "the ring table was full %u times", full);
+	CHECK(removed.size() == size_t(REPLACEMENTS - 1), "%zu of %d replaced boards were evicted", removed.size(),
+		  REPLACEMENTS - 1);
+	CHECK(widest <= BOARDS + 1 && rings.directory.count() == BOARDS, "the ring table grew to %u for %d boards", widest,
+		  BOARDS);
+
+	// An evicted ring that comes back with feedback under its old index gets it again, if it is free
+	uint8_t lost = indices[0];
+	uint8_t lostMac[6];
+	memcpy(lostMac, macs[0], 6);
+	unsigned long now = REPLACEMENTS * REPLACE_MILLIS;
+	for (int b = 1; b < BOARDS; b++) {
+		WireFeedback feedback;
+		feedback.ringIndex = indices[b];
+		size_t length = encodeFeedback(feedback, 1, packet, sizeof(packet));
+		handleRingPacket(rings, macs[b], packet, int(length), now + RING_TIMEOUT_MILLIS, tx, noPeers);
+	}
+	evictSilentRings(rings, now + RING_TIMEOUT_MILLIS, removePeer);
+	CHECK(rings.directory.find(lostMac) == NO_RING && rings.directory.count() == BOARDS - 1, "a silent ring was not evicted");
+	WireFeedback feedback;
+	feedback.ringIndex = lost;
+	RingPacket back = handleRingPacket(rings, lostMac, packet, int(encodeFeedback(feedback, 1, packet, sizeof(packet))),
+									   now + RING_TIMEOUT_MILLIS + 100, tx, noPeers);
+	CHECK(back == RingPacket::Joined && rings.directory.find(lostMac) == lost, "an evicted ring did not get index %u back", lost);
+}
+
+int main(int argc, char** argv) {
+	float loss = 0.1f;
+	int ringCount = 6;
+	float seconds = 120.0f;
+	uint32_t drain = 2;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--loss") loss = float(atof(argv[i + 1]));
+		else if (option == "--rings") ringCount = atoi(argv[i + 1]);
+		else if (option == "--seconds") seconds = float(atof(argv[i + 1]));
+		else if (option == "--drain") drain = uint32_t(atoi(argv[i + 1]));
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (ringCount < 1 || ringCount > MAX_RINGS) {
+		fprintf(stderr, "--rings must be 1 to %d\n", MAX_RINGS);
+		return 1;
+	}
+	uint32_t ticks = uint32_t(seconds * 1e6f / TICK_MICROS);
+
+	RunResult clean = runBroadcast(ringCount, 0.0f, ticks, 1, 18);
+	report("clean link:", clean, seconds);
+	CHECK(clean.joined == uint32_t(ringCount), "%u of %d rings joined", clean.joined, ringCount);
+	CHECK(clean.mostStatesPerTick <= 1, "%u state packets in one tick", clean.mostStatesPerTick);
+	CHECK(clean.worstRepeats == STATE_BROADCAST_REPEATS, "a state packet went out %u times", clean.worstRepeats);
+	for (int i = 0; i < ringCount; i++) {
+		const WireLinkStats& link = clean.links[i];
+		CHECK(link.lost == 0, "ring %d lost %lu states on a clean link", i, (unsigned long)link.lost);
+		CHECK(link.duplicates == link.received * (STATE_BROADCAST_REPEATS - 1), "ring %d dropped %lu duplicates of %lu states",
+			  i, (unsigned long)link.duplicates, (unsigned long)link.received);
+	}
+	CHECK(clean.longestStale <= 1, "a ring was behind the master for %u ticks on a clean link", clean.longestStale);
+
+	char name[64];
+	snprintf(name, sizeof(name), "%.0f%% loss, radio every %u ticks:", 100.0f * loss, drain);
+	RunResult lossy = runBroadcast(ringCount, loss, ticks, drain, 19);
+	report(name, lossy, seconds);
+	CHECK(lossy.joined == uint32_t(ringCount), "%u of %d rings joined", lossy.joined, ringCount);
+	CHECK(lossy.mostStatesPerTick <= 1, "%u state packets in one tick", lossy.mostStatesPerTick);
+	float expected = powf(loss, STATE_BROADCAST_REPEATS);  // of the packets the radio sent
+	for (int i = 0; i < ringCount; i++) {
+		const WireLinkStats& link = lossy.links[i];
+		float ratio = lossy.transmitted[i] > 0 ? float(lossy.missed[i]) / float(lossy.transmitted[i]) : 1.0f;
+		CHECK(fabsf(ratio - expected) <= 0.5f * expected + 0.002f, "ring %d missed %.2f%% of the states sent, expected %.2f%%", i,
+			  100.0f * ratio, 100.0f * expected);
+		// Sequence numbers that never went out count as lost too
+		CHECK(link.lost == lossy.missed[i] + lossy.unsent[i], "ring %d counted %lu lost, but missed %u and %u were never sent", i,
+			  (unsigned long)link.lost, lossy.missed[i], lossy.unsent[i]);
+		const WireLinkStats& reported = lossy.reported[i];
+		const WireLinkStats& delivered = lossy.delivered[i];
+		CHECK(reported.received == delivered.received && reported.lost == delivered.lost && reported.duplicates == delivered.duplicates,
+			  "ring %d reported %lu received, %lu lost, but the master has %lu, %lu", i, (unsigned long)delivered.received,
+			  (unsigned long)delivered.lost, (unsigned long)reported.received, (unsigned long)reported.lost);
+		CHECK(fabsf(reported.lossRatio() - link.lossRatio()) < 0.005f, "ring %d reported %.2f%% loss, counted %.2f%%", i,
+			  100.0f * reported.lossRatio(), 100.0f * link.lossRatio());
+	}
+	CHECK(lossy.coalesced > 0 || drain == 1, "no state packet was replaced in the queue");
+	uint32_t catchUp = drain < CATCH_UP_TICKS - 1 ? CATCH_UP_TICKS * drain : 2 * KEYFRAME_TICKS;
+	CHECK(lossy.longestStale <= catchUp, "a ring was behind the master for %u ticks", lossy.longestStale);
+
+	checkEviction();
+	return checkResult();
+}
@@ -0,0 +1,30 @@
+#ifndef SIM_CHECK_HPP
+#define SIM_CHECK_HPP
+
+// Just enough of a test framework for the host checks: a failed CHECK() is reported and counted, and main() returns
+// checkResult() so `make check` stops on it.
+
+#include <stdio.h>
+
+static int checkFailures = 0;
+
+#define CHECK(condition, ...) \
+	do { \
+		if (!(condition)) { \
+			checkFailures++; \
+			printf("FAILED %s:%d: %s: ", __FILE__, __LINE__, #condition); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+		} \
+	} while (0)
+
+static inline int checkResult() {
+	if (checkFailures > 0) {
+		printf("%d check(s) failed\n", checkFailures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
+
+#endif // SIM_CHECK_HPP
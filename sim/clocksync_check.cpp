@@ -0,0 +1,200 @@
+/**
+ * Checks ClockSync (clocksync.hpp) against skewed and drifting clocks, in virtual time: a ring whose crystal is off
+ * from the master's pings it as ringTick() does, over a link with random delays, queueing spikes on either leg and
+ * lost packets, and the ring's idea of master time is compared with the true master time every few milliseconds.
+ *
+ * Each scenario reports how long the estimate took to converge (from then on it stays within CONVERGED_MICROS) and
+ * the 99th percentile and largest error after that. What it checks:
+ *   - offsets of a second either way and skews up to the 50 ppm the crystals are specified to converge within a few
+ *     seconds, and stay within a few hundred microseconds,
+ *   - the drift the estimate learns matches the skew, trailing one that changes across the run, as the crystal
+ *     warms up, without losing the offset,
+ *   - loss and one-sided queueing delays widen the error but do not break the estimate,
+ *   - when the master restarts, and its clock jumps, the ring resynchronizes as quickly as at the start.
+ *
+ * Options: --seconds S of virtual time per scenario (300), --seed N (20).
+ */
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+#include "clocksync.hpp"
+
+static const int64_t STEP_MICROS = 1000;        // the ring's loop() polls for pongs this often
+static const int64_t SAMPLE_MICROS = 10000;     // the error is measured this often
+static const double CONVERGED_MICROS = 1000.0;  // the error bound a converged estimate stays within
+
+struct Scenario {
+	const char* name;
+	double offset;       // ring minus master time at the start, us
+	double skew;         // how much faster the ring's clock runs at the start, e.g. 40e-6
+	double skewRamp;     // change of the skew per second of the run
+	double delayMean;    // of each leg's exponential delay on top of BASE_DELAY, us
+	double spikeChance;  // of a queueing delay of up to SPIKE_MICROS on one leg
+	double loss;         // of each ping and each pong
+	double restartAt;    // seconds into the run the master restarts and its clock jumps by RESTART_JUMP, 0 for never
+	// Bounds on the result
+	double convergeSeconds;
+	double p99Micros;
+	double worstMicros;
+};
+
+static const double BASE_DELAY = 400.0;      // us each way, the airtime and the radio tasks
+static const double SPIKE_MICROS = 20000.0;
+static const double RESTART_JUMP = -7.3e6;   // us; the master's millis() started over
+
+struct Result {
+	double convergeSeconds = 0.0;     // until the error last left CONVERGED_MICROS before any restart
+	double reconvergeSeconds = 0.0;   // likewise after the restart, counted from it
+	double p99 = 0.0, worst = 0.0;    // |error| once converged, us
+	double driftError = 0.0;          // of the learned drift at the end, against the clocks' true rates
+	uint32_t accepted = 0, pings = 0;
+};
+
+// The ring's clock at true (master) time t, both in us since the start of the run
+static double ringClock(const Scenario& scenario, double t) {
+	double seconds = t / 1e6;
+	return scenario.offset + t * (1.0 + scenario.skew) + 0.5 * scenario.skewRamp * seconds * t;
+}
+
+// The master's clock at true time t: true time, until it restarts
+static double masterClock(const Scenario& scenario, double t) {
+	return scenario.restartAt > 0.0 && t >= scenario.restartAt * 1e6 ? t + RESTART_JUMP : t;
+}
+
+struct Pong {
+	double arrival;  // true time
+	int64_t t1, t2, t3;
+};
+
+static Result run(const Scenario& scenario, double seconds, uint32_t seed) {
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	std::exponential_distribution<double> delay(1.0 / scenario.delayMean);
+	auto leg = [&] {
+		double spike = unit(random) < scenario.spikeChance ? unit(random) * SPIKE_MICROS : 0.0;
+		return BASE_DELAY + delay(random) + spike;
+	};
+
+	ClockSync clockSync;
+	std::vector<Pong> inFlight;
+	std::vector<double> errors;
+	int64_t nextPing = 0;
+	// Before and after the restart, each with its own convergence; without one, the second phase never starts
+	double restart = scenario.restartAt > 0.0 ? scenario.restartAt * 1e6 : INFINITY;
+	double phaseStart[2] = {0.0, restart};
+	double lastBad[2] = {0.0, restart};
+	Result result;
+	int64_t duration = int64_t(seconds * 1e6);
+	for (int64_t t = 0; t < duration; t += STEP_MICROS) {
+		int64_t local = int64_t(ringClock(scenario, double(t)));
+
+		for (size_t i = 0; i < inFlight.size();) {
+			if (inFlight[i].arrival <= double(t)) {
+				int64_t t4 = int64_t(ringClock(scenario, inFlight[i].arrival));
+				result.accepted += clockSync.addSample(inFlight[i].t1, inFlight[i].t2, inFlight[i].t3, t4);
+				inFlight.erase(inFlight.begin() + i);
+			} else {
+				i++;
+			}
+		}
+
+		if (local >= nextPing) {
+			nextPing = local + clockSync.estimate().pingIntervalMicros();
+			result.pings++;
+			double received = double(t) + leg();
+			double sent = received + 50.0 + unit(random) * 300.0;  // the master's loop gets to it
+			if (unit(random) >= scenario.loss && unit(random) >= scenario.loss) {
+				Pong pong;
+				pong.t1 = local;
+				pong.t2 = int64_t(masterClock(scenario, received));
+				pong.t3 = int64_t(masterClock(scenario, sent));
+				pong.arrival = sent + leg();
+				inFlight.push_back(pong);
+			}
+		}
+
+		if (t % SAMPLE_MICROS == 0) {
+			const ClockEstimate& estimate = clockSync.estimate();
+			double error = INFINITY;
+			if (estimate.synchronized()) {
+				error = double(estimate.toMaster(local)) - masterClock(scenario, double(t));
+			}
+			if (!(fabs(error) <= CONVERGED_MICROS)) {
+				lastBad[double(t) >= restart] = double(t);
+			}
+			errors.push_back(error);
+		}
+	}
+
+	// The master's clock runs 1 / (1 + skew) times as fast as the ring's
+	double skew = scenario.skew + scenario.skewRamp * seconds;
+	result.driftError = clockSync.estimate().drift - (1.0 / (1.0 + skew) - 1.0);
+	result.convergeSeconds = (lastBad[0] - phaseStart[0]) / 1e6;
+	result.reconvergeSeconds = restart < INFINITY ? (lastBad[1] - phaseStart[1]) / 1e6 : 0.0;
+	std::vector<double> settled;
+	for (size_t i = 0; i < errors.size(); i++) {
+		double t = double(int64_t(i) * SAMPLE_MICROS);
+		if (t > lastBad[t >= restart]) {
+			settled.push_back(fabs(errors[i]));
+		}
+	}
+	if (!settled.empty()) {
+		std::sort(settled.begin(), settled.end());
+		result.p99 = settled[std::min(settled.size() - 1, settled.size() * 99 / 100)];
+		result.worst = settled.back();
+	}
+	return result;
+}
+
+int main(int argc, char** argv) {
+	double seconds = 300.0;
+	uint32_t seed = 20;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--seconds") seconds = atof(argv[i + 1]);
+		else if (option == "--seed") seed = uint32_t(atoi(argv[i + 1]));
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	const Scenario scenarios[] = {
+		// name                          offset    skew    ramp     delay  spikes  loss  restart  converge  p99   worst
+		{"ahead 1 s, +40 ppm",           1e6,     40e-6,  0.0,     200.0, 0.0,    0.0,  0.0,     5.0,      300,  500},
+		{"behind 1 s, -50 ppm",          -1e6,    -50e-6, 0.0,     200.0, 0.0,    0.0,  0.0,     5.0,      300,  500},
+		{"skew drifting -30 to +30 ppm", 250e3,   -30e-6, 0.2e-6,  200.0, 0.0,    0.0,  0.0,     5.0,      300,  500},
+		{"30% loss, queueing spikes",    -3e5,    25e-6,  0.0,     500.0, 0.1,    0.3,  0.0,     10.0,     500,  1000},
+		{"master restarts at 150 s",     1e6,     -20e-6, 0.0,     300.0, 0.05,   0.1,  150.0,   10.0,     500,  1000},
+	};
+
+	// The drift is measured over ClockSync's 20 s window and smoothed, so it trails a changing skew by two windows or so
+	const double DRIFT_NOISE = 8e-6;
+	const double DRIFT_LAG_SECONDS = 50.0;
+	printf("%.0f s per scenario; error of the ring's master time once it stays within %.0f us\n\n", seconds,
+		   CONVERGED_MICROS);
+	printf("%-30s  converged s  after restart s  p99 us  worst us  drift error ppm  pongs used\n", "");
+	for (const Scenario& scenario : scenarios) {
+		Result result = run(scenario, seconds, seed);
+		printf("%-30s  %11.2f  %15.2f  %6.0f  %8.0f  %15.2f  %5u/%u\n", scenario.name, result.convergeSeconds,
+			   result.reconvergeSeconds, result.p99, result.worst, result.driftError * 1e6, result.accepted, result.pings);
+		CHECK(result.convergeSeconds <= scenario.convergeSeconds, "%s: converged after %.2f s", scenario.name,
+			  result.convergeSeconds);
+		if (scenario.restartAt > 0.0) {
+			CHECK(result.reconvergeSeconds <= scenario.convergeSeconds, "%s: converged %.2f s after the restart",
+				  scenario.name, result.reconvergeSeconds);
+		}
+		CHECK(result.p99 <= scenario.p99Micros, "%s: 99th percentile error %.0f us", scenario.name, result.p99);
+		double driftBound = DRIFT_NOISE + fabs(scenario.skewRamp) * DRIFT_LAG_SECONDS;
+		CHECK(fabs(result.driftError) <= driftBound, "%s: the drift is %.2f ppm off", scenario.name, result.driftError * 1e6);
+		CHECK(result.worst <= scenario.worstMicros, "%s: largest error %.0f us", scenario.name, result.worst);
+	}
+	return checkResult();
+}
@@ -0,0 +1,208 @@
+/**
+ * Bounds how far the integer path (FixedRealFFT in fixedfft.hpp, then computeKickWeightedGEQFixed()) deviates from
+ * the float reference (RealFFT, then computeKickWeightedGEQ()), from quiet signals up to full scale: full-scale
+ * tones, square waves, alternating extremes at Nyquist and impulses, which are what would overflow a fixed-point
+ * transform without the headroom for them.
+ *
+ * The bounds are the ones the fixed-point path promises:
+ *   - each bin above NOISE within 3.2% of the float magnitude (the magnitude approximation is -1.6% / +2.7%), or
+ *     within 2^-15 of the window's peak bin: the Q31 transform leaves a floor of a few units under full-scale peaks,
+ *     which is what the int16 input resolves anyway,
+ *   - the kick-weighted GEQ channel amplitudes above NOISE within 3%,
+ *   - each post-processed channel (0-255) whose amplitude is above NOISE within 4 of the float path's, the 3% above
+ *     through the square-root scaling, except where the two land on either side of the scaling's cut-off and one
+ *     of them is 0; those flips may make up 1% of the channels. Both paths run from a fresh start over the same
+ *     frames in child processes (isolate.hpp), as the post-processing keeps state in fft.cpp's globals. Below NOISE
+ *     the gain of the post-processing turns the floor above into visible differences, so those are not compared.
+ *
+ * Options: --frames N of random signals (2000), --rounds R of the benchmark (7).
+ */
+
+#include <math.h>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include "bench.hpp"
+#include "check.hpp"
+#include "isolate.hpp"
+
+#include "fft.h"
+#include "fixedfft.hpp"
+#include "realfft.hpp"
+#include "spectral.hpp"
+
+#define NOISE 200  // as in fft.cpp
+
+typedef std::vector<int16_t> Window;
+
+static int16_t clampSample(double value) {
+	return int16_t(fmax(-32768.0, fmin(32767.0, round(value))));
+}
+
+// Full-scale and edge-case windows, then tones, kicks and noise at random levels
+static std::vector<Window> makeWindows(uint32_t frames) {
+	std::vector<Window> windows;
+	Window window(SAMPLES);
+	for (int i = 0; i < SAMPLES; i++) window[i] = clampSample(32767.0 * sin(2.0 * M_PI * 1000.0 * i / SAMPLING_FREQ));
+	windows.push_back(window);
+	for (int i = 0; i < SAMPLES; i++) window[i] = (i / 8) % 2 ? -32768 : 32767;  // 1 kHz square
+	windows.push_back(window);
+	for (int i = 0; i < SAMPLES; i++) window[i] = i % 2 ? -32768 : 32767;  // Nyquist
+	windows.push_back(window);
+	for (int i = 0; i < SAMPLES; i++) window[i] = (i / (SAMPLES / 2)) ? -32768 : 32767;  // one full-scale step
+	windows.push_back(window);
+	for (int i = 0; i < SAMPLES; i++) window[i] = i == SAMPLES / 2 ? 32767 : -32768;  // impulse on full-scale DC
+	windows.push_back(window);
+	for (int i = 0; i < SAMPLES; i++) window[i] = clampSample(40000.0 * sin(2.0 * M_PI * 90.0 * i / SAMPLING_FREQ));  // clipped kick
+	windows.push_back(window);
+
+	std::mt19937 random(14);
+	std::normal_distribution<double> noise(0.0, 1.0);
+	std::uniform_real_distribution<double> level(1.0, 4.6);  // log10 of the peak amplitude, up to past full scale
+	std::uniform_real_distribution<double> hz(40.0, 7000.0);
+	while (windows.size() < frames) {
+		double amplitude = pow(10.0, level(random));
+		double toneHz = hz(random);
+		for (int i = 0; i < SAMPLES; i++) {
+			double t = double(i) / SAMPLING_FREQ;
+			window[i] = clampSample(amplitude * (0.6 * exp(-t * 30.0) * sin(2.0 * M_PI * 70.0 * t) + 0.3 * sin(2.0 * M_PI * toneHz * t)
+												 + 0.1 * noise(random)));
+		}
+		windows.push_back(window);
+	}
+	return windows;
+}
+
+// The GEQ channel amplitudes before post-processing, as computeKickWeightedGEQ() and its integer version sum them
+static void channelAmplitudes(const float* floats, const uint32_t* fixeds, double floatChannels[NUM_GEQ_CHANNELS],
+							  double fixedChannels[NUM_GEQ_CHANNELS]) {
+	using Spectrum = SpectralAnalyzer<SAMPLES, SAMPLING_FREQ>;
+	for (int c = 0; c < NUM_GEQ_CHANNELS; c++) {
+		floatChannels[c] = fixedChannels[c] = 0.0;
+		for (int i = Spectrum::tables.geqFirstBin[c]; i <= Spectrum::tables.geqLastBin[c]; i++) {
+			floatChannels[c] += Spectrum::tables.kickWeights[i] * floats[i];
+			fixedChannels[c] += Spectrum::tables.kickWeightsQ14[i] / 16384.0 * fixeds[i];
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	uint32_t frames = 2000;
+	int rounds = 7;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--frames") frames = uint32_t(atoi(argv[i + 1]));
+		else if (option == "--rounds") rounds = atoi(argv[i + 1]);
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	Serial.muted = true;
+
+	static RealFFT<SAMPLES> floatFFT;
+	static FixedRealFFT<SAMPLES> fixedFFT;
+	std::vector<Window> windows = makeWindows(frames);
+	std::vector<std::vector<float>> floatSpectra;
+	std::vector<std::vector<uint32_t>> fixedSpectra;
+
+	std::vector<bool> audible;  // per frame and channel, whether the float channel amplitude is above NOISE
+	double worstBin = 0.0, worstChannel = 0.0;
+	double worstFullScaleBin = 0.0;
+	uint32_t binsOver = 0, channelsOver = 0, binsCompared = 0;
+	for (size_t w = 0; w < windows.size(); w++) {
+		std::vector<float> floats(SAMPLES / 2);
+		std::vector<uint32_t> fixeds(SAMPLES / 2);
+		floatFFT.magnitude(windows[w].data(), floats.data());
+		fixedFFT.magnitude(windows[w].data(), fixeds.data());
+		floats[0] = 0.0f;  // as doFFT() and doFixedFFT() leave them
+		fixeds[0] = 0;
+		float peak = 0.0f;
+		for (int i = 1; i < SAMPLES / 2; i++) peak = fmaxf(peak, floats[i]);
+		for (int i = 1; i < SAMPLES / 2; i++) {
+			if (floats[i] <= NOISE) {
+				continue;
+			}
+			double error = fabs(double(fixeds[i]) / floats[i] - 1.0);
+			binsCompared++;
+			worstBin = fmax(worstBin, error);
+			binsOver += error > 0.032 && fabs(double(fixeds[i]) - floats[i]) > peak / 32768.0;
+			if (w < 6) worstFullScaleBin = fmax(worstFullScaleBin, error);
+		}
+		double floatChannels[NUM_GEQ_CHANNELS], fixedChannels[NUM_GEQ_CHANNELS];
+		channelAmplitudes(floats.data(), fixeds.data(), floatChannels, fixedChannels);
+		for (int c = 0; c < NUM_GEQ_CHANNELS; c++) {
+			audible.push_back(floatChannels[c] > NOISE);
+			if (!audible.back()) {
+				continue;
+			}
+			double error = fabs(fixedChannels[c] / floatChannels[c] - 1.0);
+			worstChannel = fmax(worstChannel, error);
+			channelsOver += error > 0.03;
+		}
+		floatSpectra.push_back(floats);
+		fixedSpectra.push_back(fixeds);
+	}
+
+	// The post-processed channels of both paths, each from a fresh start
+	std::vector<uint8_t> floatBytes = runIsolated([&](FILE* out) {
+		float results[NUM_GEQ_CHANNELS];
+		for (std::vector<float>& spectrum : floatSpectra) {
+			computeKickWeightedGEQ(spectrum.data(), results);
+			fwrite(results, sizeof(results), 1, out);
+		}
+	});
+	std::vector<uint8_t> fixedBytes = runIsolated([&](FILE* out) {
+		float results[NUM_GEQ_CHANNELS];
+		for (std::vector<uint32_t>& spectrum : fixedSpectra) {
+			computeKickWeightedGEQFixed(spectrum.data(), results);
+			fwrite(results, sizeof(results), 1, out);
+		}
+	});
+	const size_t resultBytes = windows.size() * NUM_GEQ_CHANNELS * sizeof(float);
+	CHECK(floatBytes.size() == resultBytes && fixedBytes.size() == resultBytes, "a GEQ run did not complete");
+	double worstProcessed = 0.0;
+	uint32_t processedOver = 0, processedFlips = 0, processedCompared = 0;
+	if (floatBytes.size() == resultBytes && fixedBytes.size() == resultBytes) {
+		std::vector<float> floatResults(resultBytes / sizeof(float)), fixedResults(resultBytes / sizeof(float));
+		memcpy(floatResults.data(), floatBytes.data(), resultBytes);
+		memcpy(fixedResults.data(), fixedBytes.data(), resultBytes);
+		for (size_t i = 0; i < floatResults.size(); i++) {
+			if (!audible[i]) {
+				continue;
+			}
+			processedCompared++;
+			if ((floatResults[i] == 0.0f) != (fixedResults[i] == 0.0f)) {
+				processedFlips++;
+				continue;
+			}
+			double difference = fabs(double(fixedResults[i]) - floatResults[i]);
+			worstProcessed = fmax(worstProcessed, difference);
+			processedOver += difference > 4.0;
+		}
+	}
+
+	double floatNanos = nanosecondsPerCall([&](uint32_t i) {
+		floatFFT.magnitude(windows[i % windows.size()].data(), floatSpectra[0].data());
+		benchSink = floatSpectra[0][i % (SAMPLES / 2)];
+	}, uint32_t(windows.size()), rounds);
+	double fixedNanos = nanosecondsPerCall([&](uint32_t i) {
+		fixedFFT.magnitude(windows[i % windows.size()].data(), fixedSpectra[0].data());
+		benchSink = float(fixedSpectra[0][i % (SAMPLES / 2)]);
+	}, uint32_t(windows.size()), rounds);
+
+	printf("%zu windows, %u bins above NOISE: worst bin error %.2f%% (%.2f%% on the full-scale windows), %u over 3.2%% and 2^-15 of the peak\n",
+		   windows.size(), binsCompared, worstBin * 100.0, worstFullScaleBin * 100.0, binsOver);
+	printf("GEQ channel amplitudes: worst error %.2f%%, %u over 3%%; post-processed channels: %u above NOISE, worst difference "
+		   "%.2f, %u over 4, %u flipped at the cut-off\n",
+		   worstChannel * 100.0, channelsOver, processedCompared, worstProcessed, processedOver, processedFlips);
+	printf("per window on the host: float RealFFT %.0f ns, FixedRealFFT %.0f ns\n", floatNanos, fixedNanos);
+	CHECK(binsOver == 0, "%u bins off by more than 3.2%% and 2^-15 of the peak", binsOver);
+	CHECK(channelsOver == 0, "%u channel amplitudes off by more than 3%%", channelsOver);
+	CHECK(processedOver == 0, "%u post-processed channels off by more than 4", processedOver);
+	CHECK(processedFlips * 100 <= processedCompared, "%u of %u post-processed channels flipped at the cut-off", processedFlips, processedCompared);
+	return checkResult();
+}
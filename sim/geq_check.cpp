@@ -0,0 +1,143 @@
+/**
+ * Checks that the fused spectral stage, computeKickWeightedGEQ(), is bit-identical to the chain it replaced:
+ * applyKickDrumIsolationFilter() -> computeSpectrogramWLED() -> postProcessFFTResults(), and times both per frame,
+ * along with the original chain that evaluated the kick filter's gaussian for every bin of every frame.
+ *
+ * Both run from fft.cpp itself over the same magnitude spectra, from quiet to clipping so the smoothing, gating and
+ * clamping branches all get exercised. The stages keep their averages in fft.cpp's globals, so each runs in its own
+ * child process (isolate.hpp) from the same fresh start.
+ *
+ * Options: --frames N (4000), --rounds R of the benchmark (15).
+ */
+
+#include <math.h>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include "bench.hpp"
+#include "check.hpp"
+#include "isolate.hpp"
+
+#include "fft.h"
+#include "realfft.hpp"
+#include "spectral.hpp"
+
+typedef std::vector<std::vector<float>> Spectra;
+
+// Spectra of kicks, tones and noise at levels from near silence to full scale, as doFFT() would produce them
+static Spectra makeSpectra(uint32_t frames) {
+	std::mt19937 random(3);
+	std::normal_distribution<float> noise(0.0f, 1.0f);
+	std::uniform_real_distribution<float> level(-1.0f, 4.5f);  // log10 of the peak amplitude
+	static RealFFT<SAMPLES> fft;
+	Spectra spectra;
+	int16_t window[SAMPLES];
+	for (uint32_t frame = 0; frame < frames; frame++) {
+		float amplitude = powf(10.0f, level(random));
+		float kickHz = 50.0f + 10.0f * (frame % 8);
+		for (int i = 0; i < SAMPLES; i++) {
+			float t = float(i) / SAMPLING_FREQ;
+			float value = amplitude * (expf(-t * 30.0f) * sinf(2.0f * float(M_PI) * kickHz * t) + 0.2f * noise(random)
+				+ 0.1f * sinf(2.0f * float(M_PI) * 2500.0f * t));
+			window[i] = int16_t(fmaxf(-32768.0f, fminf(32767.0f, value)));
+		}
+		std::vector<float> magnitudes(SAMPLES / 2);
+		fft.magnitude(window, magnitudes.data());
+		magnitudes[0] = 0.0f;
+		spectra.push_back(magnitudes);
+	}
+	return spectra;
+}
+
+static void unfused(float frequencies[SAMPLES / 2], float results[NUM_GEQ_CHANNELS]) {
+	static float filtered[SAMPLES / 2];
+	static float spectrogram[NUM_GEQ_CHANNELS];
+	applyKickDrumIsolationFilter(frequencies, filtered);
+	computeSpectrogramWLED(filtered, spectrogram);
+	postProcessFFTResults(spectrogram, results);
+}
+
+// The kick filter as it was before the weights became a table, in front of the same binning and post-processing
+static void original(float frequencies[SAMPLES / 2], float results[NUM_GEQ_CHANNELS]) {
+	static float filtered[SAMPLES / 2];
+	static float spectrogram[NUM_GEQ_CHANNELS];
+	const float binFrequencySize = float(SAMPLING_FREQ) / SAMPLES;
+	for (uint16_t i = 0; i < SAMPLES / 2; i++) {
+		const float hz = i * binFrequencySize;
+		const float filterFloor = 0.05;
+		filtered[i] = (exp(-0.5 * pow((hz - KICK_HZ_MU) / KICK_HZ_SIGMA, 2)) + filterFloor) * frequencies[i];
+	}
+	computeSpectrogramWLED(filtered, spectrogram);
+	postProcessFFTResults(spectrogram, results);
+}
+
+static void fused(float frequencies[SAMPLES / 2], float results[NUM_GEQ_CHANNELS]) {
+	computeKickWeightedGEQ(frequencies, results);
+}
+
+// Runs a stage over every spectrum from a fresh start and writes the channels of each frame, then times it
+static std::vector<uint8_t> runStage(void (*stage)(float*, float*), Spectra spectra, int rounds) {
+	return runIsolated([&](FILE* out) {
+		float results[NUM_GEQ_CHANNELS];
+		for (std::vector<float>& frequencies : spectra) {
+			stage(frequencies.data(), results);
+			fwrite(results, sizeof(results), 1, out);
+		}
+		double nanos = nanosecondsPerCall([&](uint32_t i) {
+			stage(spectra[i].data(), results);
+			benchSink = results[i % NUM_GEQ_CHANNELS];
+		}, uint32_t(spectra.size()), rounds);
+		fwrite(&nanos, sizeof(nanos), 1, out);
+	});
+}
+
+int main(int argc, char** argv) {
+	uint32_t frames = 4000;
+	int rounds = 15;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--frames") frames = uint32_t(atoi(argv[i + 1]));
+		else if (option == "--rounds") rounds = atoi(argv[i + 1]);
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	Serial.muted = true;
+
+	Spectra spectra = makeSpectra(frames);
+	std::vector<uint8_t> before = runStage(unfused, spectra, rounds);
+	std::vector<uint8_t> after = runStage(fused, spectra, rounds);
+	std::vector<uint8_t> first = runStage(original, spectra, rounds);
+	const size_t resultBytes = frames * NUM_GEQ_CHANNELS * sizeof(float);
+	if (before.size() != resultBytes + sizeof(double) || after.size() != resultBytes + sizeof(double)
+		|| first.size() != resultBytes + sizeof(double)) {
+		CHECK(false, "a stage did not run to completion");
+		return checkResult();
+	}
+
+	std::vector<float> unfusedResults(frames * NUM_GEQ_CHANNELS), fusedResults(frames * NUM_GEQ_CHANNELS);
+	memcpy(unfusedResults.data(), before.data(), resultBytes);
+	memcpy(fusedResults.data(), after.data(), resultBytes);
+	uint32_t differing = 0, saturated = 0, zero = 0;
+	for (size_t i = 0; i < unfusedResults.size(); i++) {
+		differing += memcmp(&unfusedResults[i], &fusedResults[i], sizeof(float)) != 0;
+		saturated += unfusedResults[i] == 255.0f;
+		zero += unfusedResults[i] == 0.0f;
+	}
+	double originalNanos, unfusedNanos, fusedNanos;
+	memcpy(&originalNanos, first.data() + resultBytes, sizeof(double));
+	memcpy(&unfusedNanos, before.data() + resultBytes, sizeof(double));
+	memcpy(&fusedNanos, after.data() + resultBytes, sizeof(double));
+
+	printf("%u frames, %u channel values of which %u at 0 and %u at 255: %u differ\n",
+		   frames, unsigned(unfusedResults.size()), zero, saturated, differing);
+	printf("per frame: original chain %.0f ns, unfused chain %.0f ns, fused stage %.0f ns (%.1fx faster than the original)\n",
+		   originalNanos, unfusedNanos, fusedNanos, originalNanos / fusedNanos);
+	CHECK(differing == 0, "%u channel values differ between the fused and unfused stages", differing);
+	CHECK(zero > 0 && saturated > 0 && zero + saturated < unfusedResults.size(), "the spectra do not cover the whole range of the channels");
+	return checkResult();
+}
@@ -0,0 +1,117 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+// Just enough of Arduino.h for the firmware sources in src/ to build on a host: the protocol headers (State::print())
+// and the audio pipeline in fft.cpp and beatdetection.cpp
+
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define F(text) (text)
+#define DEC 10
+#define HEX 16
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+/**
+ * The clock behind millis() and micros(): real time since the program started, unless an offline run steps a
+ * virtual clock with hostSetMicros(), so that timestamps follow the audio being replayed rather than the host.
+ * Like the devices' clocks, millis() and micros() wrap at 32 bits.
+ */
+inline std::atomic<int64_t>& hostVirtualMicros() {
+	static std::atomic<int64_t> virtualMicros{-1};
+	return virtualMicros;
+}
+
+inline void hostSetMicros(int64_t now) {
+	hostVirtualMicros().store(now);
+}
+
+inline int64_t hostMicros() {
+	static const auto start = std::chrono::steady_clock::now();
+	int64_t virtualMicros = hostVirtualMicros().load();
+	if (virtualMicros >= 0) {
+		return virtualMicros;
+	}
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline unsigned long micros() {
+	return uint32_t(hostMicros());
+}
+
+inline unsigned long millis() {
+	return uint32_t(hostMicros() / 1000);
+}
+
+inline void delay(unsigned long ms) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// The host has plenty of memory, so it pretends to have PSRAM
+inline bool psramFound() {
+	return true;
+}
+
+inline void* ps_malloc(size_t size) {
+	return malloc(size);
+}
+
+/**
+ * Serial on stdout. Harnesses that print their own results set `muted` to keep the firmware's logging out of them.
+ */
+struct HostSerial {
+	bool muted = false;
+
+	template <typename... Args>
+	void printf(const char* format, Args... args) {
+		if (!muted) ::printf(format, args...);
+	}
+	void print(const char* text) {
+		if (!muted) fputs(text, stdout);
+	}
+	void print(char c) {
+		if (!muted) putchar(c);
+	}
+	void print(double value, int digits = 2) {
+		if (!muted) ::printf("%.*f", digits, value);
+	}
+	void print(long long value, int base = DEC) {
+		if (!muted) ::printf(base == HEX ? "%llX" : "%lld", value);
+	}
+	void print(int value, int base = DEC) {
+		print((long long)value, base);
+	}
+	void print(unsigned value, int base = DEC) {
+		print((long long)value, base);
+	}
+	void print(long value, int base = DEC) {
+		print((long long)value, base);
+	}
+	void print(unsigned long value, int base = DEC) {
+		print((long long)value, base);
+	}
+	void print(unsigned char value, int base = DEC) {
+		print((long long)value, base);
+	}
+	template <typename T>
+	void println(T value) {
+		print(value);
+		println();
+	}
+	void println() {
+		if (!muted) putchar('\n');
+	}
+};
+
+inline HostSerial Serial;
+
+#endif // SIM_ARDUINO_H
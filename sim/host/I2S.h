@@ -0,0 +1,59 @@
+#ifndef SIM_I2S_H
+#define SIM_I2S_H
+
+/**
+ * The I2S microphone, fed by the host: a harness registers an audio source with hostSetAudioSource(), and every
+ * i2s_read() of the sampling task pulls its block of 16-bit PCM from it. When the source runs out the read ends the
+ * task (see freertos/task.h), so replaying a recording runs the firmware's own sampling loop to the end of it.
+ */
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/task.h"
+
+#define PDM_MONO_MODE 3
+
+// Fills `samples` samples of PCM and returns true, or returns false at the end of the audio
+typedef std::function<bool(int16_t* pcm, size_t samples)> HostAudioSource;
+
+inline HostAudioSource& hostAudioSource() {
+	static HostAudioSource source;
+	return source;
+}
+
+inline void hostSetAudioSource(HostAudioSource source) {
+	hostAudioSource() = source;
+}
+
+class I2SClass {
+public:
+	void setAllPins(int, int, int, int, int) {}
+
+	bool begin(int, long, int) {
+		return true;
+	}
+};
+
+inline I2SClass I2S;
+
+namespace esp_i2s {
+
+enum i2s_port_t { I2S_NUM_0 = 0 };
+
+// bytesRead is a size_t* in ESP-IDF, where that is 32 bits like the firmware's uint32_t
+inline esp_err_t i2s_read(i2s_port_t, void* destination, size_t size, uint32_t* bytesRead, TickType_t) {
+	hostCheckStopping();
+	HostAudioSource& source = hostAudioSource();
+	if (!source || !source(static_cast<int16_t*>(destination), size / sizeof(int16_t))) {
+		throw HostTaskExit();
+	}
+	*bytesRead = uint32_t(size);
+	return ESP_OK;
+}
+
+} // namespace esp_i2s
+
+#endif // SIM_I2S_H
@@ -0,0 +1,7 @@
+#ifndef SIM_ARDUINOFFT_H
+#define SIM_ARDUINOFFT_H
+
+// ArduinoFFT is an Arduino library and is not available on a host. fft.cpp only uses it when USE_REAL_FFT is off,
+// and the host builds keep the real-input FFT engine; sim/realfft_check.cpp compares the two.
+
+#endif // SIM_ARDUINOFFT_H
@@ -0,0 +1,22 @@
+#ifndef SIM_ESP_HEAP_CAPS_H
+#define SIM_ESP_HEAP_CAPS_H
+
+// The host has one heap, so the capabilities are only there for the firmware sources to build
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+inline void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
+	(void)caps;
+	return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+inline void heap_caps_free(void* ptr) {
+	free(ptr);
+}
+
+#endif // SIM_ESP_HEAP_CAPS_H
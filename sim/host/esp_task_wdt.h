@@ -0,0 +1,13 @@
+#ifndef SIM_ESP_TASK_WDT_H
+#define SIM_ESP_TASK_WDT_H
+
+// There is no task watchdog on a host
+
+#include "esp_err.h"
+#include "freertos/task.h"
+
+inline esp_err_t esp_task_wdt_delete(TaskHandle_t) {
+	return ESP_OK;
+}
+
+#endif // SIM_ESP_TASK_WDT_H
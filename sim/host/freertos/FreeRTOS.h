@@ -0,0 +1,29 @@
+#ifndef SIM_FREERTOS_H
+#define SIM_FREERTOS_H
+
+// The FreeRTOS types and critical sections the firmware uses, on std::mutex. See task.h for tasks.
+
+#include <mutex>
+#include <stdint.h>
+
+typedef uint32_t TickType_t;  // one tick is a millisecond, as configured on the devices
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define portMAX_DELAY TickType_t(0xFFFFFFFF)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) TickType_t(ms)
+
+// A critical section keeps the other core out; a mutex does the same for the other threads
+struct portMUX_TYPE {
+	std::mutex mutex;
+};
+
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) ((mux)->mutex.lock())
+#define portEXIT_CRITICAL(mux) ((mux)->mutex.unlock())
+
+#endif // SIM_FREERTOS_H
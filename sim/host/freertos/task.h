@@ -0,0 +1,156 @@
+#ifndef SIM_FREERTOS_TASK_H
+#define SIM_FREERTOS_TASK_H
+
+/**
+ * FreeRTOS tasks as threads: xTaskCreatePinnedToCore() starts a std::thread (core and priority are ignored), and
+ * direct-to-task notifications are a counter behind a condition variable.
+ *
+ * Firmware tasks loop forever, so the host ends them from the outside: hostStopTasks() makes every blocking call
+ * in a task (ulTaskNotifyTake(), vTaskDelay(), and reads from the host I2S) throw HostTaskExit, which unwinds the
+ * task function, and then joins the threads. A task can also end itself by throwing HostTaskExit, which is how the
+ * host I2S ends the sampling task when the audio runs out; hostJoinTasks() waits for that.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "FreeRTOS.h"
+
+struct HostTaskExit {};
+
+struct HostTask {
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable wake;
+	uint32_t notifications = 0;
+	uint32_t stackDepth = 0;
+};
+
+typedef HostTask* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+struct HostTasks {
+	std::mutex lock;
+	std::vector<HostTask*> tasks;
+	std::atomic<bool> stopping{false};
+};
+
+inline HostTasks& hostTasks() {
+	static HostTasks tasks;
+	return tasks;
+}
+
+// The task the calling thread runs; threads the firmware did not start get one of their own for notifications
+inline HostTask*& hostCurrentTask() {
+	thread_local HostTask* current = nullptr;
+	if (current == nullptr) {
+		thread_local HostTask own;
+		current = &own;
+	}
+	return current;
+}
+
+inline void hostCheckStopping() {
+	if (hostTasks().stopping.load()) {
+		throw HostTaskExit();
+	}
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char*, uint32_t stackDepth, void* parameter,
+										  UBaseType_t, TaskHandle_t* handle, BaseType_t) {
+	HostTask* task = new HostTask();
+	task->stackDepth = stackDepth;
+	{
+		std::lock_guard<std::mutex> guard(hostTasks().lock);
+		hostTasks().tasks.push_back(task);
+	}
+	if (handle != nullptr) {
+		*handle = task;
+	}
+	task->thread = std::thread([task, function, parameter] {
+		hostCurrentTask() = task;
+		try {
+			function(parameter);
+		} catch (const HostTaskExit&) {
+		}
+	});
+	return pdPASS;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+	return hostCurrentTask();
+}
+
+inline TaskHandle_t xTaskGetIdleTaskHandleForCPU(UBaseType_t) {
+	return nullptr;
+}
+
+inline void xTaskNotifyGive(TaskHandle_t task) {
+	std::lock_guard<std::mutex> guard(task->lock);
+	task->notifications++;
+	task->wake.notify_all();
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait) {
+	HostTask* task = hostCurrentTask();
+	std::unique_lock<std::mutex> guard(task->lock);
+	auto ready = [task] { return task->notifications > 0 || hostTasks().stopping.load(); };
+	if (ticksToWait == portMAX_DELAY) {
+		task->wake.wait(guard, ready);
+	} else {
+		task->wake.wait_for(guard, std::chrono::milliseconds(ticksToWait), ready);
+	}
+	hostCheckStopping();
+	uint32_t value = task->notifications;
+	if (value > 0) {
+		task->notifications = clearOnExit ? 0 : value - 1;
+	}
+	return value;
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+	hostCheckStopping();
+}
+
+// Host threads have large stacks that nothing measures, so this reports the whole stack the task asked for as unused
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+	return (task != nullptr ? task : hostCurrentTask())->stackDepth;
+}
+
+/**
+ * Waits for every task to end on its own, and forgets them
+ */
+inline void hostJoinTasks() {
+	std::vector<HostTask*> tasks;
+	{
+		std::lock_guard<std::mutex> guard(hostTasks().lock);
+		tasks.swap(hostTasks().tasks);
+	}
+	for (HostTask* task : tasks) {
+		task->thread.join();
+		delete task;
+	}
+}
+
+/**
+ * Ends every task at its next blocking call, waits for them, and forgets them
+ */
+inline void hostStopTasks() {
+	hostTasks().stopping.store(true);
+	{
+		std::lock_guard<std::mutex> guard(hostTasks().lock);
+		for (HostTask* task : hostTasks().tasks) {
+			std::lock_guard<std::mutex> taskGuard(task->lock);
+			task->wake.notify_all();
+		}
+	}
+	hostJoinTasks();
+	hostTasks().stopping.store(false);
+}
+
+#endif // SIM_FREERTOS_TASK_H
@@ -0,0 +1,65 @@
+#ifndef SIM_ISOLATE_HPP
+#define SIM_ISOLATE_HPP
+
+// The audio pipeline in fft.cpp and beatdetection.cpp keeps its state in globals, as firmware does. To run it more
+// than once from a fresh start, each run goes to a child process with its own copy of them. Runs may be started
+// from several threads at once.
+
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Held from creating a run's pipe until the parent has closed its write end, so that no child started from another
+// thread inherits it; the run would not see the end of its output until that child exited too
+inline std::mutex& isolatedForkLock() {
+	static std::mutex lock;
+	return lock;
+}
+
+/**
+ * Runs `work(out)` in a forked child and returns what it wrote to `out`, or an empty result if the child failed
+ */
+template <typename F>
+std::vector<uint8_t> runIsolated(F work) {
+	int fds[2];
+	pid_t child;
+	{
+		std::lock_guard<std::mutex> guard(isolatedForkLock());
+		if (pipe(fds) != 0) {
+			return {};
+		}
+		fflush(stdout);
+		child = fork();
+		if (child == 0) {
+			close(fds[0]);
+			FILE* out = fdopen(fds[1], "wb");
+			work(out);
+			fclose(out);
+			_exit(0);
+		}
+		close(fds[1]);
+		if (child < 0) {
+			close(fds[0]);
+			return {};
+		}
+	}
+	std::vector<uint8_t> result;
+	uint8_t buffer[4096];
+	ssize_t length;
+	while ((length = read(fds[0], buffer, sizeof(buffer))) > 0) {
+		result.insert(result.end(), buffer, buffer + length);
+	}
+	close(fds[0]);
+	int status = 0;
+	waitpid(child, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		return {};
+	}
+	return result;
+}
+
+#endif // SIM_ISOLATE_HPP
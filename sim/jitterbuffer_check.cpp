@@ -0,0 +1,250 @@
+/**
+ * Replays a packet trace through a ring's JitterBuffer (jitterbuffer.hpp) and measures how smooth its playout is.
+ *
+ * The master's target sweeps at a varying speed and goes out as StateReplicator sends it: when dead reckoning from the
+ * last sample would be off, or with a keyframe every second, each packet broadcast twice. Every copy is delayed at
+ * random, now and then by a queueing spike that reorders it behind later packets, and lost, in bursts as near the
+ * speakers. The ring plays the buffer out every RING_TICK_MICROS and the result is compared with the true target and
+ * with what the ring would do without a buffer: take the angle of the latest packet to arrive.
+ *
+ * What it checks:
+ *   - the playout stays within a degree or so of the truth, a few degrees through the loss bursts, and well within
+ *     the latest-packet angle's error,
+ *   - it never steps backwards, where the latest packet does whenever a reordered one lands, and its steps change
+ *     smoothly, even where a sample after a burst corrects the dead reckoning: the largest change in step (second
+ *     difference) is a small fraction of the latest packet's,
+ *   - the buffer counted the reordered, late and duplicate packets,
+ *   - a target whose angle holds while the servo turns plays out at that angle and the servo's velocity.
+ *
+ * Options: --seconds S of trace (120), --loss P per copy outside bursts (0.1), --seed N (22).
+ */
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+#include "jitterbuffer.hpp"
+#include "protocol.hpp"
+
+static const int64_t MASTER_TICK_MICROS = 20000;
+static const int64_t RING_TICK_MICROS = 10000;
+static const int64_t KEYFRAME_MICROS = 1000000;
+static const float SEND_ERROR_DEGREES = 0.5f;    // StateReplicator's TARGET_ERROR_DEGREES
+static const float SEND_VELOCITY_ERROR = 0.25f;  // and VELOCITY_ERROR
+
+// One copy of a target packet as the ring received it
+struct Arrival {
+	int64_t arrivalMicros;
+	TargetSample sample;
+};
+
+// The true target: a sweep at 10 to 50 degrees per second, the speed changing over a 7 s cycle
+static float trueVelocity(int64_t micros) {
+	return 30.0f + 20.0f * sinf(2.0f * float(M_PI) * float(micros) / 7e6f);
+}
+
+static double trueAngle(int64_t micros) {
+	double seconds = double(micros) / 1e6;
+	return 30.0 * seconds - 20.0 * 7.0 / (2.0 * M_PI) * (cos(2.0 * M_PI * seconds / 7.0) - 1.0);
+}
+
+static float unwrap(float degrees) {
+	degrees = fmodf(degrees, 360.0f);
+	if (degrees > 180.0f) degrees -= 360.0f;
+	if (degrees < -180.0f) degrees += 360.0f;
+	return degrees;
+}
+
+struct TraceStats {
+	uint32_t packets = 0, copies = 0, delivered = 0, reordered = 0;
+};
+
+/**
+ * The packets the master sends over `seconds`, each copy with its arrival time at the ring, in order of arrival
+ */
+static std::vector<Arrival> makeTrace(double seconds, float loss, uint32_t seed, TraceStats& trace) {
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::exponential_distribution<float> transit(1.0f / 3000.0f);
+	std::vector<Arrival> arrivals;
+	TargetSample sent;
+	bool started = false;
+	int64_t nextKeyframe = 0;
+	int64_t burstEnd = -1;
+	int64_t duration = int64_t(seconds * 1e6);
+	for (int64_t now = 0; now < duration; now += MASTER_TICK_MICROS) {
+		float angle = float(fmod(trueAngle(now), 360.0));
+		float velocity = trueVelocity(now);
+		float predicted = sent.angle + sent.rate * float(now - sent.masterMicros) / 1e6f;
+		bool keyframe = !started || now >= nextKeyframe;
+		if (!keyframe && fabsf(unwrap(angle - predicted)) <= SEND_ERROR_DEGREES
+			&& fabsf(velocity - sent.rate) <= SEND_VELOCITY_ERROR) {
+			continue;
+		}
+		started = true;
+		if (keyframe) {
+			nextKeyframe = now + KEYFRAME_MICROS;
+		}
+		sent.masterMicros = now;
+		sent.angle = angle;
+		sent.rate = velocity;
+		sent.velocity = velocity;
+		trace.packets++;
+
+		// Now and then the speakers drown out everything for a few hundred milliseconds
+		if (now >= burstEnd && unit(random) < 0.004f) {
+			burstEnd = now + int64_t(100000 + unit(random) * 400000);
+		}
+		for (uint8_t copy = 0; copy < STATE_BROADCAST_REPEATS; copy++) {
+			trace.copies++;
+			if (now < burstEnd || unit(random) < loss) {
+				continue;
+			}
+			float delay = 1500.0f + transit(random);
+			if (unit(random) < 0.05f) {
+				delay += 20000.0f + unit(random) * 40000.0f;  // queued behind a retrying unicast
+			}
+			if (now + int64_t(delay) < duration) {
+				arrivals.push_back(Arrival{now + int64_t(delay), sent});
+			}
+		}
+	}
+	std::stable_sort(arrivals.begin(), arrivals.end(),
+					 [](const Arrival& a, const Arrival& b) { return a.arrivalMicros < b.arrivalMicros; });
+	int64_t newest = -1;
+	for (const Arrival& arrival : arrivals) {
+		trace.delivered++;
+		trace.reordered += arrival.sample.masterMicros < newest;
+		newest = std::max(newest, arrival.sample.masterMicros);
+	}
+	return arrivals;
+}
+
+// What one way of playing the targets out did over the run
+struct Playback {
+	std::vector<float> errors;  // |playout - truth| per ring tick, degrees
+	std::vector<float> jerks;   // |second difference of the angle| per ring tick, degrees
+	uint32_t backwards = 0;     // ticks where the angle went back, though the target only moves forward
+	uint32_t stale = 0;
+	uint32_t ticks = 0;
+	float previous = 0.0f;
+	float previousStep = 0.0f;
+
+	void add(int64_t now, float angle) {
+		errors.push_back(fabsf(unwrap(angle - float(fmod(trueAngle(now), 360.0)))));
+		float step = unwrap(angle - previous);
+		if (ticks >= 1) {
+			backwards += step < -1e-3f;
+		}
+		if (ticks >= 2) {
+			jerks.push_back(fabsf(step - previousStep));
+		}
+		previous = angle;
+		previousStep = step;
+		ticks++;
+	}
+};
+
+static float percentile(std::vector<float> values, float p) {
+	if (values.empty()) return NAN;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, size_t(p * float(values.size())))];
+}
+
+int main(int argc, char** argv) {
+	double seconds = 120.0;
+	float loss = 0.1f;
+	uint32_t seed = 22;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--seconds") seconds = atof(argv[i + 1]);
+		else if (option == "--loss") loss = float(atof(argv[i + 1]));
+		else if (option == "--seed") seed = uint32_t(atoi(argv[i + 1]));
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	TraceStats trace;
+	std::vector<Arrival> arrivals = makeTrace(seconds, loss, seed, trace);
+
+	JitterBuffer<8> buffer;
+	Playback buffered, latest;
+	TargetSample newestArrival;
+	bool anyArrived = false;
+	size_t next = 0;
+	int64_t duration = int64_t(seconds * 1e6);
+	for (int64_t now = 0; now <= duration; now += RING_TICK_MICROS) {
+		for (; next < arrivals.size() && arrivals[next].arrivalMicros <= now; next++) {
+			buffer.add(arrivals[next].sample, arrivals[next].arrivalMicros);
+			newestArrival = arrivals[next].sample;
+			anyArrived = true;
+		}
+		TargetPlayout out;
+		if (!buffer.playout(now, out) || !anyArrived) {
+			continue;
+		}
+		buffered.add(now, out.angle);
+		buffered.stale += out.stale;
+		latest.add(now, newestArrival.angle);
+	}
+	JitterStats stats = buffer.stats();
+
+	printf("%.0f s trace: %u packets, %u copies, %u delivered (%.1f%%), %u arriving after a later one\n", seconds,
+		   trace.packets, trace.copies, trace.delivered, 100.0f * trace.delivered / trace.copies, trace.reordered);
+	printf("buffer: received %u, reordered %u, late %u, duplicates %u; jitter %.0f us, delay %.0f us\n\n",
+		   stats.received, stats.reordered, stats.late, stats.duplicates, stats.jitterMicros, stats.delayMicros);
+	printf("%-16s  error p99  max deg  step change p99  max deg  backwards  stale\n", "");
+	const Playback* playbacks[] = {&buffered, &latest};
+	const char* names[] = {"jitter buffer", "latest packet"};
+	for (int i = 0; i < 2; i++) {
+		const Playback& playback = *playbacks[i];
+		printf("%-16s  %9.2f  %7.2f  %15.3f  %7.2f  %9u  %5u\n", names[i], percentile(playback.errors, 0.99f),
+			   percentile(playback.errors, 1.0f), percentile(playback.jerks, 0.99f), percentile(playback.jerks, 1.0f),
+			   playback.backwards, playback.stale);
+	}
+
+	float bufferedError = percentile(buffered.errors, 0.99f), latestError = percentile(latest.errors, 0.99f);
+	float bufferedJerk = percentile(buffered.jerks, 1.0f), latestJerk = percentile(latest.jerks, 1.0f);
+	CHECK(bufferedError <= 2.0f, "the playout was %.2f degrees off at the 99th percentile", bufferedError);
+	// Through a burst the target's 18 degrees/s^2 can take the dead reckoning some degrees off
+	CHECK(percentile(buffered.errors, 1.0f) <= 10.0f, "the playout was up to %.2f degrees off",
+		  percentile(buffered.errors, 1.0f));
+	CHECK(bufferedError <= 0.5f * latestError, "the playout was %.2f degrees off, the latest packet %.2f", bufferedError,
+		  latestError);
+	CHECK(buffered.backwards == 0, "the playout stepped back %u times", buffered.backwards);
+	CHECK(latest.backwards > 0, "reordered packets never set the latest packet's angle back");
+	CHECK(bufferedJerk <= 0.1f * latestJerk && bufferedJerk <= 0.5f, "the playout's step changed by up to %.2f degrees, "
+		  "the latest packet's by %.2f", bufferedJerk, latestJerk);
+	CHECK(buffered.stale == 0, "the playout held its angle %u times", buffered.stale);
+	CHECK(stats.received == trace.delivered, "the buffer got %u of %u packets", stats.received, trace.delivered);
+	CHECK(stats.reordered > 0 && stats.late > 0 && stats.duplicates > 0, "reordered %u, late %u, duplicates %u",
+		  stats.reordered, stats.late, stats.duplicates);
+
+	// A ring whose wheel turns while its target angle holds still: the angle stays put, the velocity passes through
+	JitterBuffer<8> held;
+	float heldError = 0.0f, heldVelocityError = 0.0f;
+	for (int64_t now = 0; now <= 3000000; now += RING_TICK_MICROS) {
+		if (now % 400000 == 0) {
+			TargetSample sample;
+			sample.masterMicros = now;
+			sample.angle = 90.0f;
+			sample.velocity = 24.0f;
+			held.add(sample, now + 2000);
+		}
+		TargetPlayout out;
+		if (held.playout(now, out)) {
+			heldError = fmaxf(heldError, fabsf(unwrap(out.angle - 90.0f)));
+			heldVelocityError = fmaxf(heldVelocityError, fabsf(out.velocity - 24.0f));
+		}
+	}
+	CHECK(heldError <= 1e-3f && heldVelocityError == 0.0f, "a held target played out up to %.3f degrees and %.3f "
+		  "degrees per second off", heldError, heldVelocityError);
+	return checkResult();
+}
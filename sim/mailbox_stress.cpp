@@ -0,0 +1,134 @@
+/**
+ * Stress test of Mailbox (src/mailbox.hpp), built with ThreadSanitizer: one writer publishes as fast as it can, the
+ * way the Wi-Fi task hands received states to loop(), while several readers copy the value out and check it.
+ *
+ * Every value the writer publishes is derived from its serial number, so a copy is consistent exactly when all of its
+ * fields agree with its serial; the value is an odd number of bytes, so the last, partial word of the slots is
+ * covered too. Any torn copy is a failure, as is a reader seeing the serials go backwards, and ThreadSanitizer
+ * reports any data race in the publish or the read and fails the run.
+ *
+ * Options: --seconds S to run for (2), --readers N (3).
+ */
+
+#include <atomic>
+#include <chrono>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+
+#include "mailbox.hpp"
+
+struct Snapshot {
+	uint32_t serial;
+	float angles[16];
+	int64_t sharedMicros;
+	uint16_t shader;
+	uint8_t brightness;
+	uint8_t tail[6];
+} __attribute__((packed));
+
+static_assert(sizeof(Snapshot) % sizeof(uint32_t) != 0, "the last word of the slots should be partial");
+
+static Snapshot snapshot(uint32_t serial) {
+	Snapshot value;
+	value.serial = serial;
+	for (int i = 0; i < 16; i++) {
+		value.angles[i] = float((serial * 7u + uint32_t(i)) % 3600u) * 0.1f;
+	}
+	value.sharedMicros = int64_t(serial) * 20000 + 123;
+	value.shader = uint16_t(serial * 3u);
+	value.brightness = uint8_t(serial);
+	for (int i = 0; i < 6; i++) {
+		value.tail[i] = uint8_t(serial >> (i * 5));
+	}
+	return value;
+}
+
+static bool consistent(const Snapshot& value) {
+	Snapshot expected = snapshot(value.serial);
+	return memcmp(&value, &expected, sizeof(Snapshot)) == 0;
+}
+
+struct ReaderResult {
+	uint64_t reads = 0;
+	uint64_t torn = 0;
+	uint64_t backwards = 0;
+	uint64_t distinct = 0;  // reads that saw a newer value than the one before
+};
+
+int main(int argc, char** argv) {
+	double seconds = 2.0;
+	int readers = 3;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--seconds") seconds = atof(argv[i + 1]);
+		else if (option == "--readers") readers = atoi(argv[i + 1]);
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	static Mailbox<Snapshot> mailbox;
+	Snapshot value;
+	CHECK(!mailbox.read(value) && mailbox.count() == 0, "an empty mailbox returned a value");
+	mailbox.publish(snapshot(1));
+	mailbox.publish(snapshot(2));
+	CHECK(mailbox.read(value) && value.serial == 2 && consistent(value), "the mailbox did not return the latest value");
+	CHECK(mailbox.count() == 2, "%u publishes counted, not 2", unsigned(mailbox.count()));
+
+	std::atomic<bool> running{true};
+	std::vector<ReaderResult> results(readers);
+	std::vector<std::thread> threads;
+	for (int r = 0; r < readers; r++) {
+		threads.emplace_back([&, r] {
+			ReaderResult& result = results[r];
+			Snapshot copy;
+			uint32_t last = 0;
+			while (running.load(std::memory_order_relaxed)) {
+				if (!mailbox.read(copy)) {
+					continue;
+				}
+				result.reads++;
+				result.torn += !consistent(copy);
+				result.backwards += copy.serial < last;
+				result.distinct += copy.serial > last;
+				last = copy.serial;
+			}
+		});
+	}
+
+	uint32_t serial = 2;
+	auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(int64_t(seconds * 1e6));
+	while (std::chrono::steady_clock::now() < end) {
+		for (int i = 0; i < 64; i++) {
+			mailbox.publish(snapshot(++serial));
+		}
+		std::this_thread::yield();  // lets readers on the same core in
+	}
+	running = false;
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	ReaderResult total;
+	for (const ReaderResult& result : results) {
+		total.reads += result.reads;
+		total.torn += result.torn;
+		total.backwards += result.backwards;
+		total.distinct += result.distinct;
+	}
+	printf("values published: %u  reads: %llu by %d readers, %llu of them newer than the last  torn: %llu  "
+		   "backwards: %llu\n", unsigned(mailbox.count()), (unsigned long long)total.reads, readers,
+		   (unsigned long long)total.distinct, (unsigned long long)total.torn, (unsigned long long)total.backwards);
+	CHECK(mailbox.count() == serial, "%u publishes counted, not %u", unsigned(mailbox.count()), unsigned(serial));
+	CHECK(total.torn == 0, "%llu torn copies", (unsigned long long)total.torn);
+	CHECK(total.backwards == 0, "%llu copies older than one read before", (unsigned long long)total.backwards);
+	for (int r = 0; r < readers; r++) {
+		CHECK(results[r].distinct > 1, "reader %d never saw the value change", r);
+	}
+	return checkResult();
+}
@@ -0,0 +1,72 @@
+/**
+ * Checks the scalar int8 kernel of NeuralOnset (neuralonset.hpp) with its default weights against the half-wave
+ * rectified low-band flux they encode, computed directly from the same GEQ frames, and times an inference in the
+ * firmware's configuration next to the entropy change heuristic it stands in for. beateval --grid
+ * useNeuralOnset=0,1 scores the two as beat detectors.
+ *
+ * Options: --frames N (200000), --rounds R of the benchmark (7).
+ */
+
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "check.hpp"
+
+#include "fft.h"
+#include "neuralonset.hpp"
+
+static const uint8_t FRAMES = 4;
+static const uint8_t HIDDEN = 8;
+
+int main(int argc, char** argv) {
+	uint32_t frames = 200000;
+	int rounds = 7;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--frames") frames = uint32_t(atoi(argv[i + 1]));
+		else if (option == "--rounds") rounds = atoi(argv[i + 1]);
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	// GEQ frames from silence to saturation, with jumps in both directions
+	std::mt19937 random(12);
+	std::uniform_int_distribution<int> level(0, 255);
+	std::vector<uint8_t> geq(size_t(frames) * NUM_GEQ_CHANNELS);
+	for (uint8_t& channel : geq) channel = uint8_t(level(random));
+
+	NeuralOnset<FRAMES, NUM_GEQ_CHANNELS, HIDDEN> model;
+	uint32_t differing = 0;
+	for (uint32_t f = 0; f < frames; f++) {
+		float strength = model.update(&geq[size_t(f) * NUM_GEQ_CHANNELS]);
+		int32_t flux = 0;
+		for (uint8_t c = 0; f > 0 && c < HIDDEN; c++) {
+			int32_t rise = (geq[size_t(f) * NUM_GEQ_CHANNELS + c] >> 1) - (geq[size_t(f - 1) * NUM_GEQ_CHANNELS + c] >> 1);
+			flux += rise > 0 ? rise : 0;
+		}
+		if (f == 0) {
+			flux = 0;
+			for (uint8_t c = 0; c < HIDDEN; c++) flux += geq[c] >> 1;  // the history starts out silent
+		}
+		differing += strength != 2.0f * float(flux);
+	}
+
+	double nanos = nanosecondsPerCall([&](uint32_t i) {
+		benchSink = model.update(&geq[size_t(i) * NUM_GEQ_CHANNELS]);
+	}, frames, rounds);
+	float channels[NUM_GEQ_CHANNELS], previous[NUM_GEQ_CHANNELS] = {};
+	double entropyNanos = nanosecondsPerCall([&](uint32_t i) {
+		for (uint8_t c = 0; c < NUM_GEQ_CHANNELS; c++) channels[c] = geq[size_t(i) * NUM_GEQ_CHANNELS + c];
+		benchSink = calculateEntropyChangeWLED(channels, previous);
+	}, frames, rounds);
+	printf("%u frames: %u differ from the low-band flux; %.0f ns per inference (%u MACs), %.0f ns for the entropy "
+		   "change heuristic\n", frames, differing, nanos, unsigned(HIDDEN * FRAMES * NUM_GEQ_CHANNELS + HIDDEN),
+		   entropyNanos);
+	CHECK(differing == 0, "%u of %u inferences differ from the flux the default weights encode", differing, frames);
+	return checkResult();
+}
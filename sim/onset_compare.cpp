@@ -0,0 +1,105 @@
+/**
+ * Replays a recording through the master's audio pipeline (replay.hpp) and compares the kicks found by the
+ * low-latency biquad onset detector in the sampling task with the beats of the spectral heuristic: how many each
+ * finds, how long after each onset the heuristic reports a beat, and, given beat annotations, how well each scores
+ * against them and how long after the annotated beat each reports it.
+ *
+ * Without --wav it replays a synthetic drum loop, written out and read back as a WAV file so the WAV path is covered,
+ * and checks that the onset detector finds the kicks and reports them within a few milliseconds. The spectral
+ * heuristic is only reported: once it has the tempo, the bonus from the previous beat can carry it over the threshold
+ * just before the kick, so on a steady loop it is not slower in the way its 32 ms window suggests.
+ *
+ * Options: --wav FILE, --beats FILE of annotations (seconds, one per line), --tolerance-ms for matching (70),
+ * --late-ms after a beat that a detection still counts for the latencies (100), --skip S seconds of warm-up left out
+ * of the scores (4), --seconds S of synthetic audio (30).
+ */
+
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "audiofile.hpp"
+#include "check.hpp"
+#include "replay.hpp"
+#include "scoring.hpp"
+
+static double median(std::vector<double> values) {
+	if (values.empty()) return NAN;
+	std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+	return values[values.size() / 2];
+}
+
+static void printScore(const char* name, const EventScore& score) {
+	printf("%-22s %4zu detections, %4zu of %zu annotated beats: precision %.3f recall %.3f F %.3f, mean offset %+.1f ms\n",
+		   name, score.detections, score.matched, score.annotations, score.precision(), score.recall(), score.fMeasure(),
+		   score.meanOffset * 1000.0);
+}
+
+int main(int argc, char** argv) {
+	std::string wavPath, beatsPath;
+	double tolerance = 0.070;
+	double late = 0.100;
+	const double early = 0.010;  // onset timestamps are back-dated to the sample, so they may precede an annotation
+	double skip = 4.0;
+	DrumPattern pattern;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--wav") wavPath = argv[i + 1];
+		else if (option == "--beats") beatsPath = argv[i + 1];
+		else if (option == "--tolerance-ms") tolerance = atof(argv[i + 1]) / 1000.0;
+		else if (option == "--late-ms") late = atof(argv[i + 1]) / 1000.0;
+		else if (option == "--skip") skip = atof(argv[i + 1]);
+		else if (option == "--seconds") pattern.seconds = atof(argv[i + 1]);
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	Serial.muted = true;
+
+	const bool synthetic = wavPath.empty();
+	Recording recording;
+	std::string error;
+	if (synthetic) {
+		Recording drums = synthesizeDrums(pattern);
+		wavPath = "/tmp/onset_compare_" + std::to_string(getpid()) + ".wav";
+		CHECK(writeWav(wavPath, drums), "can't write %s", wavPath.c_str());
+		CHECK(readWav(wavPath, recording, error), "%s", error.c_str());
+		unlink(wavPath.c_str());
+		CHECK(recording.pcm == drums.pcm, "the WAV file did not read back as it was written");
+		recording.beats = drums.beats;
+	} else if (!readWav(wavPath, recording, error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+	if (!beatsPath.empty() && !readAnnotations(beatsPath, recording.beats)) {
+		fprintf(stderr, "can't read %s\n", beatsPath.c_str());
+		return 1;
+	}
+
+	ReplayResult result = replayRecording(recording, getBeatDetectorParams());
+	CHECK(result.complete, "the replay did not reach the end of the recording");
+	double seconds = double(recording.pcm.size()) / SAMPLING_FREQ;
+	printf("%.1f s of audio, %zu analysis frames, %.0f ms of CPU per second of audio\n",
+		   seconds, result.frames.size(), result.cpuSeconds * 1000.0 / seconds);
+
+	std::vector<double> lead = eventLatencies(result.beats, result.onsets, early, late);
+	printf("onset detector %zu onsets, spectral heuristic %zu beats; %zu onsets followed by a beat, after median %.1f ms\n",
+		   result.onsets.size(), result.beats.size(), lead.size(), median(lead) * 1000.0);
+
+	if (!recording.beats.empty()) {
+		EventScore onsetScore = scoreEvents(result.onsets, recording.beats, tolerance, skip);
+		EventScore beatScore = scoreEvents(result.beats, recording.beats, tolerance, skip);
+		printScore("onset detector", onsetScore);
+		printScore("spectral heuristic", beatScore);
+		std::vector<double> onsetLatency = eventLatencies(result.onsets, recording.beats, early, late);
+		std::vector<double> beatLatency = eventLatencies(result.beats, recording.beats, early, late);
+		printf("after an annotated beat: first onset after median %.1f ms (%zu beats), first spectral beat after median %.1f ms (%zu beats)\n",
+			   median(onsetLatency) * 1000.0, onsetLatency.size(), median(beatLatency) * 1000.0, beatLatency.size());
+		if (synthetic) {
+			CHECK(onsetScore.fMeasure() >= 0.9, "the onset detector missed kicks of a plain drum loop: F %.3f", onsetScore.fMeasure());
+			CHECK(median(onsetLatency) < 0.010, "the onset detector reported kicks %.1f ms late", median(onsetLatency) * 1000.0);
+		}
+	}
+	return checkResult();
+}
@@ -0,0 +1,118 @@
+/**
+ * The master's audio pipeline on a host, in real time: fft.cpp's sampling task and beatdetection.cpp's analysis task
+ * run as threads (host/freertos/task.h), fed by a synthetic drum loop that the host I2S hands out one block at a
+ * time as the microphone would, while the main thread plays loop() and picks up the analysis frames.
+ *
+ * Reports how long a frame takes from the I2S read that completed its hop to being published in the mailbox, and
+ * from being published to being picked up by loop(), which runs at its own rate and only sees the latest frame. The
+ * frames loop() skips still count: every beat shows up in the next frame it reads, and so does the peak intensity.
+ *
+ * Options: --seconds S of audio (4), --loop-ms between loop() iterations (20, the master's 50 per second).
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audiofile.hpp"
+#include "check.hpp"
+#include "I2S.h"
+
+#include "beatdetection.h"
+#include "fft.h"
+
+static double percentile(std::vector<double> values, double p) {
+	if (values.empty()) return NAN;
+	size_t index = std::min(values.size() - 1, size_t(p * values.size()));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+int main(int argc, char** argv) {
+	DrumPattern pattern;
+	pattern.seconds = 4.0;
+	int loopMillis = 20;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--seconds") pattern.seconds = atof(argv[i + 1]);
+		else if (option == "--loop-ms") loopMillis = atoi(argv[i + 1]);
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	Serial.muted = true;
+	Recording recording = synthesizeDrums(pattern);
+
+	// The I2S driver returns each block once the microphone has recorded all of it
+	size_t blockSamples = 0;
+	size_t blocks = 0;
+	std::vector<uint32_t> deliveredMicros(recording.pcm.size());
+	auto start = std::chrono::steady_clock::now();
+	hostSetAudioSource([&](int16_t* pcm, size_t samples) {
+		if ((blocks + 1) * samples > recording.pcm.size()) {
+			return false;
+		}
+		blockSamples = samples;
+		std::this_thread::sleep_until(start + std::chrono::microseconds(int64_t((blocks + 1) * samples * 1000000 / SAMPLING_FREQ)));
+		memcpy(pcm, &recording.pcm[blocks * samples], samples * sizeof(int16_t));
+		deliveredMicros[blocks] = micros();
+		blocks++;
+		return true;
+	});
+
+	setupAsyncSampling();
+	setupBeatDetection();
+
+	std::vector<double> analysisLatency, handoff;
+	uint32_t lastSequence = 0;
+	uint32_t framesSeen = 0;
+	uint32_t beatsLatched = 0, beatsInFrame = 0, beatsCounted = 0;
+	bool ordered = true, peaksHeld = true;
+	auto next = std::chrono::steady_clock::now();
+	auto end = start + std::chrono::microseconds(int64_t(pattern.seconds * 1e6));
+	while (next < end) {
+		next += std::chrono::milliseconds(loopMillis);
+		std::this_thread::sleep_until(next);
+
+		AnalysisFrame frame;
+		if (!readAnalysisFrame(frame) || frame.sequence == lastSequence) {
+			continue;
+		}
+		uint32_t now = micros();
+		ordered &= frame.sequence > lastSequence;
+		lastSequence = frame.sequence;
+		framesSeen++;
+		beatsLatched += frame.beatSinceRead;
+		beatsInFrame += frame.isBeat;
+		beatsCounted = frame.elapsedBeats;
+		peaksHeld &= frame.peakIntensity >= frame.intensity && (!frame.isBeat || frame.beatSinceRead);
+		handoff.push_back(double(now - frame.publishedMicros));
+		// Frame n is the window that ends with block SAMPLES / block + (n - 1) hops
+		size_t lastBlock = SAMPLES / blockSamples + (frame.sequence - 1) * (HOP_SAMPLES / blockSamples) - 1;
+		analysisLatency.push_back(double(frame.publishedMicros - deliveredMicros[lastBlock]));
+	}
+	hostStopTasks();
+
+	size_t windows = blocks >= SAMPLES / blockSamples ? (blocks - SAMPLES / blockSamples) / (HOP_SAMPLES / blockSamples) + 1 : 0;
+	printf("%zu blocks recorded, %zu analysis windows, last frame analyzed %u, %u picked up by loop() every %d ms\n",
+		   blocks, windows, lastSequence, framesSeen, loopMillis);
+	printf("blocks dropped: %u  overwritten: %u\n", unsigned(droppedAudioBlocks()), unsigned(overwrittenAudioBlocks()));
+	printf("hop recorded to frame published: median %.0f us, p99 %.0f us, max %.0f us\n",
+		   percentile(analysisLatency, 0.5), percentile(analysisLatency, 0.99), percentile(analysisLatency, 1.0));
+	printf("frame published to loop():       median %.0f us, p99 %.0f us, max %.0f us\n",
+		   percentile(handoff, 0.5), percentile(handoff, 0.99), percentile(handoff, 1.0));
+	printf("beats: %u detected, %u latched in the frames loop() read, %u in the frames themselves\n", beatsCounted,
+		   beatsLatched, beatsInFrame);
+	CHECK(ordered, "loop() saw analysis frames out of order");
+	CHECK(peaksHeld, "a frame's peak intensity or beat flag left out the frame itself");
+	// A read racing with a publish can report a beat twice, but never lose one
+	CHECK(beatsLatched >= beatsCounted && beatsLatched <= beatsCounted + 2, "%u beats detected, %u latched",
+		  beatsCounted, beatsLatched);
+	CHECK(framesSeen > 0 && lastSequence + 4 >= windows, "the analysis fell behind: %u of %zu windows", lastSequence, windows);
+	CHECK(percentile(handoff, 0.5) <= loopMillis * 1000.0, "frames waited longer than a loop() iteration for pickup");
+	return checkResult();
+}
@@ -0,0 +1,164 @@
+/**
+ * Checks SlidingQuantile (quantile.hpp), which keeps the beat threshold, against std::nth_element over the same
+ * sliding window, and times it against the copy + nth_element that computePercentile() used to do.
+ *
+ * The streams are random values spread over the quantile's range, random values with zeros and values beyond both
+ * ends of it, and the heuristics the beat detector actually produced for a replayed drum loop (replay.hpp). Every
+ * frame the window slides by one value and the 50th percentile and the beat threshold's percentile are compared; the
+ * error has to stay within one bin, i.e. (maxValue / minValue)^(1 / BINS), or the result has to be the end of the
+ * range the exact value lies beyond.
+ *
+ * Options: --frames N per random stream (20000), --window W frames (HEURISTIC_BUFFER_SIZE), --rounds R (7).
+ */
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include "audiofile.hpp"
+#include "bench.hpp"
+#include "check.hpp"
+#include "replay.hpp"
+
+#include "quantile.hpp"
+
+// The beat detector's quantile and its threshold percentile at the default fudge factor
+#define QUANTILE_BINS 512
+#define QUANTILE_MIN 1e-3f
+#define QUANTILE_MAX 1e3f
+static const float THRESHOLD_PERCENT = (1.0f - 1.05f * (128.0f / 60.0f) / ANALYSIS_FRAMES_PER_SECOND) * 100.0f;
+
+// The beat detector's heuristics buffer, after a replay
+extern float heuristicsBuffer[HEURISTIC_BUFFER_SIZE];
+extern uint16_t heuristicsBufferIndex;
+extern uint32_t analysisFrame;
+
+struct StreamResult {
+	double worstError = 0.0;  // relative, for exact values inside the range
+	uint32_t outOfRange = 0;  // queries whose exact value was outside the range
+	uint32_t failures = 0;
+	uint32_t queries = 0;
+};
+
+static float exactPercentile(const std::vector<float>& window, float percent, std::vector<float>& scratch) {
+	scratch = window;
+	int rank = int(ceilf(percent / 100.0f * float(window.size()))) - 1;
+	rank = std::max(rank, 0);
+	std::nth_element(scratch.begin(), scratch.begin() + rank, scratch.end());
+	return scratch[rank];
+}
+
+static StreamResult checkStream(const std::vector<float>& stream, uint32_t windowFrames) {
+	const double tolerance = pow(double(QUANTILE_MAX) / QUANTILE_MIN, 1.0 / QUANTILE_BINS) - 1.0 + 1e-4;
+	SlidingQuantile<QUANTILE_BINS> quantile(QUANTILE_MIN, QUANTILE_MAX);
+	std::vector<float> window, scratch;
+	StreamResult result;
+	for (size_t i = 0; i < stream.size(); i++) {
+		if (window.size() == windowFrames) {
+			quantile.remove(window.front());
+			window.erase(window.begin());
+		}
+		quantile.add(stream[i]);
+		window.push_back(stream[i]);
+		for (float percent : {50.0f, THRESHOLD_PERCENT}) {
+			float exact = exactPercentile(window, percent, scratch);
+			float estimate = quantile.percentile(percent);
+			result.queries++;
+			if (!(exact >= QUANTILE_MIN)) {
+				result.outOfRange++;
+				result.failures += estimate != QUANTILE_MIN;
+			} else if (exact > QUANTILE_MAX) {
+				result.outOfRange++;
+				result.failures += fabsf(estimate / QUANTILE_MAX - 1.0f) > 1e-4f;
+			} else {
+				double error = fabs(double(estimate) / exact - 1.0);
+				result.worstError = std::max(result.worstError, error);
+				result.failures += error > tolerance;
+			}
+		}
+	}
+	CHECK(quantile.size() == window.size(), "the quantile holds %u values, the window %zu", quantile.size(), window.size());
+	return result;
+}
+
+static void report(const char* name, const StreamResult& result) {
+	printf("%-34s %6u queries, worst error %.2f%%, %u beyond the range, %u failed\n",
+		   name, result.queries, result.worstError * 100.0, result.outOfRange, result.failures);
+	CHECK(result.failures == 0, "%s: %u quantiles off by more than a bin", name, result.failures);
+}
+
+int main(int argc, char** argv) {
+	uint32_t frames = 20000;
+	uint32_t windowFrames = HEURISTIC_BUFFER_SIZE;
+	int rounds = 7;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--frames") frames = uint32_t(atoi(argv[i + 1]));
+		else if (option == "--window") windowFrames = uint32_t(atoi(argv[i + 1]));
+		else if (option == "--rounds") rounds = atoi(argv[i + 1]);
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	Serial.muted = true;
+	std::mt19937 random(8);
+
+	std::vector<float> spread(frames);
+	std::uniform_real_distribution<float> logValue(-2.5f, 2.5f);
+	for (float& value : spread) value = powf(10.0f, logValue(random));
+	report("log-uniform over the range", checkStream(spread, windowFrames));
+
+	std::vector<float> edges(frames);
+	std::exponential_distribution<float> exponential(1.0f);
+	std::uniform_int_distribution<int> kind(0, 9);
+	for (float& value : edges) {
+		int k = kind(random);
+		value = k == 0 ? 0.0f : k == 1 ? 5e3f * exponential(random) : k == 2 ? 1e-4f : exponential(random);
+	}
+	report("exponential with zeros and outliers", checkStream(edges, windowFrames));
+
+	// What the beat detector feeds its quantile, one value per analysis frame
+	DrumPattern pattern;
+	pattern.seconds = 32.0;
+	ReplayResult replay = replayRecording(synthesizeDrums(pattern), getBeatDetectorParams());
+	std::vector<float> recorded;
+	uint32_t recordedFrames = std::min<uint32_t>(analysisFrame, HEURISTIC_BUFFER_SIZE);
+	for (uint32_t i = recordedFrames; i > 0; i--) {
+		recorded.push_back(heuristicsBuffer[(heuristicsBufferIndex + HEURISTIC_BUFFER_SIZE - i) % HEURISTIC_BUFFER_SIZE]);
+	}
+	CHECK(replay.complete && recorded.size() > 3000, "the replay produced %zu heuristics", recorded.size());
+	report("heuristics of a replayed drum loop", checkStream(recorded, std::min<uint32_t>(windowFrames, 1000)));
+
+	// Per frame: slide the window by one and look up the threshold, against copying the window and selecting from it
+	SlidingQuantile<QUANTILE_BINS> quantile(QUANTILE_MIN, QUANTILE_MAX);
+	std::vector<float> ring(windowFrames), copy(windowFrames);
+	for (uint32_t i = 0; i < windowFrames; i++) {
+		ring[i] = spread[i % spread.size()];
+		quantile.add(ring[i]);
+	}
+	uint32_t slot = 0;
+	double slidingNanos = nanosecondsPerCall([&](uint32_t i) {
+		float value = spread[i % spread.size()];
+		quantile.remove(ring[slot]);
+		quantile.add(value);
+		ring[slot] = value;
+		slot = (slot + 1) % windowFrames;
+		benchSink = quantile.percentile(THRESHOLD_PERCENT);
+	}, frames, rounds);
+	double selectNanos = nanosecondsPerCall([&](uint32_t i) {
+		ring[i % windowFrames] = spread[i % spread.size()];
+		memcpy(copy.data(), ring.data(), windowFrames * sizeof(float));
+		int rank = int(ceilf(THRESHOLD_PERCENT / 100.0f * windowFrames)) - 1;
+		std::nth_element(copy.begin(), copy.begin() + rank, copy.end());
+		benchSink = copy[rank];
+	}, std::max<uint32_t>(frames / 30, 1), rounds);
+	printf("window of %u: SlidingQuantile %.0f ns every frame; copy + nth_element %.0f ns (%.0f ns per frame every 30 frames), "
+		   "and %zu bytes for the copy\n",
+		   windowFrames, slidingNanos, selectNanos, selectNanos / 30.0, windowFrames * sizeof(float));
+	return checkResult();
+}
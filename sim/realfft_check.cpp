@@ -0,0 +1,189 @@
+/**
+ * Equivalence test and benchmark of RealFFT (src/realfft.hpp) against the complex FFT it replaced.
+ *
+ * ArduinoFFT itself is an Arduino library and does not build here, so complexMagnitude() below is a float
+ * transcription of what doFFT() used to run through it: dcRemoval(), windowing(Flat_top), compute(Forward) on
+ * SAMPLES complex points with a zeroed imaginary part, and complexToMagnitude(). compute() is ArduinoFFT's radix-2
+ * transform with the twiddles advanced by recurrence. Both are also held against a direct DFT in double precision.
+ *
+ * Options: --frames N per benchmark round (20000).
+ */
+
+#include <math.h>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "check.hpp"
+
+#include "realfft.hpp"
+
+static const uint16_t N = 512;  // SAMPLES
+static const float RATE = 16000.0f;
+
+// The ArduinoFFT sequence, on float
+static void complexMagnitude(const int16_t* samples, float* magnitudes) {
+	static float re[N], im[N];
+	float mean = 0.0f;
+	for (uint16_t i = 0; i < N; i++) {
+		mean += samples[i];
+	}
+	mean /= N;
+	for (uint16_t i = 0; i < N; i++) {
+		re[i] = samples[i] - mean;
+		im[i] = 0.0f;
+	}
+	for (uint16_t i = 0; i < N / 2; i++) {
+		float ratio = float(i) / float(N - 1);
+		float weight = 0.2810639f - 0.5208972f * cosf(2.0f * float(M_PI) * ratio) + 0.1980399f * cosf(4.0f * float(M_PI) * ratio);
+		re[i] *= weight;
+		re[N - 1 - i] *= weight;
+	}
+
+	for (uint16_t i = 0, j = 0; i < N - 1; i++) {
+		if (i < j) {
+			float t = re[i];
+			re[i] = re[j];
+			re[j] = t;
+		}
+		uint16_t k = N >> 1;
+		while (k <= j) {
+			j -= k;
+			k >>= 1;
+		}
+		j += k;
+	}
+	float c1 = -1.0f, c2 = 0.0f;
+	for (uint16_t l2 = 1; l2 < N;) {
+		uint16_t l1 = l2;
+		l2 <<= 1;
+		float u1 = 1.0f, u2 = 0.0f;
+		for (uint16_t j = 0; j < l1; j++) {
+			for (uint16_t i = j; i < N; i += l2) {
+				uint16_t i1 = i + l1;
+				float t1 = u1 * re[i1] - u2 * im[i1];
+				float t2 = u1 * im[i1] + u2 * re[i1];
+				re[i1] = re[i] - t1;
+				im[i1] = im[i] - t2;
+				re[i] += t1;
+				im[i] += t2;
+			}
+			float z = u1 * c1 - u2 * c2;
+			u2 = u1 * c2 + u2 * c1;
+			u1 = z;
+		}
+		c2 = -sqrtf((1.0f - c1) / 2.0f);
+		c1 = sqrtf((1.0f + c1) / 2.0f);
+	}
+	for (uint16_t i = 0; i < N / 2; i++) {
+		magnitudes[i] = sqrtf(re[i] * re[i] + im[i] * im[i]);
+	}
+}
+
+// The same spectrum in double precision, by the definition of the DFT
+static void exactMagnitude(const int16_t* samples, double* magnitudes) {
+	double mean = 0.0;
+	for (uint16_t i = 0; i < N; i++) {
+		mean += samples[i];
+	}
+	mean /= N;
+	std::vector<double> x(N);
+	for (uint16_t i = 0; i < N; i++) {
+		double ratio = double(i < N / 2 ? i : N - 1 - i) / double(N - 1);
+		double weight = 0.2810639 - 0.5208972 * cos(2.0 * M_PI * ratio) + 0.1980399 * cos(4.0 * M_PI * ratio);
+		x[i] = (samples[i] - mean) * weight;
+	}
+	for (uint16_t k = 0; k < N / 2; k++) {
+		double re = 0.0, im = 0.0;
+		for (uint16_t n = 0; n < N; n++) {
+			double angle = 2.0 * M_PI * double((uint32_t(k) * n) % N) / N;
+			re += x[n] * cos(angle);
+			im -= x[n] * sin(angle);
+		}
+		magnitudes[k] = sqrt(re * re + im * im);
+	}
+}
+
+struct Signal {
+	const char* name;
+	std::vector<int16_t> samples;
+};
+
+static std::vector<Signal> testSignals() {
+	std::vector<Signal> signals;
+	std::mt19937 random(7);
+	auto make = [&](const char* name, auto sample) {
+		Signal signal{name, std::vector<int16_t>(N)};
+		for (uint16_t i = 0; i < N; i++) {
+			double value = sample(i);
+			signal.samples[i] = int16_t(fmax(-32768.0, fmin(32767.0, round(value))));
+		}
+		signals.push_back(signal);
+	};
+	make("sine on bin 10", [](int i) { return 8000.0 * sin(2.0 * M_PI * 10 * i / N); });
+	make("90 Hz + 1 kHz", [](int i) { return 6000.0 * sin(2.0 * M_PI * 90.0 * i / RATE) + 2000.0 * sin(2.0 * M_PI * 1000.0 * i / RATE + 0.3); });
+	make("DC offset", [](int i) { return 12000.0 + 3000.0 * sin(2.0 * M_PI * 440.0 * i / RATE); });
+	std::uniform_int_distribution<int> noise(-32768, 32767);
+	make("full-scale noise", [&](int) { return double(noise(random)); });
+	make("full-scale square", [](int i) { return (i / 20) % 2 ? 32767.0 : -32768.0; });
+	make("quiet decaying kick", [](int i) { return 40.0 * exp(-i / 200.0) * sin(2.0 * M_PI * 60.0 * i / RATE); });
+	return signals;
+}
+
+int main(int argc, char** argv) {
+	uint32_t frames = 20000;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--frames") frames = uint32_t(atoi(argv[i + 1]));
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	// Errors relative to the spectrum's peak, and per bin for bins above 1% of it
+	printf("%-20s  %-26s  %-26s\n", "", "RealFFT vs exact", "ArduinoFFT vs exact");
+	printf("%-20s  %12s %13s  %12s %13s\n", "signal", "of peak", "worst bin", "of peak", "worst bin");
+	static RealFFT<N> fft;
+	for (const Signal& signal : testSignals()) {
+		float real[N / 2], complex[N / 2];
+		double exact[N / 2];
+		fft.magnitude(signal.samples.data(), real);
+		complexMagnitude(signal.samples.data(), complex);
+		exactMagnitude(signal.samples.data(), exact);
+
+		double peak = 0.0;
+		for (uint16_t k = 0; k < N / 2; k++) peak = fmax(peak, exact[k]);
+		double realPeakError = 0.0, complexPeakError = 0.0, realBinError = 0.0, complexBinError = 0.0, realVsComplex = 0.0;
+		for (uint16_t k = 0; k < N / 2; k++) {
+			realPeakError = fmax(realPeakError, fabs(real[k] - exact[k]) / peak);
+			complexPeakError = fmax(complexPeakError, fabs(complex[k] - exact[k]) / peak);
+			realVsComplex = fmax(realVsComplex, fabs(real[k] - complex[k]) / peak);
+			if (exact[k] > 0.01 * peak) {
+				realBinError = fmax(realBinError, fabs(real[k] - exact[k]) / exact[k]);
+				complexBinError = fmax(complexBinError, fabs(complex[k] - exact[k]) / exact[k]);
+			}
+		}
+		printf("%-20s  %12.2e %13.2e  %12.2e %13.2e\n", signal.name, realPeakError, realBinError, complexPeakError, complexBinError);
+		CHECK(realPeakError < 1e-5, "%s: RealFFT is off by %.2e of the peak", signal.name, realPeakError);
+		CHECK(realBinError < 1e-4, "%s: a RealFFT bin is off by %.2e", signal.name, realBinError);
+		CHECK(realVsComplex < 2e-5, "%s: RealFFT and the complex FFT differ by %.2e of the peak", signal.name, realVsComplex);
+	}
+
+	// Both engines on the same stream of windows
+	std::vector<Signal> signals = testSignals();
+	float magnitudes[N / 2];
+	double realNanos = nanosecondsPerCall([&](uint32_t i) {
+		fft.magnitude(signals[i % signals.size()].samples.data(), magnitudes);
+		benchSink = magnitudes[i % (N / 2)];
+	}, frames);
+	double complexNanos = nanosecondsPerCall([&](uint32_t i) {
+		complexMagnitude(signals[i % signals.size()].samples.data(), magnitudes);
+		benchSink = magnitudes[i % (N / 2)];
+	}, frames);
+	printf("\n%u-point magnitude spectrum: RealFFT %.0f ns, ArduinoFFT sequence %.0f ns per frame (%.1fx)\n",
+		   N, realNanos, complexNanos, complexNanos / realNanos);
+	return checkResult();
+}
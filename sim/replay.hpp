@@ -0,0 +1,122 @@
+#ifndef SIM_REPLAY_HPP
+#define SIM_REPLAY_HPP
+
+/**
+ * Offline replay of a recording through the master's audio pipeline: fft.cpp's sampling task and beatdetection.cpp's
+ * analysis task run as they do on the device, but in lockstep with a virtual clock instead of in real time.
+ *
+ * The host I2S hands out one block per read and sets millis()/micros() to the time the microphone would have finished
+ * recording it. Before it hands out the next block it waits until the analysis task has published a frame for every
+ * hop recorded so far, so every frame is analyzed at the virtual time its hop ends, however fast the host is, and
+ * the run is deterministic.
+ *
+ * The pipeline keeps its state in globals, so a process can replay only one recording; see isolate.hpp for more.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <pthread.h>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#include "audiofile.hpp"
+#include "I2S.h"
+
+#include "beatdetection.h"
+#include "fft.h"
+
+struct ReplayResult {
+	std::vector<double> beats;          // seconds into the recording of the frames the heuristic called beats
+	std::vector<double> onsets;         // seconds into the recording of the low-latency detector's onsets
+	std::vector<AnalysisFrame> frames;  // every analysis frame, with its timestamps in virtual millis()
+	double cpuSeconds = 0.0;            // CPU time of the sampling and analysis tasks
+	bool complete = false;              // false if the analysis stopped keeping up and the replay gave up
+};
+
+// Virtual millis() at the start of the recording; not zero, since the pipeline uses a zero timestamp for "never"
+#define REPLAY_START_MICROS 1000000
+
+static inline double threadCpuSeconds(clockid_t clock) {
+	timespec now;
+	clock_gettime(clock, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/**
+ * Replays `recording` through the pipeline with the given tunables and collects what it detected
+ */
+inline ReplayResult replayRecording(const Recording& recording, const BeatDetectorParams& params) {
+	ReplayResult result;
+	size_t blocks = 0;
+	uint32_t framesSeen = 0;
+	uint32_t onsetsSeen = 0;
+	double callbackCpu = 0.0;
+	std::atomic<clockid_t> analysisClock{CLOCK_THREAD_CPUTIME_ID};
+	std::atomic<bool> finished{false};
+
+	// Waits for the analysis of every hop recorded so far, and collects the new frame and onset
+	auto catchUp = [&](size_t blockSamples) {
+		uint32_t windowBlocks = SAMPLES / blockSamples;
+		uint32_t hopBlocks = HOP_SAMPLES / blockSamples;
+		uint32_t expected = blocks >= windowBlocks ? (blocks - windowBlocks) / hopBlocks + 1 : 0;
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+		AnalysisFrame frame;
+		while (framesSeen < expected) {
+			if (!readAnalysisFrame(frame) || frame.sequence < expected) {
+				if (std::chrono::steady_clock::now() > deadline) {
+					return false;
+				}
+				std::this_thread::sleep_for(std::chrono::microseconds(20));
+				continue;
+			}
+			framesSeen = frame.sequence;
+			result.frames.push_back(frame);
+			if (frame.isBeat) {
+				result.beats.push_back((double(frame.lastBeatTimestamp) - REPLAY_START_MICROS / 1000) / 1000.0);
+			}
+		}
+		if (getOnsetCount() != onsetsSeen) {
+			onsetsSeen = getOnsetCount();
+			result.onsets.push_back((double(getLastOnsetTimestamp()) - REPLAY_START_MICROS / 1000) / 1000.0);
+		}
+		return true;
+	};
+
+	hostSetMicros(REPLAY_START_MICROS);
+	hostSetAudioSource([&](int16_t* pcm, size_t samples) {
+		double entered = threadCpuSeconds(CLOCK_THREAD_CPUTIME_ID);
+		bool caughtUp = catchUp(samples);
+		bool more = caughtUp && (blocks + 1) * samples <= recording.pcm.size();
+		if (more) {
+			memcpy(pcm, &recording.pcm[blocks * samples], samples * sizeof(int16_t));
+			blocks++;
+			hostSetMicros(REPLAY_START_MICROS + int64_t(blocks * samples) * 1000000 / SAMPLING_FREQ);
+		} else {
+			result.complete = caughtUp;
+			result.cpuSeconds = entered - callbackCpu + threadCpuSeconds(analysisClock);  // the sampling task, less this callback
+			finished = true;
+		}
+		callbackCpu += threadCpuSeconds(CLOCK_THREAD_CPUTIME_ID) - entered;
+		return more;
+	});
+
+	setBeatDetectorParams(params);
+	setupAsyncSampling();
+	setupBeatDetection();
+	{
+		std::lock_guard<std::mutex> guard(hostTasks().lock);
+		clockid_t clock;
+		pthread_getcpuclockid(hostTasks().tasks.back()->thread.native_handle(), &clock);
+		analysisClock = clock;
+	}
+	// The sampling task ends at the end of the recording; the analysis task runs until it is stopped
+	while (!finished) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	hostStopTasks();
+	hostSetMicros(-1);
+	return result;
+}
+
+#endif // SIM_REPLAY_HPP
@@ -0,0 +1,77 @@
+#ifndef SIM_SCORING_HPP
+#define SIM_SCORING_HPP
+
+// Scoring detected events (beats or onsets, in seconds) against annotations, as in the MIREX beat and onset tasks
+
+#include <algorithm>
+#include <stddef.h>
+#include <vector>
+
+struct EventScore {
+	size_t matched = 0;
+	size_t detections = 0;
+	size_t annotations = 0;
+	double meanOffset = 0.0;  // mean of detection - annotation over the matched pairs, in seconds
+
+	double precision() const {
+		return detections > 0 ? double(matched) / detections : 0.0;
+	}
+
+	double recall() const {
+		return annotations > 0 ? double(matched) / annotations : 0.0;
+	}
+
+	double fMeasure() const {
+		return matched > 0 ? 2.0 * matched / double(detections + annotations) : 0.0;
+	}
+};
+
+/**
+ * Matches each annotation to at most one detection within `tolerance` seconds of it, in time order, and counts
+ * the matches. Both lists must be sorted. Annotations before `skip` seconds, and detections more than `tolerance`
+ * before it, are left out, so the detector's warm-up is not scored.
+ */
+inline EventScore scoreEvents(const std::vector<double>& detections, const std::vector<double>& annotations,
+							  double tolerance, double skip = 0.0) {
+	EventScore score;
+	double offsets = 0.0;
+	size_t d = 0;
+	while (d < detections.size() && detections[d] < skip - tolerance) {
+		d++;
+	}
+	score.detections = detections.size() - d;
+	for (double annotation : annotations) {
+		if (annotation < skip) {
+			continue;
+		}
+		score.annotations++;
+		while (d < detections.size() && detections[d] < annotation - tolerance) {
+			d++;
+		}
+		if (d < detections.size() && detections[d] <= annotation + tolerance) {
+			offsets += detections[d] - annotation;
+			score.matched++;
+			d++;
+		}
+	}
+	score.meanOffset = score.matched > 0 ? offsets / score.matched : 0.0;
+	return score;
+}
+
+/**
+ * For each reference time, how long until the first of `events` in [reference - early, reference + late], in
+ * seconds; references with no event in that range are left out. `events` must be sorted.
+ */
+inline std::vector<double> eventLatencies(const std::vector<double>& events, const std::vector<double>& references,
+										  double early, double late) {
+	std::vector<double> latencies;
+	for (double time : references) {
+		auto first = std::lower_bound(events.begin(), events.end(), time - early);
+		if (first != events.end() && *first <= time + late) {
+			latencies.push_back(*first - time);
+		}
+	}
+	return latencies;
+}
+
+#endif // SIM_SCORING_HPP
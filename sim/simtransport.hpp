@@ -0,0 +1,291 @@
+#ifndef SIMTRANSPORT_HPP
+#define SIMTRANSPORT_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "../src/transport.hpp"
+
+// How the simulated radio channel behaves
+struct SimulatedLink {
+	uint32_t latencyMicros = 500;      // radio stack latency on top of the airtime
+	uint32_t jitterMicros = 1000;      // mean of an exponentially distributed extra delay
+	float loss = 0.02f;                // chance that a receiver misses a frame
+	uint32_t bitsPerSecond = 250000;   // ESP-NOW long-range mode
+	uint32_t overheadMicros = 400;     // preamble, MAC header and checksum of every frame
+	uint32_t ackMicros = 300;          // acknowledgment of a unicast frame
+	uint8_t attempts = 4;              // tries per unicast frame before it is reported as failed
+};
+
+struct MediumStats {
+	uint64_t frames = 0;        // attempts on the air, retries included
+	uint64_t bytes = 0;
+	uint64_t busyMicros = 0;    // airtime used
+	uint64_t queuedMicros = 0;  // time frames waited for the channel to be free
+};
+
+class SimulatedTransport;
+
+/**
+ * One shared radio channel between SimulatedTransports in the same process, in real time.
+ *
+ * Frames go out one at a time: a frame waits until the channel is free, then occupies it for its airtime
+ * (overhead plus bits at the link rate, plus an acknowledgment for unicast), so the channel saturates like a real
+ * one. Each receiver independently loses a frame with the link's loss probability; unicast frames are retried until
+ * acknowledged. Arrivals and sent callbacks are delivered from the medium's own thread, as the Wi-Fi task does on
+ * the devices.
+ */
+class SimulatedMedium {
+private:
+	struct Event {
+		int64_t time = 0;
+		uint64_t order = 0;        // keeps events at the same time in the order they were scheduled
+		SimulatedTransport* target = nullptr;
+		bool sentEvent = false;    // a sent callback rather than an arrival
+		bool delivered = false;
+		uint8_t source[6] = {};
+		std::vector<uint8_t> data;
+
+		bool operator>(const Event& other) const {
+			return time != other.time ? time > other.time : order > other.order;
+		}
+	};
+
+	SimulatedLink link;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::mutex lock;
+	std::condition_variable wake;
+	std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+	std::vector<SimulatedTransport*> nodes;
+	std::mt19937 random{1};
+	int64_t channelFreeAt = 0;
+	uint64_t scheduled = 0;
+	MediumStats counters;
+	bool running = true;
+	std::thread thread;
+
+	int64_t frameMicros(size_t length) const {
+		return link.overheadMicros + int64_t(length) * 8 * 1000000 / link.bitsPerSecond;
+	}
+
+	int64_t delayMicros() {
+		std::exponential_distribution<double> jitter(1.0 / (link.jitterMicros + 1));
+		return link.latencyMicros + int64_t(jitter(random));
+	}
+
+	bool lost() {
+		return std::uniform_real_distribution<float>(0.0f, 1.0f)(random) < link.loss;
+	}
+
+	void schedule(Event event) {
+		event.order = scheduled++;
+		events.push(std::move(event));
+	}
+
+	void run();
+
+public:
+	SimulatedMedium(const SimulatedLink& link) : link(link) {
+		thread = std::thread([this] { run(); });
+	}
+
+	~SimulatedMedium() {
+		stop();
+	}
+
+	/**
+	 * Stops delivering arrivals and sent callbacks, so the nodes can be torn down
+	 */
+	void stop() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			running = false;
+		}
+		wake.notify_all();
+		if (thread.joinable()) thread.join();
+	}
+
+	// Microseconds since the medium was created, the simulation's true time
+	int64_t now() const {
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void attach(SimulatedTransport* node) {
+		std::lock_guard<std::mutex> guard(lock);
+		nodes.push_back(node);
+	}
+
+	void transmit(SimulatedTransport* sender, const uint8_t mac[6], const uint8_t* data, size_t length);
+
+	MediumStats stats() {
+		std::lock_guard<std::mutex> guard(lock);
+		return counters;
+	}
+};
+
+/**
+ * Transport over a SimulatedMedium, for running the master and rings as threads on one host. Like esp_now_send(), a
+ * unicast to a MAC that was never added as a peer fails without going on the air.
+ */
+class SimulatedTransport : public Transport {
+private:
+	friend class SimulatedMedium;
+
+	SimulatedMedium& medium;
+	uint8_t mac[6];
+	std::mutex peerLock;  // peers are added from the medium's thread and sent to from the transmitter's
+	std::vector<std::array<uint8_t, 6>> peers;
+
+	bool isPeer(const uint8_t destination[6]) {
+		std::lock_guard<std::mutex> guard(peerLock);
+		for (const std::array<uint8_t, 6>& peer : peers) {
+			if (memcmp(peer.data(), destination, 6) == 0) return true;
+		}
+		return false;
+	}
+
+public:
+	std::atomic<uint32_t> rejected{0};  // unicasts to MACs that are not peers
+
+	SimulatedTransport(SimulatedMedium& medium, const uint8_t mac[6]) : medium(medium) {
+		memcpy(this->mac, mac, 6);
+	}
+
+	bool begin() override {
+		medium.attach(this);
+		return true;
+	}
+
+	void macAddress(uint8_t out[6]) override {
+		memcpy(out, mac, 6);
+	}
+
+	bool addPeer(const uint8_t peer[6]) override {
+		if (isPeer(peer)) {
+			return true;
+		}
+		std::array<uint8_t, 6> entry;
+		memcpy(entry.data(), peer, 6);
+		std::lock_guard<std::mutex> guard(peerLock);
+		peers.push_back(entry);  // only the one thread adds peers, so it is not added twice
+		return true;
+	}
+
+	bool removePeer(const uint8_t peer[6]) override {
+		std::lock_guard<std::mutex> guard(peerLock);
+		for (size_t i = 0; i < peers.size(); i++) {
+			if (memcmp(peers[i].data(), peer, 6) == 0) {
+				peers.erase(peers.begin() + i);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool send(const uint8_t destination[6], const uint8_t* data, size_t length) override {
+		static const uint8_t broadcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+		if (length == 0 || length > 250) {
+			return false;
+		}
+		if (memcmp(destination, broadcast, 6) != 0 && !isPeer(destination)) {
+			rejected++;
+			return false;
+		}
+		medium.transmit(this, destination, data, length);
+		return true;
+	}
+};
+
+inline void SimulatedMedium::transmit(SimulatedTransport* sender, const uint8_t mac[6], const uint8_t* data, size_t length) {
+	static const uint8_t broadcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+	bool isBroadcast = memcmp(mac, broadcast, 6) == 0;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		int64_t time = now();
+		int64_t begin = channelFreeAt > time ? channelFreeAt : time;
+		counters.queuedMicros += begin - time;
+
+		Event arrival;
+		arrival.sentEvent = false;
+		arrival.delivered = true;
+		memcpy(arrival.source, sender->mac, 6);
+		arrival.data.assign(data, data + length);
+
+		bool delivered = false;
+		int64_t end = begin;
+		if (isBroadcast) {
+			end += frameMicros(length);
+			counters.frames++;
+			counters.bytes += length;
+			for (SimulatedTransport* node : nodes) {
+				if (node != sender && !lost()) {
+					arrival.time = end + delayMicros();
+					arrival.target = node;
+					schedule(arrival);
+				}
+			}
+			delivered = true;
+		} else {
+			SimulatedTransport* receiver = nullptr;
+			for (SimulatedTransport* node : nodes) {
+				if (memcmp(node->mac, mac, 6) == 0) receiver = node;
+			}
+			for (uint8_t attempt = 0; attempt < link.attempts && !delivered; attempt++) {
+				end += frameMicros(length) + link.ackMicros;
+				counters.frames++;
+				counters.bytes += length;
+				delivered = receiver != nullptr && !lost() && !lost();  // the frame and its acknowledgment
+			}
+			if (delivered) {
+				arrival.time = end + delayMicros();
+				arrival.target = receiver;
+				schedule(arrival);
+			}
+		}
+		counters.busyMicros += end - begin;
+		channelFreeAt = end;
+
+		Event done;
+		memcpy(done.source, sender->mac, 6);
+		done.time = end + link.latencyMicros;
+		done.target = sender;
+		done.sentEvent = true;
+		done.delivered = delivered;
+		schedule(std::move(done));
+	}
+	wake.notify_all();
+}
+
+inline void SimulatedMedium::run() {
+	std::unique_lock<std::mutex> guard(lock);
+	while (running) {
+		if (events.empty()) {
+			wake.wait(guard);
+			continue;
+		}
+		int64_t wait = events.top().time - now();
+		if (wait > 0) {
+			wake.wait_for(guard, std::chrono::microseconds(wait));
+			continue;
+		}
+		Event event = events.top();
+		events.pop();
+		guard.unlock();
+		if (event.sentEvent) {
+			event.target->sent(event.delivered);
+		} else {
+			event.target->received(event.source, event.data.data(), int(event.data.size()));
+		}
+		guard.lock();
+	}
+}
+
+#endif // SIMTRANSPORT_HPP
@@ -0,0 +1,107 @@
+/**
+ * Compares SpectralAnalyzer<N, 16000> at 256, 512 and 1024 points: the time per analysis frame (windowed real FFT,
+ * then the kick-weighted GEQ binning computeKickWeightedGEQ() does with the same tables), the share of one core that
+ * takes at the firmware's hop of HOP_SAMPLES, the latency the window adds, the bin width, and the RAM the tables and
+ * buffers take.
+ *
+ * It also checks what the tables promise at every size: the GEQ channels cover increasing bin ranges inside the
+ * spectrum, and a kick at KICK_HZ_MU lands in the low GEQ channels.
+ *
+ * Options: --frames N per round (2000), --rounds R (7).
+ */
+
+#include <math.h>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "check.hpp"
+
+#include "fft.h"
+#include "spectral.hpp"
+
+// The GEQ channels of a magnitude spectrum, as computeKickWeightedGEQ() sums them before post-processing
+template <uint16_t N>
+static void kickWeightedGEQ(const float* magnitudes, float channels[SPECTRAL_GEQ_CHANNELS]) {
+	using Analyzer = SpectralAnalyzer<N, SAMPLING_FREQ>;
+	for (uint8_t c = 0; c < SPECTRAL_GEQ_CHANNELS; c++) {
+		const uint16_t from = Analyzer::tables.geqFirstBin[c];
+		const uint16_t to = Analyzer::tables.geqLastBin[c];
+		double sum = 0.0;
+		for (uint16_t i = from; i <= to; i++) {
+			sum += Analyzer::tables.kickWeights[i] * magnitudes[i];
+		}
+		channels[c] = float(sum / (to - from + 1)) * GEQ_DAMPING[c];
+	}
+}
+
+template <uint16_t N>
+static void measure(uint32_t frames, int rounds) {
+	using Analyzer = SpectralAnalyzer<N, SAMPLING_FREQ>;
+	static Analyzer analyzer;
+	static float magnitudes[N / 2];
+	float channels[SPECTRAL_GEQ_CHANNELS];
+
+	// The GEQ bin ranges must be ordered and inside the spectrum
+	bool ordered = true;
+	for (uint8_t c = 0; c < SPECTRAL_GEQ_CHANNELS; c++) {
+		ordered &= Analyzer::tables.geqFirstBin[c] <= Analyzer::tables.geqLastBin[c] && Analyzer::tables.geqLastBin[c] < N / 2;
+		ordered &= c == 0 || Analyzer::tables.geqFirstBin[c] >= Analyzer::tables.geqFirstBin[c - 1];
+	}
+	CHECK(ordered, "%u points: the GEQ bin ranges are out of order", unsigned(N));
+
+	// A decaying kick at the center of the kick filter
+	std::vector<int16_t> kick(N);
+	for (uint16_t i = 0; i < N; i++) {
+		float t = float(i) / SAMPLING_FREQ;
+		kick[i] = int16_t(8000.0f * expf(-t * 20.0f) * sinf(2.0f * float(M_PI) * KICK_HZ_MU * t));
+	}
+	analyzer.magnitude(kick.data(), magnitudes);
+	kickWeightedGEQ<N>(magnitudes, channels);
+	uint8_t kickChannel = 0;
+	for (uint8_t c = 1; c < SPECTRAL_GEQ_CHANNELS; c++) {
+		if (channels[c] > channels[kickChannel]) kickChannel = c;
+	}
+	CHECK(kickChannel <= 3, "%u points: a %.0f Hz kick peaks in GEQ channel %u", unsigned(N), KICK_HZ_MU, kickChannel);
+
+	// Windows of noise and tones, as the analysis task would read them
+	std::mt19937 random(N);
+	std::normal_distribution<float> noise(0.0f, 2000.0f);
+	std::vector<int16_t> audio(N * 16u);
+	for (size_t i = 0; i < audio.size(); i++) {
+		audio[i] = int16_t(fmaxf(-32768.0f, fminf(32767.0f, noise(random) + 6000.0f * sinf(float(i) * 0.05f))));
+	}
+	double nanos = nanosecondsPerCall([&](uint32_t i) {
+		analyzer.magnitude(&audio[(i % 16) * N], magnitudes);
+		kickWeightedGEQ<N>(magnitudes, channels);
+		benchSink = channels[i % SPECTRAL_GEQ_CHANNELS];
+	}, frames, rounds);
+
+	const double hopsPerSecond = double(SAMPLING_FREQ) / HOP_SAMPLES;
+	const size_t tableBytes = sizeof(Analyzer::tables) + sizeof(analyzer.fft);
+	const size_t bufferBytes = N * sizeof(int16_t) + N / 2 * sizeof(float);
+	printf("%5u points: %6.0f ns per frame, %5.2f%% of a core at %.0f frames/s; window %5.1f ms; bins %5.2f Hz; "
+		   "kick in GEQ channel %u; tables %6zu B, buffers %5zu B\n",
+		   unsigned(N), nanos, nanos * hopsPerSecond / 1e7, hopsPerSecond, N * 1000.0 / SAMPLING_FREQ,
+		   double(Analyzer::BIN_HZ), kickChannel, tableBytes, bufferBytes);
+}
+
+int main(int argc, char** argv) {
+	uint32_t frames = 2000;
+	int rounds = 7;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--frames") frames = uint32_t(atoi(argv[i + 1]));
+		else if (option == "--rounds") rounds = atoi(argv[i + 1]);
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	measure<256>(frames, rounds);
+	measure<512>(frames, rounds);
+	measure<1024>(frames, rounds);
+	return checkResult();
+}
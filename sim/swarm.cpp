@@ -0,0 +1,458 @@
+/**
+ * Runs a master and N rings as threads on one host, over a simulated ESP-NOW channel (simtransport.hpp), running the
+ * firmware's own protocol steps (protocol.hpp), transmit queue (txqueue.hpp), clock synchronization and jitter buffer. Rings
+ * start knowing neither the master nor their index, as a freshly flashed board does. Sweeps the ring count from 1 to
+ * MAX_RINGS to find where the protocol saturates the channel.
+ *
+ * Build and run from the repository root:
+ *   g++ -std=gnu++17 -O2 -pthread -Isim/host -Isrc sim/swarm.cpp -o swarm && ./swarm
+ *
+ * Options: --seconds S per run (3), --rings N to run a single ring count, --loss P (0.02), --jitter us (1000),
+ * --rate bits/s (250000), --full 1 to broadcast the whole state every tick instead of keyframes and deltas, --beat ms
+ * between the master's simulated beats (500, 0 for none).
+ *
+ * Columns: the rings that were assigned an index, the airtime the nodes tried to use per second of simulation (over
+ * 100% means the channel is oversubscribed), the bytes per second of state broadcasts, repeats included, the mean
+ * wait for the channel, the state packets that reached the rings and the feedback that reached the master, packets
+ * evicted from the master's and the rings' queues, failed or timed out ring sends, and the 99th percentile of the
+ * rings' clock error and of their played-out target angle error. A run counts as saturated above 90% load or below
+ * 90% delivery.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <stdlib.h>
+#include <string>
+
+#include "simtransport.hpp"
+
+#include "clocksync.hpp"
+#include "jitterbuffer.hpp"
+#include "protocol.hpp"
+#include "replication.hpp"
+#include "rings.hpp"
+#include "txqueue.hpp"
+#include "wire.hpp"
+
+static const int64_t TICK_MICROS = 20000;   // the loop() rate of the master and rings, 50 per second
+static const float DEGREES_PER_SECOND = 60.0f;
+
+static void deviceMac(int index, uint8_t mac[6]) {
+	uint8_t base[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
+	memcpy(mac, base, 6);
+	mac[4] = uint8_t(index >> 8);
+	mac[5] = uint8_t(index);
+}
+
+/**
+ * The firmware's Transmitter on a thread: its TxQueue under a mutex, sent one packet at a time
+ */
+class SimTransmitter {
+private:
+	SimulatedMedium& medium;
+	Transport& transport;
+	std::mutex lock;
+	std::condition_variable wake;
+	TxQueue<TX_QUEUE_DEPTH> queue;
+	bool completed = false;
+	bool delivered = false;
+	bool running = true;
+	std::thread thread;
+
+	static void onSent(void* context, bool delivered) {
+		SimTransmitter* transmitter = static_cast<SimTransmitter*>(context);
+		std::lock_guard<std::mutex> guard(transmitter->lock);
+		transmitter->completed = true;
+		transmitter->delivered = delivered;
+		transmitter->wake.notify_all();
+	}
+
+	void run() {
+		std::unique_lock<std::mutex> guard(lock);
+		TxMessage message;
+		while (running) {
+			if (!queue.pop(message)) {
+				wake.wait(guard);
+				continue;
+			}
+			for (uint8_t i = 0; i < message.repeats; i++) {
+				completed = false;
+				guard.unlock();
+				bool ok = transport.send(message.destination, message.data, message.length);
+				guard.lock();
+				if (ok && !wake.wait_for(guard, std::chrono::milliseconds(TX_COMPLETION_TIMEOUT_MS), [this] { return completed; })) {
+					queue.stats.timedOut++;
+					ok = false;
+				} else if (ok) {
+					ok = delivered;
+				}
+				queue.stats.recordSend(ok, uint32_t(medium.now()) - message.enqueuedMicros);
+			}
+		}
+	}
+
+public:
+	SimTransmitter(SimulatedMedium& medium, Transport& transport) : medium(medium), transport(transport) {
+		transport.onSent(onSent, this);
+		thread = std::thread([this] { run(); });
+	}
+
+	~SimTransmitter() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			running = false;
+		}
+		wake.notify_all();
+		thread.join();
+	}
+
+	void send(const uint8_t* destination, WireMessage type, const uint8_t* data, size_t length, uint8_t repeats = 1) {
+		if (length == 0 || length > WIRE_MAX_PACKET_SIZE) {
+			return;
+		}
+		std::lock_guard<std::mutex> guard(lock);
+		queue.push(destination, type, data, uint8_t(length), repeats, uint32_t(medium.now()));
+		wake.notify_all();
+	}
+
+	TxStats stats() {
+		std::lock_guard<std::mutex> guard(lock);
+		return queue.stats;
+	}
+};
+
+/**
+ * Periodic worker thread, stopped on destruction
+ */
+class Ticker {
+private:
+	std::atomic<bool> running{true};
+	std::thread thread;
+
+public:
+	template <typename F>
+	void start(int64_t phaseMicros, F tick) {
+		thread = std::thread([this, phaseMicros, tick] {
+			auto next = std::chrono::steady_clock::now() + std::chrono::microseconds(phaseMicros);
+			while (running) {
+				std::this_thread::sleep_until(next);
+				tick();
+				next += std::chrono::microseconds(TICK_MICROS);
+			}
+		});
+	}
+
+	void stop() {
+		running = false;
+		if (thread.joinable()) thread.join();
+	}
+
+	~Ticker() {
+		stop();
+	}
+};
+
+static float trueAngle(int64_t masterMicros, int slot) {
+	return fmodf(float(double(masterMicros) / 1e6 * DEGREES_PER_SECOND) + 60.0f * slot, 360.0f);
+}
+
+class Master {
+private:
+	SimulatedMedium& medium;
+	SimulatedTransport transport;
+	SimTransmitter transmitter;
+	Ticker ticker;
+	State state;
+	StateReplicator replicator;
+	bool full;
+	unsigned long beatMillis;
+	uint16_t sequence = 0;
+	MasterRings rings;                   // only touched from the medium's thread
+	std::atomic<uint8_t> activeRings{0};
+
+	static void onReceive(void* context, const uint8_t* mac, const uint8_t* data, int length) {
+		Master* master = static_cast<Master*>(context);
+		int64_t received = master->medium.now();
+		if (answerPing(mac, data, length, received, master->medium.now(), master->transmitter)) {
+			return;
+		}
+		auto addPeer = [master](const uint8_t* peer) { master->transport.addPeer(peer); };
+		switch (handleRingPacket(master->rings, mac, data, length, (unsigned long)(received / 1000), master->transmitter, addPeer)) {
+		case RingPacket::Joined:
+			master->activeRings = master->rings.directory.span();
+			master->keyframeRequested = true;
+			break;
+		case RingPacket::Assigned:
+			master->keyframeRequested = true;
+			break;
+		default:
+			break;
+		}
+	}
+
+	void tick() {
+		int64_t now = medium.now();
+		state.frame++;
+		state.time = (unsigned long)(now / 1000);
+		state.shared_micros = now;
+		state.isPaused = false;
+		state.ring_count = activeRings;
+		for (uint8_t i = 0; i < state.ring_count; i++) {
+			state.target_angle[i] = trueAngle(now, i);
+			state.target_angular_velocity[i] = DEGREES_PER_SECOND;
+			state.target_angle_rate[i] = DEGREES_PER_SECOND;
+		}
+
+		// Regular beats with an intensity that decays after each, for the deltas to carry
+		if (beatMillis > 0) {
+			unsigned long beats = state.time / beatMillis;
+			if (beats != state.elapsedBeats) {
+				state.elapsedBeats = beats;
+				state.lastBeatTimestamp = state.time;
+			}
+			state.beat_intensity = expf(-float(state.time - state.lastBeatTimestamp) / 100.0f);
+		}
+
+		if (keyframeRequested.exchange(false)) {
+			replicator.requestKeyframe();
+		}
+		if (full) {
+			uint8_t packet[WIRE_MAX_PACKET_SIZE];
+			size_t length = encodeState(state, ++sequence, packet, sizeof(packet));
+			transmitter.send(BROADCAST_ALL, WireMessage::State, packet, length, STATE_BROADCAST_REPEATS);
+			stateBytes += length * STATE_BROADCAST_REPEATS;
+		} else {
+			stateBytes += broadcastState(replicator, state, sequence, transmitter) * STATE_BROADCAST_REPEATS;
+		}
+	}
+
+public:
+	std::atomic<bool> keyframeRequested{false};
+	uint64_t stateBytes = 0;  // read after stop()
+
+	uint8_t ringCount() const {
+		return activeRings;
+	}
+
+	Master(SimulatedMedium& medium, const uint8_t mac[6], bool full, unsigned long beatMillis)
+		: medium(medium), transport(medium, mac), transmitter(medium, transport), full(full), beatMillis(beatMillis) {
+		transport.onReceive(onReceive, this);
+		transport.begin();
+	}
+
+	void start() {
+		ticker.start(0, [this] { tick(); });
+	}
+
+	void stop() {
+		ticker.stop();
+	}
+
+	uint16_t statesSent() const {
+		return sequence;
+	}
+
+	// After the medium stopped
+	uint32_t feedbackReceived() const {
+		return rings.feedbackReceived;
+	}
+
+	SimTransmitter& tx() {
+		return transmitter;
+	}
+};
+
+/**
+ * A ring: a local clock that is off by a fixed offset and runs at its own rate, the state tracker, clock sync and
+ * jitter buffer of the firmware, and a record of how far its clock and target are off
+ */
+class Ring {
+private:
+	SimulatedMedium& medium;
+	SimulatedTransport transport;
+	SimTransmitter transmitter;
+	Ticker ticker;
+	int64_t clockOffset;
+	double clockRate;
+
+	std::mutex lock;  // between the medium's thread and the ring's tick
+	StateReceiver receiver;
+	ClockSync clockSync;
+	JitterBuffer<8> targets;
+	int64_t bufferedMicros = 0;    // shared_micros of the newest target in `targets`
+	RingLink link;
+	uint8_t index = NO_RING;
+
+	int64_t localMicros() {
+		return int64_t(double(medium.now()) * clockRate) + clockOffset;
+	}
+
+	static void onReceive(void* context, const uint8_t* mac, const uint8_t* data, int length) {
+		Ring* ring = static_cast<Ring*>(context);
+		int64_t received = ring->localMicros();
+		std::lock_guard<std::mutex> guard(ring->lock);
+		uint8_t assigned;
+		switch (receiveFromMaster(ring->receiver, ring->clockSync, data, length, received, assigned)) {
+		case MasterPacket::Assign:
+			ring->index = assigned;
+			break;
+		case MasterPacket::State:
+			if (!ring->link.masterKnown || memcmp(ring->link.masterMac, mac, 6) != 0) {
+				memcpy(ring->link.masterMac, mac, 6);
+				ring->link.masterKnown = true;
+				ring->transport.addPeer(mac);
+			}
+			bufferTarget(ring->targets, ring->bufferedMicros, ring->receiver.state, ring->index, ring->clockSync.estimate(), received);
+			break;
+		default:
+			break;
+		}
+	}
+
+	void tick() {
+		int64_t local = localMicros();
+		std::lock_guard<std::mutex> guard(lock);
+
+		const ClockEstimate& estimate = clockSync.estimate();
+		if (estimate.synchronized()) {
+			int64_t shared = estimate.toMaster(local);
+			clockErrors.push_back(double(llabs(shared - medium.now())));
+			TargetPlayout target;
+			if (index != NO_RING && targets.playout(shared, target)) {
+				float error = fabsf(fmodf(target.angle - trueAngle(medium.now(), index) + 540.0f, 360.0f) - 180.0f);
+				targetErrors.push_back(error);
+			}
+		}
+
+		ringTick(link, index, NO_RING, 0.0f, receiver.tracker.stats(), estimate, local, transmitter);
+	}
+
+public:
+	std::vector<double> clockErrors;   // us
+	std::vector<double> targetErrors;  // degrees
+
+	Ring(SimulatedMedium& medium, const uint8_t mac[6], std::mt19937& random)
+		: medium(medium), transport(medium, mac), transmitter(medium, transport) {
+		clockOffset = std::uniform_int_distribution<int64_t>(-1000000, 1000000)(random);
+		clockRate = 1.0 + std::uniform_real_distribution<double>(-30e-6, 30e-6)(random);
+		transport.onReceive(onReceive, this);
+		transport.begin();
+	}
+
+	void start(int64_t phaseMicros) {
+		ticker.start(phaseMicros, [this] { tick(); });
+	}
+
+	void stop() {
+		ticker.stop();
+	}
+
+	WireLinkStats linkStats() {
+		std::lock_guard<std::mutex> guard(lock);
+		return receiver.tracker.stats();
+	}
+
+	uint16_t feedbackSent() {
+		std::lock_guard<std::mutex> guard(lock);
+		return link.feedbackSequence;
+	}
+
+	SimTransmitter& tx() {
+		return transmitter;
+	}
+};
+
+static double percentile(std::vector<double> values, double p) {
+	if (values.empty()) return NAN;
+	size_t index = std::min(values.size() - 1, size_t(p * values.size()));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+static bool runSwarm(int rings, double seconds, const SimulatedLink& link, bool full, unsigned long beatMillis) {
+	SimulatedMedium medium(link);
+	std::mt19937 random(rings);
+	uint8_t masterMac[6];
+	deviceMac(0, masterMac);
+	Master master(medium, masterMac, full, beatMillis);
+	std::vector<std::unique_ptr<Ring>> nodes;
+	for (int i = 0; i < rings; i++) {
+		uint8_t mac[6];
+		deviceMac(i + 1, mac);
+		nodes.emplace_back(new Ring(medium, mac, random));
+	}
+	master.start();
+	for (int i = 0; i < rings; i++) {
+		nodes[i]->start(std::uniform_int_distribution<int64_t>(0, TICK_MICROS)(random));
+	}
+	std::this_thread::sleep_for(std::chrono::microseconds(int64_t(seconds * 1e6)));
+	MediumStats air = medium.stats();
+	int64_t elapsed = medium.now();
+	master.stop();
+	for (auto& ring : nodes) {
+		ring->stop();
+	}
+	medium.stop();
+
+	uint64_t stateReceived = 0, stateLost = 0, feedbackSent = 0, dropped = 0, failed = 0;
+	std::vector<double> clockErrors, targetErrors;
+	for (auto& ring : nodes) {
+		WireLinkStats stats = ring->linkStats();
+		stateReceived += stats.received;
+		stateLost += stats.lost;
+		feedbackSent += ring->feedbackSent();
+		TxStats tx = ring->tx().stats();
+		dropped += tx.dropped;
+		failed += tx.failed;
+		clockErrors.insert(clockErrors.end(), ring->clockErrors.begin(), ring->clockErrors.end());
+		targetErrors.insert(targetErrors.end(), ring->targetErrors.begin(), ring->targetErrors.end());
+	}
+	double utilization = double(air.busyMicros) / double(elapsed);
+	double stateDelivery = stateReceived + stateLost > 0 ? double(stateReceived) / double(stateReceived + stateLost) : 0.0;
+	double feedbackDelivery = feedbackSent > 0 ? double(master.feedbackReceived()) / double(feedbackSent) : 0.0;
+	double queueing = air.frames > 0 ? double(air.queuedMicros) / double(air.frames) / 1000.0 : 0.0;
+	bool saturated = utilization > 0.9 || stateDelivery < 0.9 || feedbackDelivery < 0.9;
+	printf("%5d  %6u  %5.0f%%  %7.0f  %7.1f  %7.1f%%  %7.1f%%  %7lu  %6lu  %7lu  %8.0f  %8.2f  %s\n",
+		   rings, master.ringCount(), 100.0 * utilization, master.stateBytes / (elapsed / 1e6), queueing, 100.0 * stateDelivery, 100.0 * feedbackDelivery,
+		   (unsigned long)master.tx().stats().dropped, (unsigned long)dropped, (unsigned long)failed,
+		   percentile(clockErrors, 0.99), percentile(targetErrors, 0.99), saturated ? "saturated" : "");
+	fflush(stdout);
+	return saturated;
+}
+
+int main(int argc, char** argv) {
+	double seconds = 3.0;
+	int only = 0;
+	SimulatedLink link;
+	bool full = false;
+	unsigned long beatMillis = 500;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--seconds") seconds = atof(argv[i + 1]);
+		else if (option == "--rings") only = atoi(argv[i + 1]);
+		else if (option == "--loss") link.loss = float(atof(argv[i + 1]));
+		else if (option == "--jitter") link.jitterMicros = uint32_t(atoi(argv[i + 1]));
+		else if (option == "--rate") link.bitsPerSecond = uint32_t(atoi(argv[i + 1]));
+		else if (option == "--full") full = atoi(argv[i + 1]) != 0;
+		else if (option == "--beat") beatMillis = strtoul(argv[i + 1], nullptr, 10);
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	printf("%.0f kbit/s, %.0f%% loss, %u us jitter, %.0f s per run, %s, beat every %lu ms\n\n",
+		   link.bitsPerSecond / 1000.0, 100.0 * link.loss, link.jitterMicros, seconds,
+		   full ? "full state every tick" : "keyframes and deltas", beatMillis);
+	printf("rings  joined  load   state B/s  queue ms  state rx  feedback  m-drop  r-drop  r-fail  clock p99  angle p99\n");
+	printf("                                                                                      us      degrees\n");
+	if (only > 0) {
+		runSwarm(only, seconds, link, full, beatMillis);
+		return 0;
+	}
+	const int counts[] = {1, 2, 4, 6, 8, 12, MAX_RINGS};
+	for (int rings : counts) {
+		runSwarm(rings, seconds, link, full, beatMillis);
+	}
+	return 0;
+}
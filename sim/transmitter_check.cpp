@@ -0,0 +1,234 @@
+/**
+ * Checks that loop() never waits on the radio (transmitter.hpp): the firmware's Transmitter runs its task against a
+ * mocked transport whose send completes, like esp_now_send()'s sent callback, a configurable delay after it is
+ * called, and a loop at the firmware's rate enqueues what the master sends each tick.
+ *
+ * What it checks, for each completion delay:
+ *   - the time loop() spends in send() stays flat, however slow the radio is: its 99th percentile stays within a
+ *     fixed bound of the one with an instant radio, where sending inline, as the firmware used to, costs the delay
+ *     on every packet,
+ *   - the queue never holds more than TX_QUEUE_DEPTH messages, and once the radio falls behind, the latest state
+ *     replaces the queued one instead of piling up,
+ *   - every packet the task hands to the radio completes through the sent callback, and the latency it reports
+ *     covers the delay.
+ *
+ * Options: --loops N per delay (200), --interval US between loops (2000).
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+
+#include "protocol.hpp"
+#include "transmitter.hpp"
+
+static const uint8_t RING_MAC[6] = {0x02, 0, 0, 0, 0, 0x01};
+
+/**
+ * A transport whose sends complete `delayMicros` after they are made, on a thread of its own like the Wi-Fi task's
+ * sent callback. Packets go nowhere.
+ */
+class DelayedTransport : public Transport {
+private:
+	std::mutex lock;
+	std::condition_variable wake;
+	std::deque<std::chrono::steady_clock::time_point> pending;
+	bool stopping = false;
+	std::thread completions;
+
+	void run() {
+		std::unique_lock<std::mutex> guard(lock);
+		while (!stopping) {
+			if (pending.empty()) {
+				wake.wait(guard);
+				continue;
+			}
+			auto due = pending.front();
+			if (wake.wait_until(guard, due) != std::cv_status::timeout && std::chrono::steady_clock::now() < due) {
+				continue;
+			}
+			pending.pop_front();
+			guard.unlock();
+			sent(true);
+			guard.lock();
+		}
+	}
+
+public:
+	int64_t delayMicros = 0;
+	std::atomic<uint32_t> sends{0};
+
+	bool begin() override {
+		completions = std::thread([this] { run(); });
+		return true;
+	}
+
+	void macAddress(uint8_t mac[6]) override {
+		memset(mac, 0, 6);
+	}
+
+	bool addPeer(const uint8_t*) override {
+		return true;
+	}
+
+	bool removePeer(const uint8_t*) override {
+		return true;
+	}
+
+	bool send(const uint8_t*, const uint8_t*, size_t) override {
+		std::lock_guard<std::mutex> guard(lock);
+		if (stopping) {
+			return false;
+		}
+		sends++;
+		pending.push_back(std::chrono::steady_clock::now() + std::chrono::microseconds(delayMicros));
+		wake.notify_all();
+		return true;
+	}
+
+	// Drops the sends still pending; their callbacks never come
+	void stop() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+			wake.notify_all();
+		}
+		completions.join();
+	}
+};
+
+// The blocking send the master used to do inline: hand the packet to the radio and spin until it is done
+struct InlineSender {
+	DelayedTransport& transport;
+	std::atomic<bool> done{false};
+
+	explicit InlineSender(DelayedTransport& transport) : transport(transport) {
+		transport.onSent([](void* context, bool) { static_cast<InlineSender*>(context)->done.store(true); }, this);
+	}
+
+	void send(const uint8_t* destination, WireMessage, const uint8_t* data, size_t length, uint8_t repeats = 1) {
+		for (uint8_t i = 0; i < repeats; i++) {
+			done.store(false);
+			if (!transport.send(destination, data, length)) {
+				return;
+			}
+			while (!done.load()) {
+				std::this_thread::yield();
+			}
+		}
+	}
+};
+
+struct LoopTimes {
+	double median = 0.0, p99 = 0.0, worst = 0.0;  // microseconds
+};
+
+/**
+ * Runs `loops` iterations of a master's loop() that sends a state broadcast and a pong each tick, and returns the
+ * time the sends took
+ */
+template <typename Sender>
+static LoopTimes runLoop(Sender& tx, uint32_t loops, int64_t intervalMicros) {
+	uint8_t packet[WIRE_MAX_PACKET_SIZE];
+	std::vector<double> times;
+	auto next = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < loops; i++) {
+		for (size_t j = 0; j < sizeof(packet); j++) {
+			packet[j] = uint8_t(i + j);
+		}
+		auto start = std::chrono::steady_clock::now();
+		tx.send(BROADCAST_ALL, WireMessage::State, packet, 120, STATE_BROADCAST_REPEATS);
+		tx.send(RING_MAC, WireMessage::TimePong, packet, 30);
+		times.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+		next += std::chrono::microseconds(intervalMicros);
+		std::this_thread::sleep_until(next);
+	}
+	std::sort(times.begin(), times.end());
+	LoopTimes result;
+	result.median = times[times.size() / 2];
+	result.p99 = times[std::min(times.size() - 1, times.size() * 99 / 100)];
+	result.worst = times.back();
+	return result;
+}
+
+int main(int argc, char** argv) {
+	uint32_t loops = 200;
+	int64_t interval = 2000;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--loops") loops = uint32_t(atoi(argv[i + 1]));
+		else if (option == "--interval") interval = atoll(argv[i + 1]);
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (loops < 10) {
+		fprintf(stderr, "--loops must be at least 10\n");
+		return 1;
+	}
+
+	// Well within TX_COMPLETION_TIMEOUT_MS, so the task waits each send out rather than giving up on it, even when the
+	// host is slow to run the completion thread
+	const int64_t delays[] = {0, 1000, 4000, 10000};
+	const float STEP_MICROS = 1000.0f;  // how far the 99th percentile may rise over the instant radio's, for host noise
+	double instantP99 = 0.0;
+	printf("loop() every %lld us, %u loops per delay; send() time per loop in us\n\n", (long long)interval, loops);
+	printf("delay us  queued: median    p99  worst  inline: median      p99  queue max  coalesced  dropped  sent  "
+		   "latency avg  max us\n");
+	for (int64_t delay : delays) {
+		DelayedTransport transport;
+		transport.delayMicros = delay;
+		transport.begin();
+		Transmitter transmitter;
+		transmitter.begin(transport);
+		LoopTimes queued = runLoop(transmitter, loops, interval);
+		// Let the radio finish what is queued, so every send the task made has completed
+		int64_t drain = (TX_QUEUE_DEPTH + 1) * STATE_BROADCAST_REPEATS * delay + 20000;
+		std::this_thread::sleep_for(std::chrono::microseconds(drain));
+		TxStats stats = transmitter.stats();
+		uint32_t handedOver = transport.sends.load();
+		transport.stop();
+		hostStopTasks();
+
+		DelayedTransport blocking;
+		blocking.delayMicros = delay;
+		blocking.begin();
+		InlineSender inlineSender(blocking);
+		LoopTimes inlined = runLoop(inlineSender, std::min<uint32_t>(loops, 50), interval);
+		blocking.stop();
+
+		printf("%8lld  %14.1f %6.1f %6.1f  %14.1f %8.1f  %9u  %9lu  %7lu  %4lu  %11.0f  %6lu\n", (long long)delay,
+			   queued.median, queued.p99, queued.worst, inlined.median, inlined.p99, stats.maxDepth,
+			   (unsigned long)stats.coalesced, (unsigned long)stats.dropped, (unsigned long)stats.sent,
+			   stats.averageLatencyMicros, (unsigned long)stats.maxLatencyMicros);
+
+		if (delay == 0) {
+			instantP99 = queued.p99;
+		}
+		CHECK(queued.p99 <= instantP99 + STEP_MICROS, "with a %lld us radio, send() took %.1f us at the 99th percentile, "
+			  "%.1f us with an instant one", (long long)delay, queued.p99, instantP99);
+		CHECK(delay == 0 || inlined.median >= STATE_BROADCAST_REPEATS * delay, "sending inline took %.1f us, under the "
+			  "%lld us radio's delay", inlined.median, (long long)delay);
+		CHECK(stats.maxDepth <= TX_QUEUE_DEPTH, "the queue held %u messages", stats.maxDepth);
+		CHECK(stats.enqueued == 2 * loops, "%lu of %u messages enqueued", (unsigned long)stats.enqueued, 2 * loops);
+		CHECK(stats.sent == handedOver && stats.failed == 0 && stats.timedOut == 0,
+			  "%lu sent, %lu failed, %lu timed out of %lu handed to the radio", (unsigned long)stats.sent,
+			  (unsigned long)stats.failed, (unsigned long)stats.timedOut, (unsigned long)handedOver);
+		CHECK(stats.maxLatencyMicros >= delay, "a send completed %lu us after it was queued, under the %lld us delay",
+			  (unsigned long)stats.maxLatencyMicros, (long long)delay);
+		// Two messages per loop over the radio's two or three sends per loop interval: a slow radio has to coalesce
+		if (delay * (STATE_BROADCAST_REPEATS + 1) > 2 * interval) {
+			CHECK(stats.coalesced > 0, "a %lld us radio fell behind, but nothing was coalesced", (long long)delay);
+		}
+	}
+	return checkResult();
+}
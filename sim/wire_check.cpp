@@ -0,0 +1,294 @@
+/**
+ * Round trips of the wire format in wire.hpp and timings of its encoders and decoders.
+ *
+ * Random states are encoded and decoded onto a blank State, and every field must come back within its quantization
+ * step. It also checks that:
+ *   - a packet with only some fields leaves the others as the receiving state had them,
+ *   - a field from a newer master is skipped and the rest still decodes,
+ *   - truncated packets, other versions and other message types are rejected without touching the state,
+ *   - the feedback, ping, pong and ring index packets come back unchanged,
+ *   - a full state packet for six rings is less than half the size of the State struct it replaces.
+ *
+ * Options: --states N random states (20000), --rounds R of the benchmarks (7).
+ */
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include "bench.hpp"
+#include "check.hpp"
+
+#include "wire.hpp"
+
+static State randomState(std::mt19937& random, uint8_t rings) {
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::uniform_int_distribution<uint32_t> u32;
+	State st;
+	st.isPaused = random() % 2;
+	st.frame = uint16_t(random());
+	st.time = u32(random) % 4000000000UL + 70000UL;
+	st.lastUpdate = st.time - 3;
+	st.shared_micros = int64_t(u32(random)) * 1000 + 17;
+	st.updatesPerSecond = 48.0f;
+	st.lastBeatTimestamp = st.time - random() % 60000;
+	st.elapsedBeats = u32(random);
+	st.lastOnsetTimestamp = st.time - random() % 60000;
+	st.beat_phase = unit(random) * 0.999f;
+	st.beat_period = 300.0f + unit(random) * 700.0f;
+	st.next_beat_timestamp = st.time + random() % 1000;
+	st.section = uint8_t(random() % 4);
+	st.tension = unit(random);
+	st.brightness = uint8_t(random());
+	st.shader_index = uint8_t(random());
+	st.beat_intensity = unit(random) * 8.0f;
+	st.ring_count = rings;
+	for (uint8_t i = 0; i < rings; i++) {
+		st.target_angle[i] = unit(random) * 720.0f - 360.0f;
+		st.target_angular_velocity[i] = unit(random) * 400.0f - 200.0f;
+		st.target_angle_rate[i] = unit(random) * 400.0f - 200.0f;
+	}
+	return st;
+}
+
+// `st` as a ring has it after a full state packet, with its values quantized
+static State asReceived(const State& st) {
+	uint8_t packet[WIRE_MAX_PACKET_SIZE];
+	State received;
+	decodeState(packet, encodeState(st, 0, packet, sizeof(packet)), received);
+	return received;
+}
+
+static float angleDifference(float a, float b) {
+	float difference = fmodf(fabsf(a - b), 360.0f);
+	return fminf(difference, 360.0f - difference);
+}
+
+// Whether `decoded` is `original` as the rings should see it, within half a quantization step of every value
+static bool matches(const State& original, const State& decoded, std::string& mismatch) {
+	struct Field {
+		const char* name;
+		bool ok;
+	};
+	Field fields[] = {
+		{"isPaused", decoded.isPaused == original.isPaused},
+		{"frame", decoded.frame == original.frame},
+		{"time", decoded.time == original.time},
+		{"shared_micros", decoded.shared_micros == original.shared_micros},
+		{"lastBeatTimestamp", decoded.lastBeatTimestamp == original.lastBeatTimestamp},
+		{"elapsedBeats", decoded.elapsedBeats == original.elapsedBeats},
+		{"lastOnsetTimestamp", decoded.lastOnsetTimestamp == original.lastOnsetTimestamp},
+		{"beat_phase", fabsf(decoded.beat_phase - original.beat_phase) <= 0.5f / 65536.0f + 1e-6f},
+		{"beat_period", fabsf(decoded.beat_period - original.beat_period) <= 0.5f / 16.0f + 1e-3f},
+		{"next_beat_timestamp", decoded.next_beat_timestamp == original.next_beat_timestamp},
+		{"section", decoded.section == original.section},
+		{"tension", fabsf(decoded.tension - original.tension) <= 0.5f / 255.0f + 1e-6f},
+		{"brightness", decoded.brightness == original.brightness},
+		{"shader_index", decoded.shader_index == original.shader_index},
+		{"beat_intensity", fabsf(decoded.beat_intensity - original.beat_intensity) <= 0.5f / 1024.0f + 1e-5f},
+		{"ring_count", decoded.ring_count == original.ring_count},
+	};
+	for (const Field& field : fields) {
+		if (!field.ok) {
+			mismatch = field.name;
+			return false;
+		}
+	}
+	for (uint8_t i = 0; i < original.ring_count; i++) {
+		if (!(decoded.target_angle[i] >= 0.0f && decoded.target_angle[i] < 360.0f)
+			|| angleDifference(decoded.target_angle[i], original.target_angle[i]) > 0.5f * 360.0f / 65536.0f + 1e-3f) {
+			mismatch = "target_angle[" + std::to_string(i) + "]";
+			return false;
+		}
+		if (fabsf(decoded.target_angular_velocity[i] - original.target_angular_velocity[i]) > 0.5f / 16.0f + 1e-4f) {
+			mismatch = "target_angular_velocity[" + std::to_string(i) + "]";
+			return false;
+		}
+		if (fabsf(decoded.target_angle_rate[i] - original.target_angle_rate[i]) > 0.5f / 16.0f + 1e-4f) {
+			mismatch = "target_angle_rate[" + std::to_string(i) + "]";
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	uint32_t states = 20000;
+	int rounds = 7;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--states") states = uint32_t(atoi(argv[i + 1]));
+		else if (option == "--rounds") rounds = atoi(argv[i + 1]);
+		else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	std::mt19937 random(17);
+	uint8_t packet[WIRE_MAX_PACKET_SIZE];
+
+	// Full round trips, at every ring count
+	uint32_t failed = 0;
+	std::string firstMismatch;
+	for (uint32_t n = 0; n < states; n++) {
+		State original = randomState(random, uint8_t(n % (MAX_RINGS + 1)));
+		size_t length = encodeState(original, uint16_t(n), packet, sizeof(packet));
+		State decoded;
+		uint16_t sequence = 0;
+		std::string mismatch;
+		if (length == 0 || !decodeState(packet, length, decoded, &sequence) || sequence != uint16_t(n)
+			|| !matches(original, decoded, mismatch)) {
+			if (failed++ == 0) firstMismatch = mismatch.empty() ? "the packet" : mismatch;
+		}
+	}
+	CHECK(failed == 0, "%u of %u states did not survive a round trip, first in %s", failed, states, firstMismatch.c_str());
+
+	// Timestamps further than 16 bits of milliseconds from `time` saturate rather than wrap
+	State far = randomState(random, 1);
+	far.lastBeatTimestamp = far.time - 70000;
+	far.next_beat_timestamp = far.time + 70000;
+	State farDecoded;
+	decodeState(packet, encodeState(far, 1, packet, sizeof(packet)), farDecoded);
+	CHECK(farDecoded.lastBeatTimestamp == far.time - 65535 && farDecoded.next_beat_timestamp == far.time + 65535,
+		  "far timestamps came back %lu ms before and %lu ms after", far.time - farDecoded.lastBeatTimestamp,
+		  farDecoded.next_beat_timestamp - far.time);
+
+	// Each state field on its own changes only what it carries
+	const State base = asReceived(randomState(random, 6));
+	const State update = randomState(random, 6);
+	for (uint8_t field = uint8_t(WireField::Clock); field <= uint8_t(WireField::RingRates); field++) {
+		WireFieldSet fields = wireFieldBit(WireField(field));
+		CHECK(fields & WIRE_STATE_FIELDS, "field %u is not in WIRE_STATE_FIELDS", field);
+		State decoded = base;
+		decoded.time = update.time;  // as if a Clock field had come earlier, so the timestamps decode against it
+		size_t length = encodeState(update, 1, packet, sizeof(packet), fields);
+		CHECK(length > WIRE_HEADER_SIZE && decodeState(packet, length, decoded), "a packet with just field %u did not decode", field);
+		// The fields it carries now match `update`, everything else still matches `base`
+		State mixed = base;
+		mixed.time = update.time;
+		switch (WireField(field)) {
+			case WireField::Clock: mixed.frame = update.frame; break;
+			case WireField::Settings: mixed.isPaused = update.isPaused; mixed.brightness = update.brightness; mixed.shader_index = update.shader_index; break;
+			case WireField::Beat:
+				mixed.beat_intensity = update.beat_intensity;
+				mixed.elapsedBeats = update.elapsedBeats;
+				mixed.lastBeatTimestamp = update.lastBeatTimestamp;
+				mixed.lastOnsetTimestamp = update.lastOnsetTimestamp;
+				break;
+			case WireField::BeatClock:
+				mixed.beat_phase = update.beat_phase;
+				mixed.beat_period = update.beat_period;
+				mixed.next_beat_timestamp = update.next_beat_timestamp;
+				break;
+			case WireField::Structure: mixed.section = update.section; mixed.tension = update.tension; break;
+			case WireField::RingTargets:
+				memcpy(mixed.target_angle, update.target_angle, sizeof(mixed.target_angle));
+				memcpy(mixed.target_angular_velocity, update.target_angular_velocity, sizeof(mixed.target_angular_velocity));
+				break;
+			case WireField::SharedTime: mixed.shared_micros = update.shared_micros; break;
+			case WireField::RingRates:
+				memcpy(mixed.target_angle_rate, update.target_angle_rate, sizeof(mixed.target_angle_rate));
+				break;
+			default: break;
+		}
+		std::string mismatch;
+		CHECK(matches(mixed, decoded, mismatch), "a packet with just field %u changed %s", field, mismatch.c_str());
+	}
+
+	// A field this version does not know, in the middle of the packet, is skipped
+	State original = randomState(random, 6);
+	size_t length = encodeState(original, 5, packet, sizeof(packet));
+	std::vector<uint8_t> extended(packet, packet + WIRE_HEADER_SIZE);
+	const uint8_t unknown[] = {15, 3, 0xAA, 0xBB, 0xCC};
+	extended.insert(extended.end(), unknown, unknown + sizeof(unknown));
+	extended.insert(extended.end(), packet + WIRE_HEADER_SIZE, packet + length);
+	State decoded;
+	std::string mismatch;
+	CHECK(decodeState(extended.data(), extended.size(), decoded) && matches(original, decoded, mismatch),
+		  "a packet with an unknown field did not decode (%s)", mismatch.c_str());
+
+	// A packet cut between two fields is a shorter valid one; cut anywhere else, it is rejected and leaves the state alone
+	std::vector<size_t> fieldEnds = {WIRE_HEADER_SIZE};
+	for (size_t position = WIRE_HEADER_SIZE; position + 1 < length;) {
+		position += 2 + packet[position + 1];
+		fieldEnds.push_back(position);
+	}
+	uint32_t truncatedWrong = 0;
+	for (size_t cut = 0; cut < length; cut++) {
+		State target = base;
+		bool accepted = decodeState(packet, cut, target);
+		bool boundary = std::find(fieldEnds.begin(), fieldEnds.end(), cut) != fieldEnds.end();
+		std::string changed;
+		truncatedWrong += accepted != boundary || (!accepted && !matches(base, target, changed));
+	}
+	CHECK(truncatedWrong == 0, "%u truncated packets were not rejected cleanly", truncatedWrong);
+
+	// Packets of another version or type are rejected too
+	packet[0] = WIRE_VERSION + 1;
+	State other = base;
+	CHECK(!decodeState(packet, length, other), "a packet of another version was decoded");
+	packet[0] = WIRE_VERSION;
+	packet[1] = uint8_t(WireMessage::Feedback);
+	CHECK(!decodeState(packet, length, other), "a feedback packet was decoded as state");
+	CHECK(matches(base, other, mismatch), "a rejected packet changed %s", mismatch.c_str());
+
+	// The ring's packets
+	WireFeedback feedback;
+	feedback.angle = 123.4f;
+	feedback.ringIndex = 7;
+	feedback.link = {65000, 123456, 789, 12};
+	WireFeedback feedbackDecoded;
+	length = encodeFeedback(feedback, 9, packet, sizeof(packet));
+	CHECK(decodeFeedback(packet, length, feedbackDecoded) && angleDifference(feedbackDecoded.angle, feedback.angle) < 0.01f
+		  && feedbackDecoded.ringIndex == 7 && feedbackDecoded.link.lastSequence == 65000 && feedbackDecoded.link.received == 123456
+		  && feedbackDecoded.link.lost == 789 && feedbackDecoded.link.duplicates == 12, "feedback did not survive a round trip");
+	int64_t t1 = 0, t2 = 0, t3 = 0;
+	uint16_t pingSequence = 0;
+	length = encodePing(1234567890123LL, 77, packet, sizeof(packet));
+	CHECK(decodePing(packet, length, t1, pingSequence) && t1 == 1234567890123LL && pingSequence == 77, "ping did not survive a round trip");
+	length = encodePong(1, 2222222222222LL, 3333333333333LL, 77, packet, sizeof(packet));
+	CHECK(decodePong(packet, length, t1, t2, t3) && t1 == 1 && t2 == 2222222222222LL && t3 == 3333333333333LL, "pong did not survive a round trip");
+	uint8_t ringIndex = 0;
+	length = encodeRingIndex(WireMessage::Assign, 11, 3, packet, sizeof(packet));
+	CHECK(decodeRingIndex(packet, length, WireMessage::Assign, ringIndex) && ringIndex == 11, "assign did not survive a round trip");
+	CHECK(!decodeRingIndex(packet, length, WireMessage::Announce, ringIndex), "an assign was decoded as an announce");
+
+	// Sizes and timings
+	std::vector<State> samples;
+	std::vector<std::vector<uint8_t>> encoded;
+	for (uint32_t n = 0; n < 1024; n++) {
+		samples.push_back(randomState(random, 6));
+		length = encodeState(samples.back(), uint16_t(n), packet, sizeof(packet));
+		encoded.emplace_back(packet, packet + length);
+	}
+	size_t sixRings = encoded[0].size();
+	size_t allRings = encodeState(randomState(random, MAX_RINGS), 0, packet, sizeof(packet));
+	double encodeNanos = nanosecondsPerCall([&](uint32_t i) {
+		benchSink = float(encodeState(samples[i % samples.size()], uint16_t(i), packet, sizeof(packet)));
+	}, 200000, rounds);
+	double decodeNanos = nanosecondsPerCall([&](uint32_t i) {
+		const std::vector<uint8_t>& bytes = encoded[i % encoded.size()];
+		State st;
+		decodeState(bytes.data(), bytes.size(), st);
+		benchSink = st.target_angle[i % 6];
+	}, 200000, rounds);
+	length = encodeFeedback(feedback, 9, packet, sizeof(packet));
+	double feedbackNanos = nanosecondsPerCall([&](uint32_t i) {
+		WireFeedback out;
+		decodeFeedback(packet, length, out);
+		benchSink = out.angle + float(i);
+	}, 200000, rounds);
+
+	printf("%u random states round trip; State is %zu bytes, a full state packet %zu bytes for 6 rings and %zu for %u\n",
+		   states, sizeof(State), sixRings, allRings, unsigned(MAX_RINGS));
+	printf("per call on the host: encodeState %.0f ns, decodeState %.0f ns, decodeFeedback %.0f ns\n", encodeNanos, decodeNanos,
+		   feedbackNanos);
+	CHECK(sixRings * 2 < sizeof(State), "a 6-ring state packet is %zu bytes, not less than half of %zu", sixRings, sizeof(State));
+	CHECK(allRings <= WIRE_MAX_PACKET_SIZE, "a %u-ring state packet is %zu bytes", unsigned(MAX_RINGS), allRings);
+	return checkResult();
+}
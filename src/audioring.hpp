@@ -0,0 +1,111 @@
+#ifndef AUDIORING_HPP
+#define AUDIORING_HPP
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Single-producer/single-consumer ring of fixed-size audio blocks.
+ *
+ * The sampling task writes whole I2S blocks directly into the ring and publishes each one by bumping a
+ * sequence number, so the consumer never sees a half-written block. Every block is stored twice (at slot
+ * i and slot i + NUM_BLOCKS), which makes any run of up to NUM_BLOCKS consecutive blocks contiguous in
+ * memory and lets a window be copied out in one linear pass.
+ */
+template <typename T, uint16_t BLOCK_SAMPLES, uint16_t NUM_BLOCKS>
+class AudioBlockRing {
+private:
+	T blocks[2 * NUM_BLOCKS][BLOCK_SAMPLES] = {};
+	std::atomic<uint32_t> writeSequence{0};  // number of blocks published so far
+
+public:
+	volatile uint32_t droppedBlocks = 0;      // blocks the producer failed to record (written by producer)
+	volatile uint32_t overwrittenBlocks = 0;  // blocks lapped by the producer before they were read (written by consumer)
+
+	/**
+	 * Returns the slot the producer should record the next block into. The block is invisible to the
+	 * consumer until commitWrite() is called.
+	 */
+	T* beginWrite() {
+		return blocks[writeSequence.load(std::memory_order_relaxed) % NUM_BLOCKS];
+	}
+
+	/**
+	 * Mirrors the block returned by beginWrite() and publishes it.
+	 */
+	void commitWrite() {
+		uint32_t sequence = writeSequence.load(std::memory_order_relaxed);
+		uint16_t slot = sequence % NUM_BLOCKS;
+		memcpy(blocks[slot + NUM_BLOCKS], blocks[slot], sizeof(blocks[0]));
+		writeSequence.store(sequence + 1, std::memory_order_release);
+	}
+
+	/**
+	 * Discards the block returned by beginWrite(), e.g. after a short or failed read.
+	 */
+	void dropWrite() {
+		droppedBlocks = droppedBlocks + 1;
+	}
+
+	/**
+	 * Number of blocks published so far; block n is the (n+1)th block ever recorded.
+	 */
+	uint32_t sequence() const {
+		return writeSequence.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * Copies the `windowBlocks` blocks ending just before block `endSequence` into `dst`. Returns false
+	 * if the window has not been fully published yet, or if the producer overwrote part of it before or
+	 * while it was being copied.
+	 */
+	template <typename U>
+	bool readWindow(uint32_t endSequence, uint16_t windowBlocks, U* dst) {
+		uint32_t published = sequence();
+		if (windowBlocks > NUM_BLOCKS || endSequence < windowBlocks || endSequence > published) {
+			return false;
+		}
+		uint32_t start = endSequence - windowBlocks;
+		// The block at `published` may already be in flight, so it counts as overwriting block published - NUM_BLOCKS
+		if (published - start >= NUM_BLOCKS) {
+			overwrittenBlocks = overwrittenBlocks + (published - start - NUM_BLOCKS + 1);
+			return false;
+		}
+
+		const T* src = blocks[start % NUM_BLOCKS];
+		for (uint32_t i = 0; i < uint32_t(windowBlocks) * BLOCK_SAMPLES; i++) {
+			dst[i] = src[i];
+		}
+
+		// Make sure the copy above is complete before re-checking how far the producer has advanced
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint32_t publishedAfter = writeSequence.load(std::memory_order_relaxed);
+		if (publishedAfter - start >= NUM_BLOCKS) {
+			overwrittenBlocks = overwrittenBlocks + (publishedAfter - start - NUM_BLOCKS + 1);
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * Copies the most recent `windowBlocks` blocks into `dst`. Returns the end sequence of the window
+	 * that was copied, or 0 if not enough audio has been recorded yet.
+	 */
+	template <typename U>
+	uint32_t readLatestWindow(uint16_t windowBlocks, U* dst) {
+		const int maxAttempts = 4;  // the producer needs a whole block period to lap us, so retries are rare
+		for (int attempt = 0; attempt < maxAttempts; attempt++) {
+			uint32_t endSequence = sequence();
+			if (endSequence < windowBlocks) {
+				return 0;
+			}
+			if (readWindow(endSequence, windowBlocks, dst)) {
+				return endSequence;
+			}
+		}
+		return 0;
+	}
+};
+
+#endif // AUDIORING_HPP
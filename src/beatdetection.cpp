@@ -1,51 +1,107 @@
 #include <Arduino.h>
-#include <algorithm>  // Include for std::nth_element and std::sort
+#include <algorithm>  // Include for std::min and std::max
+#include <atomic>
 #include <cmath>      // Include for std::floor and std::ceil
 
+#include "beatdetection.h"
+#include "featurehistory.hpp"
 #include "fft.h"
-#include "state.hpp"
+#include "mailbox.hpp"
+#include "neuralonset.hpp"
+#include "quantile.hpp"
+#include "structure.hpp"
+#include "tempo.hpp"
 
 #define OUTPUT_TO_VISUALIZER 	false
 #define OUTPUT_TO_SERIAL 		true
+#define SERIAL_OUTPUT_INTERVAL 	4     // analysis frames between serial/visualizer prints (~30 per second)
+#define USE_FUSED_SPECTRAL_STAGE 	true  // kick filter, GEQ binning and post-processing in one pass (bit-identical to the separate stages)
 
-#define HEURISTIC_BUFFER_SIZE 			2048  // at 30fps this is 68 seconds of context
+// All of the timing below is in analysis frames, which arrive at ANALYSIS_FRAMES_PER_SECOND regardless of the loop rate
 #define MAXIMUM_BEATS_PER_MINUTE	 	155
 #define TYPICAL_BEATS_PER_MINUTE 		128
-#define SINGLE_BEAT_DURATION			100  // in ms, good value range is [50:150]
+#define MINIMUM_TRACKED_BPM				60
+#define MAXIMUM_TRACKED_BPM				200
+#define TEMPO_CONFIDENCE_THRESHOLD		0.2   // below this the tempo tracker is ignored and TYPICAL_BEATS_PER_MINUTE is assumed
+#define FEATURE_HISTORY_SECONDS			300   // kept in PSRAM (32 bytes per frame, ~1.2 MB at 125 fps)
+#define FEATURE_HISTORY_FALLBACK_FRAMES	1024  // ~8 seconds in internal RAM when there is no PSRAM
 const int MINIMUM_DELAY_BETWEEN_BEATS = 60000L / MAXIMUM_BEATS_PER_MINUTE;
 const int TYPICAL_DELAY_BETWEEN_BEATS = 60000L / TYPICAL_BEATS_PER_MINUTE;
 
+BeatDetectorParams beatDetectorParams;
+
 float heuristicsBuffer[HEURISTIC_BUFFER_SIZE] = {};
 uint16_t heuristicsBufferIndex = 0;
-float bufferCopy[HEURISTIC_BUFFER_SIZE] = {};
+// Normalized heuristics live around 1.0; 512 bins over [1e-3, 1e3] resolve the threshold to within 2.7%
+SlidingQuantile<512> heuristicsQuantile(1e-3, 1e3);
+
+// Lags from 200 BPM (37 frames) to 60 BPM (125 frames)
+TempoTracker<60 * ANALYSIS_FRAMES_PER_SECOND / MAXIMUM_TRACKED_BPM, 60 * ANALYSIS_FRAMES_PER_SECOND / MINIMUM_TRACKED_BPM> tempoTracker(ANALYSIS_FRAMES_PER_SECOND);
+StructureDetector<NUM_GEQ_CHANNELS> structureDetector(ANALYSIS_FRAMES_PER_SECOND);
+BeatClock beatClock(60.0 * ANALYSIS_FRAMES_PER_SECOND / TYPICAL_BEATS_PER_MINUTE,
+                    60.0 * ANALYSIS_FRAMES_PER_SECOND / MAXIMUM_TRACKED_BPM,
+                    60.0 * ANALYSIS_FRAMES_PER_SECOND / MINIMUM_TRACKED_BPM);
+
+// Minutes of per-frame features for analyses that need more context than the heuristics buffer
+FeatureHistory featureHistory;
+static_assert(sizeof(FeatureFrame::geq) == NUM_GEQ_CHANNELS, "FeatureFrame must hold every GEQ channel");
+static_assert(FEATURE_HISTORY_FALLBACK_FRAMES >= decltype(structureDetector)::SLOW_SECONDS * ANALYSIS_FRAMES_PER_SECOND,
+			  "the feature history must cover the structure detector's window");
+
+// 4 frames of 16 GEQ channels -> 8 hidden units -> onset strength, if useNeuralOnset is set; the default weights, as
+// no trained ones ship yet
+NeuralOnset<4, NUM_GEQ_CHANNELS, 8> neuralOnset;
+
+float bassFrequencies[BASS_SAMPLES / 2] = {};
+float bassFrequenciesPrev[BASS_SAMPLES / 2] = {};
 
 float spectrumFiltered[SAMPLES / 2] = {};
 float spectrumFilteredPrev[SAMPLES / 2] = {};
 
+#if !USE_FIXED_POINT_FFT && !USE_FUSED_SPECTRAL_STAGE
 static float spectrogram[NUM_GEQ_CHANNELS] = {0. };
+#endif
 
 static float fftProcessed[NUM_GEQ_CHANNELS] = { 0 };// Our calculated freq. channel result table to be used by effects
 static float fftProcessedPrev[NUM_GEQ_CHANNELS] = { 0 };// Our calculated freq. channel result table to be used by effects
 
-const float alpha_short = 1.0 / (30.0 * 5.0); // roughly 5 seconds
-const float alpha_long = 1.0 / (30.0 * 60.0); // roughly 60 seconds
+const float alpha_short = 1.0 / (ANALYSIS_FRAMES_PER_SECOND * 5.0); // roughly 5 seconds
+const float alpha_long = 1.0 / (ANALYSIS_FRAMES_PER_SECOND * 60.0); // roughly 60 seconds
 float heuristic_ema = 1.0;
+float bass_flux_ema = 1.0;
 float heuristicThreshold = 2.25; // empirical starting value for until heuristicsBuffer is populated
 bool bufferInitialized = false;
 
+uint32_t analysisFrame = 0;    // number of analysis frames processed so far
+uint32_t lastBeatFrame = 0;    // analysis frame of the most recent beat
+float lastHeuristic = 0.0;     // post-processed heuristic of the most recent analysis frame
+unsigned long lastBeatTimestamp = 0;
+unsigned long elapsedBeats = 0;
 
-float frequencies[SAMPLES / 2] = { 0. };
+uint32_t lastPrintedFrame = 0;
+bool beatSinceLastPrint = false;
+
+Mailbox<AnalysisFrame> analysisMailbox;
+// The analysis runs faster than loop() reads it, so the peaks of the frames in between are held for the next read
+std::atomic<uint32_t> analysisFrameRead{0};  // sequence of the frame readAnalysisFrame() returned last
+float peakIntensity = 0.0;
+bool beatSinceRead = false;
 
-extern State state;
+
+#if USE_FIXED_POINT_FFT
+uint32_t magnitudes[SAMPLES / 2] = {};
+#else
+float frequencies[SAMPLES / 2] = { 0. };
+#endif
 
 // extern int frame; // from main.cpp
 // extern float updatesPerSecond; // from main.cpp
 
 
 float calculateRecencyFactor() {
-	unsigned long durationSinceLastBeat = millis() - state.lastBeatTimestamp;
+	unsigned long durationSinceLastBeat = (analysisFrame - lastBeatFrame) * 1000UL / ANALYSIS_FRAMES_PER_SECOND;
 	// int referenceDuration = MINIMUM_DELAY_BETWEEN_BEATS - SINGLE_BEAT_DURATION;
-	int referenceDuration = (TYPICAL_DELAY_BETWEEN_BEATS / 2) - SINGLE_BEAT_DURATION;  // /2 is to pick up on eigth notes
+	int referenceDuration = (TYPICAL_DELAY_BETWEEN_BEATS / 2) - beatDetectorParams.singleBeatDuration;  // /2 is to pick up on eigth notes
 	float maxRecencyFactor = 1.10;
 	// float recencyFactor = constrain(1 - (float(referenceDuration) / durationSinceLastBeat), 0.0, maxRecencyFactor);
 	float recencyFactor = constrain(float(durationSinceLastBeat) / float(referenceDuration), 0.0, maxRecencyFactor);
@@ -53,88 +109,104 @@ float calculateRecencyFactor() {
 }
 
 
-float computePercentile(float buffer[HEURISTIC_BUFFER_SIZE], float percentile) {
-	// Calculate the index corresponding to the percentile
-	int index = static_cast<int>(std::ceil(percentile / 100.0 * HEURISTIC_BUFFER_SIZE) - 1);
-	index = std::max(0, std::min(index, HEURISTIC_BUFFER_SIZE - 1));
-	// Create a copy of the buffer to avoid modifying the original
-	memcpy(bufferCopy, buffer, HEURISTIC_BUFFER_SIZE * sizeof(float(0)));
-	// Use std::nth_element to rearrange elements
-	std::nth_element(bufferCopy, bufferCopy + index, bufferCopy + HEURISTIC_BUFFER_SIZE);
-	// Return the element at the index
-	return bufferCopy[index];
-}
-
-
-float computeBeatHeuristic() {
-
-	doFFT(frequencies);
+/**
+ * Run the beat heuristic on the analysis frame that doFFT() (or doFixedFFT()) just produced. Returns true if the frame is a beat.
+ */
+static bool analyzeFrame() {
+	analysisFrame++;
 
+#if USE_FIXED_POINT_FFT
+	computeKickWeightedGEQFixed(magnitudes, fftProcessed);
+#elif USE_FUSED_SPECTRAL_STAGE
+	computeKickWeightedGEQ(frequencies, fftProcessed);
+#else
 	applyKickDrumIsolationFilter(frequencies, spectrumFiltered);  // applies to spectrumFiltered in-place
 	computeSpectrogramWLED(spectrumFiltered, spectrogram); 
 
 	// computeSpectrogramWLED(frequencies, spectrogram); 
 	
 	postProcessFFTResults(spectrogram, fftProcessed);
+#endif
 
-	float entropyChange = calculateEntropyChange(fftProcessed, fftProcessedPrev);
-	float heuristic = entropyChange;
+	uint8_t geq[NUM_GEQ_CHANNELS];
+	for (int i = 0; i < NUM_GEQ_CHANNELS; i++) {
+		geq[i] = uint8_t(constrain(fftProcessed[i], 0.0f, 255.0f));
+	}
 
-	int time = millis();
+	// The frame that leaves the structure detector's window is read back from the history; this frame is pushed below
+	const uint32_t structureWindow = structureDetector.slowWindowFrames();
+	const uint8_t* leavingGeq = featureHistory.size() >= structureWindow ? featureHistory.recent(structureWindow - 1).geq : nullptr;
+	structureDetector.update(geq, leavingGeq);
+
+	float heuristic;
+	if (beatDetectorParams.useNeuralOnset) {
+		heuristic = neuralOnset.update(geq);
+	} else {
+		float entropyChange = calculateEntropyChangeWLED(fftProcessed, fftProcessedPrev);
+		heuristic = entropyChange;
+	}
 
 	// Update the EMA
-	if (time < 5000) {
-		heuristic_ema = alpha_short * heuristic + (1.0 - alpha_short) * heuristic_ema;
-	}
-	else {
-		// if (!bufferInitialized) {
-		// 	// Populate the buffer with the first 10 seconds of the heuristics
-		// 	for (int i = 0; i < HEURISTIC_BUFFER_SIZE; i++) {
-		// 		heuristicsBuffer[i] = heuristicsBuffer[i % heuristicsBufferIndex];
-		// 	}
-		// 	bufferInitialized = true;
-		// }
-		heuristic_ema = alpha_long * heuristic + (1.0 - alpha_long) * heuristic_ema;
-	}
+	float alpha = analysisFrame < 5 * ANALYSIS_FRAMES_PER_SECOND ? alpha_short : alpha_long;
+	// if (!bufferInitialized) {
+	// 	// Populate the buffer with the first 10 seconds of the heuristics
+	// 	for (int i = 0; i < HEURISTIC_BUFFER_SIZE; i++) {
+	// 		heuristicsBuffer[i] = heuristicsBuffer[i % heuristicsBufferIndex];
+	// 	}
+	// 	bufferInitialized = true;
+	// }
+	heuristic_ema = alpha * heuristic + (1.0 - alpha) * heuristic_ema;
 	heuristic /= heuristic_ema;
 
+#if USE_BASS_ANALYSIS
+	// Blend in the kick flux from the high-resolution bass spectrum, normalized the same way
+	if (doBassFFT(bassFrequencies)) {
+		float bassFlux = calculateBassFlux(bassFrequencies, bassFrequenciesPrev);
+		bass_flux_ema = alpha * bassFlux + (1.0 - alpha) * bass_flux_ema;
+		heuristic = (1.0 - beatDetectorParams.bassHeuristicWeight) * heuristic + beatDetectorParams.bassHeuristicWeight * (bassFlux / bass_flux_ema);
+	}
+#endif
+
 	// Write the heuristic to the buffer
+	if (analysisFrame == 1) {
+		heuristicsQuantile.add(0.0, beatDetectorParams.thresholdWindowFrames);  // the buffer starts out zeroed
+	}
+	heuristicsQuantile.remove(heuristicsBuffer[(heuristicsBufferIndex + HEURISTIC_BUFFER_SIZE - beatDetectorParams.thresholdWindowFrames) % HEURISTIC_BUFFER_SIZE]);
+	heuristicsQuantile.add(heuristic);
 	heuristicsBuffer[heuristicsBufferIndex] = heuristic;
 	heuristicsBufferIndex = (heuristicsBufferIndex + 1) % HEURISTIC_BUFFER_SIZE;
+	tempoTracker.update(heuristic);
 
 	// PostProcessing
 	float heuristicPostProcessed = heuristic;
 
 	// If the heuristic is above some percentile of the buffer, we have a beat
-	float fudgeFactor = 1.05;
-	float secondsPerFrame = 1. / state.updatesPerSecond;
+	float secondsPerFrame = 1. / ANALYSIS_FRAMES_PER_SECOND;
 	float typicalBeatsPerSecond = TYPICAL_BEATS_PER_MINUTE / 60.;
 	float typicalBeatsPerFrame = typicalBeatsPerSecond * secondsPerFrame;
 
-	float percentile = (1.0 - fudgeFactor * typicalBeatsPerFrame) * 100.0;
+	float percentile = (1.0 - beatDetectorParams.fudgeFactor * typicalBeatsPerFrame) * 100.0;
 
 	// float lowHeuristicsThreshold;
-	if (state.frame % 30 == 0) {
-		if (time > 30000) {
-			heuristicThreshold = computePercentile(heuristicsBuffer, percentile);
-			// lowHeuristicsThreshold = computePercentile(heuristicsBuffer, 45);
-		}
+	if (analysisFrame > 30 * ANALYSIS_FRAMES_PER_SECOND) {
+		heuristicThreshold = heuristicsQuantile.percentile(percentile);
+		// lowHeuristicsThreshold = heuristicsQuantile.percentile(45);
 	}
 
-	const bool convolveWithPreviousBeats = true;
-	const float previousBeatBonus = 0.40;
-	const bool applyRecencyFactor = true;
-
-	// Convolve the heuristics with the previous beats, counting heuristics that are ~126 beats earlier
-	// This could help to fix missing beats
-	int expectedBpm = 126;
-	int bpmWindow = 15;
-	if (convolveWithPreviousBeats) {
+	// Convolve the heuristics with the previous beats, counting heuristics that are one beat period earlier
+	// This could help to fix missing beats. Without a confident tempo estimate, assume ~126 BPM with a wide window
+	float expectedBpm = 126;
+	float bpmWindow = 15;
+	if (tempoTracker.confidence() > TEMPO_CONFIDENCE_THRESHOLD) {
+		expectedBpm = tempoTracker.bpm();
+		bpmWindow = 0.04 * expectedBpm;
+	}
+	if (beatDetectorParams.convolveWithPreviousBeats) {
 		// Find the heuristics entries from the buffer that are within expectedBpm +/- bpmWindow
 		float beatDurationMin = 60. / (expectedBpm + bpmWindow);  // number of seconds per beat
 		float beatDurationMax = 60. / (expectedBpm - bpmWindow);
-		int timestepsAgoMin = int(state.updatesPerSecond * beatDurationMin);
-		int timestepsAgoMax = int(state.updatesPerSecond * beatDurationMax);
+		int timestepsAgoMin = int(ANALYSIS_FRAMES_PER_SECOND * beatDurationMin);
+		int timestepsAgoMax = int(ANALYSIS_FRAMES_PER_SECOND * beatDurationMax);
 
 		// Sum the heuristics in the range
 		float avgHeuristicInWindow = 0.0;
@@ -147,20 +219,69 @@ float computeBeatHeuristic() {
 		avgHeuristicInWindow /= (timestepsAgoMax - timestepsAgoMin + 1);
 
 		if (avgHeuristicInWindow > heuristicThreshold) {
-			heuristicPostProcessed += previousBeatBonus * maxHeuristicInWindow;
+			heuristicPostProcessed += beatDetectorParams.previousBeatBonus * maxHeuristicInWindow;
 		}
 	}
 
 		// float heuristicThreshold = 1.5 * heuristic_ema;
-	if (applyRecencyFactor) {
+	if (beatDetectorParams.applyRecencyFactor) {
 		heuristicPostProcessed *= calculateRecencyFactor();
 	}
-	if (heuristicPostProcessed > heuristicThreshold && millis() - state.lastBeatTimestamp > SINGLE_BEAT_DURATION) {
-		state.lastBeatTimestamp = millis();
+	bool isBeat = false;
+	if (heuristicPostProcessed > heuristicThreshold && analysisFrame - lastBeatFrame > beatDetectorParams.singleBeatDuration * ANALYSIS_FRAMES_PER_SECOND / 1000) {
+		lastBeatFrame = analysisFrame;
+		lastBeatTimestamp = millis();
 		// Serial.print("BEAT (threshold) ");
 		// Serial.println(heuristicThreshold);
-		state.elapsedBeats++;
+		elapsedBeats++;
+		isBeat = true;
 	}
+	lastHeuristic = heuristicPostProcessed;
+
+	FeatureFrame features;
+	features.sequence = analysisFrame;
+	features.heuristic = heuristic;
+	for (int i = 0; i < NUM_GEQ_CHANNELS; i++) {
+		features.energy += fftProcessed[i];
+	}
+	features.energy /= NUM_GEQ_CHANNELS;
+	memcpy(features.geq, geq, sizeof(geq));
+	features.isBeat = isBeat;
+	featureHistory.push(features);
+
+	bool tempoConfident = tempoTracker.confidence() > TEMPO_CONFIDENCE_THRESHOLD;
+	beatClock.update(isBeat, tempoTracker.period(), tempoConfident ? tempoTracker.confidence() : 0.0);
+
+	// Start the peaks over once loop() has read the previous frame. A read that races with this repeats a peak in
+	// the next frame rather than losing one.
+	if (analysisFrameRead.load(std::memory_order_acquire) + 1 >= analysisFrame) {
+		peakIntensity = 0.0;
+		beatSinceRead = false;
+	}
+	peakIntensity = std::max(peakIntensity, heuristicPostProcessed);
+	beatSinceRead = beatSinceRead || isBeat;
+
+	AnalysisFrame frame;
+	frame.sequence = analysisFrame;
+	frame.isBeat = isBeat;
+	frame.intensity = heuristicPostProcessed;
+	frame.peakIntensity = peakIntensity;
+	frame.beatSinceRead = beatSinceRead;
+	frame.lastBeatTimestamp = lastBeatTimestamp;
+	frame.elapsedBeats = elapsedBeats;
+	frame.bpm = tempoTracker.bpm();
+	frame.tempoConfidence = tempoTracker.confidence();
+	frame.beatPhase = beatClock.beatPhase();
+	frame.beatPeriod = beatClock.beatPeriod() * 1000.0 / ANALYSIS_FRAMES_PER_SECOND;
+	frame.nextBeatTimestamp = millis() + (unsigned long)(beatClock.framesToNextBeat() * 1000.0 / ANALYSIS_FRAMES_PER_SECOND);
+	frame.beatClockLocked = beatClock.locked();
+	frame.section = uint8_t(structureDetector.section());
+	frame.tension = structureDetector.tension();
+	frame.lastOnsetTimestamp = getLastOnsetTimestamp();
+	frame.onsetCount = getOnsetCount();
+	memcpy(frame.geq, geq, sizeof(geq));
+	frame.publishedMicros = micros();
+	analysisMailbox.publish(frame);
 
 
 	// float emaThreshold = 1.3;
@@ -183,6 +304,31 @@ float computeBeatHeuristic() {
 
 	// return heuristic;
 
+	return isBeat;
+}
+
+
+/**
+ * Analyze every hop of audio recorded since the last call and return the heuristic of the most recent one.
+ * The analysis rate is set by the audio, not by how often this is called.
+ */
+float computeBeatHeuristic() {
+#if USE_FIXED_POINT_FFT
+	while (doFixedFFT(magnitudes)) {
+#else
+	while (doFFT(frequencies)) {
+#endif
+		beatSinceLastPrint |= analyzeFrame();
+	}
+	float heuristicPostProcessed = lastHeuristic;
+
+	if (analysisFrame - lastPrintedFrame < SERIAL_OUTPUT_INTERVAL) {
+		return heuristicPostProcessed;
+	}
+	lastPrintedFrame = analysisFrame;
+	bool sawBeat = beatSinceLastPrint;
+	beatSinceLastPrint = false;
+
 	#if OUTPUT_TO_VISUALIZER
 		String foo = "[SPECTROGRAM]:";
 		for (uint16_t i = 0; i < NUM_BANDS; i++) {
@@ -207,10 +353,64 @@ float computeBeatHeuristic() {
 		}
 		Serial.println("");
 
-		if (heuristicPostProcessed > heuristicThreshold) {
+		if (sawBeat) {
 			Serial.println("BEAT! ********************************************************");
 		}
 	#endif // OUTPUT_TO_SERIAL
 
 	return heuristicPostProcessed;
-}
\ No newline at end of file
+}
+
+
+static void analysisTask(void*) {
+	while (true) {
+		// Woken by the sampling task whenever a hop of audio is complete; the timeout is just a safety net
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(20));
+		computeBeatHeuristic();
+	}
+}
+
+/**
+ * Start the FFT -> beat heuristic pipeline in its own task, next to the sampling task on core 0.
+ * Must be called after setupAsyncSampling().
+ */
+void setupBeatDetection() {
+	featureHistory.begin(FEATURE_HISTORY_SECONDS * ANALYSIS_FRAMES_PER_SECOND, FEATURE_HISTORY_FALLBACK_FRAMES);
+	Serial.printf("Feature history: %u frames in %s\n", unsigned(featureHistory.capacity()), featureHistory.inPsram() ? "PSRAM" : "internal RAM");
+
+	TaskHandle_t analysisTaskHandle;
+	xTaskCreatePinnedToCore(
+		analysisTask,
+		"beat_analysis",
+		8192,
+		NULL,
+		1,
+		&analysisTaskHandle,
+		0
+	);
+	setAudioHopListener(analysisTaskHandle);
+}
+
+/**
+ * Replace the beat detector's tunables. Must be called before the first frame is analyzed.
+ */
+void setBeatDetectorParams(const BeatDetectorParams& newParams) {
+	beatDetectorParams = newParams;
+	beatDetectorParams.thresholdWindowFrames = constrain(beatDetectorParams.thresholdWindowFrames, 1, HEURISTIC_BUFFER_SIZE);
+}
+
+const BeatDetectorParams& getBeatDetectorParams() {
+	return beatDetectorParams;
+}
+
+/**
+ * Copy the most recent analysis frame; returns false until the first frame has been analyzed. Starts the frame's
+ * peakIntensity and beatSinceRead over, so call it from loop() only.
+ */
+bool readAnalysisFrame(AnalysisFrame& frame) {
+	if (!analysisMailbox.read(frame)) {
+		return false;
+	}
+	analysisFrameRead.store(frame.sequence, std::memory_order_release);
+	return true;
+}
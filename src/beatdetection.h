@@ -1,3 +1,51 @@
-#define SAMPLES 512
+#ifndef BEATDETECTION_H
+#define BEATDETECTION_H
 
-float computeBeatHeuristic();
\ No newline at end of file
+#include <Arduino.h>
+#include "fft.h"
+
+#define HEURISTIC_BUFFER_SIZE 4096  // at 125 frames/s this is 33 seconds of context
+#define USE_NEURAL_ONSET false  // int8 kernel over recent GEQ frames instead of the entropy change heuristic; untrained, it computes low-band flux
+
+// Tunables of the beat detector; the defaults are the values tuned by ear at the speaker
+struct BeatDetectorParams {
+	uint16_t thresholdWindowFrames = HEURISTIC_BUFFER_SIZE;  // frames the percentile threshold is taken over, at most HEURISTIC_BUFFER_SIZE
+	uint16_t singleBeatDuration = 100;      // in ms, good value range is [50:150]
+	float fudgeFactor = 1.05;               // scales the share of frames expected to be beats when picking the threshold percentile
+	float previousBeatBonus = 0.40;         // weight of the heuristic one beat period earlier
+	float bassHeuristicWeight = 0.5;        // share of the heuristic that comes from the high-resolution bass flux
+	bool convolveWithPreviousBeats = true;
+	bool applyRecencyFactor = true;
+	bool useNeuralOnset = USE_NEURAL_ONSET; // NeuralOnset (neuralonset.hpp) as the onset function, so beateval can score it against the heuristic
+};
+
+// Compact summary of one analysis frame, published by the analysis task for loop() to read
+struct AnalysisFrame {
+	uint32_t sequence = 0;                  // analysis frame index
+	uint32_t publishedMicros = 0;           // micros() when the frame was published, for measuring handoff latency
+	bool isBeat = false;                    // whether this frame was detected as a beat
+	float intensity = 0.0f;                 // post-processed beat heuristic
+	float peakIntensity = 0.0f;             // highest intensity of the frames since the one loop() read last, this one included
+	bool beatSinceRead = false;             // whether any of those frames was a beat
+	unsigned long lastBeatTimestamp = 0;    // millis() of the most recent beat
+	unsigned long elapsedBeats = 0;
+	float bpm = 0.0f;                       // current tempo estimate
+	float tempoConfidence = 0.0f;           // 0 (no periodicity) to 1; the estimate is only used above TEMPO_CONFIDENCE_THRESHOLD
+	float beatPhase = 0.0f;                 // beat clock phase, 0 on the beat and approaching 1 just before the next one
+	float beatPeriod = 0.0f;                // beat clock period in ms
+	unsigned long nextBeatTimestamp = 0;    // millis() at which the beat clock predicts the next beat
+	bool beatClockLocked = false;           // whether the beat clock is following the detected beats
+	uint8_t section = 0;                    // Section from structure.hpp
+	float tension = 0.0f;                   // 0 to 1, how much the music is building toward a drop
+	unsigned long lastOnsetTimestamp = 0;   // millis() of the most recent onset from the low-latency detector
+	uint32_t onsetCount = 0;
+	uint8_t geq[NUM_GEQ_CHANNELS] = {};     // post-processed GEQ bands, 0-255
+};
+
+float computeBeatHeuristic();
+void setupBeatDetection();
+bool readAnalysisFrame(AnalysisFrame& frame);
+void setBeatDetectorParams(const BeatDetectorParams& params);
+const BeatDetectorParams& getBeatDetectorParams();
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef CLOCKSYNC_HPP
+#define CLOCKSYNC_HPP
+
+#include <math.h>
+#include <stdint.h>
+
+// A ring's view of the master's clock, as of the last accepted sample
+struct ClockEstimate {
+	static const uint32_t SETTLING_SAMPLES = 16;  // until the offset has settled
+
+	double offset = 0.0;     // master minus local time at `anchor`, in us
+	double drift = 0.0;      // how much faster the master's clock runs, e.g. 20e-6 for 20 ppm
+	int64_t anchor = 0;      // local time of the last accepted sample
+	uint32_t samples = 0;    // accepted samples so far
+	uint32_t roundTrip = 0;  // of the last accepted sample, in us
+
+	bool synchronized() const {
+		return samples >= 4;
+	}
+
+	/**
+	 * Time between pings: quick until the estimate has settled, then relaxed
+	 */
+	uint32_t pingIntervalMicros() const {
+		return samples < SETTLING_SAMPLES ? 100000 : 500000;
+	}
+
+	/**
+	 * Master time corresponding to a local time
+	 */
+	int64_t toMaster(int64_t local) const {
+		return local + int64_t(llround(offset + drift * double(local - anchor)));
+	}
+};
+
+/**
+ * Estimates the offset and drift of the master's clock from timestamped ping/pong exchanges, NTP style: the ring
+ * stamps the ping when it sends it (t1), the master when it receives it (t2) and sends the pong (t3), and the ring
+ * when the pong arrives (t4).
+ *
+ * Only samples whose round trip is close to the shortest one seen recently are used, since queueing delays on
+ * either side make the rest asymmetric. The offset is pulled toward each accepted sample; the drift is measured
+ * from how far the offset moved over at least DRIFT_WINDOW, since a few hundred microseconds of noise per sample
+ * would swamp a per-sample rate estimate. That window starts once the offset has settled: the first sample sets the
+ * offset outright, and before the shortest round trip is known it may be milliseconds off. Between samples (and across lost pongs) the estimate keeps following
+ * the master at the learned rate.
+ */
+class ClockSync {
+private:
+	static constexpr double PHASE_GAIN = 0.2;
+	static constexpr double DRIFT_GAIN = 0.5;
+	static constexpr double DRIFT_WINDOW = 20e6;         // us of samples the drift is measured over
+	static constexpr double MAX_DRIFT = 500e-6;          // crystals are specified to 10-50 ppm
+	static constexpr double RESYNC_ERROR = 50000.0;      // us; larger jumps mean the master restarted
+	static const uint32_t ROUND_TRIP_MARGIN = 1000;      // us above the shortest round trip a sample may take
+	static const uint8_t MAX_REJECTED = 8;               // then the shortest round trip is relearned
+
+	ClockEstimate current;
+	int64_t driftReferenceTime = 0;
+	double driftReferenceOffset = 0.0;
+	bool driftMeasured = false;
+	uint32_t shortestRoundTrip = UINT32_MAX;
+	uint8_t rejectedInARow = 0;
+
+public:
+	/**
+	 * Adds the timestamps of one ping/pong exchange; t1 and t4 are local, t2 and t3 are the master's. Returns true
+	 * if the sample was used.
+	 */
+	bool addSample(int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+		int64_t roundTrip = (t4 - t1) - (t3 - t2);
+		if (roundTrip < 0 || roundTrip > INT32_MAX) {
+			return false;
+		}
+
+		// Let the shortest round trip creep up, so a single lucky sample does not lock out everything after it
+		if (shortestRoundTrip != UINT32_MAX) {
+			shortestRoundTrip += 1 + shortestRoundTrip / 256;
+		}
+		if (uint32_t(roundTrip) < shortestRoundTrip) {
+			shortestRoundTrip = uint32_t(roundTrip);
+		}
+		if (uint32_t(roundTrip) > shortestRoundTrip + ROUND_TRIP_MARGIN) {
+			if (++rejectedInARow >= MAX_REJECTED) {
+				shortestRoundTrip = uint32_t(roundTrip);  // the link got slower for good; use the samples after this one
+				rejectedInARow = 0;
+			}
+			return false;
+		}
+		rejectedInARow = 0;
+
+		double measured = 0.5 * (double(t2 - t1) + double(t3 - t4));
+		int64_t midpoint = t1 + (t4 - t1) / 2;
+
+		double predicted = current.offset + current.drift * double(midpoint - current.anchor);
+		double error = measured - predicted;
+		if (current.samples == 0 || fabs(error) > RESYNC_ERROR) {
+			current = ClockEstimate();
+			current.offset = measured;
+			driftMeasured = false;
+		}
+		else {
+			// A plain running mean over the first samples, then exponential
+			double gain = fmax(PHASE_GAIN, 1.0 / (current.samples + 1));
+			current.offset = predicted + gain * error;
+		}
+		current.anchor = midpoint;
+
+		double elapsed = double(midpoint - driftReferenceTime);
+		if (current.samples < ClockEstimate::SETTLING_SAMPLES) {
+			driftReferenceTime = midpoint;
+			driftReferenceOffset = current.offset;
+		} else if (elapsed >= DRIFT_WINDOW) {
+			double observed = (current.offset - driftReferenceOffset) / elapsed;
+			current.drift = driftMeasured ? current.drift + DRIFT_GAIN * (observed - current.drift) : observed;
+			current.drift = fmin(fmax(current.drift, -MAX_DRIFT), MAX_DRIFT);
+			driftMeasured = true;
+			driftReferenceTime = midpoint;
+			driftReferenceOffset = current.offset;
+		}
+		current.roundTrip = uint32_t(roundTrip);
+		current.samples++;
+		return true;
+	}
+
+	const ClockEstimate& estimate() const {
+		return current;
+	}
+};
+
+#endif // CLOCKSYNC_HPP
@@ -0,0 +1,69 @@
+#ifndef CONSTMATH_HPP
+#define CONSTMATH_HPP
+
+/**
+ * constexpr versions of the few libm functions needed to build the spectral tables at compile time.
+ *
+ * Arguments are range-reduced and the Taylor series are summed in double to well below float precision, so table
+ * entries rounded to float match libm to within 1 ulp (occasionally differing where libm itself is not correctly
+ * rounded). Not meant for runtime use.
+ */
+namespace constmath {
+
+constexpr double pi = 3.14159265358979323846;
+constexpr double ln2 = 0.69314718055994530942;
+
+constexpr double abs(double x) {
+	return x < 0 ? -x : x;
+}
+
+// Reduce x into [-pi, pi]
+constexpr double reduceAngle(double x) {
+	double turns = x / (2.0 * pi);
+	long long whole = (long long)(turns < 0 ? turns - 0.5 : turns + 0.5);
+	return x - double(whole) * 2.0 * pi;
+}
+
+constexpr double sin(double x) {
+	x = reduceAngle(x);
+	double term = x;
+	double sum = x;
+	for (int n = 1; n < 30; n++) {
+		term *= -x * x / double((2 * n) * (2 * n + 1));
+		sum += term;
+	}
+	return sum;
+}
+
+constexpr double cos(double x) {
+	x = reduceAngle(x);
+	double term = 1.0;
+	double sum = 1.0;
+	for (int n = 1; n < 30; n++) {
+		term *= -x * x / double((2 * n - 1) * (2 * n));
+		sum += term;
+	}
+	return sum;
+}
+
+// exp(x) = 2^k * exp(r) with |r| <= ln2 / 2
+constexpr double exp(double x) {
+	if (x < -700.0) {
+		return 0.0;
+	}
+	long long k = (long long)(x / ln2 + (x < 0 ? -0.5 : 0.5));
+	double r = x - double(k) * ln2;
+	double term = 1.0;
+	double sum = 1.0;
+	for (int n = 1; n < 25; n++) {
+		term *= r / double(n);
+		sum += term;
+	}
+	for (; k > 0; k--) sum *= 2.0;
+	for (; k < 0; k++) sum *= 0.5;
+	return sum;
+}
+
+} // namespace constmath
+
+#endif // CONSTMATH_HPP
@@ -0,0 +1,66 @@
+#ifndef DECIMATOR_HPP
+#define DECIMATOR_HPP
+
+#include <math.h>
+#include <stdint.h>
+
+/**
+ * Polyphase FIR decimator.
+ *
+ * A windowed-sinc low-pass of FACTOR * TAPS_PER_PHASE taps is split into FACTOR phases of TAPS_PER_PHASE taps
+ * each, so only the samples that survive decimation are ever computed. Each phase keeps its own mirrored delay
+ * line, which keeps the inner dot product contiguous.
+ */
+template <uint16_t FACTOR, uint16_t TAPS_PER_PHASE>
+class PolyphaseDecimator {
+private:
+	static const uint16_t TAPS = FACTOR * TAPS_PER_PHASE;
+
+	float coefficients[FACTOR][TAPS_PER_PHASE];          // coefficients[p][j] = h[j * FACTOR + p]
+	float history[FACTOR][2 * TAPS_PER_PHASE] = {};      // per-phase delay lines, newest sample first
+	uint16_t position = 0;
+
+public:
+	/**
+	 * Designs a Blackman-windowed low-pass with its cutoff at `cutoff` times the input Nyquist frequency
+	 */
+	PolyphaseDecimator(float cutoff = 1.0f / FACTOR) {
+		float h[TAPS];
+		float sum = 0.0f;
+		for (uint16_t k = 0; k < TAPS; k++) {
+			float t = float(k) - float(TAPS - 1) / 2.0f;
+			float sinc = (t == 0.0f) ? cutoff : sinf(float(M_PI) * cutoff * t) / (float(M_PI) * t);
+			float blackman = 0.42f - 0.5f * cosf(2.0f * float(M_PI) * k / (TAPS - 1)) + 0.08f * cosf(4.0f * float(M_PI) * k / (TAPS - 1));
+			h[k] = sinc * blackman;
+			sum += h[k];
+		}
+		for (uint16_t k = 0; k < TAPS; k++) {
+			coefficients[k % FACTOR][k / FACTOR] = h[k] / sum;  // unity gain at DC
+		}
+	}
+
+	/**
+	 * Filters and decimates `count` input samples (a multiple of FACTOR) into count / FACTOR output samples
+	 */
+	template <typename T>
+	void process(const T* in, uint16_t count, float* out) {
+		for (uint16_t m = 0; m < count / FACTOR; m++) {
+			// Phase p sees x[mM - p]; the newest sample of this group of FACTOR inputs goes to phase 0
+			const T* group = in + m * FACTOR;
+			position = (position == 0) ? TAPS_PER_PHASE - 1 : position - 1;
+			float y = 0.0f;
+			for (uint16_t p = 0; p < FACTOR; p++) {
+				float x = float(group[FACTOR - 1 - p]);
+				history[p][position] = x;
+				history[p][position + TAPS_PER_PHASE] = x;
+				const float* line = &history[p][position];
+				for (uint16_t j = 0; j < TAPS_PER_PHASE; j++) {
+					y += coefficients[p][j] * line[j];
+				}
+			}
+			out[m] = y;
+		}
+	}
+};
+
+#endif // DECIMATOR_HPP
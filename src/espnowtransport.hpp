@@ -0,0 +1,79 @@
+#ifndef ESPNOWTRANSPORT_HPP
+#define ESPNOWTRANSPORT_HPP
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <string.h>
+
+#include "transport.hpp"
+
+/**
+ * Transport over ESP-NOW, in long-range mode at full power. ESP-NOW has a single set of callbacks, so there can only
+ * be one of these.
+ */
+class EspNowTransport : public Transport {
+private:
+	uint8_t channel;
+
+	static EspNowTransport* instance;
+
+	static void onDataRecv(const uint8_t* mac, const uint8_t* data, int length) {
+		if (instance) {
+			instance->received(mac, data, length);
+		}
+	}
+
+	static void IRAM_ATTR onDataSent(const uint8_t* mac, esp_now_send_status_t status) {
+		if (instance) {
+			instance->sent(status == ESP_NOW_SEND_SUCCESS);
+		}
+	}
+
+public:
+	EspNowTransport(uint8_t channel) : channel(channel) {}
+
+	bool begin() override {
+		instance = this;
+		WiFi.mode(WIFI_STA);
+		esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_LR);
+		esp_wifi_set_promiscuous(false);
+		esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+
+		esp_wifi_set_mode(WIFI_MODE_STA);   // or AP / STA+AP
+		esp_wifi_start();
+		esp_wifi_set_max_tx_power(80);      // 20 dBm (80 × 0.25)
+
+		if (esp_now_init() != ESP_OK) {     // ESP-NOW packets now use ≤20 dBm
+			return false;
+		}
+		esp_now_register_recv_cb(onDataRecv);
+		esp_now_register_send_cb(onDataSent);
+		return true;
+	}
+
+	void macAddress(uint8_t mac[6]) override {
+		WiFi.macAddress(mac);
+	}
+
+	bool addPeer(const uint8_t mac[6]) override {
+		esp_now_peer_info_t peerInfo = {};
+		memcpy(peerInfo.peer_addr, mac, 6);
+		peerInfo.channel = channel;
+		peerInfo.encrypt = false;
+		return esp_now_add_peer(&peerInfo) == ESP_OK;
+	}
+
+	bool removePeer(const uint8_t mac[6]) override {
+		return esp_now_del_peer(mac) == ESP_OK;
+	}
+
+	bool send(const uint8_t mac[6], const uint8_t* data, size_t length) override {
+		return esp_now_send(mac, data, length) == ESP_OK;
+	}
+};
+
+EspNowTransport* EspNowTransport::instance = nullptr;
+
+#endif // ESPNOWTRANSPORT_HPP
@@ -0,0 +1,113 @@
+#ifndef FEATUREHISTORY_HPP
+#define FEATUREHISTORY_HPP
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <stdint.h>
+#include <string.h>
+
+// Per-frame summary kept for long-context analysis. 32 bytes, the S3's data cache line, and the ring is allocated on a
+// 32-byte boundary, so reading back one frame fetches a single line from PSRAM.
+struct FeatureFrame {
+	uint32_t sequence = 0;       // analysis frame index
+	float heuristic = 0.0f;      // normalized beat heuristic, before post-processing
+	float energy = 0.0f;         // mean of the post-processed GEQ channels
+	uint8_t geq[16] = {};        // post-processed GEQ channels, 0-255
+	bool isBeat = false;
+	uint8_t reserved[3] = {};
+};
+#define FEATURE_FRAME_ALIGNMENT 32
+static_assert(sizeof(FeatureFrame) == FEATURE_FRAME_ALIGNMENT, "FeatureFrame should stay one cache line");
+
+/**
+ * Ring of FeatureFrames covering several minutes of analysis, kept in PSRAM.
+ *
+ * Only the analysis task touches it: frames are appended once per hop, the structure detector reads back the one
+ * frame leaving its window per hop, and long windows are read out in one or two memcpy()s into a caller-provided
+ * buffer in internal RAM, so the slow PSRAM is only ever accessed sequentially and the per-frame working set stays in
+ * SRAM. Without PSRAM it falls back to a short ring in internal RAM.
+ */
+class FeatureHistory {
+private:
+	FeatureFrame* frames = nullptr;
+	uint32_t maxFrames = 0;
+	uint32_t pushed = 0;       // number of frames appended so far
+	bool psram = false;
+
+public:
+	/**
+	 * Allocates room for `desiredFrames` frames in PSRAM, or for `fallbackFrames` in internal RAM if there is no PSRAM.
+	 * Returns false if neither allocation succeeded.
+	 */
+	bool begin(uint32_t desiredFrames, uint32_t fallbackFrames) {
+		if (psramFound()) {
+			frames = static_cast<FeatureFrame*>(heap_caps_aligned_alloc(FEATURE_FRAME_ALIGNMENT, desiredFrames * sizeof(FeatureFrame),
+																		 MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+			if (frames != nullptr) {
+				maxFrames = desiredFrames;
+				psram = true;
+				return true;
+			}
+		}
+		frames = static_cast<FeatureFrame*>(heap_caps_aligned_alloc(FEATURE_FRAME_ALIGNMENT, fallbackFrames * sizeof(FeatureFrame),
+																	 MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+		maxFrames = frames != nullptr ? fallbackFrames : 0;
+		return frames != nullptr;
+	}
+
+	void push(const FeatureFrame& frame) {
+		if (maxFrames == 0) {
+			return;
+		}
+		frames[pushed % maxFrames] = frame;
+		pushed++;
+	}
+
+	/**
+	 * Number of frames that can currently be read back
+	 */
+	uint32_t size() const {
+		return pushed < maxFrames ? pushed : maxFrames;
+	}
+
+	uint32_t capacity() const {
+		return maxFrames;
+	}
+
+	bool inPsram() const {
+		return psram;
+	}
+
+	/**
+	 * The frame `framesAgo` frames before the newest one (0 is the newest). Must be less than size().
+	 */
+	const FeatureFrame& recent(uint32_t framesAgo) const {
+		return frames[(pushed - 1 - framesAgo) % maxFrames];
+	}
+
+	/**
+	 * Copies the most recent `count` frames, oldest first, into `dst`. Returns the number of frames copied, which
+	 * is less than `count` if the history does not reach back that far yet.
+	 */
+	uint32_t readLatest(uint32_t count, FeatureFrame* dst) const {
+		uint32_t available = size();
+		if (count > available) {
+			count = available;
+		}
+		if (count == 0) {
+			return 0;
+		}
+		uint32_t start = (pushed - count) % maxFrames;
+		uint32_t firstRun = maxFrames - start;
+		if (firstRun >= count) {
+			memcpy(dst, &frames[start], count * sizeof(FeatureFrame));
+		}
+		else {
+			memcpy(dst, &frames[start], firstRun * sizeof(FeatureFrame));
+			memcpy(dst + firstRun, frames, (count - firstRun) * sizeof(FeatureFrame));
+		}
+		return count;
+	}
+};
+
+#endif // FEATUREHISTORY_HPP
@@ -7,22 +7,30 @@
 #include <I2S.h>
 #include <cmath> 
 
+#include "audioring.hpp"
+#include "decimator.hpp"
+#include "fixedfft.hpp"
+#include "fft.h"
+#include "onset.hpp"
+#include "realfft.hpp"
+#include "spectral.hpp"
+
 #define AUDIO_IN_PIN 		35
 
-// FFT parameters
-#define SAMPLES 			512		// Must be a power of 2
-#define BUFFER_LENGTH   	512		// Length of the cyclic buffer for reading data; must be at least SAMPLES length
+// FFT parameters (SAMPLES, NUM_BANDS and NUM_GEQ_CHANNELS are defined in fft.h)
+#define BLOCK_SAMPLES 		64		// Samples per recorded block; the sampling task hands these to the FFT whole
+#define RING_BLOCKS 		32		// Number of blocks kept in the audio ring; lets the analysis fall up to ~90ms behind the sampling task
 // #define SAMPLING_FREQ 		23000	// Max sampling frequency of the mic if using adc1_get_raw()
-# define SAMPLING_FREQ 	    16000U
+// SAMPLING_FREQ (16 kHz for the PDM mic) is defined in fft.h
 // #define SAMPLING_FREQ 	5900 	// Max sampling frequency of the mic if using analogRead()
 #define AMPLITUDE 			100     // Audio amplitude scaling factor
 #define NOISE 				200		// Can be used as a basic noise filter
-#define NUM_BANDS 			8       // Number of bands in the frequency spectrogram
 #define USE_AVERAGING 		true	// Whether to use exponential moving average to smooth out the noise levels
 #define SPECTRUM_EMA_ALPHA 	0.7
 
 #define USE_WLED_FFT        true    // Whether to use the WLED FFT algorithm
-#define NUM_GEQ_CHANNELS 	16 
+#define USE_REAL_FFT        true    // Whether to use the real-input FFT engine (false falls back to ArduinoFFT)
+#define USE_ONSET_DETECTOR  true    // Whether to run the low-latency biquad onset detector in the sampling task
 
 // ADC parameters
 #ifdef CONFIG_IDF_TARGET_ESP32
@@ -41,13 +49,14 @@
 #define SAMPLE_BITS 16
 #define WAV_HEADER_SIZE 44
 #define VOLUME_GAIN 2
+#define SAMPLING_TASK_STACK 4096  // bytes; the onset detector and the bass decimator run on it for every block
 
 
 
 
 // WLED FFT params
 static float fftResultPink[NUM_GEQ_CHANNELS] = { 1.70f, 1.71f, 1.73f, 1.78f, 1.68f, 1.56f, 1.55f, 1.63f, 1.79f, 1.62f, 1.80f, 2.06f, 2.47f, 3.35f, 6.83f, 9.55f }; // Table of multiplication factors so that we can even out the frequency response.
-static uint8_t FFTScalingMode = 3;            // 0 none; 1 optimized logarithmic; 2 optimized linear; 3 optimized square root
+#define FFT_SCALING_MODE 3                      // 0 none; 1 optimized logarithmic; 2 optimized linear; 3 optimized square root
 #define FFT_DOWNSCALE 0.46f                             // downscaling factor for FFT results - for "Flat-Top" window @22Khz, new freq channels
 #define LOG_256  5.54517744f
 static uint8_t soundAgc = 1;                  // Automagic gain control: 0 - none, 1 - normal, 2 - vivid, 3 - lazy (config value)
@@ -57,55 +66,26 @@ static uint8_t inputLevel = 128;              // UI slider value
 static uint16_t decayTime = 1400;             // int: decay time in milliseconds.  Default 1.40sec
 bool limiterOn = false;                        // limiter on/off
 
-// Cyclic buffer for storing audio samples
-volatile uint16_t buffer[SAMPLES];
-volatile uint16_t lastIndex = 0;
+// Block ring for handing audio from the sampling task to the FFT
+static_assert(SAMPLES % BLOCK_SAMPLES == 0, "SAMPLES must be a whole number of blocks");
+static_assert(RING_BLOCKS * BLOCK_SAMPLES >= SAMPLES, "Audio ring must hold at least SAMPLES");
+static_assert(HOP_SAMPLES % BLOCK_SAMPLES == 0, "HOP_SAMPLES must be a whole number of blocks");
+const uint16_t WINDOW_BLOCKS = SAMPLES / BLOCK_SAMPLES;
+const uint16_t HOP_BLOCKS = HOP_SAMPLES / BLOCK_SAMPLES;
+uint32_t nextWindowEnd = WINDOW_BLOCKS;  // ring sequence at which the next analysis window ends
+uint32_t lastWindowEnd = 0;              // ring sequence at which the most recent analysis window ended
+TaskHandle_t volatile hopListener = NULL;  // task to wake whenever a new analysis hop has been recorded
+TaskHandle_t samplingTaskHandle = NULL;
+AudioBlockRing<int16_t, BLOCK_SAMPLES, RING_BLOCKS> audioRing;  // signed 16-bit PCM, after VOLUME_GAIN
 
 // Sampling and FFT stuff
 const unsigned int sampling_period_us = round(1000000. / SAMPLING_FREQ);
 const unsigned int sampling_period_ms = round(1000. / SAMPLING_FREQ);
-const float scaleFactor = float(SAMPLES / (2.0 * 256.0)); // Calculate the scale factor based on new SAMPLES
-
-// The nth frequency bin has frequency = (n) * (sampling frequency / 2) / (number of samples)
-// const float binFrequencySize = (SAMPLING_FREQ / 2.0) / SAMPLES;
-const float binFrequencySize = SAMPLING_FREQ / SAMPLES;
-
-// The MGSEQ7 has bands at 63Hz, 160Hz, 400Hz, 1kHz, 2.5kHz, 6.25kHz, 16kHz
-const int bandsHz[NUM_BANDS] = {
-	63,
-	160,
-	400,
-	1000,
-	2500,
-	6250,
-	16000
-};
-const int bandLimitsHz[NUM_BANDS - 1] = {  // center-aligned
-	(bandsHz[0] + bandsHz[1]) / 2,
-	(bandsHz[1] + bandsHz[2]) / 2,
-	(bandsHz[2] + bandsHz[3]) / 2,
-	(bandsHz[3] + bandsHz[4]) / 2,
-	(bandsHz[4] + bandsHz[5]) / 2,
-	(bandsHz[5] + bandsHz[6]) / 2
-};
-// const int bandLimitsHz[NUM_BANDS - 1] = {  // right-aligned
-//     (bandsHz[0]),
-//     (bandsHz[1]),
-//     (bandsHz[2]),
-//     (bandsHz[3]),
-//     (bandsHz[4]),
-//     (bandsHz[5]) //,
-//     // (bandsHz[6]) / 2
-// };
-const int bandLimits[7] = {  // band limits which are invariant under number of samples
-	int(3 * scaleFactor),
-	int(6 * scaleFactor),
-	int(13 * scaleFactor),
-	int(27 * scaleFactor),
-	int(55 * scaleFactor),
-	int(112 * scaleFactor),
-	int(229 * scaleFactor)
-};
+// FFT size and sample rate dependent tables (twiddles, windows, kick weights, band-to-bin maps), built at compile time
+using Spectrum = SpectralAnalyzer<SAMPLES, SAMPLING_FREQ>;
+static_assert(!USE_FIXED_POINT_FFT || USE_REAL_FFT, "The fixed-point FFT reads the int16_t window of the real FFT path");
+using BassSpectrum = SpectralAnalyzer<BASS_SAMPLES, BASS_SAMPLING_FREQ>;
+static_assert(NUM_GEQ_CHANNELS == SPECTRAL_GEQ_CHANNELS && NUM_BANDS == SPECTRAL_LEGACY_BANDS, "Band counts must match spectral.hpp");
 
 #if USE_WLED_FFT
 static float amplitudes[NUM_GEQ_CHANNELS] = {};
@@ -119,13 +99,38 @@ static float avgAmplitudes[NUM_BANDS] = {};
 
 float avgFrequencyAmplitudes[SAMPLES / 2] = {};
 
-float vReal[SAMPLES] = {};
+float vReal[SAMPLES] = {};  // holds the magnitude spectrum in its first SAMPLES / 2 entries after computeMagnitudes()
+#if USE_REAL_FFT
+int16_t sampleWindow[SAMPLES] = {};
+Spectrum spectrum;
+#if USE_FIXED_POINT_FFT
+FixedRealFFT<SAMPLES> fixedFFT;
+#endif
+#else
 float vImag[SAMPLES] = {};
 ArduinoFFT<float> FFT = ArduinoFFT<float>(vReal, vImag, SAMPLES, SAMPLING_FREQ);
+#endif
 
 // Kick drum isolation filter
-const float kick_hz_mu = 90.0; // Center frequency in Hz
-const float kick_hz_sigma = 110.0; // Standard deviation in Hz
+const float kick_hz_mu = KICK_HZ_MU; // Center frequency in Hz
+
+// Decimated low band for high-resolution bass analysis; one bass block is produced per audio block
+#if USE_BASS_ANALYSIS
+const uint16_t BASS_BLOCK_SAMPLES = BLOCK_SAMPLES / DECIMATION_FACTOR;
+const uint16_t BASS_WINDOW_BLOCKS = BASS_SAMPLES / BASS_BLOCK_SAMPLES;
+static_assert(BLOCK_SAMPLES % DECIMATION_FACTOR == 0, "BLOCK_SAMPLES must be a multiple of DECIMATION_FACTOR");
+PolyphaseDecimator<DECIMATION_FACTOR, 8> decimator;  // 64 taps, alias-free below ~300 Hz
+AudioBlockRing<float, BLOCK_SAMPLES / DECIMATION_FACTOR, 2 * (BASS_SAMPLES * DECIMATION_FACTOR / BLOCK_SAMPLES)> bassRing;
+BassSpectrum bassSpectrum(RealFFTWindow::Hann);  // Hann rather than flat top, for frequency resolution
+float bassWindow[BASS_SAMPLES] = {};
+#endif
+
+// Low-latency onset detector, run by the sampling task on every block
+#if USE_ONSET_DETECTOR
+OnsetDetector onsetDetector(kick_hz_mu, SAMPLING_FREQ, 100.0);
+#endif
+volatile unsigned long lastOnsetTimestamp = 0;
+volatile uint32_t onsetCount = 0;
 
 // For computing rolling average of the spectrum
 float currentBandEnergy[NUM_BANDS];
@@ -143,58 +148,71 @@ void setupI2S() {
 }
 
 
-static void async_sampling(void* arg) {
+/**
+ * Publish the block being recorded and wake the analysis task if it completes a hop
+ */
+static void commitBlock() {
+	const int16_t* pcm = audioRing.beginWrite();
+#if USE_ONSET_DETECTOR
+	int onsetIndex = onsetDetector.processBlock(pcm, BLOCK_SAMPLES);
+	if (onsetIndex >= 0) {
+		// Back-date to the sample the onset was detected on
+		lastOnsetTimestamp = millis() - (BLOCK_SAMPLES - onsetIndex) * 1000UL / SAMPLING_FREQ;
+		onsetCount = onsetCount + 1;
+	}
+#endif
+#if USE_BASS_ANALYSIS
+	// Published before the audio block, so the bass window for any analysis hop is always complete
+	decimator.process(pcm, BLOCK_SAMPLES, bassRing.beginWrite());
+	bassRing.commitWrite();
+#endif
+	audioRing.commitWrite();
+	TaskHandle_t listener = hopListener;
+	if (listener != NULL && audioRing.sequence() % HOP_BLOCKS == 0) {
+		xTaskNotifyGive(listener);
+	}
+}
+
+static void async_sampling(void*) {
 # if USE_RAW_ADC_READ
 	while (true) {
-		buffer[lastIndex] = adc1_get_raw(ADC_CHANNEL); // On ESP32-DevKitC core 1 has a throughput of about 23569.49 samples/s
-		lastIndex = (lastIndex + 1) % BUFFER_LENGTH;
+		int16_t* block = audioRing.beginWrite();
+		for (int i = 0; i < BLOCK_SAMPLES; i++) {
+			block[i] = adc1_get_raw(ADC_CHANNEL); // On ESP32-DevKitC core 1 has a throughput of about 23569.49 samples/s
+		}
+		commitBlock();
 	}
 # else
 # if USE_I2S_MIC
 	uint32_t sample_size = 0;
-	// uint32_t record_size = SAMPLING_FREQ * SAMPLE_BITS / 8 / 32;  // 1/32 second = 3ms of recording 
-	uint32_t record_size = 64 * SAMPLE_BITS / 8;
-	uint8_t *rec_buffer = NULL;
+	const uint32_t record_size = BLOCK_SAMPLES * SAMPLE_BITS / 8;  // 64 samples = 4ms of recording
 	Serial.printf("Ready to start recording ...\n");
 
-	// File file = SD.open("/"WAV_FILE_NAME".wav", FILE_WRITE);
-	// // Write the header to the WAV file
-	// uint8_t wav_header[WAV_HEADER_SIZE];
-	// generate_wav_header(wav_header, record_size, SAMPLE_RATE);
-	// file.write(wav_header, WAV_HEADER_SIZE);
-
-	// PSRAM malloc for recording
-	rec_buffer = (uint8_t *)ps_malloc(record_size);
-	if (rec_buffer == NULL) {
-		Serial.printf("malloc failed!\n");
-		while(1) ;
-	}
-	Serial.printf("Buffer: %d bytes\n", ESP.getPsramSize() - ESP.getFreePsram());
-
-	// Record loop
+	// Record loop; each I2S read lands directly in the next ring slot
 	while (true) {
-		esp_i2s::i2s_read(esp_i2s::I2S_NUM_0, rec_buffer, record_size, &sample_size, portMAX_DELAY);
-		if (sample_size == 0) {
-			Serial.printf("Record Failed!\n");
-		} 
-		// Write to cyclic buffer
-		for (uint32_t i = 0; i < sample_size; i += SAMPLE_BITS/8) {
-			(*(uint16_t *)(rec_buffer+i)) <<= VOLUME_GAIN;
-			buffer[lastIndex] = (*(uint16_t *)(rec_buffer+i));
-			lastIndex = (lastIndex + 1) % BUFFER_LENGTH;
+		int16_t* block = audioRing.beginWrite();
+		esp_i2s::i2s_read(esp_i2s::I2S_NUM_0, block, record_size, &sample_size, portMAX_DELAY);
+		if (sample_size != record_size) {
+			if (sample_size == 0) {
+				Serial.printf("Record Failed!\n");
+			}
+			audioRing.dropWrite();
+			continue;
+		}
+		for (int i = 0; i < BLOCK_SAMPLES; i++) {
+			block[i] = int16_t(block[i] * (1 << VOLUME_GAIN));
 		}
+		commitBlock();
 	}
 	
 # else
 	while (true) {
-		buffer[lastIndex] = analogRead(AUDIO_IN_PIN);  // On ESP32-DevKitC core 1 has a throughput of about 5995 samples/s
-		lastIndex = (lastIndex + 1) % BUFFER_LENGTH;
-		// if (lastIndex == 0) {
-		//     // Serial.print("Samples/sec: ");
-		//     // Serial.println(1000000.0 * BUFFER_LENGTH / (micros() - newTime));
-		//     // newTime = micros();
-		//     vTaskDelay(1); // this keeps the watchdog happy
-		// }
+		int16_t* block = audioRing.beginWrite();
+		for (int i = 0; i < BLOCK_SAMPLES; i++) {
+			block[i] = analogRead(AUDIO_IN_PIN);  // On ESP32-DevKitC core 1 has a throughput of about 5995 samples/s
+		}
+		commitBlock();
+		// vTaskDelay(1); // this keeps the watchdog happy
 	}
 # endif
 # endif
@@ -207,11 +225,10 @@ void setupAsyncSampling() {
 	adc1_config_width(ADC_WIDTH);
 	adc1_config_channel_atten(ADC_CHANNEL, ADC_ATTEN);
 #endif
-	TaskHandle_t samplingTaskHandle;
 	xTaskCreatePinnedToCore(
 		async_sampling,
 		"async_sampling",
-		2048,
+		SAMPLING_TASK_STACK,
 		NULL,
 		1,
 		&samplingTaskHandle,
@@ -222,6 +239,65 @@ void setupAsyncSampling() {
 }
 
 
+/**
+ * Copy the most recent SAMPLES of audio out of the ring into the FFT input
+ */
+static void readAudioWindow() {
+#if USE_REAL_FFT
+	if (audioRing.readLatestWindow(WINDOW_BLOCKS, sampleWindow) == 0) {
+		memset(sampleWindow, 0, sizeof(sampleWindow));  // not enough audio recorded yet
+	}
+#else
+	if (audioRing.readLatestWindow(WINDOW_BLOCKS, vReal) == 0) {
+		memset(vReal, 0, sizeof(vReal));  // not enough audio recorded yet
+	}
+	memset(vImag, 0, sizeof(vImag));
+#endif
+}
+
+/**
+ * Copy the next hop-aligned window out of the ring into the FFT input. Returns false if that window has not been
+ * fully recorded yet. If the analysis fell so far behind that the window was overwritten, skips ahead to the newest
+ * complete hop; the ring counts the blocks that were lost.
+ */
+static bool readNextHopWindow() {
+#if USE_REAL_FFT
+	int16_t* window = sampleWindow;
+#else
+	float* window = vReal;
+	memset(vImag, 0, sizeof(vImag));
+#endif
+	uint32_t published = audioRing.sequence();
+	if (published < nextWindowEnd) {
+		return false;
+	}
+	if (!audioRing.readWindow(nextWindowEnd, WINDOW_BLOCKS, window)) {
+		nextWindowEnd += ((published - nextWindowEnd) / HOP_BLOCKS) * HOP_BLOCKS;
+		if (!audioRing.readWindow(nextWindowEnd, WINDOW_BLOCKS, window)) {
+			nextWindowEnd += HOP_BLOCKS;
+			return false;
+		}
+	}
+	lastWindowEnd = nextWindowEnd;
+	nextWindowEnd += HOP_BLOCKS;
+	return true;
+}
+
+/**
+ * DC removal, flat-top window, FFT and magnitude; leaves the magnitude spectrum in vReal[0 .. SAMPLES / 2)
+ */
+static void computeMagnitudes() {
+#if USE_REAL_FFT
+	spectrum.magnitude(sampleWindow, vReal);
+#else
+	FFT.dcRemoval();
+	// FFT.windowing(FFTWindow::Hamming, FFTDirection::Forward);
+	FFT.windowing(FFTWindow::Flat_top, FFTDirection::Forward);  // flat top has better amplitude accuracy
+	FFT.compute(FFTDirection::Forward);
+	FFT.complexToMagnitude();
+#endif
+}
+
 /**
  * Compute the spectrogram of the audio signal and bin frequencies into bands
  */
@@ -238,40 +314,22 @@ void computeSpectrogram(float spectrogram[NUM_BANDS]) {
 		vImag[i] = 0.0;
 	}
 #else
-	float startSampleTime = micros() / 1000.0;
+	// float startSampleTime = micros() / 1000.0;
 
-	int localIndex = lastIndex;
-	for (int i = 0; i < SAMPLES; i++) {
-		vReal[i] = buffer[(localIndex + i) % BUFFER_LENGTH];
-		vImag[i] = 0.0;
-	}
+	readAudioWindow();
 
-	float endSampleTime = micros() / 1000.0;
+	// float endSampleTime = micros() / 1000.0;
 	// Serial.print("Sample time: ");
 	// Serial.println(endSampleTime - startSampleTime);
 #endif
 
 	// float startFFTTime = micros() / 1000.0;
-	FFT.dcRemoval();
-	// FFT.windowing(FFTWindow::Hamming, FFTDirection::Forward);
-	FFT.windowing(FFTWindow::Flat_top, FFTDirection::Forward);  // flat top has better amplitude accuracy
-	FFT.compute(FFTDirection::Forward);
-	FFT.complexToMagnitude();
+	computeMagnitudes();
 
 	// Analyse FFT results
 	for (uint16_t i = 2; i < (SAMPLES >> 1); i++) {
 		if (vReal[i] > NOISE) {
-
-			const float hz = i * binFrequencySize;
-
-			if (hz <= bandLimitsHz[0])                              amplitudes[0] += vReal[i];
-			else if (hz > bandLimitsHz[0] && hz <= bandLimitsHz[1]) amplitudes[1] += vReal[i];
-			else if (hz > bandLimitsHz[1] && hz <= bandLimitsHz[2]) amplitudes[2] += vReal[i];
-			else if (hz > bandLimitsHz[2] && hz <= bandLimitsHz[3]) amplitudes[3] += vReal[i];
-			else if (hz > bandLimitsHz[3] && hz <= bandLimitsHz[4]) amplitudes[4] += vReal[i];
-			else if (hz > bandLimitsHz[4] && hz <= bandLimitsHz[5]) amplitudes[5] += vReal[i];
-			else if (hz > bandLimitsHz[5] && hz <= bandLimitsHz[6]) amplitudes[6] += vReal[i];
-			else if (hz > bandLimitsHz[6])                          amplitudes[7] += vReal[i];
+			amplitudes[Spectrum::tables.legacyBand[i]] += vReal[i];
 		}
 	}
 
@@ -296,20 +354,16 @@ void computeSpectrogram(float spectrogram[NUM_BANDS]) {
 }
 
 /**
- * Compute the FFT spectrum of the audio signal, keeping the first half of the samples
+ * Compute the FFT spectrum of the next analysis window, keeping the first half of the samples. Windows are SAMPLES
+ * long and advance by HOP_SAMPLES, so this returns true ANALYSIS_FRAMES_PER_SECOND times per second of recorded
+ * audio, and false once it has caught up with the sampling task.
  */
-void doFFT(float frequencies[SAMPLES / 2]) {
+bool doFFT(float frequencies[SAMPLES / 2]) {
 
-	int localIndex = lastIndex;
-	for (int i = 0; i < SAMPLES; i++) {
-		vReal[i] = buffer[(localIndex + i) % BUFFER_LENGTH];
-		vImag[i] = 0.0;
+	if (!readNextHopWindow()) {
+		return false;
 	}
-
-	FFT.dcRemoval();
-	FFT.windowing(FFTWindow::Flat_top, FFTDirection::Forward);
-	FFT.compute(FFTDirection::Forward);
-	FFT.complexToMagnitude();
+	computeMagnitudes();
 
 	// Accumulate FFT results
 	frequencies[0] = 0.;
@@ -324,6 +378,68 @@ void doFFT(float frequencies[SAMPLES / 2]) {
 	}
 
 	// Result is stored in frequencies
+	return true;
+}
+
+/**
+ * Integer counterpart of doFFT(): the approximate magnitude spectrum of the next analysis window, computed without
+ * the FPU. Magnitudes are within about 3% of doFFT()'s above the NOISE level.
+ */
+bool doFixedFFT(uint32_t magnitudes[SAMPLES / 2]) {
+#if USE_FIXED_POINT_FFT
+	if (!readNextHopWindow()) {
+		return false;
+	}
+	fixedFFT.magnitude(sampleWindow, magnitudes);
+	magnitudes[0] = 0;
+	return true;
+#else
+	(void)magnitudes;
+	return false;
+#endif
+}
+
+/**
+ * Compute the high-resolution bass spectrum for the window doFFT() just analyzed. The bass window is longer
+ * (BASS_SAMPLES at BASS_SAMPLING_FREQ) but ends on the same sample. Returns false if it could not be read.
+ */
+bool doBassFFT(float bassFrequencies[BASS_SAMPLES / 2]) {
+#if USE_BASS_ANALYSIS
+	if (!bassRing.readWindow(lastWindowEnd, BASS_WINDOW_BLOCKS, bassWindow)) {
+		return false;
+	}
+	bassSpectrum.magnitude(bassWindow, bassFrequencies);
+	return true;
+#else
+	return false;
+#endif
+}
+
+void setAudioHopListener(TaskHandle_t task) {
+	hopListener = task;
+}
+
+unsigned long getLastOnsetTimestamp() {
+	return lastOnsetTimestamp;
+}
+
+uint32_t getOnsetCount() {
+	return onsetCount;
+}
+
+uint32_t droppedAudioBlocks() {
+	return audioRing.droppedBlocks;
+}
+
+uint32_t overwrittenAudioBlocks() {
+	return audioRing.overwrittenBlocks;
+}
+
+/**
+ * Bytes of the sampling task's SAMPLING_TASK_STACK it has never used, for loop() to log rather than the task itself
+ */
+uint32_t samplingStackUnused() {
+	return samplingTaskHandle != NULL ? uint32_t(uxTaskGetStackHighWaterMark(samplingTaskHandle)) : 0;
 }
 
 // float version of map()
@@ -348,22 +464,10 @@ void computeSpectrogramWLED(float frequencies[SAMPLES / 2], float spectrogram[NU
 		amplitudes[i] = 0;
 	}
 
-	amplitudes[0] = fftAddAvg(frequencies, 1, 2);               // 1    43 - 86   sub-bass
-	amplitudes[1] = fftAddAvg(frequencies, 2, 3);               // 1    86 - 129  bass
-	amplitudes[2] = fftAddAvg(frequencies, 3, 5);               // 2   129 - 216  bass
-	amplitudes[3] = fftAddAvg(frequencies, 5, 7);               // 2   216 - 301  bass + midrange
-	amplitudes[4] = fftAddAvg(frequencies, 7, 10);              // 3   301 - 430  midrange
-	amplitudes[5] = fftAddAvg(frequencies, 10, 13);             // 3   430 - 560  midrange
-	amplitudes[6] = fftAddAvg(frequencies, 13, 19);             // 5   560 - 818  midrange
-	amplitudes[7] = fftAddAvg(frequencies, 19, 26);             // 7   818 - 1120 midrange -- 1Khz should always be the center !
-	amplitudes[8] = fftAddAvg(frequencies, 26, 33);             // 7  1120 - 1421 midrange
-	amplitudes[9] = fftAddAvg(frequencies, 33, 44);             // 9  1421 - 1895 midrange
-	amplitudes[10] = fftAddAvg(frequencies, 44, 56);            // 12 1895 - 2412 midrange + high mid
-	amplitudes[11] = fftAddAvg(frequencies, 56, 70);            // 14 2412 - 3015 high mid
-	amplitudes[12] = fftAddAvg(frequencies, 70, 86);            // 16 3015 - 3704 high mid
-	amplitudes[13] = fftAddAvg(frequencies, 86, 104);           // 18 3704 - 4479 high mid
-	amplitudes[14] = fftAddAvg(frequencies, 104, 165) * 0.88f;  // 61 4479 - 7106 high mid + high  -- with slight damping
-	amplitudes[15] = fftAddAvg(frequencies, 165, 215) * 0.70f;  // 50 7106 - 9259 high             -- with some damping
+	// WLED's channels, from 1 bin of sub-bass up to ~50 bins of highs, with some damping of the top two
+	for (int band = 0; band < NUM_GEQ_CHANNELS; band++) {
+		amplitudes[band] = fftAddAvg(frequencies, Spectrum::tables.geqFirstBin[band], Spectrum::tables.geqLastBin[band]) * GEQ_DAMPING[band];
+	}
 
 	// Process the FFT data into bar heights
 	for (int band = 0; band < NUM_GEQ_CHANNELS; band++) {
@@ -386,81 +490,81 @@ void computeSpectrogramWLED(float frequencies[SAMPLES / 2], float spectrogram[NU
 }
 
 /**
- * WLED's post-processing routine
+ * WLED's post-processing for a single GEQ channel; scales fftResult in place and returns the channel value
  */
-void postProcessFFTResults(float fftResults[NUM_GEQ_CHANNELS], float postProcessedResults[NUM_GEQ_CHANNELS]) {
-	for (int i = 0; i < NUM_GEQ_CHANNELS; i++) {
+static inline float postProcessChannel(int i, float& fftResult) {
+	if (true) { // noise gate open
+		// Adjustment for frequency curves.
+		fftResult *= fftResultPink[i];
+#if FFT_SCALING_MODE > 0
+		fftResult *= FFT_DOWNSCALE;  // adjustment related to FFT windowing function
+#endif
+		// Manual linear adjustment of gain using sampleGain adjustment for different input types.
+		fftResult *= soundAgc ? multAgc : ((float)sampleGain / 40.0f * (float)inputLevel / 128.0f + 1.0f / 16.0f); //apply gain, with inputLevel adjustment
+		if (fftResult < 0) fftResult = 0;
+	}
 
-		if (true) { // noise gate open
-			// Adjustment for frequency curves.
-			fftResults[i] *= fftResultPink[i];
-			if (FFTScalingMode > 0) fftResults[i] *= FFT_DOWNSCALE;  // adjustment related to FFT windowing function
-			// Manual linear adjustment of gain using sampleGain adjustment for different input types.
-			fftResults[i] *= soundAgc ? multAgc : ((float)sampleGain / 40.0f * (float)inputLevel / 128.0f + 1.0f / 16.0f); //apply gain, with inputLevel adjustment
-			if (fftResults[i] < 0) fftResults[i] = 0;
-		}
+	// smooth results - rise fast, fall slower
+	if (fftResult > avgAmplitudes[i])   // rise fast 
+		avgAmplitudes[i] = fftResult * 0.75f + 0.25f * avgAmplitudes[i];  // will need approx 2 cycles (50ms) for converging against amplitudes[i]
+	else {                       // fall slow
+		if (decayTime < 1000) avgAmplitudes[i] = fftResult * 0.22f + 0.78f * avgAmplitudes[i];       // approx  5 cycles (225ms) for falling to zero
+		else if (decayTime < 2000) avgAmplitudes[i] = fftResult * 0.17f + 0.83f * avgAmplitudes[i];  // default - approx  9 cycles (225ms) for falling to zero
+		else if (decayTime < 3000) avgAmplitudes[i] = fftResult * 0.14f + 0.86f * avgAmplitudes[i];  // approx 14 cycles (350ms) for falling to zero
+		else avgAmplitudes[i] = fftResult * 0.1f + 0.9f * avgAmplitudes[i];                         // approx 20 cycles (500ms) for falling to zero
+	}
+	// constrain internal vars - just to be sure
+	fftResult = constrain(fftResult, 0.0f, 1023.0f);
+	avgAmplitudes[i] = constrain(avgAmplitudes[i], 0.0f, 1023.0f);
+
+	float currentResult;
+	if (limiterOn == true)
+		currentResult = avgAmplitudes[i];
+	else
+		currentResult = fftResult;
+
+#if FFT_SCALING_MODE == 1
+	// Logarithmic scaling
+	currentResult *= 0.42f;                      // 42 is the answer ;-)
+	currentResult -= 8.0f;                       // this skips the lowest row, giving some room for peaks
+	if (currentResult > 1.0f) currentResult = logf(currentResult); // log to base "e", which is the fastest log() function
+	else currentResult = 0.0f;                   // special handling, because log(1) = 0; log(0) = undefined
+	currentResult *= 0.85f + (float(i) / 18.0f);  // extra up-scaling for high frequencies
+	currentResult = mapf(currentResult, 0, LOG_256, 0, 255); // map [log(1) ... log(255)] to [0 ... 255]
+#elif FFT_SCALING_MODE == 2
+	// Linear scaling
+	currentResult *= 0.30f;                     // needs a bit more damping, get stay below 255
+	currentResult -= 4.0f;                       // giving a bit more room for peaks
+	if (currentResult < 1.0f) currentResult = 0.0f;
+	currentResult *= 0.85f + (float(i) / 1.8f);   // extra up-scaling for high frequencies
+#elif FFT_SCALING_MODE == 3
+	// square root scaling
+	currentResult *= 0.38f;
+	currentResult -= 6.0f;
+	if (currentResult > 1.0f) currentResult = sqrtf(currentResult);
+	else currentResult = 0.0f;                   // special handling, because sqrt(0) = undefined
+	currentResult *= 0.85f + (float(i) / 4.5f);   // extra up-scaling for high frequencies
+	currentResult = mapf(currentResult, 0.0, 16.0, 0.0, 255.0); // map [sqrt(1) ... sqrt(256)] to [0 ... 255]
+#else
+	// no scaling - leave freq bins as-is
+	currentResult -= 4; // just a bit more room for peaks
+#endif
 
-		// smooth results - rise fast, fall slower
-		if (fftResults[i] > avgAmplitudes[i])   // rise fast 
-			avgAmplitudes[i] = fftResults[i] * 0.75f + 0.25f * avgAmplitudes[i];  // will need approx 2 cycles (50ms) for converging against amplitudes[i]
-		else {                       // fall slow
-			if (decayTime < 1000) avgAmplitudes[i] = fftResults[i] * 0.22f + 0.78f * avgAmplitudes[i];       // approx  5 cycles (225ms) for falling to zero
-			else if (decayTime < 2000) avgAmplitudes[i] = fftResults[i] * 0.17f + 0.83f * avgAmplitudes[i];  // default - approx  9 cycles (225ms) for falling to zero
-			else if (decayTime < 3000) avgAmplitudes[i] = fftResults[i] * 0.14f + 0.86f * avgAmplitudes[i];  // approx 14 cycles (350ms) for falling to zero
-			else avgAmplitudes[i] = fftResults[i] * 0.1f + 0.9f * avgAmplitudes[i];                         // approx 20 cycles (500ms) for falling to zero
-		}
-		// constrain internal vars - just to be sure
-		fftResults[i] = constrain(fftResults[i], 0.0f, 1023.0f);
-		avgAmplitudes[i] = constrain(avgAmplitudes[i], 0.0f, 1023.0f);
-
-		float currentResult;
-		if (limiterOn == true)
-			currentResult = avgAmplitudes[i];
-		else
-			currentResult = fftResults[i];
-
-		switch (FFTScalingMode) {
-		case 1:
-			// Logarithmic scaling
-			currentResult *= 0.42f;                      // 42 is the answer ;-)
-			currentResult -= 8.0f;                       // this skips the lowest row, giving some room for peaks
-			if (currentResult > 1.0f) currentResult = logf(currentResult); // log to base "e", which is the fastest log() function
-			else currentResult = 0.0f;                   // special handling, because log(1) = 0; log(0) = undefined
-			currentResult *= 0.85f + (float(i) / 18.0f);  // extra up-scaling for high frequencies
-			currentResult = mapf(currentResult, 0, LOG_256, 0, 255); // map [log(1) ... log(255)] to [0 ... 255]
-			break;
-		case 2:
-			// Linear scaling
-			currentResult *= 0.30f;                     // needs a bit more damping, get stay below 255
-			currentResult -= 4.0f;                       // giving a bit more room for peaks
-			if (currentResult < 1.0f) currentResult = 0.0f;
-			currentResult *= 0.85f + (float(i) / 1.8f);   // extra up-scaling for high frequencies
-			break;
-		case 3:
-			// square root scaling
-			currentResult *= 0.38f;
-			currentResult -= 6.0f;
-			if (currentResult > 1.0f) currentResult = sqrtf(currentResult);
-			else currentResult = 0.0f;                   // special handling, because sqrt(0) = undefined
-			currentResult *= 0.85f + (float(i) / 4.5f);   // extra up-scaling for high frequencies
-			currentResult = mapf(currentResult, 0.0, 16.0, 0.0, 255.0); // map [sqrt(1) ... sqrt(256)] to [0 ... 255]
-			break;
-
-		case 0:
-		default:
-			// no scaling - leave freq bins as-is
-			currentResult -= 4; // just a bit more room for peaks
-			break;
-		}
+	// Now, let's dump it all into postProcessedResults. Need to do this, otherwise other routines might grab postProcessedResults values prematurely.
+	if (soundAgc > 0) {  // apply extra "GEQ Gain" if set by user
+		float post_gain = (float)inputLevel / 128.0f;
+		if (post_gain < 1.0f) post_gain = ((post_gain - 1.0f) * 0.8f) + 1.0f;
+		currentResult *= post_gain;
+	}
+	return constrain(currentResult, 0.0f, 255.0f);
+}
 
-		// Now, let's dump it all into postProcessedResults. Need to do this, otherwise other routines might grab postProcessedResults values prematurely.
-		if (soundAgc > 0) {  // apply extra "GEQ Gain" if set by user
-			float post_gain = (float)inputLevel / 128.0f;
-			if (post_gain < 1.0f) post_gain = ((post_gain - 1.0f) * 0.8f) + 1.0f;
-			currentResult *= post_gain;
-		}
-		// postProcessedResults[i] = constrain((int)currentResult, 0, 255);
-		postProcessedResults[i] = constrain(currentResult, 0.0f, 255.0f);
+/**
+ * WLED's post-processing routine
+ */
+void postProcessFFTResults(float fftResults[NUM_GEQ_CHANNELS], float postProcessedResults[NUM_GEQ_CHANNELS]) {
+	for (int i = 0; i < NUM_GEQ_CHANNELS; i++) {
+		postProcessedResults[i] = postProcessChannel(i, fftResults[i]);
 	}
 }
 
@@ -468,14 +572,66 @@ void postProcessFFTResults(float fftResults[NUM_GEQ_CHANNELS], float postProcess
 void applyKickDrumIsolationFilter(float frequencies[SAMPLES / 2], float spectrumFiltered[SAMPLES / 2]) {
 	// float spectrumFiltered[SAMPLES >> 1];
 	for (uint16_t i = 0; i < SAMPLES / 2; i++) { // only first half of samples are used up to Nyquist frequency
-		const float hz = i * binFrequencySize;
-		const float filterFloor = 0.05;
-		// Kick drums have a fundamental frequency range around 80Hz so we'll weight these higher
-		spectrumFiltered[i] = (exp(-0.5 * pow((hz - kick_hz_mu) / kick_hz_sigma, 2)) + filterFloor) * frequencies[i];
+		spectrumFiltered[i] = Spectrum::tables.kickWeights[i] * frequencies[i];
 	}
 	// return spectrumFiltered;
 }
 
+/**
+ * Averaging and post-processing of one GEQ channel, from its kick-weighted amplitude
+ */
+static inline float geqChannelFromAmplitude(int band, float amplitude) {
+	float barHeight = amplitude / AMPLITUDE;
+	float fftResult;
+	if (USE_AVERAGING) {
+		avgAmplitudes[band] = (barHeight * SPECTRUM_EMA_ALPHA) + (avgAmplitudes[band] * (1.0 - SPECTRUM_EMA_ALPHA));
+		fftResult = avgAmplitudes[band];
+	}
+	else {
+		fftResult = barHeight;
+	}
+	return postProcessChannel(band, fftResult);
+}
+
+/**
+ * Fused applyKickDrumIsolationFilter() -> computeSpectrogramWLED() -> postProcessFFTResults(), going straight from
+ * the magnitude spectrum to the post-processed GEQ channels. Only the bins that feed a channel are weighted, and
+ * the accumulation order is the same as the unfused chain, so the results are bit-identical to it.
+ */
+void computeKickWeightedGEQ(float frequencies[SAMPLES / 2], float postProcessedResults[NUM_GEQ_CHANNELS]) {
+	const double* kickWeights = Spectrum::tables.kickWeights;
+	for (int band = 0; band < NUM_GEQ_CHANNELS; band++) {
+		const int from = Spectrum::tables.geqFirstBin[band];
+		const int to = Spectrum::tables.geqLastBin[band];
+		float amplitude = 0.0f;
+		for (int i = from; i <= to; i++) {
+			amplitude += float(kickWeights[i] * frequencies[i]);
+		}
+		amplitude = amplitude / float(to - from + 1) * GEQ_DAMPING[band];
+
+		postProcessedResults[band] = geqChannelFromAmplitude(band, amplitude);
+	}
+}
+
+/**
+ * Integer version of computeKickWeightedGEQ(): the magnitudes from doFixedFFT() are weighted with Q14 kick weights
+ * and summed in 64 bits, and only the 16 channel amplitudes go through the float post-processing.
+ */
+void computeKickWeightedGEQFixed(const uint32_t magnitudes[SAMPLES / 2], float postProcessedResults[NUM_GEQ_CHANNELS]) {
+	const uint16_t* kickWeights = Spectrum::tables.kickWeightsQ14;
+	for (int band = 0; band < NUM_GEQ_CHANNELS; band++) {
+		const int from = Spectrum::tables.geqFirstBin[band];
+		const int to = Spectrum::tables.geqLastBin[band];
+		uint64_t sum = 0;
+		for (int i = from; i <= to; i++) {
+			sum += uint64_t(kickWeights[i]) * magnitudes[i];
+		}
+		float amplitude = float(sum) * (1.0f / 16384.0f) / float(to - from + 1) * GEQ_DAMPING[band];
+
+		postProcessedResults[band] = geqChannelFromAmplitude(band, amplitude);
+	}
+}
+
 float calculateEntropyChange(float spectrumFiltered[SAMPLES / 2], float spectrumFilteredPrev[SAMPLES / 2]) {
 	float entropyChange = 0;
 	for (uint16_t i = 2; i < (SAMPLES >> 1); i++) {
@@ -485,6 +641,22 @@ float calculateEntropyChange(float spectrumFiltered[SAMPLES / 2], float spectrum
 	return entropyChange;
 }
 
+/**
+ * Half-wave rectified spectral flux of the bass spectrum, weighted by the same kick drum gaussian as the GEQ path
+ */
+float calculateBassFlux(float bassFrequencies[BASS_SAMPLES / 2], float bassFrequenciesPrev[BASS_SAMPLES / 2]) {
+	const float* bassKickWeights = BassSpectrum::tables.kickGaussian;
+	float flux = 0;
+	for (uint16_t i = 1; i < BASS_SAMPLES / 2; i++) {
+		float rise = bassFrequencies[i] - bassFrequenciesPrev[i];
+		if (rise > 0) {
+			flux += bassKickWeights[i] * rise;
+		}
+	}
+	memcpy(bassFrequenciesPrev, bassFrequencies, (BASS_SAMPLES / 2) * sizeof(bassFrequencies[0]));
+	return flux;
+}
+
 float calculateEntropyChangeWLED(float spectrumFiltered[NUM_GEQ_CHANNELS], float spectrumFilteredPrev[NUM_GEQ_CHANNELS]) {
 	float entropyChange = 0;
 	for (uint16_t i = 0; i < NUM_GEQ_CHANNELS; i++) {
@@ -1,16 +1,42 @@
 #ifndef SPECTROGRAM_H
 #define SPECTROGRAM_H
 
+#include <Arduino.h>
+
 #define NUM_BANDS 8
 #define SAMPLES 512
 #define NUM_GEQ_CHANNELS 16
+#define SAMPLING_FREQ 16000U
+#define HOP_SAMPLES 128  // a new window is analyzed every HOP_SAMPLES of audio
+#define ANALYSIS_FRAMES_PER_SECOND (SAMPLING_FREQ / HOP_SAMPLES)  // 125 analysis frames per second at 16 kHz
+
+// Integer FFT, magnitude and GEQ band accumulation (doFixedFFT() + computeKickWeightedGEQFixed()) instead of float
+#define USE_FIXED_POINT_FFT false
+
+// Bass analysis on a decimated copy of the audio: 256 points at 2 kHz gives 7.8 Hz bins instead of 31 Hz
+#define USE_BASS_ANALYSIS true
+#define DECIMATION_FACTOR 8
+#define BASS_SAMPLING_FREQ (SAMPLING_FREQ / DECIMATION_FACTOR)
+#define BASS_SAMPLES 256
 
 void setupAsyncSampling();
 void computeSpectrogram(float spectrogram[NUM_BANDS]);
-void doFFT(float frequencies[SAMPLES / 2]);
+bool doFFT(float frequencies[SAMPLES / 2]);
+bool doFixedFFT(uint32_t magnitudes[SAMPLES / 2]);
+bool doBassFFT(float bassFrequencies[BASS_SAMPLES / 2]);
+void setAudioHopListener(TaskHandle_t task);
+unsigned long getLastOnsetTimestamp();
+uint32_t getOnsetCount();
+uint32_t droppedAudioBlocks();
+uint32_t overwrittenAudioBlocks();
+uint32_t samplingStackUnused();
 void computeSpectrogramWLED(float frequencies[SAMPLES / 2], float spectrogram[NUM_GEQ_CHANNELS]);
 void postProcessFFTResults(float fftResults[NUM_GEQ_CHANNELS], float postProcessedResults[NUM_GEQ_CHANNELS]);
 void applyKickDrumIsolationFilter(float frequencies[SAMPLES / 2], float spectrumFiltered[SAMPLES / 2]);
+void computeKickWeightedGEQ(float frequencies[SAMPLES / 2], float postProcessedResults[NUM_GEQ_CHANNELS]);
+void computeKickWeightedGEQFixed(const uint32_t magnitudes[SAMPLES / 2], float postProcessedResults[NUM_GEQ_CHANNELS]);
 float calculateEntropyChange(float spectrumFiltered[SAMPLES / 2], float spectrumFilteredPrev[SAMPLES / 2]);
+float calculateBassFlux(float bassFrequencies[BASS_SAMPLES / 2], float bassFrequenciesPrev[BASS_SAMPLES / 2]);
+float calculateEntropyChangeWLED(float spectrumFiltered[NUM_GEQ_CHANNELS], float spectrumFilteredPrev[NUM_GEQ_CHANNELS]);
 
 #endif
\ No newline at end of file
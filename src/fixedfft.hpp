@@ -0,0 +1,152 @@
+#ifndef FIXEDFFT_HPP
+#define FIXEDFFT_HPP
+
+#include <stdint.h>
+
+#include "constmath.hpp"
+
+/**
+ * Q15 window and Q31 twiddles of an N-point fixed-point real FFT, built at compile time
+ */
+template <uint16_t N>
+struct FixedRealFFTTables {
+	static const uint16_t HALF = N / 2;
+
+	int32_t cosQ31[HALF] = {};   // cos(2*pi*k/N) in Q31
+	int32_t sinQ31[HALF] = {};   // sin(2*pi*k/N) in Q31
+	int16_t flatTopQ15[N] = {};
+	uint16_t bitReverse[HALF] = {};
+
+	static constexpr int32_t toQ31(double x) {
+		double scaled = x * 2147483648.0;
+		scaled += scaled < 0 ? -0.5 : 0.5;
+		return scaled >= 2147483647.0 ? 2147483647 : (scaled <= -2147483648.0 ? -2147483647 - 1 : int32_t(scaled));
+	}
+
+	static constexpr int16_t toQ15(double x) {
+		double scaled = x * 32768.0;
+		scaled += scaled < 0 ? -0.5 : 0.5;
+		return scaled >= 32767.0 ? 32767 : (scaled <= -32768.0 ? -32768 : int16_t(scaled));
+	}
+
+	constexpr FixedRealFFTTables() {
+		for (uint16_t k = 0; k < HALF; k++) {
+			cosQ31[k] = toQ31(constmath::cos(2.0 * constmath::pi * k / N));
+			sinQ31[k] = toQ31(constmath::sin(2.0 * constmath::pi * k / N));
+		}
+
+		// Same flat-top window as RealFFT, which follows ArduinoFFT's FFTWindow::Flat_top
+		for (uint16_t i = 0; i < HALF; i++) {
+			double ratio = double(i) / double(N - 1);
+			double weight = 0.2810639 - 0.5208972 * constmath::cos(2.0 * constmath::pi * ratio) + 0.1980399 * constmath::cos(4.0 * constmath::pi * ratio);
+			flatTopQ15[i] = toQ15(weight);
+			flatTopQ15[N - 1 - i] = toQ15(weight);
+		}
+
+		uint16_t bits = 0;
+		while ((1u << bits) < HALF) bits++;
+		for (uint16_t i = 0; i < HALF; i++) {
+			uint16_t reversed = 0;
+			for (uint16_t b = 0; b < bits; b++) {
+				if (i & (1u << b)) reversed |= 1u << (bits - 1 - b);
+			}
+			bitReverse[i] = reversed;
+		}
+	}
+};
+
+/**
+ * Integer-only counterpart of RealFFT, for 16-bit samples.
+ *
+ * Same structure as RealFFT (an N/2-point complex FFT over the even/odd sample pairs plus a split pass), but the
+ * data are int32 with as many fractional bits as the headroom allows (5 at N = 512), the window is Q15 and the
+ * twiddles Q31 with 64-bit products. A 16-bit input grows by at most N through the transform, so with the fraction
+ * bits sized for that there is no need for per-stage scaling and no precision is given up to block scaling. The magnitude uses a two-segment
+ * alpha-max-beta-min approximation, which is within -1.6% / +2.7% of the true magnitude.
+ *
+ * Magnitudes come out in the same units as RealFFT's, so the float and fixed-point paths can share thresholds.
+ */
+template <uint16_t N>
+class FixedRealFFT {
+private:
+	static const uint16_t HALF = N / 2;
+	static constexpr uint8_t log2(uint16_t n) {
+		return n <= 1 ? 0 : 1 + log2(n >> 1);
+	}
+	// |windowed sample| < 2^(16 + FRACTION_BITS) and the transform grows it by at most N, so this keeps 1 bit spare
+	static const uint8_t FRACTION_BITS = 14 - log2(N);
+	static_assert(N >= 4 && N <= 1024 && (N & (N - 1)) == 0, "FixedRealFFT size must be a power of 2 up to 1024");
+
+	static constexpr FixedRealFFTTables<N> tables{};
+
+	int32_t re[HALF];
+	int32_t im[HALF];
+
+	static inline int32_t mulQ31(int32_t a, int32_t b) {
+		return int32_t((int64_t(a) * b + (int64_t(1) << 30)) >> 31);
+	}
+
+	static inline uint32_t approximateMagnitude(int64_t x, int64_t y) {
+		uint64_t a = uint64_t(x < 0 ? -x : x);
+		uint64_t b = uint64_t(y < 0 ? -y : y);
+		uint64_t hi = a > b ? a : b;
+		uint64_t lo = a > b ? b : a;
+		uint64_t first = hi + ((lo * 5) >> 5);                 // hi + 5/32 lo
+		uint64_t second = ((hi * 51) >> 6) + ((lo * 83) >> 7); // 51/64 hi + 83/128 lo
+		return uint32_t((first > second ? first : second) >> FRACTION_BITS);
+	}
+
+public:
+	/**
+	 * Computes the approximate magnitude spectrum of N samples into magnitudes[N/2], after removing the mean and
+	 * applying the flat-top window. Samples are signed 16-bit PCM, as the audio ring stores them.
+	 */
+	void magnitude(const int16_t* samples, uint32_t* magnitudes) {
+		int32_t sum = 0;
+		for (uint16_t i = 0; i < N; i++) {
+			sum += samples[i];
+		}
+		// The mean keeps 16 fractional bits; rounding it to an integer would leak up to half an LSB of DC into bin 1
+		int64_t meanQ16 = (int64_t(sum) * 65536) / N;
+
+		for (uint16_t n = 0; n < HALF; n++) {
+			uint16_t j = tables.bitReverse[n];
+			re[j] = int32_t(((int64_t(samples[2 * n]) * 65536 - meanQ16) * tables.flatTopQ15[2 * n]) >> (31 - FRACTION_BITS));
+			im[j] = int32_t(((int64_t(samples[2 * n + 1]) * 65536 - meanQ16) * tables.flatTopQ15[2 * n + 1]) >> (31 - FRACTION_BITS));
+		}
+
+		for (uint16_t size = 2; size <= HALF; size <<= 1) {
+			uint16_t halfSize = size >> 1;
+			uint16_t step = N / size;
+			for (uint16_t start = 0; start < HALF; start += size) {
+				for (uint16_t j = 0; j < halfSize; j++) {
+					int32_t wr = tables.cosQ31[j * step];
+					int32_t wi = -tables.sinQ31[j * step];
+					uint16_t a = start + j;
+					uint16_t b = a + halfSize;
+					int32_t tr = int32_t((int64_t(re[b]) * wr - int64_t(im[b]) * wi + (int64_t(1) << 30)) >> 31);
+					int32_t ti = int32_t((int64_t(re[b]) * wi + int64_t(im[b]) * wr + (int64_t(1) << 30)) >> 31);
+					re[b] = re[a] - tr;
+					im[b] = im[a] - ti;
+					re[a] += tr;
+					im[a] += ti;
+				}
+			}
+		}
+
+		// Split pass, as in RealFFT; the halving is folded into the shifts. The sums are taken in 64 bits, so a
+		// full-scale input cannot overflow them whatever the headroom left by FRACTION_BITS.
+		for (uint16_t k = 0; k < HALF; k++) {
+			uint16_t m = (HALF - k) & (HALF - 1);
+			int32_t evenRe = int32_t((int64_t(re[k]) + re[m]) >> 1);
+			int32_t evenIm = int32_t((int64_t(im[k]) - im[m]) >> 1);
+			int32_t oddRe = int32_t((int64_t(im[k]) + im[m]) >> 1);
+			int32_t oddIm = int32_t(-((int64_t(re[k]) - re[m]) >> 1));
+			int64_t xr = int64_t(evenRe) + mulQ31(tables.cosQ31[k], oddRe) + mulQ31(tables.sinQ31[k], oddIm);
+			int64_t xi = int64_t(evenIm) + mulQ31(tables.cosQ31[k], oddIm) - mulQ31(tables.sinQ31[k], oddRe);
+			magnitudes[k] = approximateMagnitude(xr, xi);
+		}
+	}
+};
+
+#endif // FIXEDFFT_HPP
@@ -0,0 +1,273 @@
+#ifndef JITTERBUFFER_HPP
+#define JITTERBUFFER_HPP
+
+#include <math.h>
+#include <stdint.h>
+
+// A ring's target as set by the master, stamped with the master's time (State::shared_micros)
+struct TargetSample {
+	int64_t masterMicros = 0;
+	float angle = 0.0f;     // degrees, 0-360
+	float rate = 0.0f;      // degrees per second the angle moves at
+	float velocity = 0.0f;  // degrees per second the servo turns at, which need not be the rate
+};
+
+// Where the ring should be right now, according to the jitter buffer
+struct TargetPlayout {
+	float angle = 0.0f;
+	float rate = 0.0f;
+	float velocity = 0.0f;  // of the sample in effect at the playout point
+	bool extrapolated = false;  // newer than the newest sample, dead reckoned from it
+	bool stale = false;         // dead reckoned as far as allowed; the angle is held
+};
+
+struct JitterStats {
+	uint32_t received = 0;
+	uint32_t reordered = 0;   // arrived after a sample the master set later, and was put in order
+	uint32_t late = 0;        // arrived after the playout point had passed it, and was dropped
+	uint32_t duplicates = 0;
+	float jitterMicros = 0.0f;
+	float delayMicros = 0.0f;
+};
+
+/**
+ * Timestamped jitter buffer for the targets a ring receives from the master.
+ *
+ * Samples are kept in the order the master set them, whatever order they arrive in. The buffer plays out at a point
+ * `delay` behind the shared clock, where there is usually a sample on either side to interpolate between (cubic
+ * Hermite on the unwrapped angle, using the rates as tangents), and then carries that forward to the present at the
+ * interpolated rate. Past the newest sample it is dead reckoned, for up to MAX_EXTRAPOLATION after it was set: the
+ * master only sends targets when the dead reckoning would be off, or with a keyframe every second. The velocity is
+ * the servo's, not the angle's, and is not interpolated: it is that of the sample the playout point is in.
+ *
+ * The delay adapts to the link: it covers the mean transit time, the spacing between samples and a multiple of the
+ * inter-arrival jitter, estimated as in RFC 3550. It changes slowly, so the playout point never jumps.
+ *
+ * The playout itself can still jump, when a sample after a gap shows the dead reckoning was off. Such a jump is not
+ * played out at once: it is taken up as a correction that decays over EASE_MICROS, so the angle eases onto the new
+ * course rather than snapping to it.
+ *
+ * Times are all on the master's clock, in microseconds. Not thread safe; feed and read it from loop().
+ */
+template <uint8_t CAPACITY>
+class JitterBuffer {
+private:
+	static constexpr float ESTIMATE_GAIN = 1.0f / 16.0f;   // RFC 3550's jitter gain, also used for transit and spacing
+	static constexpr float JITTER_MULTIPLE = 4.0f;
+	static constexpr float MAX_DELAY = 200000.0f;
+	static constexpr float DELAY_SLEW = 0.1f;              // us of delay change per us of playout, so +-10% speed
+	static const int64_t MAX_EXTRAPOLATION = 2500000;      // two lost keyframes and then some
+	static const int64_t RESET_GAP = 1000000;             // samples this much older than the newest mean a restart
+	static constexpr float JUMP_DEGREES = 0.1f;            // a change of course bigger than this between playouts is eased
+	static constexpr float MAX_EASED_JUMP = 20.0f;         // bigger ones are a new course, not an error; snap to it
+	static constexpr float EASE_MICROS = 250000.0f;        // time constant of the correction's decay
+
+	TargetSample samples[CAPACITY];
+	uint8_t count = 0;
+
+	bool estimating = false;
+	float previousTransit = 0.0f;
+	float transit = 0.0f;
+	float spacing = 0.0f;
+	float jitter = 0.0f;
+
+	float delay = 0.0f;
+	int64_t lastPlayoutNow = 0;
+	int64_t playedMicros = INT64_MIN;  // playout point of the last playout(); older samples are of no further use
+
+	// The last playout before easing, and the correction eased into it
+	bool eased = false;
+	int64_t easedMicros = 0;
+	float rawAngle = 0.0f;
+	float rawRate = 0.0f;
+	float correction = 0.0f;
+
+	JitterStats counters;
+
+	static float unwrap(float degrees) {
+		degrees = fmodf(degrees, 360.0f);
+		if (degrees > 180.0f) degrees -= 360.0f;
+		if (degrees < -180.0f) degrees += 360.0f;
+		return degrees;
+	}
+
+	static float wrap360(float degrees) {
+		degrees = fmodf(degrees, 360.0f);
+		return degrees < 0.0f ? degrees + 360.0f : degrees;
+	}
+
+	float targetDelay() const {
+		float target = transit + spacing + JITTER_MULTIPLE * jitter;
+		return fminf(fmaxf(target, 0.0f), MAX_DELAY);
+	}
+
+	// Takes a jump in `out` from where the last playout was heading up into the correction, and applies it
+	void ease(int64_t nowMicros, TargetPlayout& out) {
+		if (eased) {
+			float elapsed = float(nowMicros - easedMicros);
+			float jump = unwrap(out.angle - (rawAngle + rawRate * elapsed / 1e6f));
+			correction *= expf(-elapsed / EASE_MICROS);
+			if (fabsf(jump) > JUMP_DEGREES) {
+				correction -= jump;
+			}
+			if (fabsf(correction) > MAX_EASED_JUMP) {
+				correction = 0.0f;
+			}
+		}
+		eased = true;
+		easedMicros = nowMicros;
+		rawAngle = out.angle;
+		rawRate = out.rate;
+		out.angle = wrap360(out.angle + correction);
+	}
+
+	void removeOldest(uint8_t n) {
+		for (uint8_t i = n; i < count; i++) {
+			samples[i - n] = samples[i];
+		}
+		count -= n;
+	}
+
+public:
+	/**
+	 * Adds a sample that arrived at `arrivalMicros`
+	 */
+	void add(const TargetSample& sample, int64_t arrivalMicros) {
+		if (count > 0 && sample.masterMicros + RESET_GAP < samples[count - 1].masterMicros) {
+			clear();
+		}
+		counters.received++;
+
+		// RFC 3550: the jitter is the mean deviation of the difference in transit time between consecutive packets
+		float sampleTransit = float(arrivalMicros - sample.masterMicros);
+		if (!estimating) {
+			transit = sampleTransit;
+			estimating = true;
+		} else {
+			jitter += ESTIMATE_GAIN * (fabsf(sampleTransit - previousTransit) - jitter);
+			transit += ESTIMATE_GAIN * (sampleTransit - transit);
+		}
+		previousTransit = sampleTransit;
+
+		if (sample.masterMicros <= playedMicros) {
+			counters.late++;
+			return;
+		}
+
+		uint8_t position = count;
+		while (position > 0 && samples[position - 1].masterMicros > sample.masterMicros) {
+			position--;
+		}
+		if (position > 0 && samples[position - 1].masterMicros == sample.masterMicros) {
+			counters.duplicates++;
+			return;
+		}
+		if (position < count) {
+			counters.reordered++;
+		} else if (count > 0) {
+			spacing += ESTIMATE_GAIN * (float(sample.masterMicros - samples[count - 1].masterMicros) - spacing);
+		}
+
+		if (count == CAPACITY) {
+			if (position == 0) {
+				return;  // older than everything in a full buffer
+			}
+			removeOldest(1);
+			position--;
+		}
+		for (uint8_t i = count; i > position; i--) {
+			samples[i] = samples[i - 1];
+		}
+		samples[position] = sample;
+		count++;
+	}
+
+	/**
+	 * The target at `nowMicros`. Returns false while the buffer is empty. Calls should come with increasing times.
+	 */
+	bool playout(int64_t nowMicros, TargetPlayout& out) {
+		if (count == 0) {
+			return false;
+		}
+
+		// Move the delay toward the target slowly enough that the playout point keeps moving forward
+		float target = targetDelay();
+		if (lastPlayoutNow == 0) {
+			delay = target;
+		} else {
+			float step = DELAY_SLEW * float(nowMicros - lastPlayoutNow);
+			delay += fminf(fmaxf(target - delay, -step), step);
+		}
+		lastPlayoutNow = nowMicros;
+
+		int64_t point = nowMicros - int64_t(delay);
+		if (point < playedMicros) {
+			point = playedMicros;
+		}
+		playedMicros = point;
+
+		// Drop the samples before the one at or just before the playout point
+		uint8_t before = 0;
+		while (before + 1 < count && samples[before + 1].masterMicros <= point) {
+			before++;
+		}
+		removeOldest(before);
+
+		const TargetSample& newest = samples[count - 1];
+		out = TargetPlayout();
+		if (count >= 2 && samples[0].masterMicros <= point) {
+			// Hermite interpolation between the samples around the playout point, then on to now at the rate there
+			const TargetSample& a = samples[0];
+			const TargetSample& b = samples[1];
+			float span = float(b.masterMicros - a.masterMicros) / 1e6f;
+			float t = float(point - a.masterMicros) / 1e6f / span;
+			float t2 = t * t;
+			float t3 = t2 * t;
+			float distance = unwrap(b.angle - a.angle);
+			float angle = (t3 - 2.0f * t2 + t) * a.rate * span
+			            + (-2.0f * t3 + 3.0f * t2) * distance
+			            + (t3 - t2) * b.rate * span;
+			float rate = (6.0f * t - 6.0f * t2) * distance / span
+			           + (3.0f * t2 - 4.0f * t + 1.0f) * a.rate
+			           + (3.0f * t2 - 2.0f * t) * b.rate;
+			out.angle = wrap360(a.angle + angle + rate * float(nowMicros - point) / 1e6f);
+			out.rate = rate;
+			out.velocity = a.velocity;
+			ease(nowMicros, out);
+			return true;
+		}
+
+		// Past the newest sample (or before the only one): dead reckon from it
+		int64_t age = nowMicros - newest.masterMicros;
+		out.extrapolated = true;
+		if (age > MAX_EXTRAPOLATION) {
+			age = MAX_EXTRAPOLATION;
+			out.stale = true;
+		}
+		out.angle = wrap360(newest.angle + newest.rate * float(age) / 1e6f);
+		out.rate = out.stale ? 0.0f : newest.rate;
+		out.velocity = out.stale ? 0.0f : newest.velocity;
+		ease(nowMicros, out);
+		return true;
+	}
+
+	void clear() {
+		count = 0;
+		estimating = false;
+		spacing = 0.0f;
+		jitter = 0.0f;
+		lastPlayoutNow = 0;
+		playedMicros = INT64_MIN;
+		eased = false;
+		correction = 0.0f;
+	}
+
+	JitterStats stats() const {
+		JitterStats copy = counters;
+		copy.jitterMicros = jitter;
+		copy.delayMicros = delay;
+		return copy;
+	}
+};
+
+#endif // JITTERBUFFER_HPP
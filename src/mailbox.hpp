@@ -0,0 +1,78 @@
+#ifndef MAILBOX_HPP
+#define MAILBOX_HPP
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Single-writer mailbox that always holds the most recently published value.
+ *
+ * The value is double-buffered behind a seqlock: the writer fills the slot readers are not using and then
+ * bumps the sequence, so publishing never blocks and readers only retry if the writer laps them twice
+ * during a single copy. T must be trivially copyable.
+ *
+ * The slots are copied as atomic words rather than plain memory, so a reader overlapping a publish is not a data
+ * race under the C++ memory model. The words are stored with release and loaded with acquire, rather than relying on
+ * fences, so a word a reader gets from an unfinished publish also shows it the publish's in-progress sequence.
+ * ThreadSanitizer follows that, where it does not follow fences (see sim/mailbox_stress.cpp); on the ESP32 the
+ * orderings only add memory barriers around the word copies.
+ */
+template <typename T>
+class Mailbox {
+private:
+	static const size_t WORDS = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+	std::atomic<uint32_t> slots[2][WORDS];
+	std::atomic<uint32_t> sequence{0};  // twice the number of publishes, plus one while a publish is in progress
+
+public:
+	/**
+	 * Publishes a new value. Must only be called from one task.
+	 */
+	void publish(const T& value) {
+		uint32_t current = sequence.load(std::memory_order_relaxed);
+		uint32_t index = (current >> 1) + 1;
+		sequence.store(current + 1, std::memory_order_relaxed);
+		uint32_t words[WORDS] = {};
+		memcpy(words, &value, sizeof(T));
+		std::atomic<uint32_t>* slot = slots[index & 1];
+		for (size_t i = 0; i < WORDS; i++) {
+			slot[i].store(words[i], std::memory_order_release);  // not before the in-progress sequence
+		}
+		sequence.store(current + 2, std::memory_order_release);
+	}
+
+	/**
+	 * Copies the most recently published value into `out`. Returns false if nothing was published yet.
+	 */
+	bool read(T& out) const {
+		while (true) {
+			uint32_t before = sequence.load(std::memory_order_acquire);
+			uint32_t index = before >> 1;
+			if (index == 0) {
+				return false;
+			}
+			uint32_t words[WORDS];
+			const std::atomic<uint32_t>* slot = slots[index & 1];
+			for (size_t i = 0; i < WORDS; i++) {
+				words[i] = slot[i].load(std::memory_order_acquire);  // not after the second load of the sequence
+			}
+			// Publish index + 2 reuses our slot, and it marks itself in progress with 2 * index + 3 before writing
+			uint32_t after = sequence.load(std::memory_order_relaxed);
+			if (after - 2 * index < 3) {
+				memcpy(&out, words, sizeof(T));
+				return true;
+			}
+		}
+	}
+
+	/**
+	 * Number of values published so far.
+	 */
+	uint32_t count() const {
+		return sequence.load(std::memory_order_acquire) >> 1;
+	}
+};
+
+#endif // MAILBOX_HPP
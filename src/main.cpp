@@ -28,6 +28,8 @@ int led_count_this_ring_inside = 0;
 
 const float alpha_short = 1.0 / (50.0 * 1.0); // roughly 1 seconds
 
+uint32_t analysisHandoffMicros = 0; // age of the analysis frame when loop() picked it up
+
 int deviceIndex = -1;
 
 State state;
@@ -68,8 +70,6 @@ void setup() {
 	delay(1000);
 	Serial.println("Done waiting");
 
-	Synchronizer::instance = &synchronizer;
-	Serial.println("Synchronizer instance created");
 	synchronizer.init();
 
 	// This must be done after synchronizer.init()
@@ -78,6 +78,7 @@ void setup() {
 
 	if (synchronizer.role == MASTER) {
 		setupAsyncSampling();
+		setupBeatDetection();
 		setupBluetooth();
 	} else if (synchronizer.role == RING) {
 		servoController.setupServo();
@@ -108,13 +109,19 @@ void loop() {
 	#else
 
     // On the master node, step the trajectory forward at 10 RPM
+	bool stateArrived = false;
 	if (synchronizer.role == MASTER) {
 		trajectoryPlanner.update(state);
 		state.frame++;
 		state.time = millis();
+		state.shared_micros = synchronizer.sharedMicros();
+	} else {
+		// Render this frame from one consistent copy of the latest state the master sent
+		stateArrived = synchronizer.applyReceivedState();
 	}
 
-	if (state.frame % 30 == 0) {
+	// The master only sends the frame counter along with something else, so rings go by what arrives
+	if (synchronizer.role == MASTER ? state.frame % 30 == 0 : stateArrived) {
 		uint8_t brightness = state.brightness;
 		if (deviceIndex == 5)	{
 			brightness = 255; // sphere always at max brightness
@@ -123,19 +130,44 @@ void loop() {
 	}
 
 	if (synchronizer.role == MASTER) {
-		state.beat_intensity = computeBeatHeuristic();
+		// The analysis task runs the FFT and beat heuristic; just pick up its latest result, with the peak intensity of
+		// the frames since the last one so no beat falls between two loop() iterations
+		AnalysisFrame analysis;
+		if (readAnalysisFrame(analysis)) {
+			state.beat_intensity = analysis.peakIntensity;
+			state.lastBeatTimestamp = analysis.lastBeatTimestamp;
+			state.elapsedBeats = analysis.elapsedBeats;
+			state.lastOnsetTimestamp = analysis.lastOnsetTimestamp;
+			state.beat_phase = analysis.beatPhase;
+			state.beat_period = analysis.beatClockLocked ? analysis.beatPeriod : 0.0f;
+			state.next_beat_timestamp = analysis.nextBeatTimestamp;
+			state.section = analysis.section;
+			state.tension = analysis.tension;
+			analysisHandoffMicros = micros() - analysis.publishedMicros;
+		}
 	} else if (synchronizer.role == RING) {
-		servoController.runServo();
-		shaderManager.run(state.frame, state.beat_intensity);
+		if (shaderManager.layoutIndex != ledLayoutIndex()) {
+			shaderManager.relayout();  // the master assigned this ring another index than it booted with
+		}
+		servoController.runServo(synchronizer.updateServoTarget());
+		shaderManager.run(synchronizer.sharedFrame(), state.beat_intensity * sectionIntensityScale(state.section, state.tension));
 	} else if (synchronizer.role == BASE) {
-		shaderManager.run(state.frame, state.beat_intensity);	
+		shaderManager.run(synchronizer.sharedFrame(), state.beat_intensity * sectionIntensityScale(state.section, state.tension));
 	}
 
 	#if PRINT_SUMMARY
 		Serial.print("Updates per second: ");
 		Serial.print(state.updatesPerSecond);
 		Serial.print("  |  Beat heuristic: ");
-		Serial.println(state.beat_intensity);
+		Serial.print(state.beat_intensity);
+		if (synchronizer.role == MASTER) {
+			Serial.printf("  |  Audio blocks dropped: %lu  overwritten: %lu  |  Analysis handoff: %lu us  |  Sampling stack unused: %lu B",
+						  (unsigned long)droppedAudioBlocks(),
+						  (unsigned long)overwrittenAudioBlocks(),
+						  (unsigned long)analysisHandoffMicros,
+						  (unsigned long)samplingStackUnused());
+		}
+		Serial.println("");
 		// Serial.print("Active shader: ");
 		// Serial.println(shaderManager.activeShader->getName());
 		// Serial.print("Active accent shader: ");
@@ -146,6 +178,7 @@ void loop() {
 
 	// Send synchronization data via ESP-NOW
 	synchronizer.synchronize();
+	synchronizer.handleSerialCommands();
 
 	#endif // BLUETOOTH_DEBUG_MODE
 
@@ -0,0 +1,110 @@
+#ifndef ONSET_HPP
+#define ONSET_HPP
+
+#include <math.h>
+#include <stdint.h>
+
+/**
+ * Second-order IIR section (transposed direct form II)
+ */
+struct Biquad {
+	float b0 = 1.0f, b1 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f;
+	float z1 = 0.0f, z2 = 0.0f;
+
+	// RBJ cookbook band-pass with 0 dB peak gain
+	static Biquad bandPass(float centerHz, float q, float sampleRate) {
+		Biquad f;
+		float w0 = 2.0f * float(M_PI) * centerHz / sampleRate;
+		float alpha = sinf(w0) / (2.0f * q);
+		float a0 = 1.0f + alpha;
+		f.b0 = alpha / a0;
+		f.b1 = 0.0f;
+		f.b2 = -alpha / a0;
+		f.a1 = -2.0f * cosf(w0) / a0;
+		f.a2 = (1.0f - alpha) / a0;
+		return f;
+	}
+
+	inline float process(float x) {
+		float y = b0 * x + z1;
+		z1 = b1 * x - a1 * y + z2;
+		z2 = b2 * x - a2 * y;
+		return y;
+	}
+};
+
+/**
+ * Low-latency kick onset detector that runs directly on the sample stream.
+ *
+ * A small bank of band-passes around the kick fundamental feeds fast-attack/slow-release envelope followers.
+ * Each envelope is compared against its own slowly adapting floor, and an onset fires when the average
+ * envelope-to-floor ratio crosses a threshold, so the detector reacts within a few samples of the attack
+ * instead of waiting for a whole FFT window.
+ */
+class OnsetDetector {
+private:
+	static const int NUM_FILTERS = 3;
+	Biquad filters[NUM_FILTERS];
+	float envelopes[NUM_FILTERS] = {};
+	float floors[NUM_FILTERS] = {};
+
+	float attackCoef;
+	float releaseCoef;
+	float floorCoef;           // per-block EMA coefficient of the envelope floors
+	float threshold = 2.2f;    // average envelope/floor ratio that counts as an onset
+	float minFloor = 200.0f;   // keeps the ratio from blowing up in silence; same scale as NOISE in fft.cpp
+	uint32_t refractorySamples;
+	uint32_t samplesSinceOnset = 0;
+	bool armed = true;         // re-armed once the ratio falls back below the threshold
+
+public:
+	OnsetDetector(float centerHz, float sampleRate, float refractoryMs) {
+		const float ratios[NUM_FILTERS] = { 0.6f, 1.0f, 1.5f };
+		for (int i = 0; i < NUM_FILTERS; i++) {
+			filters[i] = Biquad::bandPass(centerHz * ratios[i], 1.4f, sampleRate);
+		}
+		attackCoef = 1.0f - expf(-1.0f / (0.001f * sampleRate));   // ~1 ms attack
+		releaseCoef = 1.0f - expf(-1.0f / (0.050f * sampleRate));  // ~50 ms release
+		floorCoef = 0.004f;                                         // ~1 s at 64-sample blocks and 16 kHz
+		refractorySamples = uint32_t(refractoryMs * 0.001f * sampleRate);
+		samplesSinceOnset = refractorySamples;
+	}
+
+	/**
+	 * Runs one block of samples through the filterbank. Returns the index within the block of the sample an
+	 * onset was detected on, or -1 if there was none.
+	 */
+	int processBlock(const int16_t* samples, uint16_t count) {
+		int detected = -1;
+		for (uint16_t n = 0; n < count; n++) {
+			float x = float(samples[n]);
+			float ratio = 0.0f;
+			for (int i = 0; i < NUM_FILTERS; i++) {
+				float y = fabsf(filters[i].process(x));
+				float coef = y > envelopes[i] ? attackCoef : releaseCoef;
+				envelopes[i] += coef * (y - envelopes[i]);
+				ratio += envelopes[i] / (floors[i] > minFloor ? floors[i] : minFloor);
+			}
+			ratio /= NUM_FILTERS;
+
+			samplesSinceOnset++;
+			if (ratio > threshold) {
+				if (armed && samplesSinceOnset >= refractorySamples) {
+					samplesSinceOnset = 0;
+					detected = n;
+				}
+				armed = false;
+			}
+			else {
+				armed = true;
+			}
+		}
+
+		for (int i = 0; i < NUM_FILTERS; i++) {
+			floors[i] += floorCoef * (envelopes[i] - floors[i]);
+		}
+		return detected;
+	}
+};
+
+#endif // ONSET_HPP
@@ -0,0 +1,267 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "clocksync.hpp"
+#include "jitterbuffer.hpp"
+#include "replication.hpp"
+#include "rings.hpp"
+#include "state.hpp"
+#include "wire.hpp"
+
+/*
+ * The steps of the master/ring protocol: joining, feedback, clock pings and the state broadcasts.
+ *
+ * They are plain functions over the protocol's own state, and send through any `tx` with Transmitter's
+ * send(destination, type, data, length, repeats), so synchronize.hpp runs them on the devices and sim/swarm.cpp runs
+ * the same ones on the host. Times are passed in; what to do with the radio, Preferences or the LEDs is left to the
+ * caller, going by what the functions return.
+ */
+
+#define STATE_BROADCAST_REPEATS 2  // copies of each state packet; broadcasts are not acknowledged or retried
+#define ANNOUNCE_INTERVAL_MICROS 500000  // how often a ring without an index asks the master for one
+#define RING_TIMEOUT_MILLIS 5000  // a ring the master has not heard from in this long is evicted, freeing its index
+
+static const uint8_t BROADCAST_ALL[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+// The rings on the master, indexed by ring index
+struct MasterRings {
+	RingDirectory directory;
+	float angles[MAX_RINGS] = {};
+	WireLinkStats links[MAX_RINGS];            // as last reported by each ring
+	unsigned long heartbeats[MAX_RINGS] = {};  // millis() when each ring was last heard from
+	uint16_t assignSequence = 0;
+	uint32_t feedbackReceived = 0;
+};
+
+// What handleRingPacket() made of a packet on the master
+enum class RingPacket : uint8_t {
+	Other,     // not an announcement or feedback
+	Joined,    // a ring that had not joined was given an index
+	Assigned,  // a ring that had joined was told its index again
+	Feedback,  // a joined ring reported its angle and link stats
+	Full,      // a ring could not join, as every index is taken
+};
+
+/**
+ * On the master: gives the ring with this MAC an index, `preferred` if it is free, and tells the ring. A new ring is
+ * passed to `addPeer(mac)` first, as unicasts only reach peers and the transmit task may send the assignment before
+ * the caller gets to it. Returns the index, or NO_RING if every index is taken; `added` says whether the ring is new.
+ */
+template <typename Sender, typename AddPeer>
+uint8_t joinRing(MasterRings& rings, const uint8_t* mac, uint8_t preferred, Sender& tx, AddPeer& addPeer, bool& added) {
+	uint8_t known = rings.directory.count();
+	uint8_t index = rings.directory.join(mac, preferred);
+	added = rings.directory.count() != known;
+	if (index == NO_RING) {
+		return NO_RING;
+	}
+	if (added) {
+		addPeer(mac);
+	}
+	uint8_t packet[WIRE_MAX_PACKET_SIZE];
+	size_t length = encodeRingIndex(WireMessage::Assign, index, ++rings.assignSequence, packet, sizeof(packet));
+	tx.send(mac, WireMessage::Assign, packet, length);
+	return index;
+}
+
+/**
+ * On the master: answers a ring's clock ping with a pong stamped with when the ping arrived and when the pong is
+ * sent. Returns false if the packet is not a ping.
+ */
+template <typename Sender>
+bool answerPing(const uint8_t* mac, const uint8_t* data, int length, int64_t receivedMicros, int64_t sentMicros, Sender& tx) {
+	int64_t pingTime;
+	uint16_t pingId;
+	if (!decodePing(data, length, pingTime, pingId)) {
+		return false;
+	}
+	uint8_t packet[WIRE_MAX_PACKET_SIZE];
+	size_t size = encodePong(pingTime, receivedMicros, sentMicros, pingId, packet, sizeof(packet));
+	tx.send(mac, WireMessage::TimePong, packet, size);
+	return true;
+}
+
+/**
+ * On the master: joins a ring that announces itself, and records a ring's feedback. A ring that sends feedback under
+ * an index the master does not know it by, because it joined before the master restarted or missed its assignment,
+ * joins again first. Rings that join are passed to `addPeer` (see joinRing()).
+ */
+template <typename Sender, typename AddPeer>
+RingPacket handleRingPacket(MasterRings& rings, const uint8_t* mac, const uint8_t* data, int length, unsigned long nowMillis,
+							Sender& tx, AddPeer addPeer) {
+	bool added = false;
+	uint8_t preferred;
+	if (decodeRingIndex(data, length, WireMessage::Announce, preferred)) {
+		uint8_t index = joinRing(rings, mac, preferred, tx, addPeer, added);
+		if (index == NO_RING) {
+			return RingPacket::Full;
+		}
+		rings.heartbeats[index] = nowMillis;
+		return added ? RingPacket::Joined : RingPacket::Assigned;
+	}
+
+	WireFeedback feedback;
+	if (!decodeFeedback(data, length, feedback)) {
+		return RingPacket::Other;
+	}
+	uint8_t index = rings.directory.find(mac);
+	bool rejoined = index == NO_RING || index != feedback.ringIndex;
+	if (rejoined) {
+		index = joinRing(rings, mac, feedback.ringIndex, tx, addPeer, added);
+		if (index == NO_RING) {
+			return RingPacket::Full;
+		}
+	}
+	rings.feedbackReceived++;
+	rings.angles[index] = feedback.angle;
+	rings.links[index] = feedback.link;
+	rings.heartbeats[index] = nowMillis;
+	return added ? RingPacket::Joined : rejoined ? RingPacket::Assigned : RingPacket::Feedback;
+}
+
+/**
+ * On the master: evicts the rings it has not heard from in RING_TIMEOUT_MILLIS, so a board that was replaced or
+ * switched off gives its index back and the state stops carrying its target. Each is passed to
+ * `removePeer(mac, index)` before it goes. Returns how many rings were evicted.
+ */
+template <typename RemovePeer>
+uint8_t evictSilentRings(MasterRings& rings, unsigned long nowMillis, RemovePeer removePeer) {
+	uint8_t evicted = 0;
+	for (uint8_t index = 0; index < MAX_RINGS; index++) {
+		const uint8_t* mac = rings.directory.mac(index);
+		if (mac == nullptr || nowMillis - rings.heartbeats[index] < RING_TIMEOUT_MILLIS) {
+			continue;
+		}
+		removePeer(mac, index);
+		rings.directory.remove(index);
+		rings.angles[index] = 0.0f;
+		rings.links[index] = WireLinkStats();
+		evicted++;
+	}
+	return evicted;
+}
+
+/**
+ * On the master: broadcasts what the rings need of the state, if anything (see StateReplicator), in one packet
+ * repeated STATE_BROADCAST_REPEATS times with the same sequence number so the rings can drop the copies. Returns the
+ * packet's length, 0 if there was nothing to send.
+ */
+template <typename Sender>
+size_t broadcastState(StateReplicator& replicator, const State& st, uint16_t& sequence, Sender& tx) {
+	uint8_t packet[WIRE_MAX_PACKET_SIZE];
+	size_t length = replicator.encode(st, sequence + 1, packet, sizeof(packet));
+	if (length == 0) {
+		return 0;
+	}
+	sequence++;
+	tx.send(BROADCAST_ALL, WireMessage::State, packet, length, STATE_BROADCAST_REPEATS);
+	return length;
+}
+
+// What receiveFromMaster() made of a packet on a ring
+enum class MasterPacket : uint8_t {
+	Other,   // nothing to act on: not from the master, a repeat, or a pong ClockSync discarded
+	Clock,   // a pong that updated the clock estimate
+	Assign,  // the master assigned this ring an index
+	State,   // a new state
+};
+
+// A ring's view of the master's state broadcasts
+struct StateReceiver {
+	SequenceTracker tracker;
+	State state;  // the fields the master sent, decoded onto the last state received
+};
+
+/**
+ * On a ring: takes in a packet from the master. Pongs go to `clockSync`, an assigned index to `assigned`, and a state
+ * packet that is not a repeat is decoded onto `receiver.state`.
+ */
+inline MasterPacket receiveFromMaster(StateReceiver& receiver, ClockSync& clockSync, const uint8_t* data, int length, int64_t receivedMicros, uint8_t& assigned) {
+	int64_t t1, t2, t3;
+	if (decodePong(data, length, t1, t2, t3)) {
+		return clockSync.addSample(t1, t2, t3, receivedMicros) ? MasterPacket::Clock : MasterPacket::Other;
+	}
+	if (decodeRingIndex(data, length, WireMessage::Assign, assigned)) {
+		return MasterPacket::Assign;
+	}
+	State received = receiver.state;
+	uint16_t sequence;
+	if (decodeState(data, length, received, &sequence) && receiver.tracker.accept(sequence)) {
+		receiver.state = received;
+		return MasterPacket::State;
+	}
+	return MasterPacket::Other;
+}
+
+/**
+ * On a ring: adds ring `index`'s target from a received state to the jitter buffer, once both ends agree on the
+ * time. SharedTime only comes with the targets, so a state with the shared_micros of the newest buffered target is a
+ * delta that left them out. Returns whether the target was added.
+ */
+template <uint8_t CAPACITY>
+bool bufferTarget(JitterBuffer<CAPACITY>& buffer, int64_t& bufferedMicros, const State& state, uint8_t index,
+				  const ClockEstimate& estimate, int64_t receivedMicros) {
+	if (index >= state.ring_count || state.shared_micros == 0 || state.shared_micros == bufferedMicros || !estimate.synchronized()) {
+		return false;
+	}
+	TargetSample target;
+	target.masterMicros = state.shared_micros;
+	target.angle = state.target_angle[index];
+	target.rate = state.target_angle_rate[index];
+	target.velocity = state.target_angular_velocity[index];
+	buffer.add(target, estimate.toMaster(receivedMicros));
+	bufferedMicros = state.shared_micros;
+	return true;
+}
+
+// A ring's side of the joining handshake, feedback and clock pings
+struct RingLink {
+	uint8_t masterMac[6] = {};
+	bool masterKnown = false;  // learned from the state broadcasts
+	int64_t nextAnnounceMicros = 0;
+	int64_t nextPingMicros = 0;
+	uint16_t announceSequence = 0;
+	uint16_t feedbackSequence = 0;
+	uint16_t pingSequence = 0;
+};
+
+/**
+ * On a ring, once per loop: asks for an index, `preferred` if it has one, until the master assigns one; then reports
+ * its angle and how many of the state broadcasts made it here; and pings the master for clock synchronization as
+ * often as the estimate asks. The ping is stamped when queued, so time spent in the queue counts as round trip, and
+ * ClockSync skips those samples.
+ */
+template <typename Sender>
+void ringTick(RingLink& link, uint8_t assigned, uint8_t preferred, float angle, const WireLinkStats& received,
+			  const ClockEstimate& estimate, int64_t nowMicros, Sender& tx) {
+	uint8_t packet[WIRE_MAX_PACKET_SIZE];
+	size_t length;
+	if (assigned == NO_RING && nowMicros >= link.nextAnnounceMicros) {
+		link.nextAnnounceMicros = nowMicros + ANNOUNCE_INTERVAL_MICROS;
+		length = encodeRingIndex(WireMessage::Announce, preferred, ++link.announceSequence, packet, sizeof(packet));
+		tx.send(link.masterKnown ? link.masterMac : BROADCAST_ALL, WireMessage::Announce, packet, length);
+	}
+	if (!link.masterKnown) {
+		return;
+	}
+
+	if (assigned != NO_RING) {
+		WireFeedback feedback;
+		feedback.angle = angle;
+		feedback.ringIndex = assigned;
+		feedback.link = received;
+		length = encodeFeedback(feedback, ++link.feedbackSequence, packet, sizeof(packet));
+		tx.send(link.masterMac, WireMessage::Feedback, packet, length);
+	}
+
+	if (nowMicros >= link.nextPingMicros) {
+		link.nextPingMicros = nowMicros + estimate.pingIntervalMicros();
+		length = encodePing(nowMicros, ++link.pingSequence, packet, sizeof(packet));
+		tx.send(link.masterMac, WireMessage::TimePing, packet, length);
+	}
+}
+
+#endif // PROTOCOL_HPP
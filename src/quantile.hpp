@@ -0,0 +1,123 @@
+#ifndef QUANTILE_HPP
+#define QUANTILE_HPP
+
+#include <math.h>
+#include <stdint.h>
+
+/**
+ * Order statistics over a sliding window of non-negative values.
+ *
+ * Values are counted in BINS log-spaced bins between minValue and maxValue (plus one underflow and one overflow
+ * bin), and the counts are kept in a Fenwick tree, so adding or removing a value and looking up a quantile are
+ * all O(log BINS) regardless of the window length. Quantiles are exact up to the bin width (a relative error of
+ * (maxValue/minValue)^(1/BINS) - 1); within a bin the result is interpolated by rank. The caller owns the window
+ * and removes each value as it slides out.
+ */
+template <uint16_t BINS>
+class SlidingQuantile {
+private:
+	static const uint16_t TOTAL_BINS = BINS + 2;  // bin 0 is the underflow bin, bin BINS + 1 the overflow bin
+
+	uint16_t tree[TOTAL_BINS + 1] = {};  // Fenwick tree over the bin counts, 1-based
+	uint16_t counts[TOTAL_BINS] = {};
+	uint16_t total = 0;
+
+	float minValue;
+	float logMin;
+	float binsPerLog;
+	float logPerBin;
+
+	uint16_t binOf(float value) const {
+		if (!(value >= minValue)) {  // also catches NaN
+			return 0;
+		}
+		float position = (logf(value) - logMin) * binsPerLog;
+		if (position >= float(BINS)) {
+			return BINS + 1;
+		}
+		return 1 + uint16_t(position);
+	}
+
+	void update(uint16_t bin, int32_t delta) {
+		counts[bin] += delta;
+		for (uint16_t i = bin + 1; i <= TOTAL_BINS; i += i & -i) {
+			tree[i] += delta;
+		}
+	}
+
+public:
+	SlidingQuantile(float minValue, float maxValue)
+		: minValue(minValue),
+		  logMin(logf(minValue)),
+		  binsPerLog(float(BINS) / (logf(maxValue) - logf(minValue))),
+		  logPerBin((logf(maxValue) - logf(minValue)) / float(BINS)) {}
+
+	void add(float value) {
+		update(binOf(value), 1);
+		total++;
+	}
+
+	/**
+	 * Adds `count` copies of a value, e.g. to mirror a zero-initialized window
+	 */
+	void add(float value, uint16_t count) {
+		update(binOf(value), count);
+		total += count;
+	}
+
+	/**
+	 * Removes a value that was previously added; it is binned the same way, so it must be bit-identical
+	 */
+	void remove(float value) {
+		update(binOf(value), -1);
+		total--;
+	}
+
+	uint16_t size() const {
+		return total;
+	}
+
+	/**
+	 * Returns the value with `rank` smaller values in the window, i.e. what std::nth_element would put at `rank`
+	 */
+	float select(uint16_t rank) const {
+		if (total == 0) {
+			return 0.0f;
+		}
+		if (rank >= total) {
+			rank = total - 1;
+		}
+
+		// Descend the Fenwick tree to the last bin whose prefix count is still <= rank
+		uint16_t position = 0;
+		uint16_t remaining = rank;
+		uint16_t step = 1;
+		while (2 * step <= TOTAL_BINS) step <<= 1;
+		for (; step > 0; step >>= 1) {
+			if (position + step <= TOTAL_BINS && tree[position + step] <= remaining) {
+				position += step;
+				remaining -= tree[position];
+			}
+		}
+		uint16_t bin = position;  // 0-based bin containing the value, `remaining` values into it
+
+		if (bin == 0) {
+			return minValue;
+		}
+		if (bin == BINS + 1) {
+			return expf(logMin + float(BINS) * logPerBin);
+		}
+		float fraction = (float(remaining) + 0.5f) / float(counts[bin]);
+		return expf(logMin + (float(bin - 1) + fraction) * logPerBin);
+	}
+
+	/**
+	 * Returns the `percent` (0-100) percentile of the window, using the same rank as ceil(percent / 100 * size) - 1
+	 */
+	float percentile(float percent) const {
+		int rank = int(ceilf(percent / 100.0f * float(total))) - 1;
+		return select(rank < 0 ? 0 : uint16_t(rank));
+	}
+};
+
+#endif // QUANTILE_HPP
@@ -0,0 +1,138 @@
+#ifndef REALFFT_HPP
+#define REALFFT_HPP
+
+#include <math.h>
+#include <stdint.h>
+
+#include "constmath.hpp"
+
+enum class RealFFTWindow { FlatTop, Hann };
+
+/**
+ * Twiddles, windows and the bit-reversal permutation of an N-point real FFT, built at compile time
+ */
+template <uint16_t N>
+struct RealFFTTables {
+	static const uint16_t HALF = N / 2;
+
+	float cosTable[HALF] = {};  // cos(2*pi*k/N)
+	float sinTable[HALF] = {};  // sin(2*pi*k/N)
+	float flatTop[N] = {};
+	float hann[N] = {};
+	uint16_t bitReverse[HALF] = {};
+
+	constexpr RealFFTTables() {
+		for (uint16_t k = 0; k < HALF; k++) {
+			cosTable[k] = float(constmath::cos(2.0 * constmath::pi * k / N));
+			sinTable[k] = float(constmath::sin(2.0 * constmath::pi * k / N));
+		}
+
+		// Same coefficients and symmetric indexing as ArduinoFFT's FFTWindow::Flat_top and FFTWindow::Hann
+		for (uint16_t i = 0; i < HALF; i++) {
+			float ratio = float(i) / float(N - 1);
+			float cos1 = float(constmath::cos(double(2.0f * float(constmath::pi) * ratio)));
+			float cos2 = float(constmath::cos(double(4.0f * float(constmath::pi) * ratio)));
+			float flat = 0.2810639f - (0.5208972f * cos1) + (0.1980399f * cos2);
+			float hannWeight = 0.54f * (1.0f - cos1);
+			flatTop[i] = flat;
+			flatTop[N - 1 - i] = flat;
+			hann[i] = hannWeight;
+			hann[N - 1 - i] = hannWeight;
+		}
+
+		uint16_t bits = 0;
+		while ((1u << bits) < HALF) bits++;
+		for (uint16_t i = 0; i < HALF; i++) {
+			uint16_t reversed = 0;
+			for (uint16_t b = 0; b < bits; b++) {
+				if (i & (1u << b)) reversed |= 1u << (bits - 1 - b);
+			}
+			bitReverse[i] = reversed;
+		}
+	}
+};
+
+/**
+ * FFT engine for real-valued audio windows.
+ *
+ * A real N-point FFT is computed as an N/2-point complex FFT over the even/odd sample pairs, followed by
+ * a split pass that recovers the N/2 bins of the real spectrum. Twiddles, the windows and the
+ * bit-reversal permutation are constexpr tables, so they live in flash and cost nothing at startup. DC
+ * removal and windowing are fused into the pass that loads the samples, and the magnitude is computed in
+ * the same pass as the split.
+ */
+template <uint16_t N>
+class RealFFT {
+private:
+	static const uint16_t HALF = N / 2;
+	static_assert(N >= 4 && (N & (N - 1)) == 0, "RealFFT size must be a power of 2");
+
+	static constexpr RealFFTTables<N> tables{};
+	static constexpr const float* cosTable = tables.cosTable;
+	static constexpr const float* sinTable = tables.sinTable;
+	static constexpr const uint16_t* bitReverse = tables.bitReverse;
+
+	const float* window;
+
+	float re[HALF];
+	float im[HALF];
+
+public:
+	RealFFT(RealFFTWindow windowType = RealFFTWindow::FlatTop)
+		: window(windowType == RealFFTWindow::Hann ? tables.hann : tables.flatTop) {}
+
+	/**
+	 * Computes the magnitude spectrum of N real samples into magnitudes[N/2], after removing the mean
+	 * and applying the window. The output matches ArduinoFFT's dcRemoval(), windowing(), compute(Forward)
+	 * and complexToMagnitude() sequence up to float rounding.
+	 */
+	template <typename T>
+	void magnitude(const T* samples, float* magnitudes) {
+		float mean = 0.0f;
+		for (uint16_t i = 0; i < N; i++) {
+			mean += float(samples[i]);
+		}
+		mean /= float(N);
+
+		// Pack even/odd samples into a half-size complex signal, in bit-reversed order
+		for (uint16_t n = 0; n < HALF; n++) {
+			uint16_t j = bitReverse[n];
+			re[j] = (float(samples[2 * n]) - mean) * window[2 * n];
+			im[j] = (float(samples[2 * n + 1]) - mean) * window[2 * n + 1];
+		}
+
+		// Radix-2 butterflies; the N/2-point twiddles are every other entry of the N-point table
+		for (uint16_t size = 2; size <= HALF; size <<= 1) {
+			uint16_t halfSize = size >> 1;
+			uint16_t step = N / size;
+			for (uint16_t start = 0; start < HALF; start += size) {
+				for (uint16_t j = 0; j < halfSize; j++) {
+					float wr = cosTable[j * step];
+					float wi = -sinTable[j * step];
+					uint16_t a = start + j;
+					uint16_t b = a + halfSize;
+					float tr = re[b] * wr - im[b] * wi;
+					float ti = re[b] * wi + im[b] * wr;
+					re[b] = re[a] - tr;
+					im[b] = im[a] - ti;
+					re[a] += tr;
+					im[a] += ti;
+				}
+			}
+		}
+
+		// Split the half-size spectrum Z into the real spectrum X[k] = E[k] + W^k O[k]
+		for (uint16_t k = 0; k < HALF; k++) {
+			uint16_t m = (HALF - k) & (HALF - 1);
+			float evenRe = 0.5f * (re[k] + re[m]);
+			float evenIm = 0.5f * (im[k] - im[m]);
+			float oddRe = 0.5f * (im[k] + im[m]);
+			float oddIm = -0.5f * (re[k] - re[m]);
+			float xr = evenRe + cosTable[k] * oddRe + sinTable[k] * oddIm;
+			float xi = evenIm + cosTable[k] * oddIm - sinTable[k] * oddRe;
+			magnitudes[k] = sqrtf(xr * xr + xi * xi);
+		}
+	}
+};
+
+#endif // REALFFT_HPP
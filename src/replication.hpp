@@ -0,0 +1,172 @@
+#ifndef REPLICATION_HPP
+#define REPLICATION_HPP
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "state.hpp"
+#include "wire.hpp"
+
+// What the master's state broadcasts have cost, for the bytes per second on the serial log
+struct ReplicationStats {
+	uint32_t ticks = 0;
+	uint32_t keyframes = 0;
+	uint32_t deltas = 0;
+	uint32_t skipped = 0;  // ticks where the rings could predict everything, so nothing was sent
+	uint64_t bytes = 0;    // state packet bytes, not counting repeats
+};
+
+/**
+ * Decides what of the master's State goes out each tick.
+ *
+ * Every KEYFRAME_INTERVAL the whole state goes out, for rings that just joined or missed a packet. In between, a
+ * delta carries only the fields that changed, and ticks where nothing did send nothing. Rings decode onto the
+ * state they have, so a delta is an ordinary state packet with fewer fields.
+ *
+ * The target angles move at constant rates that the rings dead reckon from SharedTime, so the targets are only
+ * resent when a ring's prediction would be more than TARGET_ERROR_DEGREES off, or a rate or velocity changes. The
+ * rate goes out in RingRates, with the targets: a ring whose wheel turns while its target angle holds still has a
+ * velocity but no rate. The same
+ * goes for the continuous audio values, within their own tolerances. beat_phase is never a reason to send: rings
+ * can work it out from next_beat_timestamp and beat_period.
+ *
+ * The replicator keeps what the rings decoded from the packets it built, quantization included, so its
+ * predictions match theirs exactly. That assumes the packets arrive, which broadcasts do not promise, and the
+ * transmit queue replaces a state packet still queued with the next one. So a group of fields that changed goes
+ * out again in the next DELTA_RESENDS deltas, sent for that alone if nothing else changed: a ring that misses a
+ * delta, or whose delta was replaced by the next one in the queue, catches up within DELTA_RESENDS ticks rather than
+ * at the next keyframe. A keyframe counts as a change of every group, so it is repeated the same way: otherwise one
+ * replaced in the queue would leave a ring that needs it waiting for the next.
+ */
+class StateReplicator {
+private:
+	static const int64_t KEYFRAME_INTERVAL = 1000000;  // us
+	static constexpr float TARGET_ERROR_DEGREES = 0.5f;
+	static constexpr float VELOCITY_ERROR = 0.25f;      // degrees per second
+	static constexpr float INTENSITY_ERROR = 0.05f;
+	static constexpr float TENSION_ERROR = 0.02f;
+	static const int32_t BEAT_TIME_ERROR = 10;          // ms
+	static const uint8_t DELTA_RESENDS = 3;             // deltas after a change that carry the changed group again
+
+	State sent;                 // the state as the rings have it
+	bool started = false;
+	int64_t nextKeyframeMicros = 0;
+	uint8_t resends[16] = {};   // by state field, how many more deltas carry it again
+	ReplicationStats counters;
+
+	static float unwrap(float degrees) {
+		degrees = fmodf(degrees, 360.0f);
+		if (degrees > 180.0f) degrees -= 360.0f;
+		if (degrees < -180.0f) degrees += 360.0f;
+		return degrees;
+	}
+
+	bool settingsChanged(const State& st) const {
+		return st.isPaused != sent.isPaused || st.brightness != sent.brightness || st.shader_index != sent.shader_index;
+	}
+
+	bool beatChanged(const State& st) const {
+		// Timestamps are compared as sent, relative to `time`, so one that saturates does not count as a change
+		return st.elapsedBeats != sent.elapsedBeats
+			|| millisToWire(st.lastBeatTimestamp, st.time) != millisToWire(sent.lastBeatTimestamp, st.time)
+			|| millisToWire(st.lastOnsetTimestamp, st.time) != millisToWire(sent.lastOnsetTimestamp, st.time)
+			|| fabsf(st.beat_intensity - sent.beat_intensity) > INTENSITY_ERROR;
+	}
+
+	bool beatClockChanged(const State& st) const {
+		int32_t nextBeat = millisToWire(st.time, st.next_beat_timestamp);
+		int32_t sentNextBeat = millisToWire(st.time, sent.next_beat_timestamp);
+		return unsignedToWire(st.beat_period, 16.0f) != unsignedToWire(sent.beat_period, 16.0f)
+			|| abs(nextBeat - sentNextBeat) > BEAT_TIME_ERROR;
+	}
+
+	bool structureChanged(const State& st) const {
+		return st.section != sent.section || fabsf(st.tension - sent.tension) > TENSION_ERROR;
+	}
+
+	bool targetsChanged(const State& st) const {
+		if (st.ring_count != sent.ring_count) {
+			return true;
+		}
+		float elapsed = float(st.shared_micros - sent.shared_micros) / 1e6f;
+		for (uint8_t i = 0; i < st.ring_count; i++) {
+			float predicted = sent.target_angle[i] + sent.target_angle_rate[i] * elapsed;
+			if (fabsf(unwrap(st.target_angle[i] - predicted)) > TARGET_ERROR_DEGREES
+				|| fabsf(st.target_angle_rate[i] - sent.target_angle_rate[i]) > VELOCITY_ERROR
+				|| fabsf(st.target_angular_velocity[i] - sent.target_angular_velocity[i]) > VELOCITY_ERROR) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+public:
+	/**
+	 * Encodes what the rings need of `st`, timed by its shared_micros. Returns the packet size, or 0 if there is
+	 * nothing to send this tick or the packet does not fit.
+	 */
+	size_t encode(const State& st, uint16_t sequence, uint8_t* buffer, size_t capacity) {
+		counters.ticks++;
+		WireFieldSet fields = 0;
+		bool keyframe = !started || st.shared_micros >= nextKeyframeMicros;
+		if (keyframe) {
+			fields = WIRE_STATE_FIELDS;
+		} else {
+			if (settingsChanged(st)) fields |= wireFieldBit(WireField::Settings);
+			if (beatChanged(st)) fields |= wireFieldBit(WireField::Beat);
+			if (beatClockChanged(st)) fields |= wireFieldBit(WireField::BeatClock);
+			if (structureChanged(st)) fields |= wireFieldBit(WireField::Structure);
+			if (targetsChanged(st)) fields |= wireFieldBit(WireField::RingTargets) | wireFieldBit(WireField::RingRates);
+		}
+		WireFieldSet changed = fields;
+		for (uint8_t field = 0; field < 16 && !keyframe; field++) {
+			if (resends[field] > 0) fields |= WireFieldSet(1u << field);
+		}
+		if (fields == 0) {
+			counters.skipped++;
+			return 0;
+		}
+
+		// The beat timestamps are relative to `time`, and the target angles to shared_micros
+		fields |= wireFieldBit(WireField::Clock);
+		if (fields & wireFieldBit(WireField::RingTargets)) {
+			fields |= wireFieldBit(WireField::SharedTime);
+		}
+
+		size_t length = encodeState(st, sequence, buffer, capacity, fields);
+		if (length == 0) {
+			return 0;
+		}
+		decodeState(buffer, length, sent);
+		for (uint8_t field = 0; field < 16; field++) {
+			if (changed & WireFieldSet(1u << field)) {
+				resends[field] = DELTA_RESENDS;
+			} else if (resends[field] > 0) {
+				resends[field]--;
+			}
+		}
+		if (keyframe) {
+			started = true;
+			nextKeyframeMicros = st.shared_micros + KEYFRAME_INTERVAL;
+			counters.keyframes++;
+		} else {
+			counters.deltas++;
+		}
+		counters.bytes += length;
+		return length;
+	}
+
+	/**
+	 * Sends the whole state on the next tick, e.g. for a ring that just joined
+	 */
+	void requestKeyframe() {
+		started = false;
+	}
+
+	const ReplicationStats& stats() const {
+		return counters;
+	}
+};
+
+#endif // REPLICATION_HPP
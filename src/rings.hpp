@@ -0,0 +1,126 @@
+#ifndef RINGS_HPP
+#define RINGS_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "state.hpp"
+
+#define NO_RING 0xFF
+
+/**
+ * The master's table of rings that have joined, by MAC address.
+ *
+ * Lookups hash the MAC into an open-addressing table twice the size of the ring count, so finding a ring takes one
+ * or two probes however many there are. A ring keeps its index until the master removes it, when it has not heard
+ * from it for a while (see evictSilentRings()); a ring that comes back after that asks for its old index again.
+ */
+class RingDirectory {
+private:
+	static const uint8_t SLOTS = 2 * MAX_RINGS;  // a power of two
+
+	uint8_t macs[MAX_RINGS][6];
+	bool taken[MAX_RINGS] = {};
+	uint8_t table[SLOTS] = {};  // ring index + 1, 0 for an empty slot
+	uint8_t joined = 0;
+	uint8_t highest = 0;        // one past the highest index taken
+
+	// FNV-1a; the low bits of a MAC alone are too alike across one vendor's boards
+	static uint8_t hash(const uint8_t mac[6]) {
+		uint32_t h = 2166136261u;
+		for (int i = 0; i < 6; i++) {
+			h = (h ^ mac[i]) * 16777619u;
+		}
+		return uint8_t((h ^ (h >> 16)) & (SLOTS - 1));
+	}
+
+	void insert(uint8_t index) {
+		uint8_t slot = hash(macs[index]);
+		while (table[slot] != 0) {
+			slot = (slot + 1) & (SLOTS - 1);
+		}
+		table[slot] = index + 1;
+	}
+
+public:
+	/**
+	 * The index of the ring with this MAC, or NO_RING if it has not joined
+	 */
+	uint8_t find(const uint8_t mac[6]) const {
+		for (uint8_t slot = hash(mac), probes = 0; probes < SLOTS; slot = (slot + 1) & (SLOTS - 1), probes++) {
+			if (table[slot] == 0) {
+				return NO_RING;
+			}
+			uint8_t index = table[slot] - 1;
+			if (memcmp(macs[index], mac, 6) == 0) {
+				return index;
+			}
+		}
+		return NO_RING;
+	}
+
+	/**
+	 * Joins a ring, giving it `preferred` if that index is free, or else the lowest free one. A ring that already
+	 * joined keeps its index. Returns NO_RING if the table is full.
+	 */
+	uint8_t join(const uint8_t mac[6], uint8_t preferred) {
+		uint8_t index = find(mac);
+		if (index != NO_RING) {
+			return index;
+		}
+		if (preferred < MAX_RINGS && !taken[preferred]) {
+			index = preferred;
+		} else {
+			for (uint8_t i = 0; i < MAX_RINGS && index == NO_RING; i++) {
+				if (!taken[i]) index = i;
+			}
+			if (index == NO_RING) {
+				return NO_RING;
+			}
+		}
+
+		memcpy(macs[index], mac, 6);
+		taken[index] = true;
+		insert(index);
+		joined++;
+		if (index + 1 > highest) highest = index + 1;
+		return index;
+	}
+
+	/**
+	 * Takes the ring with this index out, freeing the index
+	 */
+	void remove(uint8_t index) {
+		if (index >= MAX_RINGS || !taken[index]) {
+			return;
+		}
+		taken[index] = false;
+		joined--;
+		// Linear probing has no cheap delete, and there are only MAX_RINGS entries: build the table again
+		memset(table, 0, sizeof(table));
+		highest = 0;
+		for (uint8_t i = 0; i < MAX_RINGS; i++) {
+			if (taken[i]) {
+				insert(i);
+				highest = i + 1;
+			}
+		}
+	}
+
+	const uint8_t* mac(uint8_t index) const {
+		return index < MAX_RINGS && taken[index] ? macs[index] : nullptr;
+	}
+
+	uint8_t count() const {
+		return joined;
+	}
+
+	/**
+	 * One past the highest index of the rings in the table, i.e. how many targets the state has to carry
+	 */
+	uint8_t span() const {
+		return highest;
+	}
+};
+
+#endif // RINGS_HPP
@@ -45,7 +45,7 @@ private:
 	};
 
 public:
-	int   ringIndex        = 0;          // 1…6  (0 = master / unused)
+	int   ringIndex        = -1;         // this ring's index in the state, -1 until it has one
 	unsigned long lastStateReceived = 0; // ms
 	float target_angle = 0.0;  // Target angle in degrees for this servo
 	float target_angular_velocity = 0.0; // Target angular velocity in degrees per second
@@ -66,13 +66,16 @@ public:
 
 	}
 
-	void runServo() {
+	/**
+	 * `targetAge` is how long ago, in seconds, the master set target_angle and target_angular_velocity
+	 */
+	void runServo(float targetAge) {
 	    if (state.isPaused) {
 	        servo.hold();
 	    } else {
 			#if USE_CUSTOM_PD_CONTROLLER
 			/* --- predict where the master wants me *now* --- */
-			float dt = (millis() - lastStateReceived) / 1000.0f;   // seconds
+			float dt = targetAge;   // seconds, on the shared clock so transmission delays are accounted for
 			float predicted = wrap360(target_angle + target_angular_velocity * dt); // linear extrapolation
 			if (predicted < 0) predicted += 360.0f;
 
@@ -126,12 +129,9 @@ public:
 		// Pretty print a table
 		Serial.println(F("\nRing   Target°   Currnt°   ω (°/s)"));
 		Serial.println(F("----   --------  --------   --------"));
-		Serial.printf("  1    %8.1f   %8.1f   %8.1f\n", state.target_angle_1, ringIndex == 1 ? current_angle : 0., state.target_angular_velocity_1);
-		Serial.printf("  2    %8.1f   %8.1f   %8.1f\n", state.target_angle_2, ringIndex == 2 ? current_angle : 0., state.target_angular_velocity_2);
-		Serial.printf("  3    %8.1f   %8.1f   %8.1f\n", state.target_angle_3, ringIndex == 3 ? current_angle : 0., state.target_angular_velocity_3);
-		Serial.printf("  4    %8.1f   %8.1f   %8.1f\n", state.target_angle_4, ringIndex == 4 ? current_angle : 0., state.target_angular_velocity_4);
-		Serial.printf("  5    %8.1f   %8.1f   %8.1f\n", state.target_angle_5, ringIndex == 5 ? current_angle : 0., state.target_angular_velocity_5);
-		Serial.printf("  6    %8.1f   %8.1f   %8.1f\n", state.target_angle_6, ringIndex == 6 ? current_angle : 0., state.target_angular_velocity_6);	
+		for (uint8_t i = 0; i < state.ring_count; i++) {
+			Serial.printf("  %-2u   %8.1f   %8.1f   %8.1f\n", i + 1, state.target_angle[i], ringIndex == i ? current_angle : 0., state.target_angular_velocity[i]);
+		}
 		Serial.println(F("===========================\n"));
 	}
 
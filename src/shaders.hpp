@@ -47,6 +47,12 @@ extern State state;
 
 extern int deviceIndex;
 
+// Which of the LED tables above this board uses. Rings past the original six, and boards without a ring index yet,
+// borrow the first ring's.
+inline int ledLayoutIndex() {
+	return deviceIndex >= 0 && deviceIndex < NUM_RINGS ? deviceIndex : 0;
+}
+
 struct LedColor {
 	uint8_t r, g, b, w;
 	LedColor(
@@ -316,8 +322,8 @@ public:
 	void update(int frame) override {
 		for (int i = 0; i < ledCount; i++) {
 			float t = float(periods * i) / float(ledCount) + float(frame) / float(cycleTime);
-			// ledColors[i] = LedColor::hueInterpolateZigZag(t, ringHueRanges[deviceIndex].startHue, ringHueRanges[deviceIndex].endHue);
-			ledColors[i] = LedColor::hueInterpolateSine(t, ringHueRanges[deviceIndex].startHue, ringHueRanges[deviceIndex].endHue);
+			// ledColors[i] = LedColor::hueInterpolateZigZag(t, ringHueRanges[ledLayoutIndex()].startHue, ringHueRanges[ledLayoutIndex()].endHue);
+			ledColors[i] = LedColor::hueInterpolateSine(t, ringHueRanges[ledLayoutIndex()].startHue, ringHueRanges[ledLayoutIndex()].endHue);
 		}
 	}
 };
@@ -435,7 +441,7 @@ public:
 	void update(int frame) override {
 		for (int i = 0; i < ledCount; i++) {
 			float t = float(periods * i) / float(ledCount) + float(frame) / float(cycleTime);
-			ledColors[i] = LedColor::hueInterpolateSine(t, ringHueRanges[deviceIndex].startHue, ringHueRanges[deviceIndex].endHue);
+			ledColors[i] = LedColor::hueInterpolateSine(t, ringHueRanges[ledLayoutIndex()].startHue, ringHueRanges[ledLayoutIndex()].endHue);
 		}
 	}
 };
@@ -892,6 +898,7 @@ public:
 	AccentShader* activeAccentShader = nullptr;
 	Shader* activeShaderInside = nullptr;
 	AccentShader* activeAccentShaderInside = nullptr;
+	int layoutIndex = -1;  // the ledLayoutIndex() the shaders were made for
 
 	ShaderManager(
 		Adafruit_NeoPixel& strip1, 
@@ -900,17 +907,29 @@ public:
 	) : strip_outside_cw(strip1), strip_outside_ccw(strip2), strip_inside_cw(strip3) { }
 
 	~ShaderManager() {
+		deleteShaders();
+	}
+
+	void deleteShaders() {
 		// Clean up all shaders
 		for (auto& shader : shaders) {
 			delete shader.second;
 		}
 		shaders.clear();
+		for (auto& shader : shadersInside) {
+			delete shader.second;
+		}
+		shadersInside.clear();
 
 		// Clean up all accent shaders
 		for (auto& shader : accentShaders) {
 			delete shader.second;
 		}
 		accentShaders.clear();
+		for (auto& shader : accentShadersInside) {
+			delete shader.second;
+		}
+		accentShadersInside.clear();
 
 		// Clear the pointers but don't delete them as they're already deleted above
 		activeShader = nullptr;
@@ -920,8 +939,9 @@ public:
 	}
 
 	void init() {
-		led_count_this_ring = led_counts_outside[deviceIndex];
-		led_count_this_ring_inside = led_counts_inside[deviceIndex];
+		layoutIndex = ledLayoutIndex();
+		led_count_this_ring = led_counts_outside[ledLayoutIndex()];
+		led_count_this_ring_inside = led_counts_inside[ledLayoutIndex()];
 
 		Serial.println("LED led_count_this_ring: ");
 		Serial.println(led_count_this_ring);
@@ -1028,6 +1048,31 @@ public:
 		}
 	}
 	
+	/**
+	 * Remakes the shaders for the LED counts of the ring this board now is, when the master assigned it another
+	 * index than it booted with, keeping the active shaders, and blanks the strips so no LEDs past the new counts
+	 * stay lit
+	 */
+	void relayout() {
+		String active = activeShader != nullptr ? activeShader->getName() : String("");
+		String activeInside = activeShaderInside != nullptr ? activeShaderInside->getName() : String("");
+		String activeAccent = activeAccentShader != nullptr ? activeAccentShader->getName() : String("");
+		String activeAccentInside = activeAccentShaderInside != nullptr ? activeAccentShaderInside->getName() : String("");
+		deleteShaders();
+		init();
+		if (shaders.count(active)) activeShader = shaders[active];
+		if (shadersInside.count(activeInside)) activeShaderInside = shadersInside[activeInside];
+		if (accentShaders.count(activeAccent)) activeAccentShader = accentShaders[activeAccent];
+		if (accentShadersInside.count(activeAccentInside)) activeAccentShaderInside = accentShadersInside[activeAccentInside];
+
+		strip_outside_cw.clear();
+		strip_outside_cw.show();
+		strip_outside_ccw.clear();
+		strip_outside_ccw.show();
+		strip_inside_cw.clear();
+		strip_inside_cw.show();
+	}
+
 	void setupLedStrips(int brightness) {
 		strip_outside_cw.begin();
 		strip_outside_cw.setBrightness(brightness);
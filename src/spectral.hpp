@@ -0,0 +1,115 @@
+#ifndef SPECTRAL_HPP
+#define SPECTRAL_HPP
+
+#include <stdint.h>
+
+#include "constmath.hpp"
+#include "realfft.hpp"
+
+// Kick drum isolation filter: a gaussian around the kick fundamental, on top of a small floor
+constexpr float KICK_HZ_MU = 90.0f;     // Center frequency in Hz
+constexpr float KICK_HZ_SIGMA = 110.0f; // Standard deviation in Hz
+constexpr float KICK_FILTER_FLOOR = 0.05f;
+
+constexpr uint8_t SPECTRAL_GEQ_CHANNELS = 16;
+constexpr uint8_t SPECTRAL_LEGACY_BANDS = 8;
+
+// Edges of WLED's 16 GEQ channels, in Hz; channel c spans [edge c, edge c + 1]. These are WLED's bin ranges at 512
+// points and 16 kHz (31.25 Hz bins), so that configuration reproduces them exactly.
+constexpr float GEQ_EDGES_HZ[SPECTRAL_GEQ_CHANNELS + 1] = {
+	31.25f, 62.5f, 93.75f, 156.25f, 218.75f, 312.5f, 406.25f, 593.75f, 812.5f,
+	1031.25f, 1375.0f, 1750.0f, 2187.5f, 2687.5f, 3250.0f, 5156.25f, 6718.75f
+};
+constexpr float GEQ_DAMPING[SPECTRAL_GEQ_CHANNELS] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0.88f, 0.70f };
+
+// The 8 legacy bands follow the MGSEQ7 bands at 63Hz, 160Hz, 400Hz, 1kHz, 2.5kHz, 6.25kHz and 16kHz, with limits
+// centered between them. As in the original table only six limits are set, so band 6 stays empty and band 7 starts
+// at 11125 Hz.
+constexpr int LEGACY_BANDS_HZ[SPECTRAL_LEGACY_BANDS] = { 63, 160, 400, 1000, 2500, 6250, 16000 };
+constexpr int LEGACY_BAND_LIMITS_HZ[SPECTRAL_LEGACY_BANDS - 1] = {  // center-aligned
+	(LEGACY_BANDS_HZ[0] + LEGACY_BANDS_HZ[1]) / 2,
+	(LEGACY_BANDS_HZ[1] + LEGACY_BANDS_HZ[2]) / 2,
+	(LEGACY_BANDS_HZ[2] + LEGACY_BANDS_HZ[3]) / 2,
+	(LEGACY_BANDS_HZ[3] + LEGACY_BANDS_HZ[4]) / 2,
+	(LEGACY_BANDS_HZ[4] + LEGACY_BANDS_HZ[5]) / 2,
+	(LEGACY_BANDS_HZ[5] + LEGACY_BANDS_HZ[6]) / 2
+};
+
+/**
+ * Per-bin tables of an N-point spectrum at SAMPLE_RATE, built at compile time
+ */
+template <uint16_t N, uint32_t SAMPLE_RATE>
+struct SpectralTables {
+	static const uint16_t BINS = N / 2;
+
+	double kickWeights[BINS] = {};   // gaussian + floor; double so the fused and unfused GEQ paths agree exactly
+	float kickGaussian[BINS] = {};   // gaussian only
+	uint16_t kickWeightsQ14[BINS] = {};  // gaussian + floor in Q14, for the fixed-point path
+	uint16_t geqFirstBin[SPECTRAL_GEQ_CHANNELS] = {};
+	uint16_t geqLastBin[SPECTRAL_GEQ_CHANNELS] = {};
+	uint8_t legacyBand[BINS] = {};   // which of the 8 legacy bands each bin falls into
+
+	static constexpr uint16_t binOf(float hz) {
+		int bin = int(hz * N / SAMPLE_RATE + 0.5f);
+		return bin < 1 ? 1 : (bin > BINS - 1 ? BINS - 1 : bin);
+	}
+
+	constexpr SpectralTables() {
+		for (uint16_t i = 0; i < BINS; i++) {
+			const float hz = i * (float(SAMPLE_RATE) / N);
+			const float z = (hz - KICK_HZ_MU) / KICK_HZ_SIGMA;
+			kickWeights[i] = constmath::exp(-0.5 * double(z) * double(z)) + KICK_FILTER_FLOOR;
+			kickGaussian[i] = float(constmath::exp(-0.5 * double(z) * double(z)));
+			kickWeightsQ14[i] = uint16_t(kickWeights[i] * 16384.0 + 0.5);
+
+			uint8_t band = SPECTRAL_LEGACY_BANDS - 1;
+			if (hz <= LEGACY_BAND_LIMITS_HZ[0]) {
+				band = 0;
+			}
+			for (uint8_t b = 1; b < SPECTRAL_LEGACY_BANDS - 1; b++) {
+				if (hz > LEGACY_BAND_LIMITS_HZ[b - 1] && hz <= LEGACY_BAND_LIMITS_HZ[b]) band = b;
+			}
+			legacyBand[i] = band;
+		}
+		for (uint8_t c = 0; c < SPECTRAL_GEQ_CHANNELS; c++) {
+			geqFirstBin[c] = binOf(GEQ_EDGES_HZ[c]);
+			geqLastBin[c] = binOf(GEQ_EDGES_HZ[c + 1]);
+		}
+	}
+};
+
+/**
+ * Everything that depends on the FFT size and the sample rate, derived from them at compile time: the real FFT
+ * with its twiddles and windows, the kick drum weights, and the bin ranges of the GEQ channels and legacy bands.
+ * Changing N only requires a different instantiation.
+ */
+template <uint16_t N, uint32_t SAMPLE_RATE>
+class SpectralAnalyzer {
+public:
+	static const uint16_t SIZE = N;
+	static const uint16_t BINS = N / 2;
+	static constexpr float BIN_HZ = float(SAMPLE_RATE) / N;
+	static constexpr SpectralTables<N, SAMPLE_RATE> tables{};
+
+	RealFFT<N> fft;
+
+	SpectralAnalyzer(RealFFTWindow windowType = RealFFTWindow::FlatTop) : fft(windowType) {}
+
+	/**
+	 * Windowed magnitude spectrum of N samples into magnitudes[N / 2]
+	 */
+	template <typename T>
+	void magnitude(const T* samples, float* magnitudes) {
+		fft.magnitude(samples, magnitudes);
+	}
+
+	static constexpr float binToHz(uint16_t bin) {
+		return bin * BIN_HZ;
+	}
+
+	static constexpr uint16_t hzToBin(float hz) {
+		return SpectralTables<N, SAMPLE_RATE>::binOf(hz);
+	}
+};
+
+#endif // SPECTRAL_HPP
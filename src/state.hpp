@@ -3,6 +3,10 @@
 
 #include <Arduino.h>
 
+#include "structure.hpp"
+
+#define MAX_RINGS 16  // rings a master can drive, within ESP-NOW's 20 peers; the state packet carries targets for the ones that joined
+
 // The synchronization packet sent over ESP‑NOW
 struct State {
 
@@ -12,34 +16,32 @@ struct State {
     uint16_t frame            = 0;
     unsigned long time        = 0;
 	unsigned long lastUpdate  = 0;
+	int64_t shared_micros     = 0;  // master esp_timer_get_time() when the targets were set; see Synchronizer::sharedMicros()
     float updatesPerSecond    = 50.0f; 
 
 	unsigned long lastBeatTimestamp = 0;
 	unsigned long elapsedBeats = 0;
+	unsigned long lastOnsetTimestamp = 0;  // from the low-latency onset detector, alongside the spectral beats above
+
+	// Beat clock on the master, so rings can time accents to the predicted beat instead of the last detected one
+	float beat_phase = 0.0f;               // 0 on the beat, approaching 1 just before the next one
+	float beat_period = 0.0f;              // in ms, 0 while the clock is not locked
+	unsigned long next_beat_timestamp = 0; // master millis(), compare against `time`
+
+	// Song structure on the master
+	uint8_t section = 0;                   // a Section from structure.hpp
+	float tension = 0.0f;                  // 0 to 1, rises through a buildup and is released by the drop
 
     // Visual state
 	uint8_t brightness    = 160; // 0-255
     uint8_t shader_index  = 0;
     float beat_intensity  = 0.0f;
 
-    // Per‑ring telemetry
-    float target_angle_1  = 0.0f;
-	float target_angular_velocity_1 = 0.0f;
-
-    float target_angle_2  = 0.0f;
-	float target_angular_velocity_2 = 0.0f;
-
-    float target_angle_3  = 0.0f;
-	float target_angular_velocity_3 = 0.0f;
-
-    float target_angle_4  = 0.0f;
-	float target_angular_velocity_4 = 0.0f;
-
-    float target_angle_5  = 0.0f;
-	float target_angular_velocity_5 = 0.0f;
-
-    float target_angle_6  = 0.0f;
-	float target_angular_velocity_6 = 0.0f;
+    // Per‑ring telemetry, for rings 0 to ring_count - 1 as numbered by the master (see RingDirectory)
+	uint8_t ring_count = 0;
+	float target_angle[MAX_RINGS] = {};
+	float target_angular_velocity[MAX_RINGS] = {};  // the speed the servos turn at
+	float target_angle_rate[MAX_RINGS] = {};        // how fast target_angle moves; the rings dead reckon it with this
 
 	void print() const {
 		Serial.println(F("========== State =========="));
@@ -52,9 +54,17 @@ struct State {
 		Serial.printf("LastUpd: %9lu ms   UPS: %5.1f\n",
 					  lastUpdate,
 					  updatesPerSecond);
-		Serial.printf("BeatTs:  %9lu ms   Beats: %-6lu\n",
+		Serial.printf("BeatTs:  %9lu ms   Beats: %-6lu   OnsetTs: %9lu ms\n",
 					  lastBeatTimestamp,
-					  elapsedBeats);
+					  elapsedBeats,
+					  lastOnsetTimestamp);
+		Serial.printf("BeatPhase: %.2f   BeatPeriod: %6.1f ms   NextBeat: %9lu ms\n",
+					  beat_phase,
+					  beat_period,
+					  next_beat_timestamp);
+		Serial.printf("Section: %-9s   Tension: %.2f\n",
+					  sectionName(section),
+					  tension);
 	
 		// Visual parameters
 		Serial.printf("Brightness: %-3u   Shader: %-3u   BeatInt: %.2f\n",
@@ -63,14 +73,11 @@ struct State {
 					  beat_intensity);
 	
 		// Per‑ring angles
-		Serial.println(F("\nRing   Target°   ω (°/s)"));
-		Serial.println(F("----   --------   --------"));
-		Serial.printf("  1    %8.1f   %8.1f\n", target_angle_1, target_angular_velocity_1);
-		Serial.printf("  2    %8.1f   %8.1f\n", target_angle_2, target_angular_velocity_2);
-		Serial.printf("  3    %8.1f   %8.1f\n", target_angle_3, target_angular_velocity_3);
-		Serial.printf("  4    %8.1f   %8.1f\n", target_angle_4, target_angular_velocity_4);
-		Serial.printf("  5    %8.1f   %8.1f\n", target_angle_5, target_angular_velocity_5);
-		Serial.printf("  6    %8.1f   %8.1f\n", target_angle_6, target_angular_velocity_6);	
+		Serial.println(F("\nRing   Target°   ω (°/s)   Rate (°/s)"));
+		Serial.println(F("----   --------   --------   ----------"));
+		for (uint8_t i = 0; i < ring_count; i++) {
+			Serial.printf("  %-2u   %8.1f   %8.1f   %10.1f\n", i + 1, target_angle[i], target_angular_velocity[i], target_angle_rate[i]);
+		}
 		Serial.println(F("===========================\n"));
 	}
 
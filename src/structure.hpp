@@ -0,0 +1,245 @@
+#ifndef STRUCTURE_HPP
+#define STRUCTURE_HPP
+
+#include <math.h>
+#include <stdint.h>
+
+// Section of the song the music is in, as detected on the master
+enum class Section : uint8_t {
+	Normal = 0,
+	Buildup = 1,    // highs and rhythmic density rising, usually before a drop
+	Breakdown = 2,  // bass mostly gone
+	Drop = 3,       // bass back in after a buildup or breakdown
+};
+
+inline const char* sectionName(uint8_t section) {
+	switch (Section(section)) {
+		case Section::Buildup: return "buildup";
+		case Section::Breakdown: return "breakdown";
+		case Section::Drop: return "drop";
+		default: return "normal";
+	}
+}
+
+/**
+ * Scale for the beat intensity shown by the shaders in a given section: subdued in breakdowns, growing with the
+ * tension of a buildup and strongest on the drop
+ */
+inline float sectionIntensityScale(uint8_t section, float tension) {
+	switch (Section(section)) {
+		case Section::Buildup: return 1.0f + 0.5f * tension;
+		case Section::Breakdown: return 0.6f;
+		case Section::Drop: return 1.5f;
+		default: return 1.0f;
+	}
+}
+
+/**
+ * Song structure detector over the post-processed GEQ channels, one frame at a time.
+ *
+ * Each frame costs O(CHANNELS) to reduce the channels and O(1) after that, with no scans over past frames. The
+ * averages over the last SLOW_SECONDS are sliding means kept as running sums: the caller hands in the frame that
+ * leaves that window along with the new one, which the firmware reads back from its FeatureHistory rather than
+ * keeping a second copy of the last seconds. Everything else is an exponential moving average:
+ *  - the bass level is the short-term bass energy relative to a slow baseline (which is frozen during buildups and
+ *    breakdowns, so a long breakdown does not become the new normal), and the bass jump is the same energy relative
+ *    to the last SLOW_SECONDS, which is what marks a drop;
+ *  - the high-band slope is the difference between a fast average and the SLOW_SECONDS mean of the upper channels;
+ *  - the flux variance is the short-term variance of the half-wave rectified spectral flux, relative to its own
+ *    baseline; snare rolls and risers drive it up.
+ * A rising high band and flux variance build up tension, and a section change only happens once its condition has
+ * held for a while; the thresholds to leave a section are looser than those to enter it.
+ */
+template <uint8_t CHANNELS>
+class StructureDetector {
+private:
+	static const uint8_t BASS_CHANNELS = CHANNELS / 4;
+	static const uint8_t HIGH_FIRST_CHANNEL = CHANNELS / 2;
+
+public:
+	// Length of the sliding window, in seconds; the frames that leave it must still be readable by the caller
+	static constexpr float SLOW_SECONDS = 8.0f;
+
+private:
+	// Time constants, in seconds
+	static constexpr float FAST_SECONDS = 1.0f;
+	static constexpr float BASELINE_SECONDS = 60.0f;
+	static constexpr float FLUX_SECONDS = 2.0f;
+	static constexpr float TENSION_SECONDS = 2.0f;
+	static constexpr float WARMUP_SECONDS = 10.0f;
+
+	// Thresholds, with hysteresis between entering and leaving
+	static constexpr float BREAKDOWN_ENTER_BASS = 0.45f;
+	static constexpr float BREAKDOWN_EXIT_BASS = 0.7f;
+	static constexpr float DROP_JUMP = 1.5f;             // bass relative to the last SLOW_SECONDS for a drop
+	static constexpr float DROP_MIN_BASS = 0.8f;         // ... and relative to the baseline
+	static constexpr float BUILDUP_ENTER_TENSION = 0.5f;
+	static constexpr float BUILDUP_EXIT_TENSION = 0.25f;
+	static constexpr float DROP_SECONDS = 15.0f;         // how long a drop lasts unless the bass goes away again
+	static constexpr float CONFIRM_SECONDS = 1.0f;       // how long a new section must be indicated before switching
+	static constexpr float DROP_CONFIRM_SECONDS = 0.1f;  // drops are abrupt
+
+	uint8_t previous[CHANNELS] = {};
+	float bassFast = 0.0f, bassBaseline = 0.0f;
+	float highFast = 0.0f;
+	uint32_t bassWindowSum = 0, highWindowSum = 0;  // channel sums over the frames in the sliding window
+	uint32_t windowFrames = 0;                      // how many frames that is, until the window has filled
+	float fluxMean = 0.0f, fluxSquareMean = 0.0f, fluxVarianceBaseline = 0.0f;
+
+	float fastCoef, baselineCoef, fluxCoef, tensionCoef;
+	uint32_t slowFrames, warmupFrames, dropFrames, confirmFrames, dropConfirmFrames;
+
+	uint32_t frames = 0;
+	uint32_t framesInSection = 0;
+	uint32_t framesCandidate = 0;
+	Section current = Section::Normal;
+	Section candidate = Section::Normal;
+	float currentTension = 0.0f;
+	float bassLevelValue = 1.0f;
+
+	Section indicatedSection(float bassLevel, float bassJump) const {
+		bool bassReturns = bassJump > DROP_JUMP && bassLevel > DROP_MIN_BASS;
+		switch (current) {
+			case Section::Drop:
+				if (bassLevel < BREAKDOWN_ENTER_BASS) return Section::Breakdown;
+				if (framesInSection < dropFrames) return Section::Drop;
+				return currentTension > BUILDUP_ENTER_TENSION ? Section::Buildup : Section::Normal;
+			case Section::Buildup:
+				if (bassReturns) return Section::Drop;
+				if (currentTension > BUILDUP_EXIT_TENSION) return Section::Buildup;
+				return bassLevel < BREAKDOWN_ENTER_BASS ? Section::Breakdown : Section::Normal;
+			case Section::Breakdown:
+				if (bassReturns) return Section::Drop;
+				if (currentTension > BUILDUP_ENTER_TENSION) return Section::Buildup;
+				return bassLevel < BREAKDOWN_EXIT_BASS ? Section::Breakdown : Section::Normal;
+			default:
+				if (bassReturns && currentTension > BUILDUP_ENTER_TENSION) return Section::Drop;
+				if (currentTension > BUILDUP_ENTER_TENSION) return Section::Buildup;
+				if (bassLevel < BREAKDOWN_ENTER_BASS) return Section::Breakdown;
+				return Section::Normal;
+		}
+	}
+
+public:
+	StructureDetector(float framesPerSecond)
+		: fastCoef(1.0f / (FAST_SECONDS * framesPerSecond)),
+		  baselineCoef(1.0f / (BASELINE_SECONDS * framesPerSecond)),
+		  fluxCoef(1.0f / (FLUX_SECONDS * framesPerSecond)),
+		  tensionCoef(1.0f / (TENSION_SECONDS * framesPerSecond)),
+		  slowFrames(uint32_t(SLOW_SECONDS * framesPerSecond)),
+		  warmupFrames(uint32_t(WARMUP_SECONDS * framesPerSecond)),
+		  dropFrames(uint32_t(DROP_SECONDS * framesPerSecond)),
+		  confirmFrames(uint32_t(CONFIRM_SECONDS * framesPerSecond)),
+		  dropConfirmFrames(uint32_t(DROP_CONFIRM_SECONDS * framesPerSecond)) {}
+
+	/**
+	 * Number of frames in the sliding window: once that many have been added, every update() needs the frame that
+	 * was added slowWindowFrames() updates before the new one
+	 */
+	uint32_t slowWindowFrames() const {
+		return slowFrames;
+	}
+
+	/**
+	 * Adds the next frame of post-processed GEQ channels (0-255). `leaving` is the frame added slowWindowFrames()
+	 * updates earlier, which drops out of the sliding window, or nullptr while fewer frames than that were added.
+	 */
+	void update(const uint8_t channels[CHANNELS], const uint8_t* leaving) {
+		uint32_t bassSum = 0;
+		uint32_t highSum = 0;
+		float flux = 0.0f;
+		for (uint8_t c = 0; c < CHANNELS; c++) {
+			if (c < BASS_CHANNELS) bassSum += channels[c];
+			if (c >= HIGH_FIRST_CHANNEL) highSum += channels[c];
+			int16_t rise = int16_t(channels[c]) - previous[c];
+			if (rise > 0) flux += rise;
+			previous[c] = channels[c];
+		}
+		float bass = float(bassSum) / BASS_CHANNELS;
+		float high = float(highSum) / (CHANNELS - HIGH_FIRST_CHANNEL);
+		flux /= CHANNELS;
+
+		bassWindowSum += bassSum;
+		highWindowSum += highSum;
+		if (leaving != nullptr) {
+			for (uint8_t c = 0; c < CHANNELS; c++) {
+				if (c < BASS_CHANNELS) bassWindowSum -= leaving[c];
+				if (c >= HIGH_FIRST_CHANNEL) highWindowSum -= leaving[c];
+			}
+		}
+		else {
+			windowFrames++;
+		}
+		float bassSlow = float(bassWindowSum) / (windowFrames * BASS_CHANNELS);
+		float highSlow = float(highWindowSum) / (windowFrames * (CHANNELS - HIGH_FIRST_CHANNEL));
+
+		if (frames == 0) {
+			bassFast = bass;
+			highFast = high;
+		}
+		frames++;
+
+		bassFast += fastCoef * (bass - bassFast);
+		highFast += fastCoef * (high - highFast);
+		fluxMean += fluxCoef * (flux - fluxMean);
+		fluxSquareMean += fluxCoef * (flux * flux - fluxSquareMean);
+		float fluxVariance = fmaxf(fluxSquareMean - fluxMean * fluxMean, 0.0f);
+
+		// Only learn what "normal" sounds like outside of buildups and breakdowns. Until the baselines have seen a
+		// full time constant they are plain running means, so the first frames do not bias them for minutes.
+		if (current == Section::Normal || current == Section::Drop) {
+			float coef = fmaxf(baselineCoef, 1.0f / frames);
+			bassBaseline += coef * (bass - bassBaseline);
+			fluxVarianceBaseline += coef * (fluxVariance - fluxVarianceBaseline);
+		}
+
+		const float epsilon = 1.0f;
+		bassLevelValue = (bassFast + epsilon) / (bassBaseline + epsilon);
+		float bassJump = (bassFast + epsilon) / (bassSlow + epsilon);
+		float highSlope = (highFast - highSlow) / (highSlow + epsilon);
+		float fluxVarianceRatio = (fluxVariance + epsilon) / (fluxVarianceBaseline + epsilon);
+		float rise = fmaxf(highSlope, 0.0f) + 0.5f * fmaxf(fluxVarianceRatio - 1.0f, 0.0f);
+		currentTension += tensionCoef * (fminf(rise, 1.0f) - currentTension);
+
+		framesInSection++;
+		if (frames < warmupFrames) {
+			return;
+		}
+
+		Section indicated = indicatedSection(bassLevelValue, bassJump);
+		if (indicated == current) {
+			framesCandidate = 0;
+			return;
+		}
+		framesCandidate = indicated == candidate ? framesCandidate + 1 : 1;
+		candidate = indicated;
+		if (framesCandidate >= (indicated == Section::Drop ? dropConfirmFrames : confirmFrames)) {
+			if (indicated == Section::Drop) {
+				currentTension = 0.0f;  // the drop releases the tension
+			}
+			current = indicated;
+			framesInSection = 0;
+			framesCandidate = 0;
+		}
+	}
+
+	Section section() const {
+		return current;
+	}
+
+	/**
+	 * How much the music is building toward something, 0 to 1
+	 */
+	float tension() const {
+		return currentTension;
+	}
+
+	/**
+	 * Short-term bass energy relative to its baseline, around 1 in a normal section
+	 */
+	float bassLevel() const {
+		return bassLevelValue;
+	}
+};
+
+#endif // STRUCTURE_HPP
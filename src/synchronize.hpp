@@ -2,18 +2,28 @@
 #define SYNCHRONIZE_HPP
 
 #include <Arduino.h>
-#include <WiFi.h>
-#include <esp_now.h>
-#include <esp_wifi.h>
+#include <Preferences.h>
+#include <atomic>
+#include <esp_timer.h>
 #include <string.h>
+#include "clocksync.hpp"
+#include "espnowtransport.hpp"
+#include "jitterbuffer.hpp"
+#include "mailbox.hpp"
+#include "protocol.hpp"
+#include "replication.hpp"
+#include "rings.hpp"
 #include "state.hpp"
+#include "transmitter.hpp"
+#include "txqueue.hpp"
+#include "wire.hpp"
 
-// Hardcoded list of device MAC addresses (index 0: master; indexes 1-6: rings)
+// MAC addresses of the original totem's boards. Rings are numbered by the master when they join, and these only
+// seed the role and preferred ring index of a board that has none stored in Preferences (see Synchronizer::init()).
 #define NUM_DEVICES 7
 #define MASTER_INDEX 6
 #define ESPNOW_CH 0
-uint8_t BROADCAST_ALL[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-uint8_t deviceList[NUM_DEVICES][6] = {  // TODO: finish filling out this list
+uint8_t deviceList[NUM_DEVICES][6] = {
   {0x24, 0x58, 0x7C, 0xE4, 0x1A, 0x50},  // ring 1 (outer ring)
   {0x98, 0x3D, 0xAE, 0xEA, 0x0D, 0xC8},  // ring 2
   {0x98, 0x3D, 0xAE, 0xE5, 0xEF, 0xF4},  // ring 3
@@ -22,7 +32,6 @@ uint8_t deviceList[NUM_DEVICES][6] = {  // TODO: finish filling out this list
   {0x98, 0x3D, 0xAE, 0xE7, 0x92, 0x50},  // ring 6 (sphere)
   {0xD8, 0x3B, 0xDA, 0x45, 0xCE, 0x4C}   // master
 };
-unsigned long heartbeats[NUM_DEVICES] = {0};
 
 
 enum DeviceRole { MASTER, RING, BASE };
@@ -31,28 +40,29 @@ extern ServoController servoController;
 
 extern State state;
 
-static volatile bool tx_done      = true;
-static volatile esp_now_send_status_t last_status;
-
-void IRAM_ATTR onDataSent(const uint8_t *mac, esp_now_send_status_t status) {
-    last_status = status;
-    tx_done     = true;            // free the “slot”
-}
-
-void sendStateToRing(const uint8_t *addr, const State &st) {
-    while (!tx_done) {             // wait for previous packet to drain
-        vTaskDelay(1);             // give Wi‑Fi task time (~1 ms)
-    }
-
-    tx_done = false;
-    esp_err_t err = esp_now_send(addr,
-                                 reinterpret_cast<const uint8_t*>(&st),
-                                 sizeof(State));
-    if (err != ESP_OK) {
-        Serial.printf("[ERR] send: %s\n", esp_err_to_name(err));
-        tx_done = true;            // don’t dead‑lock on failure
-    }
-}
+#define TARGET_BUFFER_SAMPLES 8    // of the ring's targets, which come at most 50 times a second
+#define SHARED_FRAME_MICROS 20000  // rings render frame n at shared time n * 20 ms, the 50 fps the shaders were tuned at
+
+#define RING_PACKET_QUEUE_DEPTH (2 * MAX_RINGS)  // an announcement and a feedback packet per ring
+#define STATS_LOG_TICKS 256        // loops between the link and jitter statistics on the serial console
+#define SERIAL_COMMAND_LENGTH 32
+
+// Preferences keys, in the "totem" namespace. Both can be set from the serial console (see handleSerialCommands()).
+#define PREFERENCE_ROLE "role"     // 0 for the master, 1 for a ring; unset falls back to deviceList
+#define PREFERENCE_RING "ring"     // the ring index this board was last assigned
+
+EspNowTransport espNowTransport(ESPNOW_CH);
+Transmitter transmitter;  // all sends go through its task
+
+static uint16_t stateSequence = 0;  // one per state packet sent
+
+// A state received from the master, as handed from the ESP-NOW receive callback to loop()
+struct ReceivedState {
+	State state;
+	int64_t receivedMicros;                    // local esp_timer_get_time()
+	WireLinkStats link;
+	uint8_t source[6];                         // the master's MAC
+};
 
 class Synchronizer {
 
@@ -60,18 +70,58 @@ public:
 
 	DeviceRole role;
 
-	float current_angles[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
-
-	Synchronizer() {
+	// Rings on the master. The receive callback only answers pings itself: announcements and feedback are queued,
+	// the latest of each per ring, for loop() to join the rings and record what they report, so `rings` is only
+	// touched by loop().
+	MasterRings rings;
+	TxQueue<RING_PACKET_QUEUE_DEPTH> ringPackets;
+	portMUX_TYPE ringPacketLock = portMUX_INITIALIZER_UNLOCKED;
+	StateReplicator replicator;
+	int64_t replicationStatsMicros = 0;
+	uint64_t replicationStatsBytes = 0;
+
+	// Joining on a ring: it announces itself until the master assigns it an index, which the receive callback
+	// leaves in assignedRing for loop() to adopt. Only loop() touches `link`.
+	std::atomic<uint8_t> assignedRing{NO_RING};
+	RingLink link;
+	unsigned long masterHeartbeat = 0;
+	Preferences preferences;
+
+	// State handoff on a ring: the receive callback decodes onto stateReceiver.state and publishes it, and loop()
+	// copies the latest one into `state` with applyReceivedState()
+	StateReceiver stateReceiver;
+	Mailbox<ReceivedState> receivedState;
+	uint32_t appliedStates = 0;
+	WireLinkStats receivedLink;                // the tracker's stats as of the applied state, for the feedback
+	JitterBuffer<TARGET_BUFFER_SAMPLES> targetBuffer;  // this ring's targets, smoothed over late and lost packets
+	int64_t bufferedTargetMicros = 0;          // shared_micros of the newest target in targetBuffer
+
+	// Clock synchronization on a ring: the receive callback feeds pongs to clockSync and publishes its estimate
+	ClockSync clockSync;
+	Mailbox<ClockEstimate> clockEstimate;
+	int64_t lastSharedMicros = 0;
+
+	uint32_t ticks = 0;                        // calls to synchronize()
+	String serialCommand;                      // the line being typed on the serial console
+
+	Transport& transport;
+
+	Synchronizer(Transport& transport = espNowTransport) : transport(transport) {
 
 	}
 
 	void init() {
-		WiFi.mode(WIFI_STA);
+		// Initialize the radio.
+		transport.onReceive(onDataRecv, this);
+		if (!transport.begin()) {
+			Serial.println("Error initializing ESP-NOW");
+			while (true);
+		}
+		transmitter.begin(transport);
 
 		// Determine device role based on MAC address.
 		uint8_t ownMac[6];
-		WiFi.macAddress(ownMac);
+		transport.macAddress(ownMac);
 		Serial.print("Device MAC Address: ");
 		for (int i = 0; i < 6; i++) {
 			Serial.print("0x");
@@ -79,157 +129,350 @@ public:
 			if (i < 5) Serial.print(", ");
 		}
 		Serial.println();
-		bool recognized = false;
+
+		// Role and preferred ring index: as stored, or else by the original totem's MAC table
+		preferences.begin("totem", false);
+		int legacyIndex = -1;
 		for (int i = 0; i < NUM_DEVICES; i++) {
 			if (memcmp(ownMac, deviceList[i], 6) == 0) {
-				recognized = true;
-				deviceIndex = i;
+				legacyIndex = i;
 				break;
 			}
 		}
-		if (!recognized) {
-			Serial.println("Device MAC not recognized. Setting device index to -1. THIS WILL CAUSE A SEGFAULT.");
-			role = RING;
-			deviceIndex = -1;
+		uint8_t storedRole = preferences.getUChar(PREFERENCE_ROLE, 0xFF);
+		if (storedRole != 0xFF) {
+			role = storedRole == 0 ? MASTER : RING;
+		} else {
+			role = legacyIndex == MASTER_INDEX ? MASTER : RING;
 		}
-		else {
-			Serial.print("Device index: ");
-			Serial.println(deviceIndex);
-			role = (deviceIndex == MASTER_INDEX) ? MASTER : RING;
+		uint8_t preferredRing = preferences.getUChar(PREFERENCE_RING, NO_RING);
+		if (preferredRing == NO_RING && legacyIndex >= 0 && legacyIndex != MASTER_INDEX) {
+			preferredRing = uint8_t(legacyIndex);
+		}
+		deviceIndex = role == RING && preferredRing < MAX_RINGS ? preferredRing : -1;
+		if (role == RING && deviceIndex < 0) {
+			Serial.println("No ring index stored for this board; it will be assigned one when it joins.");
 		}
 		Serial.print("Role: ");
 		Serial.println(role == MASTER ? "MASTER" : "RING");
 		Serial.print("Device index: ");
 		Serial.println(deviceIndex);
 
-		// Initialize ESP-NOW.
-		esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_LR);
-		esp_wifi_set_promiscuous(false);
-    	esp_wifi_set_channel(ESPNOW_CH, WIFI_SECOND_CHAN_NONE);
-
-		esp_wifi_set_mode(WIFI_MODE_STA);   // or AP / STA+AP
-		esp_wifi_start();
-		esp_wifi_set_max_tx_power(80);      // 20 dBm (80 × 0.25)
-
-		esp_err_t response = esp_now_init();  // ESP‑NOW packets now use ≤20 dBm
-
-		if (response != ESP_OK) {
-			Serial.println("Error initializing ESP-NOW");
-			while (true);
+		// Add peers. The master broadcasts the state and adds each ring as it joins, to answer its clock pings and
+		// assign it an index; a ring broadcasts its announcements and adds the master once it hears from it.
+		if (!transport.addPeer(BROADCAST_ALL)) {
+			Serial.println("Failed to add broadcast peer");
 		}
-		esp_now_register_recv_cb(onDataRecv);
-
 		if (role == MASTER) {
-			esp_now_register_send_cb(onDataSent);   // register TX‑done callback
+			delay(1000); // Wait for ESP-NOW to stabilize on rings
+			state.isPaused = false;
 		}
 
-		// Add peers.
+		servoController.ringIndex = deviceIndex;   // pass index to servo layer
+	}
+
+	// Static callback wrapper.
+	static void onDataRecv(void* context, const uint8_t* mac, const uint8_t* incomingData, int len) {
+		// This bridges the gap between the C style callback of the transport and the instance method
+		static_cast<Synchronizer*>(context)->handleReceive(mac, incomingData, len);
+	}
+
+	// Handle received data.
+	void handleReceive(const uint8_t* mac, const uint8_t* incomingData, int len) {
+		int64_t receivedMicros = esp_timer_get_time();
 		if (role == MASTER) {
-			delay(1000); // Wait for ESP-NOW to stabilize on rings
-			// Master adds all rings.
-			for (int i = 0; i < NUM_DEVICES; i++) {
-				if (i == MASTER_INDEX) continue;
-				esp_now_peer_info_t peerInfo = {};
-				memcpy(peerInfo.peer_addr, deviceList[i], 6);
-				peerInfo.channel = ESPNOW_CH;
-				peerInfo.encrypt = false;
-				if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-					Serial.print("Failed to add ring peer ");
-					Serial.println(i);
-				}
+			if (answerPing(mac, incomingData, len, receivedMicros, esp_timer_get_time(), transmitter)) {
+				return;
+			}
+			WireHeader header;
+			if (decodeHeader(incomingData, len, header) && (header.type == WireMessage::Announce || header.type == WireMessage::Feedback)
+				&& len <= WIRE_MAX_PACKET_SIZE) {
+				portENTER_CRITICAL(&ringPacketLock);
+				ringPackets.push(mac, header.type, incomingData, uint8_t(len), 0, uint32_t(receivedMicros));
+				portEXIT_CRITICAL(&ringPacketLock);
 			}
-			state.isPaused = false;
 		}
 		else {
-			// ring adds master.
-			esp_now_peer_info_t peerInfo = {};
-			memcpy(peerInfo.peer_addr, deviceList[MASTER_INDEX], 6);
-			peerInfo.channel = ESPNOW_CH;
-			peerInfo.encrypt = false;
-			if (esp_now_add_peer(&peerInfo) != ESP_OK) {
-				Serial.println("Failed to add master peer");
+			// `state` itself is only touched by loop()
+			uint8_t assigned;
+			switch (receiveFromMaster(stateReceiver, clockSync, incomingData, len, receivedMicros, assigned)) {
+			case MasterPacket::Clock:
+				clockEstimate.publish(clockSync.estimate());
+				break;
+			case MasterPacket::Assign:
+				assignedRing.store(assigned);
+				break;
+			case MasterPacket::State: {
+				masterHeartbeat = millis();               // heard from master
+				ReceivedState handoff;
+				handoff.state = stateReceiver.state;
+				handoff.receivedMicros = receivedMicros;
+				handoff.link = stateReceiver.tracker.stats();
+				memcpy(handoff.source, mac, 6);
+				receivedState.publish(handoff);
+				break;
+			}
+			default:
+				break;
 			}
 		}
+	}
 
-		servoController.ringIndex = deviceIndex;   // pass index to servo layer
+	/**
+	 * On the master: joins the rings and records the feedback the receive callback queued since the last call, and
+	 * evicts the rings that went silent
+	 */
+	void processRingPackets() {
+		TxMessage packet;
+		while (true) {
+			portENTER_CRITICAL(&ringPacketLock);
+			bool available = ringPackets.pop(packet);
+			portEXIT_CRITICAL(&ringPacketLock);
+			if (!available) {
+				break;
+			}
+			auto addPeer = [this](const uint8_t* mac) { transport.addPeer(mac); };
+			switch (handleRingPacket(rings, packet.destination, packet.data, packet.length, millis(), transmitter, addPeer)) {
+			case RingPacket::Joined:
+				Serial.printf("Ring %u joined.\n", rings.directory.find(packet.destination) + 1);
+				replicator.requestKeyframe();
+				break;
+			case RingPacket::Assigned:
+				replicator.requestKeyframe();
+				break;
+			case RingPacket::Full:
+				Serial.println("Ring table full; ignoring a ring.");
+				break;
+			default:
+				break;
+			}
+		}
+
+		auto removePeer = [this](const uint8_t* mac, uint8_t index) {
+			Serial.printf("Ring %u timed out.\n", index + 1);
+			transport.removePeer(mac);
+		};
+		evictSilentRings(rings, millis(), removePeer);
 	}
 
-	// Static pointer for use in the static callback.
-	static Synchronizer* instance;
+	/**
+	 * On a ring: takes on the index the master assigned, and remembers it for the next boot. loop() sees the new
+	 * deviceIndex and lays the LEDs out for it.
+	 */
+	void adoptRingIndex(uint8_t index) {
+		if (deviceIndex >= 0 && deviceIndex != index) {
+			Serial.printf("Master assigned ring index %u instead of %d.\n", index, deviceIndex);
+		}
+		deviceIndex = index;
+		servoController.ringIndex = index;
+		targetBuffer.clear();
+		bufferedTargetMicros = 0;
+		if (preferences.getUChar(PREFERENCE_RING, NO_RING) != index) {
+			preferences.putUChar(PREFERENCE_RING, index);
+		}
+	}
 
-	// Static callback wrapper.
-	static void onDataRecv(const uint8_t* mac, const uint8_t* incomingData, int len) {
-		if (instance) {
-			// This bridges the gap between the static C style callback required by ESP-now and the instance method
-			instance->handleReceive(mac, incomingData, len);
+	/**
+	 * Copies the latest state received from the master into `state` and picks out this ring's servo targets. Called
+	 * once at the top of loop(), so a frame is rendered from one consistent state however many packets arrive while
+	 * it runs. Returns false if nothing new arrived since the last call.
+	 */
+	bool applyReceivedState() {
+		uint32_t published = receivedState.count();
+		if (published == appliedStates) {
+			return false;
+		}
+		ReceivedState received;
+		if (!receivedState.read(received)) {
+			return false;
+		}
+		appliedStates = published;
+
+		// The update rate is this device's own
+		unsigned long lastUpdate = state.lastUpdate;
+		float updatesPerSecond = state.updatesPerSecond;
+		state = received.state;
+		state.lastUpdate = lastUpdate;
+		state.updatesPerSecond = updatesPerSecond;
+		receivedLink = received.link;
+		servoController.lastStateReceived = (unsigned long)(received.receivedMicros / 1000);  // millis() runs off the same timer
+		if (!link.masterKnown || memcmp(link.masterMac, received.source, 6) != 0) {
+			memcpy(link.masterMac, received.source, 6);
+			link.masterKnown = true;
+			transport.addPeer(link.masterMac);
 		}
+
+		// Pick out the new target angle for *this* ring
+		if (deviceIndex < 0 || deviceIndex >= state.ring_count) {
+			return true;  // not joined yet
+		}
+		servoController.target_angle = state.target_angle[deviceIndex];
+		servoController.target_angular_velocity = state.target_angular_velocity[deviceIndex];
+
+		// Timestamped targets go through the jitter buffer
+		ClockEstimate estimate;
+		if (clockEstimate.read(estimate)) {
+			bufferTarget(targetBuffer, bufferedTargetMicros, state, uint8_t(deviceIndex), estimate, received.receivedMicros);
+		}
+		return true;
 	}
 
-	// Handle received data.
-	void handleReceive(const uint8_t* mac, const uint8_t* incomingData, int len) {
+	void printTxStats() {
+		TxStats tx = transmitter.stats();
+		Serial.printf("TX sent: %lu  failed: %lu  timed out: %lu  coalesced: %lu  dropped: %lu  depth: %u (max %u)  latency: %lu us (avg %.0f, max %lu)\n",
+					  (unsigned long)tx.sent,
+					  (unsigned long)tx.failed,
+					  (unsigned long)tx.timedOut,
+					  (unsigned long)tx.coalesced,
+					  (unsigned long)tx.dropped,
+					  tx.depth,
+					  tx.maxDepth,
+					  (unsigned long)tx.lastLatencyMicros,
+					  tx.averageLatencyMicros,
+					  (unsigned long)tx.maxLatencyMicros);
+	}
+
+	/**
+	 * Microseconds on the master's clock (esp_timer_get_time()), which all devices share. On a ring this is the
+	 * local clock corrected by the clock synchronization, and never runs backwards. Divided by 1000 it compares
+	 * with the master's millis() timestamps in State.
+	 */
+	int64_t sharedMicros() {
 		if (role == MASTER) {
-			if (len == sizeof(float)) {
-				float receivedAngle;
-				memcpy(&receivedAngle, incomingData, sizeof(float));
-				int senderIndex = -1;
-				for (int i = 0; i < NUM_DEVICES; i++) {
-					if (i == MASTER_INDEX) continue;
-					if (memcmp(mac, deviceList[i], 6) == 0) {
-						senderIndex = i;
-						break;
-					}
-				}
-				if (senderIndex != -1) {
-					current_angles[senderIndex - 1] = receivedAngle;
-					heartbeats[senderIndex] = millis(); // heard from ring
-				} else {
-					Serial.println("Received data from unknown ring.");
-				}
-			}
+			return esp_timer_get_time();
 		}
-		else {
-			if (len == sizeof(State)) {
-				// Copy master‑sent state directly into the global state object
-				memcpy(&state, incomingData, sizeof(State));
-
-				servoController.lastStateReceived = millis();
-				heartbeats[0] = millis();                 // heard from master
-
-				// Pick out the new target angle for *this* ring
-				switch (deviceIndex) {
-					case 0: 
-						servoController.target_angle = state.target_angle_1;
-						servoController.target_angular_velocity = state.target_angular_velocity_1;
-						break;
-					case 1:
-						servoController.target_angle = state.target_angle_2;
-						servoController.target_angular_velocity = state.target_angular_velocity_2;
-						break;
-					case 2:
-						servoController.target_angle = state.target_angle_3;
-						servoController.target_angular_velocity = state.target_angular_velocity_3;
-						break;
-					case 3:
-						servoController.target_angle = state.target_angle_4;
-						servoController.target_angular_velocity = state.target_angular_velocity_4;
-						break;
-					case 4:
-						servoController.target_angle = state.target_angle_5;
-						servoController.target_angular_velocity = state.target_angular_velocity_5;
-						break;
-					case 5:
-						servoController.target_angle = state.target_angle_6;
-						servoController.target_angular_velocity = state.target_angular_velocity_6;
-						break;
-					default:
-						Serial.println("Unknown device index.");
-						return;
+		ClockEstimate estimate;
+		if (!clockEstimate.read(estimate)) {
+			return esp_timer_get_time();
+		}
+		int64_t now = estimate.toMaster(esp_timer_get_time());
+		if (now < lastSharedMicros) {
+			now = lastSharedMicros;
+		}
+		lastSharedMicros = now;
+		return now;
+	}
+
+	bool sharedClockReady() {
+		ClockEstimate estimate;
+		return role == MASTER || (clockEstimate.read(estimate) && estimate.synchronized());
+	}
+
+	/**
+	 * Frame to render, derived from the shared clock so all rings show the same frame at the same time and
+	 * keep going through lost packets. Falls back to the master's frame counter until the clock is synchronized.
+	 */
+	int sharedFrame() {
+		if (!sharedClockReady()) {
+			return state.frame;
+		}
+		return int(sharedMicros() / SHARED_FRAME_MICROS);
+	}
+
+	/**
+	 * Points the servo at where the jitter buffer says this ring should be now, and returns how far ahead of the
+	 * servo's target, in seconds, runServo() should extrapolate: none when the buffer already did, the state's age
+	 * when it could not.
+	 */
+	float updateServoTarget() {
+		TargetPlayout target;
+		if (sharedClockReady() && targetBuffer.playout(sharedMicros(), target)) {
+			servoController.target_angle = target.angle;
+			servoController.target_angular_velocity = target.velocity;
+			return 0.0f;
+		}
+		return stateAgeSeconds();
+	}
+
+	/**
+	 * How long ago, in seconds, the master set the current state's targets
+	 */
+	float stateAgeSeconds() {
+		if (state.shared_micros != 0 && sharedClockReady()) {
+			return float(sharedMicros() - state.shared_micros) / 1e6f;
+		}
+		return (millis() - servoController.lastStateReceived) / 1000.0f;
+	}
+
+	// What the state broadcasts cost since the last call, counting their repeats
+	void printReplicationStats() {
+		const ReplicationStats& replication = replicator.stats();
+		int64_t now = esp_timer_get_time();
+		float seconds = (now - replicationStatsMicros) / 1e6f;
+		float bytesPerSecond = replicationStatsMicros != 0 && seconds > 0.0f
+			? (replication.bytes - replicationStatsBytes) * STATE_BROADCAST_REPEATS / seconds : 0.0f;
+		replicationStatsMicros = now;
+		replicationStatsBytes = replication.bytes;
+		Serial.printf("State keyframes: %lu  deltas: %lu  skipped: %lu of %lu ticks  %.0f bytes/s\n",
+					  (unsigned long)replication.keyframes,
+					  (unsigned long)replication.deltas,
+					  (unsigned long)replication.skipped,
+					  (unsigned long)replication.ticks,
+					  bytesPerSecond);
+	}
+
+	// Per-ring delivery of the state broadcasts, as reported in the rings' feedback
+	void printLinkStats() {
+		printTxStats();
+		printReplicationStats();
+		for (uint8_t i = 0; i < rings.directory.span(); i++) {
+			const WireLinkStats& stats = rings.links[i];
+			if (rings.directory.mac(i) == nullptr) continue;
+			Serial.printf("  Ring %d: received %lu  lost %lu (%.1f%%)  duplicates %lu  last seq %u\n",
+						  i + 1,
+						  (unsigned long)stats.received,
+						  (unsigned long)stats.lost,
+						  100.0f * stats.lossRatio(),
+						  (unsigned long)stats.duplicates,
+						  stats.lastSequence);
+		}
+	}
+
+	/**
+	 * Reads commands typed on the serial console, one per line, in the "command:argument" form of the Bluetooth
+	 * commands:
+	 *   setRole:master or setRole:ring   stores the role and reboots into it
+	 *   setRing:N                         stores N (0-based) as the ring index to ask the master for; setRing:none
+	 *                                     forgets it. A master keeps the index it gave a ring until it restarts.
+	 * Never blocks; call once per loop.
+	 */
+	void handleSerialCommands() {
+		while (Serial.available() > 0) {
+			char c = char(Serial.read());
+			if (c != '\n' && c != '\r') {
+				if (serialCommand.length() < SERIAL_COMMAND_LENGTH) {
+					serialCommand += c;
 				}
+				continue;
+			}
+			if (serialCommand.length() > 0) {
+				runSerialCommand(serialCommand);
 			}
+			serialCommand = "";
+		}
+	}
+
+	void runSerialCommand(const String& line) {
+		int separator = line.indexOf(':');
+		String command = separator < 0 ? line : line.substring(0, separator);
+		String argument = separator < 0 ? String("") : line.substring(separator + 1);
+		if (command == "setRole" && (argument == "master" || argument == "ring")) {
+			preferences.putUChar(PREFERENCE_ROLE, argument == "master" ? 0 : 1);
+			Serial.printf("Role set to %s; rebooting.\n", argument.c_str());
+			delay(100);
+			ESP.restart();
+		} else if (command == "setRing" && argument == "none") {
+			preferences.remove(PREFERENCE_RING);
+			Serial.println("Ring index forgotten; the master will assign one.");
+		} else if (command == "setRing" && argument.length() > 0 && argument.toInt() >= 0 && argument.toInt() < MAX_RINGS) {
+			preferences.putUChar(PREFERENCE_RING, uint8_t(argument.toInt()));
+			Serial.printf("Ring index %ld stored; it is asked for the next time this ring joins a master.\n", argument.toInt());
+		} else {
+			Serial.println("Invalid command");
 		}
 	}
 
-	// Send data: master sends full state; ring sends back its servo angle.
+	// Send data: master broadcasts the state; ring sends back its servo angle and link stats.
 	void synchronize() {
 		if (role == MASTER) {
 			// Serial.println("Master sending state to all rings.");
@@ -242,10 +485,9 @@ public:
 			// 	state.print();
 			// }
 
-			for (int i = 0; i < NUM_DEVICES; ++i) {
-				if (i == MASTER_INDEX) continue;
-				sendStateToRing(deviceList[i], state);
-			}
+			processRingPackets();
+			state.ring_count = rings.directory.span();
+			broadcastState(replicator, state, stateSequence, transmitter);
 
 			// for (int i = 1; i < NUM_DEVICES; i++) {
 			// 	delay(10);
@@ -263,17 +505,40 @@ public:
 			// }
 			state.print();
 
+			if (++ticks % STATS_LOG_TICKS == 0) {
+				printLinkStats();
+			}
 		}
 		else {
-			esp_err_t result = esp_now_send(deviceList[MASTER_INDEX], (uint8_t*)&servoController.current_angle, sizeof(float));
-			if (result != ESP_OK) {
-				Serial.println("Error sending angle.");
+			ticks++;
+
+			// Join: ask for an index until the master assigns one, then report back
+			uint8_t assigned = assignedRing.load();
+			if (assigned != NO_RING && assigned != deviceIndex) {
+				adoptRingIndex(assigned);
+			}
+			ClockEstimate estimate;
+			clockEstimate.read(estimate);
+			ringTick(link, assigned, deviceIndex >= 0 ? uint8_t(deviceIndex) : NO_RING, servoController.current_angle, receivedLink,
+					 estimate, esp_timer_get_time(), transmitter);
+			if (!link.masterKnown) {
+				return;
+			}
+
+			if (ticks % STATS_LOG_TICKS == 0) {
+				JitterStats jitter = targetBuffer.stats();
+				Serial.printf("Targets received: %lu  reordered: %lu  late: %lu  duplicates: %lu  jitter: %.0f us  delay: %.0f us\n",
+							  (unsigned long)jitter.received,
+							  (unsigned long)jitter.reordered,
+							  (unsigned long)jitter.late,
+							  (unsigned long)jitter.duplicates,
+							  jitter.jitterMicros,
+							  jitter.delayMicros);
 			}
 			state.print();
 		}
 	}
 };
 
-Synchronizer* Synchronizer::instance = nullptr;
 
 #endif // SYNCHRONIZE_HPP
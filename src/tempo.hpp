@@ -0,0 +1,236 @@
+#ifndef TEMPO_HPP
+#define TEMPO_HPP
+
+#include <math.h>
+#include <stdint.h>
+
+/**
+ * Tempo estimator over a stream of onset strengths, one value per analysis frame.
+ *
+ * Keeps a leaky autocorrelation of the (mean-removed) onset strength for every lag between MIN_LAG and MAX_LAG
+ * frames. Each new frame adds one product per lag, so the cost is O(MAX_LAG - MIN_LAG) per frame and the
+ * history fades with a time constant of a few seconds, which lets the estimate follow a change of track without
+ * rescanning old frames. Each lag is scored together with half the correlation at twice the lag, and weighted by
+ * a log-Gaussian tempo prior, which settles the octave ambiguity; the best lag is refined with parabolic
+ * interpolation.
+ */
+template <uint16_t MIN_LAG, uint16_t MAX_LAG>
+class TempoTracker {
+private:
+	static const uint16_t NUM_LAGS = MAX_LAG - MIN_LAG + 1;
+	static const uint16_t HISTORY = MAX_LAG + 1;
+
+	float history[HISTORY] = {};   // mean-removed onset strengths, ring indexed by frame
+	float correlation[NUM_LAGS] = {};
+	float prior[NUM_LAGS];
+	float energy = 0.0f;           // leaky autocorrelation at lag 0
+	float smoothed = 0.0f;
+	float mean = 0.0f;
+	uint16_t position = 0;
+	uint32_t frames = 0;
+
+	float framesPerSecond;
+	float decay;                   // per-frame leak of the autocorrelation
+	float meanCoef;
+
+	float currentLag = 0.0f;
+	float currentConfidence = 0.0f;
+
+	float score(uint16_t i) const {
+		float value = correlation[i];
+		uint16_t harmonic = 2 * (MIN_LAG + i) - MIN_LAG;  // index of twice the lag
+		if (harmonic < NUM_LAGS) {
+			value += 0.5f * correlation[harmonic];
+		}
+		return value * prior[i];
+	}
+
+public:
+	/**
+	 * `memorySeconds` is the time constant of the autocorrelation; `preferredBpm` is the center of the tempo prior
+	 */
+	TempoTracker(float framesPerSecond, float memorySeconds = 4.0f, float preferredBpm = 120.0f)
+		: framesPerSecond(framesPerSecond),
+		  decay(1.0f / (memorySeconds * framesPerSecond)),
+		  meanCoef(1.0f / framesPerSecond) {
+		float preferredLag = 60.0f * framesPerSecond / preferredBpm;
+		for (uint16_t i = 0; i < NUM_LAGS; i++) {
+			float octaves = log2f(float(MIN_LAG + i) / preferredLag);
+			prior[i] = expf(-0.5f * octaves * octaves / (0.9f * 0.9f));
+		}
+		currentLag = preferredLag;
+	}
+
+	/**
+	 * Adds the onset strength of the next frame and updates the tempo estimate
+	 */
+	void update(float onsetStrength) {
+		// Smooth over ~3 frames so a beat landing a frame early or late still correlates
+		smoothed += 0.5f * (onsetStrength - smoothed);
+		mean += meanCoef * (smoothed - mean);
+		float x = smoothed - mean;
+		history[position] = x;
+
+		energy += decay * (x * x - energy);
+		for (uint16_t i = 0; i < NUM_LAGS; i++) {
+			uint16_t lag = MIN_LAG + i;
+			uint16_t past = position >= lag ? position - lag : position + HISTORY - lag;
+			correlation[i] += decay * (x * history[past] - correlation[i]);
+		}
+		position = (position + 1) % HISTORY;
+		frames++;
+
+		float bestScore = 0.0f;
+		uint16_t best = 0;
+		for (uint16_t i = 0; i < NUM_LAGS; i++) {
+			float candidate = score(i);
+			if (candidate > bestScore) {
+				bestScore = candidate;
+				best = i;
+			}
+		}
+		if (bestScore <= 0.0f || frames < HISTORY) {
+			currentConfidence = 0.0f;
+			return;
+		}
+
+		// Parabolic interpolation between the neighbouring lags
+		float offset = 0.0f;
+		if (best > 0 && best < NUM_LAGS - 1) {
+			float left = score(best - 1);
+			float right = score(best + 1);
+			float curvature = left - 2.0f * bestScore + right;
+			if (curvature < 0.0f) {
+				offset = 0.5f * (left - right) / curvature;
+			}
+		}
+		currentLag = float(MIN_LAG + best) + offset;
+		currentConfidence = energy > 0.0f ? fminf(correlation[best] / energy, 1.0f) : 0.0f;
+	}
+
+	/**
+	 * Current tempo estimate
+	 */
+	float bpm() const {
+		return 60.0f * framesPerSecond / currentLag;
+	}
+
+	/**
+	 * Beat period of the current estimate, in frames
+	 */
+	float period() const {
+		return currentLag;
+	}
+
+	/**
+	 * Normalized autocorrelation at the detected period, 0 (no periodicity) to 1 (perfectly periodic)
+	 */
+	float confidence() const {
+		return currentConfidence;
+	}
+};
+
+/**
+ * Phase-locked beat clock, advanced once per analysis frame.
+ *
+ * Between beats the phase free-runs at the current period, so it can predict when the next beat will land.
+ * Each detected beat that falls near a predicted one nudges the phase and the period toward it (a second-order
+ * loop); detections far from the prediction are treated as syncopation and ignored once the clock is locked.
+ * The period is also pulled toward the tempo tracker's estimate while that is confident, which lets the loop
+ * acquire a new tempo faster than the beat detections alone would.
+ */
+class BeatClock {
+private:
+	float phase = 0.0f;             // beats since the last predicted beat, [0, 1)
+	float period;                   // frames per beat
+	float minPeriod;
+	float maxPeriod;
+
+	float phaseGain;
+	float periodGain;
+	float tempoGain = 0.005f;       // per-frame pull toward the tempo tracker's period
+	float captureWindow = 0.2f;     // largest phase error (in beats) a detection may have to count once locked
+
+	uint8_t matchedBeats = 0;       // consecutive detections inside the capture window
+	float beatsSinceMatch = 0.0f;
+	uint8_t beatsInDisagreement = 0;  // beats the confident tracker has disagreed with the period by more than 8%
+
+public:
+	BeatClock(float initialPeriod, float minPeriod, float maxPeriod, float phaseGain = 0.25f, float periodGain = 0.05f)
+		: period(initialPeriod), minPeriod(minPeriod), maxPeriod(maxPeriod), phaseGain(phaseGain), periodGain(periodGain) {}
+
+	/**
+	 * Advances the clock by one frame. `beat` is whether a beat was detected on this frame, `trackedPeriod` and
+	 * `trackedConfidence` are the tempo tracker's current estimate (a confidence of 0 disables the pull).
+	 */
+	void update(bool beat, float trackedPeriod, float trackedConfidence) {
+		if (trackedConfidence > 0.0f) {
+			// While unlocked there is no phase to protect, so take the tracker's tempo outright
+			period += (locked() ? tempoGain * trackedConfidence : 1.0f) * (trackedPeriod - period);
+		}
+
+		phase += 1.0f / period;
+		if (phase >= 1.0f) {
+			phase -= 1.0f;
+			beatsSinceMatch += 1.0f;
+			bool disagrees = trackedConfidence > 0.0f && fabsf(trackedPeriod - period) > 0.08f * period;
+			beatsInDisagreement = disagrees ? beatsInDisagreement + 1 : 0;
+			if (beatsSinceMatch > 4.0f || beatsInDisagreement > 2) {
+				matchedBeats = 0;   // lost lock, e.g. after a change of track
+				beatsInDisagreement = 0;
+			}
+		}
+
+		if (!beat) {
+			return;
+		}
+		float error = phase >= 0.5f ? phase - 1.0f : phase;  // positive if the beat came after the prediction
+		if (!locked()) {
+			// Acquire: jump straight to the detected beat
+			phase = 0.0f;
+			matchedBeats = (fabsf(error) < captureWindow) ? matchedBeats + 1 : 1;
+			beatsSinceMatch = 0.0f;
+			return;
+		}
+		if (fabsf(error) > captureWindow) {
+			return;
+		}
+		phase -= phaseGain * error;
+		if (phase < 0.0f) phase += 1.0f;
+		if (phase >= 1.0f) phase -= 1.0f;
+		period += periodGain * error * period;
+		period = fminf(fmaxf(period, minPeriod), maxPeriod);
+		if (matchedBeats < 255) matchedBeats++;
+		beatsSinceMatch = 0.0f;
+	}
+
+	/**
+	 * True once a few consecutive beats matched the prediction
+	 */
+	bool locked() const {
+		return matchedBeats >= 3;
+	}
+
+	/**
+	 * Position within the current beat, 0 on the beat and approaching 1 just before the next one
+	 */
+	float beatPhase() const {
+		return phase;
+	}
+
+	/**
+	 * Current beat period, in frames
+	 */
+	float beatPeriod() const {
+		return period;
+	}
+
+	/**
+	 * Number of frames until the next predicted beat
+	 */
+	float framesToNextBeat() const {
+		return (1.0f - phase) * period;
+	}
+};
+
+#endif // TEMPO_HPP
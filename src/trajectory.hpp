@@ -10,6 +10,10 @@ float DEGS_PER_SEC = RPM * 360.0f / 60.0f;
  * Updates the target angles at a fixed RPM.
  */
 class TrajectoryPlanner {
+private:
+	// Which of the original six rings advance their target angle for now; rings added past them all do
+	static constexpr float TURNING[6] = {0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f};
+
 public:
 
     /**
@@ -19,18 +23,12 @@ public:
      */
     void update(State& state) {
 		float dt = 1. / state.updatesPerSecond;
-        state.target_angle_1 = fmodf(state.target_angle_1 + DEGS_PER_SEC * dt*0., 360.0f);
-        state.target_angle_2 = fmodf(state.target_angle_2 + DEGS_PER_SEC * dt*0., 360.0f);
-        state.target_angle_3 = fmodf(state.target_angle_3 + DEGS_PER_SEC * dt, 360.0f);
-        state.target_angle_4 = fmodf(state.target_angle_4 + DEGS_PER_SEC * dt*0., 360.0f);
-        state.target_angle_5 = fmodf(state.target_angle_5 + DEGS_PER_SEC * dt*0., 360.0f);
-        state.target_angle_6 = fmodf(state.target_angle_6 + DEGS_PER_SEC * dt, 360.0f);
-		state.target_angular_velocity_1 = 0. * DEGS_PER_SEC;
-		state.target_angular_velocity_2 = DEGS_PER_SEC;
-		state.target_angular_velocity_3 = DEGS_PER_SEC;
-		state.target_angular_velocity_4 = DEGS_PER_SEC;
-		state.target_angular_velocity_5 = DEGS_PER_SEC;
-		state.target_angular_velocity_6 = DEGS_PER_SEC;
+		for (uint8_t i = 0; i < state.ring_count; i++) {
+			float turning = i < 6 ? TURNING[i] : 1.0f;
+			state.target_angle[i] = fmodf(state.target_angle[i] + DEGS_PER_SEC * dt * turning, 360.0f);
+			state.target_angular_velocity[i] = i == 0 ? 0.0f : DEGS_PER_SEC;
+			state.target_angle_rate[i] = DEGS_PER_SEC * turning;  // rings dead reckon the angle with it
+		}
     }
 
 };
\ No newline at end of file
@@ -0,0 +1,119 @@
+#ifndef TRANSMITTER_HPP
+#define TRANSMITTER_HPP
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "transport.hpp"
+#include "txqueue.hpp"
+#include "wire.hpp"
+
+#define TX_TASK_PRIORITY 2           // above loop(), which runs at 1; the task is blocked most of the time
+#define TX_TASK_CORE 1
+
+/**
+ * Transmitter running in its own task, so loop() only ever enqueues.
+ *
+ * The task sends one packet at a time over the transport and waits for its sent callback, which wakes it with a
+ * task notification; enqueueing wakes it the same way. The queue is shared with the task under a critical section.
+ */
+class Transmitter {
+private:
+	TxQueue<TX_QUEUE_DEPTH> queue;
+	portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+	Transport* transport = nullptr;
+	TaskHandle_t task = nullptr;
+	std::atomic<bool> completed{false};
+	std::atomic<bool> lastDelivered{true};
+
+	static void taskEntry(void* arg) {
+		static_cast<Transmitter*>(arg)->run();
+	}
+
+	static void onSent(void* context, bool delivered) {
+		Transmitter* transmitter = static_cast<Transmitter*>(context);
+		transmitter->lastDelivered.store(delivered);
+		transmitter->completed.store(true);
+		if (transmitter->task != nullptr) {
+			xTaskNotifyGive(transmitter->task);
+		}
+	}
+
+	// Sends the message and blocks until the radio is done with it; false if it could not be sent
+	bool sendAndWait(const TxMessage& message) {
+		completed.store(false);
+		if (!transport->send(message.destination, message.data, message.length)) {
+			return false;
+		}
+		uint32_t start = millis();
+		while (!completed.load()) {
+			if (millis() - start > TX_COMPLETION_TIMEOUT_MS) {
+				portENTER_CRITICAL(&lock);
+				queue.stats.timedOut++;
+				portEXIT_CRITICAL(&lock);
+				return false;
+			}
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TX_COMPLETION_TIMEOUT_MS));
+		}
+		return lastDelivered.load();
+	}
+
+	bool pop(TxMessage& message) {
+		portENTER_CRITICAL(&lock);
+		bool available = queue.pop(message);
+		portEXIT_CRITICAL(&lock);
+		return available;
+	}
+
+	void run() {
+		TxMessage message;
+		while (true) {
+			if (!pop(message)) {
+				ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+				continue;
+			}
+			for (uint8_t i = 0; i < message.repeats; i++) {
+				bool ok = sendAndWait(message);
+				uint32_t latency = micros() - message.enqueuedMicros;
+				portENTER_CRITICAL(&lock);
+				queue.stats.recordSend(ok, latency);
+				portEXIT_CRITICAL(&lock);
+			}
+		}
+	}
+
+public:
+	/**
+	 * Starts the task, which takes over the transport's sent callback
+	 */
+	void begin(Transport& transport) {
+		this->transport = &transport;
+		transport.onSent(onSent, this);
+		xTaskCreatePinnedToCore(taskEntry, "espnow_tx", 4096, this, TX_TASK_PRIORITY, &task, TX_TASK_CORE);
+	}
+
+	/**
+	 * Queues a packet, replacing any queued packet of the same type to the same destination. Never blocks.
+	 */
+	void send(const uint8_t* destination, WireMessage type, const uint8_t* data, size_t length, uint8_t repeats = 1) {
+		if (length == 0 || length > WIRE_MAX_PACKET_SIZE) {
+			return;
+		}
+		uint32_t now = micros();
+		portENTER_CRITICAL(&lock);
+		queue.push(destination, type, data, uint8_t(length), repeats, now);
+		portEXIT_CRITICAL(&lock);
+		if (task != nullptr) {
+			xTaskNotifyGive(task);
+		}
+	}
+
+	TxStats stats() {
+		portENTER_CRITICAL(&lock);
+		TxStats copy = queue.stats;
+		portEXIT_CRITICAL(&lock);
+		return copy;
+	}
+};
+
+#endif // TRANSMITTER_HPP
@@ -0,0 +1,64 @@
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*TransportReceiveCallback)(void* context, const uint8_t* mac, const uint8_t* data, int length);
+typedef void (*TransportSentCallback)(void* context, bool delivered);
+
+/**
+ * Packet link between the master and the rings: ESP-NOW on the devices (EspNowTransport), a simulated radio channel
+ * on a host (sim/simtransport.hpp).
+ *
+ * Devices are addressed by 6-byte MAC addresses, and FF:FF:FF:FF:FF:FF reaches every device. send() only hands the
+ * packet to the radio; the sent callback reports when the radio is done with it, and whether a unicast packet was
+ * acknowledged. Both callbacks may be called from another task and must not block.
+ */
+class Transport {
+private:
+	TransportReceiveCallback receiveCallback = nullptr;
+	void* receiveContext = nullptr;
+	TransportSentCallback sentCallback = nullptr;
+	void* sentContext = nullptr;
+
+protected:
+	void received(const uint8_t* mac, const uint8_t* data, int length) {
+		if (receiveCallback != nullptr) {
+			receiveCallback(receiveContext, mac, data, length);
+		}
+	}
+
+	void sent(bool delivered) {
+		if (sentCallback != nullptr) {
+			sentCallback(sentContext, delivered);
+		}
+	}
+
+public:
+	virtual ~Transport() {}
+
+	// Register before begin()
+	void onReceive(TransportReceiveCallback callback, void* context) {
+		receiveCallback = callback;
+		receiveContext = context;
+	}
+
+	void onSent(TransportSentCallback callback, void* context) {
+		sentCallback = callback;
+		sentContext = context;
+	}
+
+	virtual bool begin() = 0;
+	virtual void macAddress(uint8_t mac[6]) = 0;
+	virtual bool addPeer(const uint8_t mac[6]) = 0;
+	virtual bool removePeer(const uint8_t mac[6]) = 0;
+
+	/**
+	 * Starts sending a packet; returns false if it could not be handed to the radio, in which case no sent callback
+	 * follows
+	 */
+	virtual bool send(const uint8_t mac[6], const uint8_t* data, size_t length) = 0;
+};
+
+#endif // TRANSPORT_HPP
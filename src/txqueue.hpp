@@ -0,0 +1,111 @@
+#ifndef TXQUEUE_HPP
+#define TXQUEUE_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "wire.hpp"
+
+#define TX_QUEUE_DEPTH 4
+#define TX_COMPLETION_TIMEOUT_MS 20  // give up on a send callback that never comes
+
+// A packet waiting to be sent
+struct TxMessage {
+	uint8_t destination[6];
+	WireMessage type;
+	uint8_t repeats;           // times to send it, for broadcasts that are not acknowledged
+	uint8_t length;
+	uint8_t data[WIRE_MAX_PACKET_SIZE];
+	uint32_t enqueuedMicros;
+};
+
+struct TxStats {
+	uint32_t enqueued = 0;
+	uint32_t coalesced = 0;    // replaced a queued message of the same type to the same destination
+	uint32_t dropped = 0;      // evicted unsent because the queue was full
+	uint32_t sent = 0;         // packets the radio reported as sent, repeats included
+	uint32_t failed = 0;       // packets the transport refused or reported as failed
+	uint32_t timedOut = 0;     // sends whose completion callback never came
+	uint8_t depth = 0;
+	uint8_t maxDepth = 0;
+	uint32_t lastLatencyMicros = 0;  // from enqueue to the completion of the last send
+	uint32_t maxLatencyMicros = 0;
+	float averageLatencyMicros = 0.0f;
+
+	/**
+	 * Counts one send of a message that was enqueued `latencyMicros` before it completed
+	 */
+	void recordSend(bool ok, uint32_t latencyMicros) {
+		if (ok) {
+			sent++;
+		} else {
+			failed++;
+		}
+		lastLatencyMicros = latencyMicros;
+		if (latencyMicros > maxLatencyMicros) maxLatencyMicros = latencyMicros;
+		averageLatencyMicros += 0.05f * (latencyMicros - averageLatencyMicros);
+	}
+};
+
+/**
+ * Bounded FIFO of outgoing packets that keeps only the latest message of each type per destination: enqueueing a
+ * message replaces a queued one of the same type to the same destination in place. When the queue is full the
+ * oldest message is evicted.
+ *
+ * The queue itself knows nothing of tasks or clocks, so the host simulator runs the same one: the caller passes in
+ * the time, and keeps pushes, pops and reads of the stats under its own lock (a critical section in Transmitter, a
+ * mutex on the host).
+ */
+template <uint8_t DEPTH>
+class TxQueue {
+private:
+	TxMessage slots[DEPTH];
+	uint8_t head = 0;
+	uint8_t count = 0;
+
+public:
+	TxStats stats;
+
+	void push(const uint8_t* destination, WireMessage type, const uint8_t* data, uint8_t length, uint8_t repeats, uint32_t nowMicros) {
+		stats.enqueued++;
+		TxMessage* slot = nullptr;
+		for (uint8_t i = 0; i < count; i++) {
+			TxMessage& queued = slots[(head + i) % DEPTH];
+			if (queued.type == type && memcmp(queued.destination, destination, 6) == 0) {
+				slot = &queued;
+				stats.coalesced++;
+				break;
+			}
+		}
+		if (slot == nullptr) {
+			if (count == DEPTH) {
+				head = (head + 1) % DEPTH;
+				count--;
+				stats.dropped++;
+			}
+			slot = &slots[(head + count) % DEPTH];
+			count++;
+		}
+		memcpy(slot->destination, destination, 6);
+		slot->type = type;
+		slot->repeats = repeats;
+		slot->length = length;
+		memcpy(slot->data, data, length);
+		slot->enqueuedMicros = nowMicros;
+		stats.depth = count;
+		if (count > stats.maxDepth) stats.maxDepth = count;
+	}
+
+	bool pop(TxMessage& message) {
+		bool available = count > 0;
+		if (available) {
+			message = slots[head];
+			head = (head + 1) % DEPTH;
+			count--;
+			stats.depth = count;
+		}
+		return available;
+	}
+};
+
+#endif // TXQUEUE_HPP
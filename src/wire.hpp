@@ -0,0 +1,634 @@
+#ifndef WIRE_HPP
+#define WIRE_HPP
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rings.hpp"
+#include "state.hpp"
+
+/**
+ * Binary wire format of the packets between the master and the rings.
+ *
+ * Every packet starts with a 4-byte header: the format version, the message type and a 16-bit sequence number,
+ * all little-endian. The body is a list of fields, each a type byte, a length byte and that many bytes of value.
+ * Decoders skip field types they do not know, so new fields can be added without breaking older rings; the
+ * version only changes if the header or the encoding of an existing field does.
+ *
+ * Values are quantized: angles are 16-bit binary angles (65536 per turn), velocities int16 in 1/16 degree per
+ * second, and timestamps are sent as 16-bit millisecond offsets from `time`; decoded angles are in [0, 360).
+ * Fields that only matter on the master (lastUpdate, updatesPerSecond) are not sent.
+ *
+ * A state packet need not carry every field: rings decode it onto the state they already have, so the master can
+ * send just what changed (see StateReplicator).
+ */
+
+#define WIRE_VERSION 1
+#define WIRE_HEADER_SIZE 4
+#define WIRE_MAX_PACKET_SIZE 250  // ESP_NOW_MAX_DATA_LEN
+
+enum class WireMessage : uint8_t {
+	State = 1,     // master to rings, broadcast once per tick
+	Feedback = 2,  // ring to master: current angle and how well the state broadcasts arrive
+	TimePing = 3,  // ring to master, for clock synchronization
+	TimePong = 4,  // master to the ring that pinged
+	Announce = 5,  // ring to master (or broadcast until it knows the master), until it is assigned an index
+	Assign = 6,    // master to a ring: the index it is to use
+};
+
+enum class WireField : uint8_t {
+	Clock = 1,        // frame (u16), time (u32)
+	Settings = 2,     // isPaused, brightness, shader_index (u8 each)
+	Beat = 3,         // beat_intensity (u16, 1/1024), elapsedBeats (u32), age of lastBeatTimestamp and lastOnsetTimestamp (u16 ms)
+	BeatClock = 4,    // beat_phase (u16, 1/65536), beat_period (u16, 1/16 ms), next_beat_timestamp - time (u16 ms)
+	Structure = 5,    // section (u8), tension (u8, 1/255)
+	RingTargets = 6,  // for each of rings 0 to ring_count - 1: target angle (u16 binary angle), target angular velocity (i16, 1/16 deg/s)
+	SharedTime = 7,   // shared_micros (u64)
+	RingRates = 8,    // for each ring: the rate its target angle changes at, which need not be the angular velocity (i16, 1/16 deg/s)
+
+	// Feedback fields
+	RingAngle = 16,   // current angle (u16 binary angle)
+	LinkStats = 17,   // last state sequence (u16), received, lost and duplicate state packets (u32 each)
+
+	// Clock synchronization fields, all in microseconds of esp_timer_get_time()
+	PingTime = 18,    // t1: when the ring sent the ping (u64)
+	PongTimes = 19,   // t1 echoed, t2: when the master received the ping, t3: when it sent the pong (u64 each)
+
+	// Ring discovery fields, also in Feedback
+	RingIndex = 20,   // u8: the preferred index in an Announce, the assigned one in Assign and Feedback; NO_RING for none
+};
+
+// A set of state fields, bit n standing for WireField n; state fields are numbered below 16 to fit
+typedef uint16_t WireFieldSet;
+
+constexpr WireFieldSet wireFieldBit(WireField field) {
+	return WireFieldSet(1u << uint8_t(field));
+}
+
+#define WIRE_STATE_FIELDS WireFieldSet(0x01FE)  // Clock through RingRates
+static_assert(WIRE_STATE_FIELDS == WireFieldSet(2 * wireFieldBit(WireField::RingRates) - wireFieldBit(WireField::Clock)),
+			  "WIRE_STATE_FIELDS must cover every state field");
+
+struct WireHeader {
+	uint8_t version = WIRE_VERSION;
+	WireMessage type = WireMessage::State;
+	uint16_t sequence = 0;
+};
+
+// How well the state broadcasts reach a ring, as counted by its SequenceTracker
+struct WireLinkStats {
+	uint16_t lastSequence = 0;
+	uint32_t received = 0;    // distinct state packets
+	uint32_t lost = 0;        // sequence numbers that never arrived
+	uint32_t duplicates = 0;  // repeats and reordered stragglers that were dropped
+
+	float lossRatio() const {
+		return received + lost > 0 ? float(lost) / float(received + lost) : 0.0f;
+	}
+};
+
+struct WireFeedback {
+	float angle = 0.0f;
+	uint8_t ringIndex = NO_RING;
+	WireLinkStats link;
+};
+
+/**
+ * Drops repeated and out-of-date packets by sequence number and counts the gaps. A jump back by more than
+ * RESYNC_GAP is taken to be a restarted sender rather than a stale packet.
+ */
+class SequenceTracker {
+private:
+	static const int16_t RESYNC_GAP = 1000;
+	bool started = false;
+	WireLinkStats counts;
+
+public:
+	/**
+	 * Returns true if the packet with this sequence number is new and should be applied
+	 */
+	bool accept(uint16_t sequence) {
+		if (!started) {
+			started = true;
+			counts.lastSequence = sequence;
+			counts.received++;
+			return true;
+		}
+		int16_t ahead = int16_t(uint16_t(sequence - counts.lastSequence));
+		if (ahead <= 0 && ahead > -RESYNC_GAP) {
+			counts.duplicates++;
+			return false;
+		}
+		if (ahead > 1) {
+			counts.lost += ahead - 1;
+		}
+		counts.lastSequence = sequence;
+		counts.received++;
+		return true;
+	}
+
+	const WireLinkStats& stats() const {
+		return counts;
+	}
+};
+
+// Quantization of the individual values
+
+inline uint16_t angleToWire(float degrees) {
+	float turns = degrees / 360.0f;
+	turns -= floorf(turns);
+	return uint16_t(int32_t(lroundf(turns * 65536.0f)) & 0xFFFF);
+}
+
+inline float angleFromWire(uint16_t angle) {
+	return angle * (360.0f / 65536.0f);
+}
+
+inline uint16_t unsignedToWire(float value, float scale) {
+	float scaled = roundf(value * scale);
+	return scaled <= 0.0f ? 0 : (scaled >= 65535.0f ? 65535 : uint16_t(scaled));
+}
+
+inline int16_t signedToWire(float value, float scale) {
+	float scaled = roundf(value * scale);
+	return scaled <= -32768.0f ? -32768 : (scaled >= 32767.0f ? 32767 : int16_t(scaled));
+}
+
+// Milliseconds from `earlier` to `later`, saturated to 16 bits (0 if `earlier` is actually later)
+inline uint16_t millisToWire(unsigned long earlier, unsigned long later) {
+	if (later <= earlier) {
+		return 0;
+	}
+	return later - earlier > 65535UL ? 65535 : uint16_t(later - earlier);
+}
+
+/**
+ * Appends little-endian values to a packet buffer; once a write does not fit, every later one is dropped and
+ * ok() turns false
+ */
+class WireWriter {
+private:
+	uint8_t* buffer;
+	size_t capacity;
+	size_t position = 0;
+	size_t fieldStart = 0;
+	bool overflow = false;
+
+public:
+	WireWriter(uint8_t* buffer, size_t capacity) : buffer(buffer), capacity(capacity) {}
+
+	void u8(uint8_t value) {
+		if (position + 1 > capacity) {
+			overflow = true;
+			return;
+		}
+		buffer[position++] = value;
+	}
+
+	void u16(uint16_t value) {
+		u8(uint8_t(value));
+		u8(uint8_t(value >> 8));
+	}
+
+	void u32(uint32_t value) {
+		u16(uint16_t(value));
+		u16(uint16_t(value >> 16));
+	}
+
+	void u64(uint64_t value) {
+		u32(uint32_t(value));
+		u32(uint32_t(value >> 32));
+	}
+
+	void header(const WireHeader& header) {
+		u8(header.version);
+		u8(uint8_t(header.type));
+		u16(header.sequence);
+	}
+
+	// Starts a field; its length is filled in by endField()
+	void beginField(WireField type) {
+		u8(uint8_t(type));
+		fieldStart = position;
+		u8(0);
+	}
+
+	void endField() {
+		if (!overflow) {
+			buffer[fieldStart] = uint8_t(position - fieldStart - 1);
+		}
+	}
+
+	bool ok() const {
+		return !overflow;
+	}
+
+	size_t size() const {
+		return overflow ? 0 : position;
+	}
+};
+
+/**
+ * Reads little-endian values from a packet; reads past the end return 0 and turn ok() false
+ */
+class WireReader {
+private:
+	const uint8_t* data;
+	size_t length;
+	size_t position = 0;
+	bool underflow = false;
+
+public:
+	WireReader(const uint8_t* data, size_t length) : data(data), length(length) {}
+
+	uint8_t u8() {
+		if (position + 1 > length) {
+			underflow = true;
+			return 0;
+		}
+		return data[position++];
+	}
+
+	uint16_t u16() {
+		uint16_t low = u8();
+		return uint16_t(low | (uint16_t(u8()) << 8));
+	}
+
+	uint32_t u32() {
+		uint32_t low = u16();
+		return low | (uint32_t(u16()) << 16);
+	}
+
+	uint64_t u64() {
+		uint64_t low = u32();
+		return low | (uint64_t(u32()) << 32);
+	}
+
+	bool header(WireHeader& header) {
+		header.version = u8();
+		header.type = WireMessage(u8());
+		header.sequence = u16();
+		return ok() && header.version == WIRE_VERSION;
+	}
+
+	/**
+	 * Reads the next field's type and returns a reader over its value, skipping it in this one. Returns false at
+	 * the end of the packet or if the field is truncated.
+	 */
+	bool nextField(WireField& type, WireReader& value) {
+		if (position >= length) {
+			return false;
+		}
+		type = WireField(u8());
+		uint8_t fieldLength = u8();
+		if (!ok() || position + fieldLength > length) {
+			underflow = true;
+			return false;
+		}
+		value = WireReader(data + position, fieldLength);
+		position += fieldLength;
+		return true;
+	}
+
+	bool ok() const {
+		return !underflow;
+	}
+
+	size_t remaining() const {
+		return length - position;
+	}
+};
+
+/**
+ * Reads just the header of a packet; false if it is too short or of another version
+ */
+inline bool decodeHeader(const uint8_t* data, size_t length, WireHeader& header) {
+	WireReader in(data, length);
+	return in.header(header);
+}
+
+/**
+ * Encodes the fields of `st` that the rings use into `buffer`, or just those in `fields`. Returns the packet size,
+ * or 0 if it does not fit.
+ */
+inline size_t encodeState(const State& st, uint16_t sequence, uint8_t* buffer, size_t capacity, WireFieldSet fields = WIRE_STATE_FIELDS) {
+	WireWriter out(buffer, capacity);
+	WireHeader header;
+	header.type = WireMessage::State;
+	header.sequence = sequence;
+	out.header(header);
+
+	if (fields & wireFieldBit(WireField::Clock)) {
+		out.beginField(WireField::Clock);
+		out.u16(st.frame);
+		out.u32(st.time);
+		out.endField();
+	}
+
+	if (fields & wireFieldBit(WireField::Settings)) {
+		out.beginField(WireField::Settings);
+		out.u8(st.isPaused ? 1 : 0);
+		out.u8(st.brightness);
+		out.u8(st.shader_index);
+		out.endField();
+	}
+
+	if (fields & wireFieldBit(WireField::Beat)) {
+		out.beginField(WireField::Beat);
+		out.u16(unsignedToWire(st.beat_intensity, 1024.0f));
+		out.u32(st.elapsedBeats);
+		out.u16(millisToWire(st.lastBeatTimestamp, st.time));
+		out.u16(millisToWire(st.lastOnsetTimestamp, st.time));
+		out.endField();
+	}
+
+	if (fields & wireFieldBit(WireField::BeatClock)) {
+		out.beginField(WireField::BeatClock);
+		out.u16(unsignedToWire(st.beat_phase, 65536.0f));
+		out.u16(unsignedToWire(st.beat_period, 16.0f));
+		out.u16(millisToWire(st.time, st.next_beat_timestamp));
+		out.endField();
+	}
+
+	if (fields & wireFieldBit(WireField::Structure)) {
+		out.beginField(WireField::Structure);
+		out.u8(st.section);
+		out.u8(uint8_t(fminf(fmaxf(st.tension, 0.0f), 1.0f) * 255.0f + 0.5f));
+		out.endField();
+	}
+
+	// Only the rings that joined, so the packet grows with the totem
+	if (fields & wireFieldBit(WireField::RingTargets)) {
+		out.beginField(WireField::RingTargets);
+		for (uint8_t i = 0; i < st.ring_count && i < MAX_RINGS; i++) {
+			out.u16(angleToWire(st.target_angle[i]));
+			out.u16(uint16_t(signedToWire(st.target_angular_velocity[i], 16.0f)));
+		}
+		out.endField();
+	}
+
+	if (fields & wireFieldBit(WireField::SharedTime)) {
+		out.beginField(WireField::SharedTime);
+		out.u64(uint64_t(st.shared_micros));
+		out.endField();
+	}
+
+	if (fields & wireFieldBit(WireField::RingRates)) {
+		out.beginField(WireField::RingRates);
+		for (uint8_t i = 0; i < st.ring_count && i < MAX_RINGS; i++) {
+			out.u16(uint16_t(signedToWire(st.target_angle_rate[i], 16.0f)));
+		}
+		out.endField();
+	}
+
+	return out.size();
+}
+
+/**
+ * Decodes a state packet into `st`, leaving fields that are not in the packet untouched. Returns false (without
+ * touching `st`) if the packet is not a state packet of this version or is truncated.
+ */
+inline bool decodeState(const uint8_t* data, size_t length, State& st, uint16_t* sequence = nullptr) {
+	WireReader in(data, length);
+	WireHeader header;
+	if (!in.header(header) || header.type != WireMessage::State) {
+		return false;
+	}
+
+	// Check the whole packet first, so a truncated one does not leave a half-updated state behind. This also picks
+	// up the time the other timestamps are relative to, wherever the Clock field is.
+	WireReader check = in;
+	WireField type;
+	WireReader value(nullptr, 0);
+	unsigned long time = st.time;
+	while (check.nextField(type, value)) {
+		if (type == WireField::Clock) {
+			value.u16();
+			time = value.u32();
+		}
+	}
+	if (!check.ok()) {
+		return false;
+	}
+
+	while (in.nextField(type, value)) {
+		switch (type) {
+			case WireField::Clock:
+				st.frame = value.u16();
+				st.time = value.u32();
+				break;
+			case WireField::Settings:
+				st.isPaused = value.u8() != 0;
+				st.brightness = value.u8();
+				st.shader_index = value.u8();
+				break;
+			case WireField::Beat:
+				st.beat_intensity = value.u16() / 1024.0f;
+				st.elapsedBeats = value.u32();
+				st.lastBeatTimestamp = time - value.u16();
+				st.lastOnsetTimestamp = time - value.u16();
+				break;
+			case WireField::BeatClock:
+				st.beat_phase = value.u16() / 65536.0f;
+				st.beat_period = value.u16() / 16.0f;
+				st.next_beat_timestamp = time + value.u16();
+				break;
+			case WireField::Structure:
+				st.section = value.u8();
+				st.tension = value.u8() / 255.0f;
+				break;
+			case WireField::RingTargets: {
+				size_t count = value.remaining() / 4;
+				st.ring_count = uint8_t(count < MAX_RINGS ? count : MAX_RINGS);
+				for (uint8_t i = 0; i < st.ring_count; i++) {
+					st.target_angle[i] = angleFromWire(value.u16());
+					st.target_angular_velocity[i] = int16_t(value.u16()) / 16.0f;
+				}
+				break;
+			}
+			case WireField::SharedTime:
+				st.shared_micros = int64_t(value.u64());
+				break;
+			case WireField::RingRates: {
+				size_t count = value.remaining() / 2;
+				for (uint8_t i = 0; i < count && i < MAX_RINGS; i++) {
+					st.target_angle_rate[i] = int16_t(value.u16()) / 16.0f;
+				}
+				break;
+			}
+			default:
+				break;  // a field from a newer master
+		}
+	}
+	if (sequence != nullptr) {
+		*sequence = header.sequence;
+	}
+	return true;
+}
+
+inline size_t encodeFeedback(const WireFeedback& feedback, uint16_t sequence, uint8_t* buffer, size_t capacity) {
+	WireWriter out(buffer, capacity);
+	WireHeader header;
+	header.type = WireMessage::Feedback;
+	header.sequence = sequence;
+	out.header(header);
+
+	out.beginField(WireField::RingAngle);
+	out.u16(angleToWire(feedback.angle));
+	out.endField();
+
+	out.beginField(WireField::RingIndex);
+	out.u8(feedback.ringIndex);
+	out.endField();
+
+	out.beginField(WireField::LinkStats);
+	out.u16(feedback.link.lastSequence);
+	out.u32(feedback.link.received);
+	out.u32(feedback.link.lost);
+	out.u32(feedback.link.duplicates);
+	out.endField();
+
+	return out.size();
+}
+
+/**
+ * Decodes a ring's feedback packet; same rules as decodeState()
+ */
+inline bool decodeFeedback(const uint8_t* data, size_t length, WireFeedback& feedback) {
+	WireReader in(data, length);
+	WireHeader header;
+	if (!in.header(header) || header.type != WireMessage::Feedback) {
+		return false;
+	}
+	WireReader check = in;
+	WireField type;
+	WireReader value(nullptr, 0);
+	while (check.nextField(type, value)) {}
+	if (!check.ok()) {
+		return false;
+	}
+
+	while (in.nextField(type, value)) {
+		switch (type) {
+			case WireField::RingAngle:
+				feedback.angle = angleFromWire(value.u16());
+				break;
+			case WireField::RingIndex:
+				feedback.ringIndex = value.u8();
+				break;
+			case WireField::LinkStats:
+				feedback.link.lastSequence = value.u16();
+				feedback.link.received = value.u32();
+				feedback.link.lost = value.u32();
+				feedback.link.duplicates = value.u32();
+				break;
+			default:
+				break;
+		}
+	}
+	return true;
+}
+
+inline size_t encodePing(int64_t t1, uint16_t sequence, uint8_t* buffer, size_t capacity) {
+	WireWriter out(buffer, capacity);
+	WireHeader header;
+	header.type = WireMessage::TimePing;
+	header.sequence = sequence;
+	out.header(header);
+	out.beginField(WireField::PingTime);
+	out.u64(uint64_t(t1));
+	out.endField();
+	return out.size();
+}
+
+inline size_t encodePong(int64_t t1, int64_t t2, int64_t t3, uint16_t sequence, uint8_t* buffer, size_t capacity) {
+	WireWriter out(buffer, capacity);
+	WireHeader header;
+	header.type = WireMessage::TimePong;
+	header.sequence = sequence;
+	out.header(header);
+	out.beginField(WireField::PongTimes);
+	out.u64(uint64_t(t1));
+	out.u64(uint64_t(t2));
+	out.u64(uint64_t(t3));
+	out.endField();
+	return out.size();
+}
+
+/**
+ * Decodes a ping; `sequence` is echoed in the pong
+ */
+inline bool decodePing(const uint8_t* data, size_t length, int64_t& t1, uint16_t& sequence) {
+	WireReader in(data, length);
+	WireHeader header;
+	if (!in.header(header) || header.type != WireMessage::TimePing) {
+		return false;
+	}
+	WireField type;
+	WireReader value(nullptr, 0);
+	while (in.nextField(type, value)) {
+		if (type == WireField::PingTime) {
+			t1 = int64_t(value.u64());
+			sequence = header.sequence;
+			return value.ok();
+		}
+	}
+	return false;
+}
+
+inline bool decodePong(const uint8_t* data, size_t length, int64_t& t1, int64_t& t2, int64_t& t3) {
+	WireReader in(data, length);
+	WireHeader header;
+	if (!in.header(header) || header.type != WireMessage::TimePong) {
+		return false;
+	}
+	WireField type;
+	WireReader value(nullptr, 0);
+	while (in.nextField(type, value)) {
+		if (type == WireField::PongTimes) {
+			t1 = int64_t(value.u64());
+			t2 = int64_t(value.u64());
+			t3 = int64_t(value.u64());
+			return value.ok();
+		}
+	}
+	return false;
+}
+
+/**
+ * Encodes an Announce or Assign packet, which carry just a ring index
+ */
+inline size_t encodeRingIndex(WireMessage type, uint8_t ringIndex, uint16_t sequence, uint8_t* buffer, size_t capacity) {
+	WireWriter out(buffer, capacity);
+	WireHeader header;
+	header.type = type;
+	header.sequence = sequence;
+	out.header(header);
+	out.beginField(WireField::RingIndex);
+	out.u8(ringIndex);
+	out.endField();
+	return out.size();
+}
+
+/**
+ * Decodes an Announce or Assign packet of the given type
+ */
+inline bool decodeRingIndex(const uint8_t* data, size_t length, WireMessage type, uint8_t& ringIndex) {
+	WireReader in(data, length);
+	WireHeader header;
+	if (!in.header(header) || header.type != type) {
+		return false;
+	}
+	WireField field;
+	WireReader value(nullptr, 0);
+	while (in.nextField(field, value)) {
+		if (field == WireField::RingIndex) {
+			ringIndex = value.u8();
+			return value.ok();
+		}
+	}
+	return false;
+}
+
+#endif // WIRE_HPP